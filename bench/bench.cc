@@ -0,0 +1,569 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+benchmark the stages of the window pipeline without a camera.
+
+usage: zwo_bench [options] [recording...]
+    --frames n      frames timed per source. default 20.
+    --warmup n      frames run first and not timed. default 2.
+    --threads n     worker threads. default one per core.
+    --scalar        use the scalar pixel kernels.
+    --size WxH      synthetic frame size. may be repeated.
+                    replaces the default sizes.
+    --no-synthetic  only run the recordings.
+    --csv file      also write the results to the file.
+
+recordings are SER files, tiffs, or directories of tiffs.
+
+the stages are run the way the window thread runs them.
+on the same modules with the same worker pool.
+each stage is timed separately.
+then the chain from raw frame to display bytes is timed as the pipeline.
+
+the results are csv on stdout.
+one line per source and stage.
+the synthetic frames are the same every run.
+so results are comparable between runs and machines.
+**/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include <shared/frame_reader.h>
+#include <shared/frame_stats.h>
+#include <shared/perf_stats.h>
+#include <shared/worker_pool.h>
+#include <window/focus_meter.h>
+#include <window/histogram.h>
+#include <window/pixel_kernels.h>
+#include <window/robust_stack.h>
+#include <window/star_registration.h>
+#include <window/tone_tables.h>
+
+#include "synthetic.h"
+
+
+namespace {
+    /** stage settings. typical of a deep sky session. **/
+    const int kIso = 400;
+    const double kGamma = 2.0;
+    const double kBalanceRed = 1.3;
+    const double kBalanceBlue = 1.5;
+    const double kKappa = 3.0;
+    const int kHistogramBins = 256;
+    const int kGammaTableSize = 1124;
+
+    /** the default synthetic frame sizes. 1080p, asi533, asi294. **/
+    const int kDefaultSizes[][2] = {
+        {1920, 1080},
+        {3008, 3008},
+        {4144, 2822}
+    };
+
+    enum {
+        kStageStats,
+        kStageBlack,
+        kStageDebayer,
+        kStageDebayerEa,
+        kStageIso,
+        kStageBalance,
+        kStageTones,
+        kStageSrgb,
+        kStageHistogram,
+        kStageStack,
+        kStageRegister,
+        kStageFocus,
+        kStagePipeline,
+        kStages
+    };
+    const char *kStageNames[kStages] = {
+        "stats",
+        "black",
+        "debayer",
+        "debayer_ea",
+        "iso",
+        "balance",
+        "tones",
+        "srgb",
+        "histogram",
+        "stack",
+        "register",
+        "focus",
+        "pipeline"
+    };
+
+    /** a source of raw frames. **/
+    class Source {
+    public:
+        std::string name_;
+        int width_ = 0;
+        int height_ = 0;
+        BayerPattern bayer_pattern_ = BayerPattern::kRGGB;
+        std::function<bool(int index, cv::Mat &bayer)> read_;
+    };
+
+    class Options {
+    public:
+        int frames_ = 20;
+        int warmup_ = 2;
+        int threads_ = 0;
+        bool scalar_ = false;
+        bool synthetic_ = true;
+        std::vector<std::pair<int, int>> sizes_;
+        std::vector<std::string> recordings_;
+        std::string csv_file_;
+    };
+
+    class Bench {
+    public:
+        Options options_;
+        WorkerPool *pool_ = nullptr;
+        const PixelKernels *kernels_ = nullptr;
+        std::FILE *csv_ = nullptr;
+
+        /** per source state. **/
+        LatencyHistogram *times_[kStages] = {nullptr};
+        int bayer_code_ = 0;
+        int bayer_code_ea_ = 0;
+        cv::Mat bayer_;
+        cv::Mat work_;
+        cv::Mat black_;
+        cv::Mat rgb16_;
+        cv::Mat rgb16_ea_;
+        cv::Mat tones_;
+        cv::Mat display_;
+        FrameStats stats_;
+        ToneTables tone_tables_;
+        Histogram histogram_;
+        RobustStack stack_;
+        StarRegistration registration_;
+        FocusMeter focus_meter_;
+        std::vector<agm::uint8> gamma_table_;
+
+        Bench() = default;
+        Bench(const Bench &) = delete;
+        ~Bench() noexcept {
+            if (csv_) {
+                std::fclose(csv_);
+            }
+            delete pool_;
+        }
+
+        bool init() noexcept {
+            pool_ = WorkerPool::create(options_.threads_);
+            kernels_ = options_.scalar_ ? PixelKernels::getScalar() : PixelKernels::get();
+            if (options_.csv_file_.size()) {
+                csv_ = std::fopen(options_.csv_file_.c_str(), "w");
+                if (csv_ == nullptr) {
+                    std::fprintf(stderr, "Failed to open file: %s\n", options_.csv_file_.c_str());
+                    return false;
+                }
+            }
+            initGammaTable();
+            tone_tables_.update(kIso, kGamma, kBalanceRed, kBalanceBlue);
+            output("source,width,height,threads,kernels,stage,frames,mean_ms,p50_ms,p99_ms,max_ms,mpix_per_s\n");
+            return true;
+        }
+
+        void run() noexcept {
+            std::vector<Source> sources;
+            if (options_.synthetic_) {
+                addSynthetic(sources);
+            }
+            /** the readers must outlive the sources. **/
+            std::vector<std::unique_ptr<FrameReader>> readers;
+            for (auto &path : options_.recordings_) {
+                auto reader = new(std::nothrow) FrameReader;
+                readers.push_back(std::unique_ptr<FrameReader>(reader));
+                bool success = reader->open(path);
+                if (success == false) {
+                    std::fprintf(stderr, "Failed to read recording: %s\n", path.c_str());
+                    continue;
+                }
+                Source source;
+                source.name_ = path;
+                source.width_ = reader->getWidth();
+                source.height_ = reader->getHeight();
+                source.bayer_pattern_ = reader->getBayerPattern();
+                source.read_ = [reader](int index, cv::Mat &bayer) {
+                    return reader->read(index % reader->getFrameCount(), bayer);
+                };
+                sources.push_back(std::move(source));
+            }
+            for (auto &source : sources) {
+                runSource(source);
+            }
+        }
+
+        void addSynthetic(
+            std::vector<Source> &sources
+        ) noexcept {
+            auto sizes = options_.sizes_;
+            if (sizes.empty()) {
+                for (auto &size : kDefaultSizes) {
+                    sizes.push_back(std::make_pair(size[0], size[1]));
+                }
+            }
+            for (auto &size : sizes) {
+                int wd = size.first;
+                int ht = size.second;
+                Source source;
+                source.name_ = "synthetic";
+                source.width_ = wd;
+                source.height_ = ht;
+                source.read_ = [wd, ht](int index, cv::Mat &bayer) {
+                    makeSyntheticFrame(bayer, wd, ht, index);
+                    return true;
+                };
+                sources.push_back(std::move(source));
+            }
+        }
+
+        void runSource(
+            const Source &source
+        ) noexcept {
+            int wd = source.width_;
+            int ht = source.height_;
+            LOG("Bench "<<source.name_<<" "<<wd<<"x"<<ht);
+
+            /** the histograms are per source. **/
+            std::vector<std::unique_ptr<LatencyHistogram>> times;
+            for (int i = 0; i < kStages; ++i) {
+                auto histogram = new(std::nothrow) LatencyHistogram(source.name_.c_str(), kStageNames[i]);
+                times.push_back(std::unique_ptr<LatencyHistogram>(histogram));
+                times_[i] = histogram;
+            }
+
+            setBayerCodes(source.bayer_pattern_);
+            makeSyntheticBlack(black_, wd, ht);
+            stack_.allocate(RobustStack::Mode::kSigmaClip, 3 * wd * ht);
+            histogram_.configure(kHistogramBins, pool_->getThreadCount());
+            registration_.reset();
+            focus_meter_.reset();
+
+            int total = options_.warmup_ + options_.frames_;
+            int nstacked = 0;
+            for (int i = 0; i < total; ++i) {
+                /** warm up frames aren't recorded. **/
+                bool timed = (i >= options_.warmup_);
+                auto time = [=](int stage) {
+                    return timed ? times_[stage] : nullptr;
+                };
+
+                bool success = source.read_(i, bayer_);
+                if (success == false) {
+                    std::fprintf(stderr, "Failed to read frame %d of %s\n", i, source.name_.c_str());
+                    break;
+                }
+
+                /** each stage on its own. **/
+                bayer_.copyTo(work_);
+                computeStats(time(kStageStats));
+                subtractBlack(time(kStageBlack));
+                debayer(time(kStageDebayer));
+                debayerEdgeAware(time(kStageDebayerEa));
+                rgb16_.copyTo(tones_);
+                isoScale(time(kStageIso));
+                balanceColors(time(kStageBalance));
+                rgb16_.copyTo(tones_);
+                applyTones(time(kStageTones));
+                displayGamma(time(kStageSrgb));
+                addHistogram(time(kStageHistogram));
+                stackFrame(++nstacked, time(kStageStack));
+                registerFrame(time(kStageRegister));
+                measureFocus(time(kStageFocus));
+
+                /** the whole chain from raw frame to display bytes. **/
+                bayer_.copyTo(work_);
+                {
+                    ScopedTimer timer(time(kStagePipeline));
+                    computeStats(nullptr);
+                    subtractBlack(nullptr);
+                    debayer(nullptr);
+                    rgb16_.copyTo(tones_);
+                    applyTones(nullptr);
+                    addHistogram(nullptr);
+                    displayGamma(nullptr);
+                }
+            }
+
+            for (int i = 0; i < kStages; ++i) {
+                writeResult(source, times_[i]);
+                times_[i] = nullptr;
+            }
+            stack_.release();
+        }
+
+        void computeStats(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            auto data = (const agm::uint16 *) work_.data;
+            stats_.compute(data, work_.cols, work_.rows, 65535);
+        }
+
+        void subtractBlack(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            int wd = work_.cols;
+            int ht = work_.rows;
+            int band = pool_->getBandRows(ht, 1);
+            pool_->run(ht, band, [=](int, int y0, int y1) {
+                auto img = (agm::uint16 *) work_.data + wd * y0;
+                auto blk = (const agm::uint16 *) black_.data + wd * y0;
+                kernels_->subtract_(img, blk, wd * (y1 - y0));
+            });
+        }
+
+        void debayer(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            cv::cvtColor(work_, rgb16_, bayer_code_);
+        }
+
+        void debayerEdgeAware(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            cv::cvtColor(work_, rgb16_ea_, bayer_code_ea_);
+        }
+
+        /** run a kernel over the BGR components in bands. **/
+        void runComponents(
+            cv::Mat &rgb16,
+            const std::function<void(agm::uint16 *ptr, int count)> &func
+        ) noexcept {
+            int wd = rgb16.cols;
+            int ht = rgb16.rows;
+            int band = pool_->getBandRows(ht, 1);
+            pool_->run(ht, band, [&](int, int y0, int y1) {
+                auto ptr = (agm::uint16 *) rgb16.data + 3 * wd * y0;
+                func(ptr, 3 * wd * (y1 - y0));
+            });
+        }
+
+        void isoScale(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            runComponents(tones_, [this](agm::uint16 *ptr, int count) {
+                kernels_->iso_scale_(ptr, count, kIso);
+            });
+        }
+
+        void balanceColors(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            runComponents(tones_, [this](agm::uint16 *ptr, int count) {
+                kernels_->balance_colors_(ptr, count / 3, kBalanceRed, kBalanceBlue);
+            });
+        }
+
+        /** iso, gamma, and balance in one pass. **/
+        void applyTones(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            runComponents(tones_, [this](agm::uint16 *ptr, int count) {
+                tone_tables_.apply(ptr, count / 3);
+            });
+        }
+
+        void displayGamma(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            int wd = tones_.cols;
+            int ht = tones_.rows;
+            display_.create(ht, wd, CV_8UC3);
+            int band = pool_->getBandRows(ht, 1);
+            pool_->run(ht, band, [=](int, int y0, int y1) {
+                auto src = (const agm::uint16 *) tones_.data + 3 * wd * y0;
+                auto dst = display_.data + 3 * wd * y0;
+                kernels_->display_gamma_(src, dst, 3 * wd * (y1 - y0), gamma_table_.data(), kGammaTableSize - 1);
+            });
+        }
+
+        void addHistogram(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            int step = Histogram::chooseStep(tones_.cols, tones_.rows, FrameStats::kMaxSamples);
+            histogram_.decay(95);
+            histogram_.add(tones_, step, pool_);
+        }
+
+        void stackFrame(
+            int nframes,
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            int wd = rgb16_.cols;
+            int ht = rgb16_.rows;
+            int band = pool_->getBandRows(ht, 1);
+            pool_->run(ht, band, [=](int, int y0, int y1) {
+                auto src = (const agm::uint16 *) rgb16_.data;
+                stack_.add(src, 3 * wd * y0, 3 * wd * (y1 - y0), nframes, kKappa);
+            });
+        }
+
+        void registerFrame(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            StarRegistration::Transform xform;
+            registration_.measure(bayer_, pool_, xform);
+        }
+
+        void measureFocus(
+            LatencyHistogram *time
+        ) noexcept {
+            ScopedTimer timer(time);
+            FocusMeter::Result result;
+            focus_meter_.measure(bayer_, pool_, result);
+        }
+
+        /** same as the window thread. **/
+        void setBayerCodes(
+            BayerPattern pattern
+        ) noexcept {
+            switch (pattern) {
+            case BayerPattern::kRGGB:
+            default:
+                bayer_code_ = cv::COLOR_BayerBG2BGR;
+                bayer_code_ea_ = cv::COLOR_BayerBG2BGR_EA;
+                break;
+            case BayerPattern::kBGGR:
+                bayer_code_ = cv::COLOR_BayerRG2BGR;
+                bayer_code_ea_ = cv::COLOR_BayerRG2BGR_EA;
+                break;
+            case BayerPattern::kGRBG:
+                bayer_code_ = cv::COLOR_BayerGB2BGR;
+                bayer_code_ea_ = cv::COLOR_BayerGB2BGR_EA;
+                break;
+            case BayerPattern::kGBRG:
+                bayer_code_ = cv::COLOR_BayerGR2BGR;
+                bayer_code_ea_ = cv::COLOR_BayerGR2BGR_EA;
+                break;
+            }
+        }
+
+        /** the timing doesn't depend on the curve. a straight line will do. **/
+        void initGammaTable() noexcept {
+            gamma_table_.resize(kGammaTableSize + PixelKernels::kTablePadding, 0);
+            for (int i = 0; i < kGammaTableSize; ++i) {
+                gamma_table_[i] = agm::uint8(i * 255 / (kGammaTableSize - 1));
+            }
+        }
+
+        void writeResult(
+            const Source &source,
+            const LatencyHistogram *time
+        ) noexcept {
+            LatencyCounts counts;
+            time->copyCounts(counts);
+            auto summary = LatencySummary::summarize(counts);
+            double mpix = 0.0;
+            if (summary.mean_ > 0.0) {
+                mpix = double(source.width_) * double(source.height_) / summary.mean_;
+            }
+            char line[1024];
+            std::snprintf(line, sizeof(line), "%s,%d,%d,%d,%s,%s,%lld,%.3f,%.3f,%.3f,%.3f,%.1f\n",
+                source.name_.c_str(), source.width_, source.height_,
+                pool_->getThreadCount(), kernels_->name_, time->stage_.c_str(),
+                (long long) summary.count_, summary.mean_ / 1000.0,
+                summary.p50_ / 1000.0, summary.p99_ / 1000.0, summary.max_ / 1000.0, mpix);
+            output(line);
+        }
+
+        void output(
+            const char *line
+        ) noexcept {
+            std::fputs(line, stdout);
+            std::fflush(stdout);
+            if (csv_) {
+                std::fputs(line, csv_);
+            }
+        }
+    };
+
+    void usage() noexcept {
+        std::fprintf(stderr,
+            "usage: zwo_bench [--frames n] [--warmup n] [--threads n] [--scalar]\n"
+            "                 [--size WxH]... [--no-synthetic] [--csv file] [recording...]\n");
+    }
+
+    bool parseOptions(
+        int argc,
+        char *argv[],
+        Options &options
+    ) noexcept {
+        for (int i = 1; i < argc; ++i) {
+            const char *arg = argv[i];
+            bool has_value = (i + 1 < argc);
+            if (std::strcmp(arg, "--frames") == 0 && has_value) {
+                options.frames_ = std::max(1, std::atoi(argv[++i]));
+            } else if (std::strcmp(arg, "--warmup") == 0 && has_value) {
+                options.warmup_ = std::max(0, std::atoi(argv[++i]));
+            } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+                options.threads_ = std::atoi(argv[++i]);
+            } else if (std::strcmp(arg, "--scalar") == 0) {
+                options.scalar_ = true;
+            } else if (std::strcmp(arg, "--size") == 0 && has_value) {
+                int wd = 0;
+                int ht = 0;
+                int n = std::sscanf(argv[++i], "%dx%d", &wd, &ht);
+                /** the debayer wants whole bayer cells. **/
+                if (n != 2 || wd < 64 || ht < 64 || (wd & 1) || (ht & 1)) {
+                    std::fprintf(stderr, "Bad size: %s\n", argv[i]);
+                    return false;
+                }
+                options.sizes_.push_back(std::make_pair(wd, ht));
+            } else if (std::strcmp(arg, "--no-synthetic") == 0) {
+                options.synthetic_ = false;
+            } else if (std::strcmp(arg, "--csv") == 0 && has_value) {
+                options.csv_file_ = argv[++i];
+            } else if (arg[0] == '-') {
+                return false;
+            } else {
+                options.recordings_.push_back(arg);
+            }
+        }
+        return true;
+    }
+}
+
+int main(
+    int argc, char *argv[]
+) noexcept {
+    agm::log::init(TARGET_NAME ".log");
+
+    Bench bench;
+    bool success = parseOptions(argc, argv, bench.options_);
+    if (success == false) {
+        usage();
+        return 1;
+    }
+    success = bench.init();
+    if (success == false) {
+        return 1;
+    }
+    bench.run();
+    return 0;
+}
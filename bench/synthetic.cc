@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include "synthetic.h"
+
+
+namespace {
+    /** one star per this many pixels. **/
+    const int kPixelsPerStar = 40000;
+    const double kBackground = 2000.0;
+    const double kNoise = 60.0;
+    const double kSigma = 1.6;
+    /** stars are drawn out to this many sigma. **/
+    const int kRadius = 6;
+    /** the seed of the star field. **/
+    const unsigned kFieldSeed = 1234;
+    /** the channel gains of RGGB. **/
+    const double kGains[2][2] = {{0.6, 1.0}, {1.0, 0.8}};
+
+    void addStar(
+        cv::Mat &bayer,
+        double cx,
+        double cy,
+        double peak
+    ) noexcept {
+        int x0 = std::max(0, int(cx) - kRadius);
+        int y0 = std::max(0, int(cy) - kRadius);
+        int x1 = std::min(bayer.cols, int(cx) + kRadius + 1);
+        int y1 = std::min(bayer.rows, int(cy) + kRadius + 1);
+        double k = -0.5 / (kSigma * kSigma);
+        for (int y = y0; y < y1; ++y) {
+            auto row = bayer.ptr<agm::uint16>(y);
+            double dy = y - cy;
+            for (int x = x0; x < x1; ++x) {
+                double dx = x - cx;
+                double v = row[x] + peak * kGains[y & 1][x & 1] * std::exp(k * (dx * dx + dy * dy));
+                row[x] = agm::uint16(std::min(v, 65535.0));
+            }
+        }
+    }
+}
+
+void makeSyntheticFrame(
+    cv::Mat &bayer,
+    int width,
+    int height,
+    int index
+) noexcept {
+    bayer.create(height, width, CV_16UC1);
+
+    /** the background has a gradient and noise. **/
+    std::mt19937 noise_rng(index + 1);
+    std::normal_distribution<double> noise(0.0, kNoise);
+    for (int y = 0; y < height; ++y) {
+        auto row = bayer.ptr<agm::uint16>(y);
+        double gradient = kBackground * (1.0 + 0.2 * double(y) / double(height));
+        for (int x = 0; x < width; ++x) {
+            double v = gradient * kGains[y & 1][x & 1] + noise(noise_rng);
+            row[x] = agm::uint16(std::max(0.0, std::min(v, 65535.0)));
+        }
+    }
+
+    /** the same star field drifts slowly with a little rotation. **/
+    double angle = 0.0002 * index;
+    double ca = std::cos(angle);
+    double sa = std::sin(angle);
+    double shift_x = 1.5 * index;
+    double shift_y = 0.7 * index;
+    double mx = 0.5 * width;
+    double my = 0.5 * height;
+
+    std::mt19937 field_rng(kFieldSeed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    int nstars = std::max(10, width * height / kPixelsPerStar);
+    for (int i = 0; i < nstars; ++i) {
+        double x = uniform(field_rng) * width - mx;
+        double y = uniform(field_rng) * height - my;
+        /** mostly faint stars with a few bright ones. **/
+        double peak = 500.0 + 40000.0 * std::pow(uniform(field_rng), 6.0);
+        double cx = ca * x - sa * y + mx + shift_x;
+        double cy = sa * x + ca * y + my + shift_y;
+        addStar(bayer, cx, cy, peak);
+    }
+}
+
+void makeSyntheticBlack(
+    cv::Mat &black,
+    int width,
+    int height
+) noexcept {
+    black.create(height, width, CV_16UC1);
+    std::mt19937 rng(kFieldSeed + 1);
+    std::normal_distribution<double> noise(0.0, 10.0);
+    for (int y = 0; y < height; ++y) {
+        auto row = black.ptr<agm::uint16>(y);
+        for (int x = 0; x < width; ++x) {
+            row[x] = agm::uint16(std::max(0.0, 500.0 + noise(rng)));
+        }
+    }
+}
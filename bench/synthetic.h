@@ -0,0 +1,25 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+synthetic raw bayer frames for the benchmark.
+
+a sky background with noise, a gradient, and a field of gaussian stars.
+the same seed always makes the same frame.
+so runs can be compared.
+
+each frame of a sequence is shifted a little from the last.
+so registration and stacking do real work.
+**/
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+
+/** make frame number index of a width x height RGGB sequence as CV_16UC1. **/
+void makeSyntheticFrame(cv::Mat &bayer, int width, int height, int index) noexcept;
+
+/** make a dark frame to subtract. **/
+void makeSyntheticBlack(cv::Mat &black, int width, int height) noexcept;
@@ -0,0 +1,361 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+build the star index for the plate solver from a catalog.
+
+usage: zwo_index [options] catalog.csv stars.idx
+    --max-mag m         skip stars fainter than m. default 13.
+    --min-dec d         skip stars south of d degrees. default -90.
+    --min-diameter d    the smallest quads in degrees. default 0.07.
+    --max-diameter d    the largest quads in degrees. default 0.42.
+    --quads-per-star n  quads with each star as A. default 16.
+
+the catalog is text. one star per line.
+    ra_degrees,dec_degrees,magnitude
+lines that don't start with a number are skipped.
+any catalog will do. it needs to go as faint as max-mag.
+tycho-2 stops around magnitude 12. ucac4 or gaia exported to csv are deeper.
+
+the quad diameters should cover the field of view of the camera.
+from about 1/4 of the short side to the diagonal.
+the defaults are for the 0.3 degree field in notes.txt.
+there should be more than a dozen stars in the field.
+at magnitude 13 there are about 200 per square degree.
+the whole sky at magnitude 13 is a big index. --min-dec can trim it.
+
+quads are built around each star brightest first.
+B is the brightest star the right distance from A.
+C and D are the brightest stars inside the circle through A and B.
+the bright stars are the ones most likely to be found in an image.
+**/
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include <solver/star_index.h>
+
+
+namespace {
+    const double kRadiansPerDegree = M_PI / 180.0;
+
+    class Options {
+    public:
+        std::string catalog_;
+        std::string index_;
+        double max_mag_ = 13.0;
+        double min_dec_ = -90.0;
+        double min_diameter_ = 0.07;
+        double max_diameter_ = 0.42;
+        int quads_per_star_ = 16;
+    };
+
+    class Builder {
+    public:
+        Options options_;
+        std::vector<StarIndex::Star> stars_;
+        std::vector<StarIndex::Quad> quads_;
+
+        /** stars in cells of the max diameter. **/
+        double cell_size_ = 0.0;
+        std::unordered_map<agm::uint64, std::vector<int>> cells_;
+        std::set<std::array<agm::uint32, 4>> unique_;
+        std::vector<int> near_;
+        std::vector<int> inside_;
+
+        bool run() noexcept {
+            bool success = readCatalog();
+            if (success == false) {
+                return false;
+            }
+            buildCells();
+            buildQuads();
+            LOG("Writing "<<stars_.size()<<" stars and "<<quads_.size()<<" quads to "<<options_.index_);
+            return StarIndex::write(options_.index_, stars_, quads_,
+                options_.min_diameter_ * kRadiansPerDegree,
+                options_.max_diameter_ * kRadiansPerDegree,
+                cell_size_);
+        }
+
+        bool readCatalog() noexcept {
+            auto fp = std::fopen(options_.catalog_.c_str(), "r");
+            if (fp == nullptr) {
+                LOG("Failed to open catalog: "<<options_.catalog_);
+                return false;
+            }
+            char line[1024];
+            int skipped = 0;
+            while (std::fgets(line, sizeof(line), fp)) {
+                double ra = 0.0;
+                double dec = 0.0;
+                double mag = 0.0;
+                int n = std::sscanf(line, "%lf , %lf , %lf", &ra, &dec, &mag);
+                if (n != 3) {
+                    ++skipped;
+                    continue;
+                }
+                if (mag > options_.max_mag_ || dec < options_.min_dec_) {
+                    continue;
+                }
+                double v[3];
+                StarIndex::toVector(ra, dec, v);
+                StarIndex::Star star;
+                star.x_ = float(v[0]);
+                star.y_ = float(v[1]);
+                star.z_ = float(v[2]);
+                star.mag_ = float(mag);
+                stars_.push_back(star);
+            }
+            std::fclose(fp);
+            LOG("Read "<<stars_.size()<<" stars from "<<options_.catalog_<<". skipped "<<skipped<<" lines.");
+            if (stars_.size() < 4) {
+                LOG("Not enough stars.");
+                return false;
+            }
+
+            /** brightest first. **/
+            std::stable_sort(stars_.begin(), stars_.end(),
+                [](const StarIndex::Star &a, const StarIndex::Star &b) {
+                    return a.mag_ < b.mag_;
+                });
+            return true;
+        }
+
+        static agm::uint64 getKey(
+            int ix,
+            int iy,
+            int iz
+        ) noexcept {
+            const int kOffset = 1 << 20;
+            const agm::uint64 kMask = (agm::uint64(1) << 21) - 1;
+            return ((agm::uint64(ix + kOffset) & kMask) << 42)
+                | ((agm::uint64(iy + kOffset) & kMask) << 21)
+                | (agm::uint64(iz + kOffset) & kMask);
+        }
+
+        int getCell(
+            double value
+        ) const noexcept {
+            return int(std::floor(value / cell_size_));
+        }
+
+        void buildCells() noexcept {
+            cell_size_ = options_.max_diameter_ * kRadiansPerDegree;
+            int nstars = stars_.size();
+            for (int i = 0; i < nstars; ++i) {
+                auto &star = stars_[i];
+                auto key = getKey(getCell(star.x_), getCell(star.y_), getCell(star.z_));
+                cells_[key].push_back(i);
+            }
+        }
+
+        /** the stars within the max diameter of a star. brightest first. **/
+        void findNear(
+            int index
+        ) noexcept {
+            near_.clear();
+            auto &star = stars_[index];
+            int cx = getCell(star.x_);
+            int cy = getCell(star.y_);
+            int cz = getCell(star.z_);
+            for (int ix = cx - 1; ix <= cx + 1; ++ix) {
+            for (int iy = cy - 1; iy <= cy + 1; ++iy) {
+            for (int iz = cz - 1; iz <= cz + 1; ++iz) {
+                auto it = cells_.find(getKey(ix, iy, iz));
+                if (it == cells_.end()) {
+                    continue;
+                }
+                for (auto s : it->second) {
+                    if (s != index && getAngle(index, s) <= options_.max_diameter_ * kRadiansPerDegree) {
+                        near_.push_back(s);
+                    }
+                }
+            }
+            }
+            }
+            /** the stars are sorted by magnitude. so the index is the brightness. **/
+            std::sort(near_.begin(), near_.end());
+        }
+
+        double getAngle(
+            int a,
+            int b
+        ) const noexcept {
+            auto &sa = stars_[a];
+            auto &sb = stars_[b];
+            double d = double(sa.x_) * sb.x_ + double(sa.y_) * sb.y_ + double(sa.z_) * sb.z_;
+            return std::acos(std::max(-1.0, std::min(d, 1.0)));
+        }
+
+        void buildQuads() noexcept {
+            double min_d = options_.min_diameter_ * kRadiansPerDegree;
+            double max_d = options_.max_diameter_ * kRadiansPerDegree;
+            int nstars = stars_.size();
+            for (int a = 0; a < nstars; ++a) {
+                findNear(a);
+                int count = 0;
+                for (auto b : near_) {
+                    if (count >= options_.quads_per_star_) {
+                        break;
+                    }
+                    double d = getAngle(a, b);
+                    if (d < min_d || d > max_d) {
+                        continue;
+                    }
+                    bool success = addQuad(a, b);
+                    if (success) {
+                        ++count;
+                    }
+                }
+                if ((a + 1) % 10000 == 0) {
+                    LOG("Built quads for "<<a + 1<<" of "<<nstars<<" stars: "<<quads_.size()<<" quads.");
+                }
+            }
+        }
+
+        /** C and D are the brightest stars in the circle through A and B. **/
+        bool addQuad(
+            int a,
+            int b
+        ) noexcept {
+            auto &sa = stars_[a];
+            auto &sb = stars_[b];
+            double center[3] = {
+                double(sa.x_) + sb.x_,
+                double(sa.y_) + sb.y_,
+                double(sa.z_) + sb.z_
+            };
+            double len = std::sqrt(center[0] * center[0] + center[1] * center[1] + center[2] * center[2]);
+            for (auto &v : center) {
+                v /= len;
+            }
+            double radius = 0.5 * getAngle(a, b);
+            double min_dot = std::cos(radius);
+
+            inside_.clear();
+            for (auto s : near_) {
+                if (s == b) {
+                    continue;
+                }
+                auto &star = stars_[s];
+                double d = center[0] * star.x_ + center[1] * star.y_ + center[2] * star.z_;
+                if (d > min_dot) {
+                    inside_.push_back(s);
+                    if (inside_.size() == 2) {
+                        break;
+                    }
+                }
+            }
+            if (inside_.size() < 2) {
+                return false;
+            }
+
+            int ids[4] = {a, b, inside_[0], inside_[1]};
+            double xy[4][2];
+            for (int i = 0; i < 4; ++i) {
+                auto &star = stars_[ids[i]];
+                double v[3] = {star.x_, star.y_, star.z_};
+                StarIndex::project(center, v, xy[i][0], xy[i][1]);
+            }
+            int order[4];
+            double code[4];
+            bool success = StarIndex::computeCode(xy, order, code);
+            if (success == false) {
+                return false;
+            }
+
+            /** each set of 4 stars is one quad. **/
+            std::array<agm::uint32, 4> key;
+            for (int i = 0; i < 4; ++i) {
+                key[i] = ids[i];
+            }
+            std::sort(key.begin(), key.end());
+            if (unique_.insert(key).second == false) {
+                return false;
+            }
+
+            StarIndex::Quad quad;
+            for (int i = 0; i < 4; ++i) {
+                quad.stars_[i] = ids[order[i]];
+                quad.code_[i] = float(code[i]);
+            }
+            quads_.push_back(quad);
+            return true;
+        }
+    };
+
+    void usage() noexcept {
+        std::fprintf(stderr,
+            "usage: zwo_index [--max-mag m] [--min-dec d] [--min-diameter d] [--max-diameter d]\n"
+            "                 [--quads-per-star n] catalog.csv stars.idx\n");
+    }
+
+    bool parseOptions(
+        int argc,
+        char *argv[],
+        Options &options
+    ) noexcept {
+        std::vector<std::string> files;
+        for (int i = 1; i < argc; ++i) {
+            const char *arg = argv[i];
+            bool has_value = (i + 1 < argc);
+            if (std::strcmp(arg, "--max-mag") == 0 && has_value) {
+                options.max_mag_ = std::atof(argv[++i]);
+            } else if (std::strcmp(arg, "--min-dec") == 0 && has_value) {
+                options.min_dec_ = std::atof(argv[++i]);
+            } else if (std::strcmp(arg, "--min-diameter") == 0 && has_value) {
+                options.min_diameter_ = std::atof(argv[++i]);
+            } else if (std::strcmp(arg, "--max-diameter") == 0 && has_value) {
+                options.max_diameter_ = std::atof(argv[++i]);
+            } else if (std::strcmp(arg, "--quads-per-star") == 0 && has_value) {
+                options.quads_per_star_ = std::max(1, std::atoi(argv[++i]));
+            } else if (arg[0] == '-') {
+                return false;
+            } else {
+                files.push_back(arg);
+            }
+        }
+        if (files.size() != 2) {
+            return false;
+        }
+        if (options.min_diameter_ <= 0.0 || options.max_diameter_ <= options.min_diameter_
+        ||  options.max_diameter_ > 30.0) {
+            std::fprintf(stderr, "Bad quad diameters: %g to %g degrees\n",
+                options.min_diameter_, options.max_diameter_);
+            return false;
+        }
+        options.catalog_ = files[0];
+        options.index_ = files[1];
+        return true;
+    }
+}
+
+int main(
+    int argc, char *argv[]
+) noexcept {
+    agm::log::init(TARGET_NAME ".log");
+
+    Builder builder;
+    bool success = parseOptions(argc, argv, builder.options_);
+    if (success == false) {
+        usage();
+        return 1;
+    }
+    success = builder.run();
+    if (success == false) {
+        return 1;
+    }
+    return 0;
+}
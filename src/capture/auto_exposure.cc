@@ -0,0 +1,152 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "auto_exposure.h"
+
+
+namespace {
+    /** the level is the value 99.99% of the sampled pixels are below. **/
+    const double kOutlierFraction = 0.0001;
+    /** put the level here as a fraction of saturation. **/
+    const double kTargetFraction = 0.85;
+    /** the level is clipped if it's this close to saturation. **/
+    const double kClippedFraction = 0.98;
+    /** the frame is clipped if more pixels than this are saturated. not counting hot pixels. **/
+    const int kMaxSaturated = 16;
+    /**
+    pixels are hot if this many of them are still saturated after two cuts.
+    a 16x shorter exposure fades the star cores.
+    **/
+    const double kHotFraction = 0.9;
+    const int kHotCuts = 2;
+    /** allow at most this fraction of the frame to be hot. **/
+    const double kMaxHotFraction = 0.001;
+    /** cut the exposure by this much when the level is clipped. **/
+    const double kClippedCut = 4.0;
+    /** never change the exposure more than this much in one frame. **/
+    const double kMaxStep = 16.0;
+    /** the level is in the noise if it's this close to black. **/
+    const double kMinSignal = 64.0;
+    /** the exposures must differ by this much to measure the black level. **/
+    const double kMinSlopeChange = 0.2;
+    /** ignore changes smaller than this. **/
+    const double kDeadband = 0.04;
+}
+
+void AutoExposure::setSaturation(
+    int saturation
+) noexcept {
+    saturation_ = std::max(saturation, 1);
+}
+
+void AutoExposure::setSettleFrames(
+    int frames
+) noexcept {
+    settle_frames_ = std::max(frames, 0);
+}
+
+void AutoExposure::reset() noexcept {
+    have_last_ = false;
+    settling_ = 0;
+    cut_saturated_ = 0;
+    cuts_ = 0;
+    hot_pixels_ = 0;
+}
+
+int AutoExposure::update(
+    const FrameStats &stats,
+    int exposure
+) noexcept {
+    if (stats.valid_ == false || stats.samples_ <= 0 || exposure <= 0) {
+        return exposure;
+    }
+    /** this frame may have been exposed before the last change. **/
+    if (settling_ > 0) {
+        --settling_;
+        return exposure;
+    }
+
+    /** the binning or the region of interest changed. the hot pixels are different ones. **/
+    if (stats.count_ != count_) {
+        count_ = stats.count_;
+        cut_saturated_ = 0;
+        cuts_ = 0;
+        hot_pixels_ = 0;
+    }
+
+    /** hot pixels are saturated in every frame. so never count more than the fewest seen. **/
+    hot_pixels_ = std::min(hot_pixels_, stats.saturated_);
+
+    /** star cores fade when the exposure is cut. hot pixels don't. **/
+    if (cuts_ > 0 && stats.saturated_ < kHotFraction * cut_saturated_) {
+        cut_saturated_ = 0;
+        cuts_ = 0;
+    }
+    if (cuts_ >= kHotCuts) {
+        int max_hot = int(kMaxHotFraction * stats.count_);
+        hot_pixels_ = std::min(stats.saturated_, max_hot);
+        cut_saturated_ = 0;
+        cuts_ = 0;
+    }
+
+    /** the hot pixels are above the level too. **/
+    double hot_fraction = double(hot_pixels_) / double(std::max(stats.count_, 1));
+    double fraction = 1.0 - kOutlierFraction - hot_fraction;
+    double level = stats.getPercentile(fraction);
+    double target = kTargetFraction * saturation_;
+    bool clipped = (level >= kClippedFraction * saturation_)
+        || (stats.saturated_ > hot_pixels_ + kMaxSaturated);
+
+    double next = exposure;
+    if (clipped) {
+        next = exposure / kClippedCut;
+        have_last_ = false;
+        if (cuts_ == 0) {
+            cut_saturated_ = stats.saturated_;
+        }
+        ++cuts_;
+    } else {
+        cut_saturated_ = 0;
+        cuts_ = 0;
+        /** two points on the line give the black level. **/
+        if (have_last_) {
+            double dt = double(exposure) - double(last_exposure_);
+            if (std::abs(dt) >= kMinSlopeChange * std::min(exposure, last_exposure_)) {
+                double slope = (level - last_level_) / dt;
+                if (slope > 0.0) {
+                    double black = level - slope * exposure;
+                    black_ = std::max(0.0, std::min(black, std::min(level, last_level_)));
+                }
+            }
+        }
+        have_last_ = true;
+        last_exposure_ = exposure;
+        last_level_ = level;
+
+        double signal = level - black_;
+        if (signal < kMinSignal) {
+            next = exposure * kMaxStep;
+        } else {
+            next = exposure * (target - black_) / signal;
+        }
+    }
+
+    next = std::max(exposure / kMaxStep, std::min(next, exposure * kMaxStep));
+    next = std::max(double(kMinExposure), std::min(next, double(kMaxExposure)));
+    if (std::abs(next - exposure) < kDeadband * exposure) {
+        return exposure;
+    }
+
+    int result = int(std::round(next));
+    if (result != exposure) {
+        settling_ = settle_frames_;
+    }
+    return result;
+}
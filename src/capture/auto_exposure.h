@@ -0,0 +1,82 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+predict the exposure from one frame.
+
+the sensor is linear. a pixel is the black level plus a rate times the exposure.
+so the exposure that puts the bright end of the histogram at the target is
+    target exposure = exposure * (target - black) / (level - black)
+the level is the 99.99th percentile of the sampled histogram.
+it's the bright end of the stars. not the sky background.
+hot pixels can't throw it off the way the maximum did.
+
+the black level isn't known to start with. it's taken to be 0.
+two unclipped frames at different exposures give the slope and the black level.
+so the first prediction is close and the second one is right.
+
+a frame is clipped if the level is near saturation.
+or if more than a few pixels are saturated. so star cores don't clip.
+a clipped frame says there's too much but not by how much.
+the exposure is cut by 4 and tried again.
+pixels that are still saturated after two cuts are hot. so they're left out.
+the count of hot pixels is never more than the fewest saturated pixels in a frame.
+it starts over when the scene or the frame size changes.
+
+small changes are ignored.
+so the exposure doesn't dither. which would keep changing the dark it needs.
+**/
+
+#pragma once
+
+#include <aggiornamento/aggiornamento.h>
+
+#include <shared/frame_stats.h>
+
+
+class AutoExposure {
+public:
+    AutoExposure() noexcept = default;
+    AutoExposure(const AutoExposure &) = delete;
+    ~AutoExposure() noexcept = default;
+
+    /** exposure limits in microseconds. **/
+    static const int kMinExposure = 100;
+    static const int kMaxExposure = 30 * 1000 * 1000;
+
+    /** saturation is the value the sensor reports when it's full. **/
+    void setSaturation(int saturation) noexcept;
+
+    /**
+    video mode has frames in flight.
+    a few frames after a change may have the old exposure.
+    **/
+    void setSettleFrames(int frames) noexcept;
+
+    /** the scene changed. forget the last frame and the hot pixels but keep the black level. **/
+    void reset() noexcept;
+
+    /** returns the exposure for the next frame. **/
+    int update(const FrameStats &stats, int exposure) noexcept;
+
+    /** the black level in 16 bit units. **/
+    double getBlack() const noexcept { return black_; }
+
+private:
+    int saturation_ = 65535;
+    int settle_frames_ = 0;
+    int settling_ = 0;
+    double black_ = 0.0;
+    /** the last unclipped frame. **/
+    bool have_last_ = false;
+    int last_exposure_ = 0;
+    double last_level_ = 0.0;
+    /** the saturated count before the cuts in a row. **/
+    int cut_saturated_ = 0;
+    int cuts_ = 0;
+    /** the number of values in the last frame. **/
+    int count_ = 0;
+    /** the number of pixels that are saturated at any exposure. **/
+    int hot_pixels_ = 0;
+};
@@ -4,8 +4,28 @@ Copyright (C) 2012-2024 tim cotter. All rights reserved.
 
 /**
 capture images from the zwo asi astrophotography camera.
+
+there's one capture thread per camera.
+each one has its own image ring and settings.
+
+the cameras share the usb bandwidth.
+each is allowed a share of it in proportion to the data it sends.
+see usb_bandwidth.h.
+the small guide camera doesn't need much.
+
+auto exposure predicts the exposure from the histogram of each frame.
+see auto_exposure.h.
+
+a long exposure is canceled when it can't be used.
+when the mount starts slewing or the capture settings change.
+no new long exposure is started while the mount slews.
 **/
 
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
 #include <ASICamera2.h>
 
 #include <aggiornamento/aggiornamento.h>
@@ -13,297 +33,680 @@ capture images from the zwo asi astrophotography camera.
 #include <aggiornamento/master.h>
 #include <aggiornamento/thread.h>
 
-#include <shared/image_double_buffer.h>
+#include <menu/ioptron.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
 #include <shared/settings_buffer.h>
 
+#include "auto_exposure.h"
+#include "usb_bandwidth.h"
+
 
 namespace {
+/** the first camera keeps the old name. **/
+const int kMaxCameras = 8;
+const char *kThreadNames[kMaxCameras] = {
+    "CaptureThread", "CaptureThread1", "CaptureThread2", "CaptureThread3",
+    "CaptureThread4", "CaptureThread5", "CaptureThread6", "CaptureThread7"
+};
+/** exposures this long can be canceled. **/
+const int kMinCancelExposure = 1000 * 1000;
+/** how often a long exposure checks if it should be canceled. **/
+const agm::int64 kCancelCheckMicroseconds = 100 * 1000;
+/** the camera can't send frames faster than this however short the exposure. **/
+const int kMinFrameMicroseconds = 1000;
+
 class CaptureThread : public agm::Thread {
 public:
     /** share data with the windows thread. **/
-    ImageDoubleBuffer *image_double_buffer_ = nullptr;
+    ImageRing *image_ring_ = nullptr;
     ImageBuffer *img_ = nullptr;
     /** share data with the menu thread. **/
     SettingsBuffer *settings_buffer_ = nullptr;
+    SettingsSnapshot settings_;
+    /** checked during long exposures without changing our copy. **/
+    SettingsSnapshot peek_;
+    /** long exposures are canceled when the mount slews. **/
+    Ioptron *mount_ = nullptr;
+    bool slewing_ = false;
+    /** where the time goes. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_frame_ = nullptr;
+    LatencyHistogram *time_acquire_ = nullptr;
+    LatencyHistogram *time_exposure_ = nullptr;
+    LatencyHistogram *time_transfer_ = nullptr;
+    LatencyHistogram *time_video_ = nullptr;
+    LatencyHistogram *time_stats_ = nullptr;
+    LatencyHistogram *time_publish_ = nullptr;
     bool auto_exposure_ = false;
     int exposure_ = 0;
+    bool video_mode_ = false;
+    int bin_ = 1;
+    bool roi_follows_display_ = false;
+    int roi_width_ = 0;
+    int roi_height_ = 0;
+    int display_width_ = 0;
+    int display_height_ = 0;
 
     /** internal fields. **/
-    static const int kCameraNumber = 0;
+    std::string name_;
+    /** the index is the order the sdk found the cameras. the id is how the sdk knows it. **/
+    int camera_index_ = 0;
+    int camera_id_ = 0;
+    bool require_color_ = true;
+    /** our share of the usb bandwidth. **/
+    UsbBandwidth *usb_ = nullptr;
+    int bandwidth_ = 0;
+    bool mono_ = false;
+    int max_width_ = 0;
+    int max_height_ = 0;
+    int supported_bins_[16] = {0};
+    /** the current region of interest in binned pixels. **/
     int width_ = 0;
     int height_ = 0;
-    int over61_ = 0;
-    int under61_ = 0;
+    int start_x_ = 0;
+    int start_y_ = 0;
+    int cur_bin_ = 0;
+    /** the exposure last given to the camera. **/
+    int camera_exposure_ = 0;
+    /** the value of a full pixel. the low bits are 0 if the adc has fewer than 16 bits. **/
+    int saturation_ = 65535;
+    BayerPattern bayer_pattern_ = BayerPattern::kRGGB;
+    AutoExposure auto_exposure_engine_;
+    bool video_running_ = false;
+    int dropped_frames_ = 0;
+    int temperature_ = 0;
+    agm::int64 temperature_time_ = 0;
 
     CaptureThread(
-        ImageDoubleBuffer *image_double_buffer,
-        SettingsBuffer *settings_buffer
-    ) noexcept : agm::Thread("CaptureThread") {
-        image_double_buffer_ = image_double_buffer;
+        ImageRing *image_ring,
+        SettingsBuffer *settings_buffer,
+        Ioptron *mount,
+        PerfStats *perf_stats,
+        int camera_index,
+        UsbBandwidth *usb,
+        bool require_color
+    ) noexcept : agm::Thread(kThreadNames[camera_index]) {
+        name_ = kThreadNames[camera_index];
+        image_ring_ = image_ring;
         settings_buffer_ = settings_buffer;
+        mount_ = mount;
+        perf_stats_ = perf_stats;
+        camera_index_ = camera_index;
+        usb_ = usb;
+        require_color_ = require_color;
     }
 
     virtual ~CaptureThread() = default;
 
     virtual void begin() noexcept {
-        LOG("CaptureThread.");
-        /**
-        capture thread starts with buffer 0.
-        window thread starts with buffer 1.
-        **/
-        img_ = image_double_buffer_->acquire(0);
-
-        /** find the camera. **/
-        int num_cameras = ASIGetNumOfConnectedCameras();
-        if (num_cameras != 1) {
-            LOG("CaptureThread Aborting.");
-            LOG("  Number of cameras is "<<num_cameras<<".");
-            LOG("  Expected number is 1.");
+        LOG(name_<<".");
+        auto kThread = name_.c_str();
+        time_frame_ = perf_stats_->addStage(kThread, "frame");
+        time_acquire_ = perf_stats_->addStage(kThread, "acquire");
+        time_exposure_ = perf_stats_->addStage(kThread, "exposure");
+        time_transfer_ = perf_stats_->addStage(kThread, "transfer");
+        time_video_ = perf_stats_->addStage(kThread, "video");
+        time_stats_ = perf_stats_->addStage(kThread, "stats");
+        time_publish_ = perf_stats_->addStage(kThread, "publish");
+
+        /** get the camera info. main found the cameras. **/
+        ASI_CAMERA_INFO camera_info;
+		auto result = ASIGetCameraProperty(&camera_info, camera_index_);
+		if (result != ASI_SUCCESS) {
+            LOG(name_<<" Aborting.");
+            LOG("  ASIGetCameraProperty("<<camera_index_<<"): "<<result);
             agm::master::setDone();
             return;
-        }
-
-        /** get the camera info. **/
-        ASI_CAMERA_INFO camera_info;
-		ASIGetCameraProperty(&camera_info, kCameraNumber);
-		LOG("CaptureThread Found camera: "<<camera_info.Name);
+		}
+        camera_id_ = camera_info.CameraID;
+		LOG(name_<<" Found camera "<<camera_index_<<": "<<camera_info.Name<<" id="<<camera_id_);
 
         /** show max resolution. **/
-        width_ = camera_info.MaxWidth;
-        height_ = camera_info.MaxHeight;
-        LOG("CaptureThread Max resolution: "<<width_<<" x "<<height_);
-
-        /** show color format. **/
-        bool is_color = (camera_info.IsColorCam == ASI_TRUE);
-        if (is_color == false) {
-            LOG("CaptureThread Aborting.");
+        max_width_ = camera_info.MaxWidth;
+        max_height_ = camera_info.MaxHeight;
+        LOG(name_<<" Max resolution: "<<max_width_<<" x "<<max_height_);
+        for (int i = 0; i < 16; ++i) {
+            supported_bins_[i] = camera_info.SupportedBins[i];
+        }
+
+        /** show color format. a guide camera may be mono. **/
+        mono_ = (camera_info.IsColorCam != ASI_TRUE);
+        if (mono_ && require_color_) {
+            LOG(name_<<" Aborting.");
             LOG("  Camera is not color.");
             agm::master::setDone();
             return;
         }
-        int bayer_ = camera_info.BayerPattern;
+        int bit_depth = camera_info.BitDepth;
+        if (bit_depth >= 8 && bit_depth < 16) {
+            saturation_ = 0xFFFF & ~((1 << (16 - bit_depth)) - 1);
+        }
+        LOG(name_<<" Bit depth: "<<bit_depth<<" saturation: "<<saturation_);
+        auto_exposure_engine_.setSaturation(saturation_);
+        int bayer = camera_info.BayerPattern;
         const char* bayer_types[] = {"RGGB", "BGGR", "GRBG", "GBRG"};
-        LOG("CaptureThread Bayer ("<<bayer_<<"): "<<bayer_types[bayer_]);
+        if (bayer < 0 || bayer > 3) {
+            bayer = 0;
+        }
+        bayer_pattern_ = (BayerPattern) bayer;
+        LOG(name_<<" Bayer ("<<bayer<<"): "<<bayer_types[bayer]);
 
         /** open the camera for capturing. **/
-		auto result = ASIOpenCamera(kCameraNumber);
+		result = ASIOpenCamera(camera_id_);
 		if (result != ASI_SUCCESS) {
-            LOG("Failed to open camera.");
-            LOG("  ASIOpenCamera("<<kCameraNumber<<"): "<<result);
+            LOG(name_<<" Failed to open camera.");
+            LOG("  ASIOpenCamera("<<camera_id_<<"): "<<result);
             agm::master::setDone();
             return;
 		}
-		LOG("CaptureThread Opened camera.");
+		LOG(name_<<" Opened camera.");
 
 		/** initialize camera. **/
-    	result = ASIInitCamera(kCameraNumber);
+    	result = ASIInitCamera(camera_id_);
 		if (result != ASI_SUCCESS) {
-            LOG("CaptureThread Aborting.");
+            LOG(name_<<" Aborting.");
             LOG("  Failed to initialize camera.");
-            LOG("  ASIInitCamera("<<kCameraNumber<<"): "<<result);
+            LOG("  ASIInitCamera("<<camera_id_<<"): "<<result);
             agm::master::setDone();
             return;
         }
-        LOG("CaptureThread Initialized camera.");
+        LOG(name_<<" Initialized camera.");
 
         /** gain 100 probably means no software gain. **/
-    	ASISetControlValue(kCameraNumber, ASI_GAIN, 100, ASI_FALSE);
+    	ASISetControlValue(camera_id_, ASI_GAIN, 100, ASI_FALSE);
 	    /** the scale seems to be 1 to 99 relative to green. defaults are 52,95. **/
-    	ASISetControlValue(kCameraNumber, ASI_WB_R, 52, ASI_FALSE);
-    	ASISetControlValue(kCameraNumber, ASI_WB_B, 95, ASI_FALSE);
-    	/** no idea what this is. something about usb transfer speed. **/
-        ASISetControlValue(kCameraNumber, ASI_BANDWIDTHOVERLOAD, 40, ASI_FALSE);
+    	ASISetControlValue(camera_id_, ASI_WB_R, 52, ASI_FALSE);
+    	ASISetControlValue(camera_id_, ASI_WB_B, 95, ASI_FALSE);
+    	/** the range of the usb bandwidth the camera may use. **/
+        setBandwidthLimits();
         /** no flipping. **/
-        ASISetControlValue(kCameraNumber, ASI_FLIP, 0, ASI_FALSE);
+        ASISetControlValue(camera_id_, ASI_FLIP, 0, ASI_FALSE);
         /** these auto settings should not be in use by the camera. **/
-        ASISetControlValue(kCameraNumber, ASI_AUTO_MAX_GAIN, 0, ASI_FALSE);
-        ASISetControlValue(kCameraNumber, ASI_AUTO_MAX_EXP, 0, ASI_FALSE);
-        ASISetControlValue(kCameraNumber, ASI_AUTO_TARGET_BRIGHTNESS, 0, ASI_FALSE);
+        ASISetControlValue(camera_id_, ASI_AUTO_MAX_GAIN, 0, ASI_FALSE);
+        ASISetControlValue(camera_id_, ASI_AUTO_MAX_EXP, 0, ASI_FALSE);
+        ASISetControlValue(camera_id_, ASI_AUTO_TARGET_BRIGHTNESS, 0, ASI_FALSE);
         /** no idea what high speed mode is. **/
-        ASISetControlValue(kCameraNumber, ASI_HIGH_SPEED_MODE, 0, ASI_FALSE);
+        ASISetControlValue(camera_id_, ASI_HIGH_SPEED_MODE, 0, ASI_FALSE);
         /** no idea what mono binning is. **/
-        ASISetControlValue(kCameraNumber, ASI_MONO_BIN, 0, ASI_FALSE);
+        ASISetControlValue(camera_id_, ASI_MONO_BIN, 0, ASI_FALSE);
 
         /** change color mode. **/
-        LOG("CaptureThread Using Raw16.");
-        int bin = 1;
-        auto type = ASI_IMG_RAW16;
-        result = ASISetROIFormat(kCameraNumber, width_, height_, bin, type);
-        LOG("CaptureThread ASISetROIFormat("<<width_<<", "<<height_<<", "<<bin<<", "<<type<<") = "<<result);
-		if (result != ASI_SUCCESS) {
-            LOG("CaptureThread Aborting.");
+        LOG(name_<<" Using Raw16.");
+        copySettings();
+        bool success = setRoi();
+		if (success == false) {
+            LOG(name_<<" Aborting.");
             LOG("  Failed to set resolution and format.");
             agm::master::setDone();
             return;
         }
 
-        /** start with an exposure of 20 milliseconds. **/
-        exposure_ = 20 * 1000;
+        /** allocate all of the buffers in the ring once. **/
+        image_ring_->allocate(width_, height_);
+
+        /** auto exposure starts with an exposure of 20 milliseconds. **/
+        if (auto_exposure_) {
+            exposure_ = 20 * 1000;
+        }
     }
 
     virtual void runOnce() noexcept {
-        /** ensure we have a buffer to read into. **/
-        allocateBuffer();
+        /**
+        get a buffer to read into.
+        the ring never makes us wait for the window thread.
+        keep the buffer we have if the last capture timed out.
+        **/
+        ScopedTimer frame_timer(time_frame_);
+        if (img_ == nullptr) {
+            ScopedTimer timer(time_acquire_);
+            img_ = image_ring_->acquireWrite();
+        }
+        if (img_ == nullptr || img_->width_ == 0) {
+            return;
+        }
 
-        /** copy all of the settings at once. **/
-        copySettings();
+        /** copy all of the settings at once if they changed. **/
+        bool changed = copySettings();
+
+        /** change the region of interest and binning. **/
+        if (changed) {
+            updateRoi();
+        }
+        img_->allocate(width_, height_);
 
     	/** exposure time is in microseconds. **/
-	    ASISetControlValue(kCameraNumber, ASI_EXPOSURE, exposure_, ASI_FALSE);
+        if (exposure_ != camera_exposure_) {
+            ASISetControlValue(camera_id_, ASI_EXPOSURE, exposure_, ASI_FALSE);
+            camera_exposure_ = exposure_;
+            writeSettings();
+        }
+
+        /** the other cameras may have changed what they send too. **/
+        updateBandwidth();
 
         /** capture an image. **/
+        bool captured = false;
+        if (video_mode_) {
+            captured = captureVideo();
+        } else {
+            captured = captureSnapshot();
+        }
+        if (captured == false) {
+            return;
+        }
+
+        /** compute the stats once for all consumers. **/
+        {
+            ScopedTimer timer(time_stats_);
+            auto data = (const agm::uint16 *) img_->bayer_.data;
+            img_->stats_.compute(data, img_->width_, img_->height_, saturation_);
+        }
+
+        /** note how the image was captured. **/
+        img_->exposure_ = exposure_;
+        img_->bin_ = cur_bin_;
+        img_->bayer_pattern_ = bayer_pattern_;
+        img_->mono_ = mono_;
+        img_->temperature_ = getTemperature();
+
+        /** adjust the exposure time. **/
+        autoAdjustExposure();
+
+        /** give the image to the consumers. **/
+        {
+            ScopedTimer timer(time_publish_);
+            image_ring_->publish(img_);
+        }
+        img_ = nullptr;
+    }
+
+    /**
+    long exposures use snapshot mode.
+    start an exposure and wait for it to finish.
+    **/
+    bool captureSnapshot() noexcept {
+        stopVideo();
+
+        /** don't waste a long exposure on a moving mount. **/
+        bool cancelable = (exposure_ >= kMinCancelExposure);
+        if (cancelable && isSlewing()) {
+            agm::sleep::milliseconds(100);
+            return false;
+        }
+
         auto status = ASI_EXP_WORKING;
-        ASIStartExposure(kCameraNumber, ASI_FALSE);
-        for(;;) {
-            ASIGetExpStatus(kCameraNumber, &status);
-            if (status != ASI_EXP_WORKING) {
-                break;
+        {
+            ScopedTimer timer(time_exposure_);
+            ASIStartExposure(camera_id_, ASI_FALSE);
+            agm::int64 start_time = agm::time::microseconds();
+            agm::int64 check_time = start_time;
+            for(;;) {
+                ASIGetExpStatus(camera_id_, &status);
+                if (status != ASI_EXP_WORKING) {
+                    break;
+                }
+                agm::sleep::milliseconds(1);
+
+                /** give up on the exposure if it's going to be wasted. **/
+                if (cancelable == false) {
+                    continue;
+                }
+                auto now = agm::time::microseconds();
+                if (now - check_time < kCancelCheckMicroseconds) {
+                    continue;
+                }
+                check_time = now;
+                const char *why = getCancelReason();
+                if (why) {
+                    ASIStopExposure(camera_id_);
+                    LOG(name_<<" Canceled the exposure after "<<(now - start_time)<<" us: "<<why);
+                    return false;
+                }
             }
-            agm::sleep::milliseconds(1);
         }
 		auto result = ASI_ERROR_END;
         if (status == ASI_EXP_SUCCESS) {
-            result = ASIGetDataAfterExp(kCameraNumber, img_->bayer_.data, img_->bytes_);
+            ScopedTimer timer(time_transfer_);
+            result = ASIGetDataAfterExp(camera_id_, img_->bayer_.data, img_->bytes_);
         }
         if (result != ASI_SUCCESS) {
-            LOG("CaptureThread Aborting.");
+            LOG(name_<<" Aborting.");
             LOG("  Failed to capture image.");
             LOG("  ASIGetDataAfterExp() = "<<result);
             agm::master::setDone();
-            return;
+            return false;
         }
-
-        /** adjust the exposure time. **/
-        autoAdjustExposure();
-
-        img_ = image_double_buffer_->swap(img_);
+        return true;
     }
 
-    void allocateBuffer() noexcept {
-        if (img_->width_) {
-            return;
+    /**
+    short exposures use video mode.
+    the camera streams frames back to back.
+    there's no setup and no dead time between exposures.
+    the exposure can be changed while the video is running.
+    **/
+    bool captureVideo() noexcept {
+        if (video_running_ == false) {
+            auto result = ASIStartVideoCapture(camera_id_);
+            if (result != ASI_SUCCESS) {
+                LOG(name_<<" Aborting.");
+                LOG("  Failed to start video capture.");
+                LOG("  ASIStartVideoCapture() = "<<result);
+                agm::master::setDone();
+                return false;
+            }
+            LOG(name_<<" Started video capture.");
+            video_running_ = true;
+            dropped_frames_ = 0;
+        }
+
+        /** the sdk suggests waiting twice the exposure plus 500ms. **/
+        int wait_ms = 2 * exposure_ / 1000 + 500;
+        auto video_start = agm::time::microseconds();
+        auto result = ASIGetVideoData(camera_id_, img_->bayer_.data, img_->bytes_, wait_ms);
+        /** the wait for the frame and the transfer are one call. **/
+        time_video_->record(agm::time::microseconds() - video_start);
+        if (result == ASI_ERROR_TIMEOUT) {
+            /** try again next time with the same buffer. **/
+            return false;
+        }
+        if (result != ASI_SUCCESS) {
+            LOG(name_<<" Aborting.");
+            LOG("  Failed to capture video frame.");
+            LOG("  ASIGetVideoData() = "<<result);
+            agm::master::setDone();
+            return false;
         }
 
-        const int kBytesPerPixel = 2;
-        int sz = width_ * height_;
-        img_->width_ = width_;
-        img_->height_ = height_;
-        img_->bytes_ = kBytesPerPixel * sz;
-        img_->bayer_ = std::move(cv::Mat(height_, width_, CV_16UC1));
+        /** note frames the camera dropped because we didn't read them fast enough. **/
+        int dropped = 0;
+        ASIGetDroppedFrames(camera_id_, &dropped);
+        if (dropped != dropped_frames_) {
+            LOG(name_<<" Camera dropped "<<dropped - dropped_frames_<<" video frames.");
+            dropped_frames_ = dropped;
+        }
+        return true;
     }
 
-    void copySettings() noexcept {
-        std::lock_guard<std::mutex> lock(settings_buffer_->mutex_);
-        auto_exposure_ = settings_buffer_->auto_exposure_;
-        exposure_ = settings_buffer_->exposure_;
+    /**
+    the sensor temperature in tenths of a degree C.
+    it changes slowly. so read it every few seconds.
+    **/
+    int getTemperature() noexcept {
+        auto now = agm::time::microseconds();
+        if (temperature_time_ == 0 || now - temperature_time_ > 5000000LL) {
+            temperature_time_ = now;
+            long value = 0;
+            ASI_BOOL is_auto = ASI_FALSE;
+            auto result = ASIGetControlValue(camera_id_, ASI_TEMPERATURE, &value, &is_auto);
+            if (result == ASI_SUCCESS) {
+                temperature_ = value;
+            }
+        }
+        return temperature_;
     }
 
-    void writeSettings() noexcept {
-        /** only update exposure if auto exposure is enabled. **/
-        std::lock_guard<std::mutex> lock(settings_buffer_->mutex_);
-        if (settings_buffer_->auto_exposure_) {
-            settings_buffer_->exposure_ = exposure_;
+    void stopVideo() noexcept {
+        if (video_running_) {
+            ASIStopVideoCapture(camera_id_);
+            LOG(name_<<" Stopped video capture.");
+            video_running_ = false;
         }
     }
 
     /**
-    adjust the exposure so the largest value is equally likely
-    to be above or below 61000.
-    which is chosen fairly arbitrarily.
+    returns false if the settings haven't changed.
+    auto exposure keeps its own exposure.
     **/
-    void autoAdjustExposure() noexcept {
+    bool copySettings() noexcept {
+        bool changed = settings_.update(settings_buffer_);
+        if (changed == false) {
+            return false;
+        }
+        auto_exposure_ = settings_->auto_exposure_;
         if (auto_exposure_ == false) {
-            over61_ = 0;
-            under61_ = 0;
-            return;
+            exposure_ = settings_->exposure_;
         }
+        video_mode_ = settings_->video_mode_;
+        /** video mode has a frame in flight with the old exposure. **/
+        auto_exposure_engine_.setSettleFrames(video_mode_ ? 1 : 0);
+        bin_ = settings_->bin_;
+        roi_follows_display_ = settings_->roi_follows_display_;
+        roi_width_ = settings_->roi_width_;
+        roi_height_ = settings_->roi_height_;
+        display_width_ = settings_->display_width_;
+        display_height_ = settings_->display_height_;
+        return true;
+    }
 
-        /** find the maximum pixel value in the image. **/
-        int sz = width_ * height_;
-        int hi = 0;
-        auto src = (agm::uint16 *) img_->bayer_.data;
-        for (int i = 0; i < sz; ++i) {
-            int x = *src++;
-            hi = std::max(hi, x);
+    /** use the requested binning if the camera supports it. **/
+    int getBin() noexcept {
+        for (int i = 0; i < 16 && supported_bins_[i]; ++i) {
+            if (supported_bins_[i] == bin_) {
+                return bin_;
+            }
         }
+        return 1;
+    }
 
-        /** some panics. **/
-        if (hi == 0) {
-            return;
-        }
-        if (hi < 50000) {
-            /** guard against overflow. **/
-            agm::int64 x = exposure_;
-            x = x * 56000 / hi;
-            /** arbitrarily limit auto exposure to 100 us and 30s. **/
-            static const agm::int64 k100us = 100;
-            static const agm::int64 k30s = 30*1000*1000;
-            x = std::max(k100us, std::min(x, k30s));
-            exposure_ = x;
-            LOG("new auto exposure="<<exposure_);
-            writeSettings();
+    /**
+    compute the region of interest from the settings.
+    sizes and positions are in binned pixels.
+    the roi is centered on the sensor.
+    the window thread crops the image to 80% of the display.
+    so there's no point transferring more than that.
+    **/
+    void getRoi(
+        int &wd,
+        int &ht,
+        int &x,
+        int &y,
+        int &bin
+    ) noexcept {
+        bin = getBin();
+        int full_wd = max_width_ / bin;
+        int full_ht = max_height_ / bin;
+        wd = full_wd;
+        ht = full_ht;
+        if (roi_follows_display_ && display_width_ > 0 && display_height_ > 0) {
+            wd = std::min(wd, display_width_ * 80 / 100);
+            ht = std::min(ht, display_height_ * 80 / 100);
+        } else if (roi_width_ > 0 && roi_height_ > 0) {
+            wd = std::min(wd, roi_width_);
+            ht = std::min(ht, roi_height_);
         }
 
-        /** the counts decay over time. **/
-        over61_ = over61_ * 97/100;
-        under61_ = under61_ * 97/100;
+        /** the sdk requires the width be a multiple of 8 and the height a multiple of 2. **/
+        wd = std::max(8, wd / 8 * 8);
+        ht = std::max(2, ht / 2 * 2);
 
-        /** increase either the over or under count. **/
-        if (hi > 61000) {
-            over61_ += 10;
-        } else {
-            under61_ += 10;
-        }
+        /** keep the start position even to preserve the bayer pattern. **/
+        x = (full_wd - wd) / 4 * 2;
+        y = (full_ht - ht) / 4 * 2;
+    }
 
-        /** no adjustment this frame. **/
-        if (over61_ < 100 && under61_ < 100) {
+    /** change the roi if the settings changed. **/
+    void updateRoi() noexcept {
+        int wd, ht, x, y, bin;
+        getRoi(wd, ht, x, y, bin);
+        if (wd == width_ && ht == height_ && x == start_x_ && y == start_y_ && bin == cur_bin_) {
             return;
         }
 
-        /** take no step if they're really close. **/
-        if (over61_ <= 90 || under61_ <= 90) {
-            /** take a big step of about 10% of the exposure. **/
-            int step;
-            step = exposure_ / 10;
-
-            /** unless, we're already close to the correct value. **/
-            if (over61_ > 5 && under61_ > 5) {
-                step /= 30;
+        /** the roi can't change while video is running. **/
+        stopVideo();
+        bool success = setRoi();
+        if (success == false) {
+            /** tell the menu thread so we don't try again. **/
+            LOG(name_<<" Using the full frame.");
+            bin_ = 1;
+            roi_follows_display_ = false;
+            roi_width_ = 0;
+            roi_height_ = 0;
+            {
+                SettingsLock lock(settings_buffer_);
+                settings_buffer_->bin_ = bin_;
+                settings_buffer_->roi_follows_display_ = roi_follows_display_;
+                settings_buffer_->roi_width_ = roi_width_;
+                settings_buffer_->roi_height_ = roi_height_;
             }
+            setRoi();
+        }
+    }
 
-            /** must make an adjustment. **/
-            if (step == 0) {
-                step = 1;
-            }
+    /** tell the camera which pixels to send us. **/
+    bool setRoi() noexcept {
+        int wd, ht, x, y, bin;
+        getRoi(wd, ht, x, y, bin);
+        auto type = ASI_IMG_RAW16;
+        auto result = ASISetROIFormat(camera_id_, wd, ht, bin, type);
+        LOG(name_<<" ASISetROIFormat("<<wd<<", "<<ht<<", "<<bin<<", "<<type<<") = "<<result);
+        if (result != ASI_SUCCESS) {
+            return false;
+        }
+        result = ASISetStartPos(camera_id_, x, y);
+        LOG(name_<<" ASISetStartPos("<<x<<", "<<y<<") = "<<result);
+        if (result != ASI_SUCCESS) {
+            return false;
+        }
+        width_ = wd;
+        height_ = ht;
+        start_x_ = x;
+        start_y_ = y;
+        cur_bin_ = bin;
+        return true;
+    }
 
-            /** step the correct direction. **/
-            if (over61_ >= 100) {
-                step = - step;
+    /** the split takes what the camera allows into account. **/
+    void setBandwidthLimits() noexcept {
+        int ncontrols = 0;
+        ASIGetNumOfControls(camera_id_, &ncontrols);
+        for (int i = 0; i < ncontrols; ++i) {
+            ASI_CONTROL_CAPS caps;
+            auto result = ASIGetControlCaps(camera_id_, i, &caps);
+            if (result == ASI_SUCCESS && caps.ControlType == ASI_BANDWIDTHOVERLOAD) {
+                LOG(name_<<" Usb bandwidth range: "<<caps.MinValue<<"-"<<caps.MaxValue<<"%");
+                usb_->setLimits(camera_index_, caps.MinValue, caps.MaxValue);
+                break;
             }
+        }
+    }
 
-            /** take the step. **/
-            exposure_ += step;
-            LOG("new auto exposure="<<exposure_);
+    /** tell the split what we send. use the share we're given. **/
+    void updateBandwidth() noexcept {
+        double frame_bytes = 2.0 * double(width_) * double(height_);
+        double seconds = 1e-6 * std::max(exposure_, kMinFrameMicroseconds);
+        usb_->setDemand(camera_index_, frame_bytes / seconds);
+        int bandwidth = usb_->getShare(camera_index_);
+        if (bandwidth != bandwidth_) {
+            bandwidth_ = bandwidth;
+            ASISetControlValue(camera_id_, ASI_BANDWIDTHOVERLOAD, bandwidth_, ASI_FALSE);
+            LOG(name_<<" Usb bandwidth: "<<bandwidth_<<"%");
+        }
+    }
 
-            writeSettings();
+    /** tell the menu without taking the lock or publishing new settings. **/
+    void writeSettings() noexcept {
+        settings_buffer_->current_exposure_.store(exposure_, std::memory_order_relaxed);
+    }
+
+    /**
+    returns why a long exposure in progress should be canceled.
+    or nullptr if it shouldn't.
+    **/
+    const char *getCancelReason() noexcept {
+        if (isSlewing()) {
+            return "the mount is slewing.";
+        }
+        bool changed = peek_.update(settings_buffer_);
+        if (changed == false) {
+            return nullptr;
+        }
+        if (peek_->auto_exposure_ != auto_exposure_
+        ||  (peek_->auto_exposure_ == false && peek_->exposure_ != exposure_)
+        ||  peek_->video_mode_ != video_mode_
+        ||  peek_->bin_ != bin_
+        ||  peek_->roi_follows_display_ != roi_follows_display_
+        ||  peek_->roi_width_ != roi_width_
+        ||  peek_->roi_height_ != roi_height_) {
+            return "the capture settings changed.";
+        }
+        return nullptr;
+    }
+
+    /** from the polled mount status. the scene changes when it stops. **/
+    bool isSlewing() noexcept {
+        MountStatus status;
+        bool valid = mount_ && mount_->getStatus(status);
+        bool slewing = valid && status.isSlewing();
+        if (slewing_ && slewing == false) {
+            auto_exposure_engine_.reset();
         }
+        slewing_ = slewing;
+        return slewing;
+    }
 
-        /** reset the over/under counts. **/
-        int big = std::max(over61_, under61_);
-        over61_ = over61_ * 90 / big;
-        under61_ = under61_ * 90 / big;
+    /** predict the exposure from the histogram. **/
+    void autoAdjustExposure() noexcept {
+        if (auto_exposure_ == false) {
+            return;
+        }
+        int exposure = auto_exposure_engine_.update(img_->stats_, exposure_);
+        if (exposure != exposure_) {
+            exposure_ = exposure;
+            LOG(name_<<" new auto exposure="<<exposure_<<" black="<<int(auto_exposure_engine_.getBlack()));
+        }
     }
 
     virtual void end() noexcept {
-    	ASICloseCamera(kCameraNumber);
-    	LOG("CaptureThread Closed camera.");
+        stopVideo();
+    	ASICloseCamera(camera_id_);
+    	LOG(name_<<" Closed camera.");
     }
 };
 }
 
+/**
+find the cameras and add them to the usb bandwidth split.
+returns the number of cameras.
+**/
+int findCameras(
+    UsbBandwidth *usb
+) noexcept {
+    int ncameras = ASIGetNumOfConnectedCameras();
+    LOG("Found "<<ncameras<<" cameras.");
+    if (ncameras > kMaxCameras) {
+        LOG("  Using the first "<<kMaxCameras<<".");
+        ncameras = kMaxCameras;
+    }
+    for (int i = 0; i < ncameras; ++i) {
+        ASI_CAMERA_INFO info;
+        auto result = ASIGetCameraProperty(&info, i);
+        double npixels = 0.0;
+        if (result == ASI_SUCCESS) {
+            npixels = double(info.MaxWidth) * double(info.MaxHeight);
+            LOG("  "<<i<<": "<<info.Name<<" "<<info.MaxWidth<<" x "<<info.MaxHeight
+                <<(info.IsColorCam == ASI_TRUE ? " color" : " mono"));
+        }
+        /** until the capture thread knows better. full frames once a second. **/
+        usb->addCamera(2.0 * npixels);
+    }
+    return ncameras;
+}
+
 agm::Thread *createCaptureThread(
-    ImageDoubleBuffer *image_double_buffer,
-    SettingsBuffer *settings_buffer
+    ImageRing *image_ring,
+    SettingsBuffer *settings_buffer,
+    Ioptron *mount,
+    PerfStats *perf_stats,
+    int camera_index,
+    UsbBandwidth *usb,
+    bool require_color
 ) noexcept {
-    return new(std::nothrow) CaptureThread(image_double_buffer, settings_buffer);
+    if (camera_index < 0 || camera_index >= kMaxCameras) {
+        return nullptr;
+    }
+    return new(std::nothrow) CaptureThread(image_ring, settings_buffer, mount, perf_stats,
+        camera_index, usb, require_color);
 }
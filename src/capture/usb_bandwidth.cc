@@ -0,0 +1,126 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "usb_bandwidth.h"
+
+
+void UsbBandwidth::setTotal(
+    int percent
+) noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    total_ = std::max(1, std::min(percent, 100));
+    split();
+}
+
+int UsbBandwidth::addCamera(
+    double demand
+) noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Camera camera;
+    camera.demand_ = std::max(demand, 0.0);
+    cameras_.push_back(camera);
+    split();
+    return cameras_.size() - 1;
+}
+
+void UsbBandwidth::setLimits(
+    int camera,
+    int min_percent,
+    int max_percent
+) noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &cam = cameras_[camera];
+    cam.min_ = std::max(0, min_percent);
+    cam.max_ = std::max(cam.min_, max_percent);
+    split();
+}
+
+void UsbBandwidth::setDemand(
+    int camera,
+    double demand
+) noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &cam = cameras_[camera];
+    demand = std::max(demand, 0.0);
+    if (demand == cam.demand_) {
+        return;
+    }
+    cam.demand_ = demand;
+    split();
+}
+
+int UsbBandwidth::getShare(
+    int camera
+) noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cameras_[camera].share_;
+}
+
+void UsbBandwidth::split() noexcept {
+    for (auto &cam : cameras_) {
+        cam.fixed_ = false;
+    }
+
+    /**
+    split what's left between the cameras that aren't clamped.
+    clamp the first one that's out of range and split again.
+    **/
+    double remaining = total_;
+    for (;;) {
+        int nfree = 0;
+        double demand = 0.0;
+        for (auto &cam : cameras_) {
+            if (cam.fixed_ == false) {
+                ++nfree;
+                demand += cam.demand_;
+            }
+        }
+        if (nfree == 0) {
+            break;
+        }
+
+        Camera *clamped = nullptr;
+        for (auto &cam : cameras_) {
+            if (cam.fixed_) {
+                continue;
+            }
+            double share = remaining / nfree;
+            if (demand > 0.0) {
+                share = remaining * cam.demand_ / demand;
+            }
+            if (share < cam.min_) {
+                cam.share_ = cam.min_;
+                clamped = &cam;
+                break;
+            }
+            if (share > cam.max_) {
+                cam.share_ = cam.max_;
+                clamped = &cam;
+                break;
+            }
+            /** round down so the shares don't add up to more than the total. **/
+            cam.share_ = int(std::floor(share));
+        }
+        if (clamped == nullptr) {
+            break;
+        }
+        clamped->fixed_ = true;
+        remaining -= clamped->share_;
+    }
+
+    int sum = 0;
+    for (auto &cam : cameras_) {
+        sum += cam.share_;
+    }
+    if (sum > total_ && logged_over_ == false) {
+        logged_over_ = true;
+        LOG("The cameras need at least "<<sum<<"% of the usb bandwidth. Only "<<total_<<"% is allowed.");
+    }
+}
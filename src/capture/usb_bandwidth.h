@@ -0,0 +1,73 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+split the usb bandwidth between the cameras.
+
+each camera gets a share in proportion to the data it would send.
+which is the size of its frame over its exposure time.
+so binning, the region of interest, and the frame rate all count.
+
+each camera has a min and max percent.
+a share outside its range is clamped first.
+the rest of the bandwidth is split between the other cameras.
+if the mins add up to more than the total the cameras get their mins.
+the log says so once.
+
+main adds the cameras before the threads start.
+the capture threads set their limits and demands.
+any thread may ask for its share.
+**/
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class UsbBandwidth {
+public:
+    UsbBandwidth() noexcept = default;
+    UsbBandwidth(const UsbBandwidth &) = delete;
+    ~UsbBandwidth() noexcept = default;
+
+    /** the percent of the usb bandwidth all of the cameras may use. **/
+    void setTotal(int percent) noexcept;
+
+    /**
+    add a camera with a first guess at its demand.
+    before the threads start.
+    returns the index of the camera.
+    **/
+    int addCamera(double demand) noexcept;
+
+    /** the range of percents the camera accepts. **/
+    void setLimits(int camera, int min_percent, int max_percent) noexcept;
+
+    /** the bytes per second the camera would send if nothing held it back. **/
+    void setDemand(int camera, double demand) noexcept;
+
+    /** the percent of the bandwidth the camera may use. **/
+    int getShare(int camera) noexcept;
+
+private:
+    class Camera {
+    public:
+        double demand_ = 0.0;
+        int min_ = 0;
+        int max_ = 100;
+        int share_ = 0;
+        bool fixed_ = false;
+    };
+
+    std::mutex mutex_;
+    int total_ = 100;
+    std::vector<Camera> cameras_;
+    bool logged_over_ = false;
+
+    /** with the lock held. **/
+    void split() noexcept;
+};
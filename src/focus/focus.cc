@@ -0,0 +1,157 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+measure the focus from the sizes of a few stars in every captured frame.
+
+the focus thread has its own place in the image ring.
+it reads every frame. so the focus is sampled at the capture rate.
+not the rate the window draws.
+it falls behind if the frames come faster than it can measure them.
+the frames it misses are counted. the capture thread never waits for it.
+
+the average is logged once a second while the focus helper measures stars.
+**/
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+#include <aggiornamento/thread.h>
+
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/settings_buffer.h>
+#include <shared/worker_pool.h>
+#include <window/focus_meter.h>
+
+
+namespace {
+
+class FocusThread : public agm::Thread {
+public:
+    /** share data with the capture thread. **/
+    ImageRing *image_ring_ = nullptr;
+    int ring_consumer_ = -1;
+    /** share data with the menu thread. **/
+    SettingsBuffer *settings_buffer_ = nullptr;
+    SettingsSnapshot settings_;
+    bool show_focus_ = false;
+    FocusMetric focus_metric_ = FocusMetric::kStars;
+    /** where the time goes. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_measure_ = nullptr;
+
+    WorkerPool *pool_ = nullptr;
+    FocusMeter focus_meter_;
+    agm::int64 focus_start_ = 0;
+    agm::int64 focus_frames_ = 0;
+    int focus_count_ = 0;
+    double focus_hfr_ = 0.0;
+    double focus_fwhm_ = 0.0;
+    int focus_stars_ = 0;
+
+    FocusThread(
+        ImageRing *image_ring,
+        SettingsBuffer *settings_buffer,
+        PerfStats *perf_stats
+    ) noexcept : agm::Thread("FocusThread") {
+        image_ring_ = image_ring;
+        /** we want every frame. **/
+        ring_consumer_ = image_ring_->addConsumer(ImageRing::Policy::kEvery);
+        settings_buffer_ = settings_buffer;
+        perf_stats_ = perf_stats;
+    }
+
+    virtual ~FocusThread() = default;
+
+    virtual void begin() noexcept {
+        LOG("FocusThread.");
+        time_measure_ = perf_stats_->addStage("FocusThread", "measure");
+        /** the stars are usually found once. don't compete with the window thread for the cores. **/
+        pool_ = WorkerPool::create(1);
+    }
+
+    virtual void runOnce() noexcept {
+        /** wait for the next frame. **/
+        auto img = image_ring_->acquireRead(ring_consumer_);
+        if (img == nullptr) {
+            return;
+        }
+
+        copySettings();
+        if (show_focus_ && focus_metric_ == FocusMetric::kStars) {
+            measureFocus(img);
+        } else {
+            focus_meter_.reset();
+            focus_start_ = 0;
+        }
+
+        image_ring_->releaseRead(ring_consumer_, img);
+    }
+
+    virtual void end() noexcept {
+        delete pool_;
+        pool_ = nullptr;
+    }
+
+    void copySettings() noexcept {
+        bool changed = settings_.update(settings_buffer_);
+        if (changed == false) {
+            return;
+        }
+        show_focus_ = settings_->show_focus_;
+        focus_metric_ = settings_->focus_metric_;
+    }
+
+    /** log the average once a second. **/
+    void measureFocus(
+        const ImageBuffer *img
+    ) noexcept {
+        auto now = agm::time::microseconds();
+        if (focus_start_ == 0) {
+            focus_start_ = now;
+            focus_frames_ = 0;
+            focus_count_ = 0;
+            focus_hfr_ = 0.0;
+            focus_fwhm_ = 0.0;
+            focus_stars_ = 0;
+        }
+
+        FocusMeter::Result result;
+        bool found = false;
+        {
+            ScopedTimer timer(time_measure_);
+            found = focus_meter_.measure(img->bayer_, pool_, result);
+        }
+        ++focus_frames_;
+        if (found) {
+            ++focus_count_;
+            focus_hfr_ += result.hfr_;
+            focus_fwhm_ += result.fwhm_;
+            focus_stars_ = result.nstars_;
+        }
+
+        auto elapsed = now - focus_start_;
+        if (elapsed < 1000000LL) {
+            return;
+        }
+        if (focus_count_ == 0) {
+            LOG("FocusThread focus: no stars.");
+        } else {
+            double hfr = focus_hfr_ / focus_count_;
+            double fwhm = focus_fwhm_ / focus_count_;
+            double fps = double(focus_frames_) * 1000000.0 / double(elapsed);
+            LOG("FocusThread focus hfr: "<<hfr<<" fwhm: "<<fwhm<<" stars: "<<focus_stars_<<" fps: "<<fps);
+        }
+        focus_start_ = 0;
+    }
+};
+}
+
+agm::Thread *createFocusThread(
+    ImageRing *image_ring,
+    SettingsBuffer *settings_buffer,
+    PerfStats *perf_stats
+) noexcept {
+    return new(std::nothrow) FocusThread(image_ring, settings_buffer, perf_stats);
+}
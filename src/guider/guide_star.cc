@@ -0,0 +1,168 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+the box is tiny. so the loops are plain integer and float.
+**/
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <window/star_registration.h>
+
+#include "guide_star.h"
+
+
+namespace {
+    /** the peak must be this many standard deviations above the background. **/
+    const double kPeakSigmas = 6.0;
+    /** ignore superpixels less than this many standard deviations above the background. **/
+    const double kNoiseSigmas = 3.0;
+    /** a saturated star has no center. **/
+    const int kSaturated = 60000;
+    /** the star is lost if it's this close to the edge of the box in bayer pixels. **/
+    const double kEdge = 3.0;
+}
+
+void GuideStar::reset() noexcept {
+    found_ = false;
+    snr_ = 0.0;
+}
+
+bool GuideStar::find(
+    const cv::Mat &bayer,
+    WorkerPool *pool
+) noexcept {
+    reset();
+    if (bayer.cols < 4 * kBox || bayer.rows < 4 * kBox) {
+        return false;
+    }
+
+    /** the stars are sorted brightest first. **/
+    StarRegistration finder;
+    auto &stars = finder.detect(bayer, pool);
+    for (auto &star : stars) {
+        if (star.x_ < kBox || star.y_ < kBox
+        ||  star.x_ > bayer.cols - kBox || star.y_ > bayer.rows - kBox) {
+            continue;
+        }
+
+        /** skip saturated stars. **/
+        int x0 = int(star.x_) - kBox / 2;
+        int y0 = int(star.y_) - kBox / 2;
+        int mx = 0;
+        for (int y = y0; y < y0 + kBox; ++y) {
+            auto row = bayer.ptr<agm::uint16>(y);
+            for (int x = x0; x < x0 + kBox; ++x) {
+                mx = std::max(mx, int(row[x]));
+            }
+        }
+        if (mx >= kSaturated) {
+            continue;
+        }
+
+        bool success = measureAt(bayer, star.x_, star.y_);
+        if (success) {
+            found_ = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GuideStar::measure(
+    const cv::Mat &bayer
+) noexcept {
+    if (found_ == false) {
+        return false;
+    }
+    /** a star lost for a frame is looked for again in the same place. **/
+    return measureAt(bayer, x_, y_);
+}
+
+bool GuideStar::measureAt(
+    const cv::Mat &bayer,
+    double cx,
+    double cy
+) noexcept {
+    if (bayer.cols < kBox || bayer.rows < kBox) {
+        return false;
+    }
+
+    /** the box starts on a bayer cell. **/
+    int x0 = (int(cx) - kBox / 2) & ~1;
+    int y0 = (int(cy) - kBox / 2) & ~1;
+    x0 = std::max(0, std::min(x0, (bayer.cols - kBox) & ~1));
+    y0 = std::max(0, std::min(y0, (bayer.rows - kBox) & ~1));
+
+    /** sum the superpixels. **/
+    for (int j = 0; j < kCells; ++j) {
+        auto row0 = bayer.ptr<agm::uint16>(y0 + 2 * j) + x0;
+        auto row1 = bayer.ptr<agm::uint16>(y0 + 2 * j + 1) + x0;
+        auto dst = &cells_[j * kCells];
+        for (int i = 0; i < kCells; ++i) {
+            dst[i] = float(row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1]);
+        }
+    }
+
+    /** the background and noise from the edge of the box. **/
+    std::vector<float> edge;
+    edge.reserve(4 * kCells);
+    for (int i = 0; i < kCells; ++i) {
+        edge.push_back(cells_[i]);
+        edge.push_back(cells_[(kCells - 1) * kCells + i]);
+    }
+    for (int j = 1; j < kCells - 1; ++j) {
+        edge.push_back(cells_[j * kCells]);
+        edge.push_back(cells_[j * kCells + kCells - 1]);
+    }
+    int n = edge.size();
+    std::nth_element(edge.begin(), edge.begin() + n / 2, edge.end());
+    double background = edge[n / 2];
+    for (auto &value : edge) {
+        value = std::abs(value - float(background));
+    }
+    std::nth_element(edge.begin(), edge.begin() + n / 2, edge.end());
+    double sigma = std::max(1.4826 * edge[n / 2], 1.0);
+
+    /** the centroid of the superpixels above the noise. **/
+    double threshold = background + kNoiseSigmas * sigma;
+    double peak = 0.0;
+    double sum = 0.0;
+    double sum_x = 0.0;
+    double sum_y = 0.0;
+    int count = 0;
+    for (int j = 0; j < kCells; ++j) {
+        auto src = &cells_[j * kCells];
+        for (int i = 0; i < kCells; ++i) {
+            double v = src[i];
+            peak = std::max(peak, v);
+            if (v <= threshold) {
+                continue;
+            }
+            v -= background;
+            sum += v;
+            sum_x += v * i;
+            sum_y += v * j;
+            ++count;
+        }
+    }
+    if (count == 0 || peak < background + kPeakSigmas * sigma) {
+        return false;
+    }
+
+    /** the center of a superpixel is between its bayer pixels. **/
+    double x = x0 + 2.0 * sum_x / sum + 0.5;
+    double y = y0 + 2.0 * sum_y / sum + 0.5;
+    if (x < x0 + kEdge || x > x0 + kBox - kEdge
+    ||  y < y0 + kEdge || y > y0 + kBox - kEdge) {
+        return false;
+    }
+
+    x_ = x;
+    y_ = y;
+    snr_ = sum / (sigma * std::sqrt(double(count)));
+    return true;
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+track one guide star in a small box of each frame.
+
+the star is found once in the whole frame.
+after that only the box around its last position is read.
+so the cost per frame doesn't depend on the size of the frame.
+
+the box is summed into 2x2 superpixels.
+which averages away the bayer pattern.
+the background is the median of the edge of the box.
+the position is the centroid of the superpixels above the noise.
+the box follows the star.
+
+the star is lost if it fades into the noise or leaves the box.
+**/
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include <shared/worker_pool.h>
+
+
+class GuideStar {
+public:
+    GuideStar() noexcept = default;
+    GuideStar(const GuideStar &) = delete;
+    ~GuideStar() noexcept = default;
+
+    /** the box is this many bayer pixels on a side. **/
+    static const int kBox = 32;
+
+    /** forget the star. **/
+    void reset() noexcept;
+
+    /**
+    find the brightest unsaturated star away from the edges.
+    returns false if there isn't one.
+    **/
+    bool find(const cv::Mat &bayer, WorkerPool *pool) noexcept;
+
+    /** measure the star in the box around its last position. returns false if it's lost. **/
+    bool measure(const cv::Mat &bayer) noexcept;
+
+    bool isFound() const noexcept { return found_; }
+
+    /** position in bayer pixels. **/
+    double getX() const noexcept { return x_; }
+    double getY() const noexcept { return y_; }
+    /** signal to noise ratio of the last measurement. **/
+    double getSnr() const noexcept { return snr_; }
+
+private:
+    bool found_ = false;
+    double x_ = 0.0;
+    double y_ = 0.0;
+    double snr_ = 0.0;
+
+    /** the superpixels of the box. **/
+    static const int kCells = kBox / 2;
+    float cells_[kCells * kCells];
+
+    bool measureAt(const cv::Mat &bayer, double x, double y) noexcept;
+};
@@ -0,0 +1,458 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+autoguide the mount from the camera frames.
+
+the guider has its own thread and its own place in the image ring.
+it takes the newest frame as soon as it's published.
+it reads only the box around the guide star.
+and it sends the corrections to the mount io thread without waiting.
+so the time from frame to correction doesn't depend on the display.
+
+the corrections are guide pulses.
+the mount moves at the guide rate for a number of milliseconds.
+and stops by itself.
+
+calibration:
+pulse west until the star has moved far enough.
+then pulse north.
+the star moves so many pixels per millisecond along each axis.
+which gives the matrix from pixels to milliseconds.
+dec backlash is not compensated.
+
+guiding:
+the lock position is where the star was when guiding started.
+each frame the error from the lock position is split into ra and dec.
+a fraction of it is corrected with one pulse per axis.
+errors smaller than the seeing are ignored.
+
+a frame that started before the last pulse settled shows the mount moving.
+it's used to follow the star but not to correct it.
+**/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+#include <aggiornamento/thread.h>
+
+#include <menu/ioptron.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/settings_buffer.h>
+#include <shared/worker_pool.h>
+
+#include "guide_star.h"
+
+
+namespace {
+
+/** calibration pulses. **/
+const int kCalibrationPulseMs = 1000;
+const int kMaxCalibrationSteps = 15;
+/** the star should move this many pixels along each axis. **/
+const double kCalibrationPixels = 20.0;
+/** less than this and the mount isn't moving. **/
+const double kMinCalibrationPixels = 4.0;
+
+/** ignore errors smaller than this many pixels. **/
+const double kMinMovePixels = 0.15;
+const int kMaxPulseMs = 2000;
+/** the mount takes a moment to settle after a pulse. **/
+const agm::int64 kSettleUs = 100 * 1000;
+/** give up after losing the star this many frames in a row. **/
+const int kMaxLostFrames = 5;
+/** log the guiding error every so many corrections. **/
+const int kStatsFrames = 30;
+
+/** the same clock as the image ring timestamps. **/
+agm::int64 getUtcMicroseconds() noexcept {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+class GuiderThread : public agm::Thread {
+public:
+    /** share data with the capture thread. **/
+    ImageRing *image_ring_ = nullptr;
+    int ring_consumer_ = -1;
+    /** share data with the menu thread. **/
+    SettingsBuffer *settings_buffer_ = nullptr;
+    SettingsSnapshot settings_;
+    bool guide_ = false;
+    int aggressiveness_ = 70;
+    int calibration_generation_ = 0;
+    /** the mount is shared with the menu thread. **/
+    Ioptron *mount_ = nullptr;
+    /** where the time goes. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_frame_ = nullptr;
+    LatencyHistogram *time_find_ = nullptr;
+    LatencyHistogram *time_centroid_ = nullptr;
+    LatencyHistogram *time_latency_ = nullptr;
+
+    enum class State {
+        kOff,
+        kSelect,
+        kCalibrateRa,
+        kCalibrateDec,
+        kGuiding
+    };
+    State state_ = State::kOff;
+    WorkerPool *pool_ = nullptr;
+    GuideStar star_;
+    int lost_frames_ = 0;
+    /** when the last pulse is done. **/
+    agm::int64 pulse_end_ = 0;
+    std::string status_;
+
+    /** pixels per millisecond of guiding west and north. **/
+    bool calibrated_ = false;
+    double ra_x_ = 0.0;
+    double ra_y_ = 0.0;
+    double dec_x_ = 0.0;
+    double dec_y_ = 0.0;
+    /** the calibration in progress. **/
+    double start_x_ = 0.0;
+    double start_y_ = 0.0;
+    int steps_ = 0;
+
+    /** guiding. **/
+    double lock_x_ = 0.0;
+    double lock_y_ = 0.0;
+    int nstats_ = 0;
+    double sum_ra2_ = 0.0;
+    double sum_dec2_ = 0.0;
+
+    GuiderThread(
+        ImageRing *image_ring,
+        SettingsBuffer *settings_buffer,
+        Ioptron *mount,
+        PerfStats *perf_stats
+    ) noexcept : agm::Thread("GuiderThread") {
+        image_ring_ = image_ring;
+        /** we want the newest frame. **/
+        ring_consumer_ = image_ring_->addConsumer(ImageRing::Policy::kLatest);
+        settings_buffer_ = settings_buffer;
+        mount_ = mount;
+        perf_stats_ = perf_stats;
+    }
+
+    virtual ~GuiderThread() = default;
+
+    virtual void begin() noexcept {
+        LOG("GuiderThread.");
+        static const char *kThread = "GuiderThread";
+        time_frame_ = perf_stats_->addStage(kThread, "frame");
+        time_find_ = perf_stats_->addStage(kThread, "find");
+        time_centroid_ = perf_stats_->addStage(kThread, "centroid");
+        time_latency_ = perf_stats_->addStage(kThread, "latency");
+        /** finding the star is rare. don't compete with the window thread for the cores. **/
+        pool_ = WorkerPool::create(1);
+    }
+
+    virtual void runOnce() noexcept {
+        /** wait for the next frame. **/
+        auto img = image_ring_->acquireRead(ring_consumer_);
+        if (img == nullptr) {
+            return;
+        }
+
+        copySettings();
+        if (guide_ == false) {
+            if (state_ != State::kOff) {
+                state_ = State::kOff;
+                star_.reset();
+                LOG("GuiderThread Stopped guiding.");
+                setStatus("off");
+            }
+        } else if (mount_->isConnected() == false) {
+            stopGuiding("the mount is not connected.");
+        } else if (isSlewing()) {
+            stopGuiding("the mount is slewing.");
+        } else {
+            ScopedTimer timer(time_frame_);
+            guideFrame(img);
+        }
+
+        image_ring_->releaseRead(ring_consumer_, img);
+    }
+
+    virtual void end() noexcept {
+        delete pool_;
+        pool_ = nullptr;
+    }
+
+    /** from the polled status. the serial port isn't touched. **/
+    bool isSlewing() noexcept {
+        MountStatus status;
+        bool valid = mount_->getStatus(status);
+        return valid && (status.isSlewing() || status.isParked());
+    }
+
+    void copySettings() noexcept {
+        if (settings_.update(settings_buffer_) == false) {
+            return;
+        }
+        guide_ = settings_->guide_;
+        aggressiveness_ = settings_->guide_aggressiveness_;
+        if (calibration_generation_ != settings_->guide_calibration_) {
+            calibration_generation_ = settings_->guide_calibration_;
+            calibrated_ = false;
+            if (state_ != State::kOff) {
+                state_ = State::kSelect;
+            }
+        }
+    }
+
+    void guideFrame(
+        const ImageBuffer *img
+    ) noexcept {
+        if (state_ == State::kOff) {
+            state_ = State::kSelect;
+        }
+        if (state_ == State::kSelect) {
+            selectStar(img);
+            return;
+        }
+
+        bool found = false;
+        {
+            ScopedTimer timer(time_centroid_);
+            found = star_.measure(img->bayer_);
+        }
+        if (found == false) {
+            ++lost_frames_;
+            if (lost_frames_ >= kMaxLostFrames) {
+                stopGuiding("lost the guide star.");
+            }
+            return;
+        }
+        lost_frames_ = 0;
+
+        /** the box follows the star. but don't correct a blurred frame. **/
+        agm::int64 exposure_start = img->timestamp_ - img->exposure_;
+        if (exposure_start < pulse_end_ + kSettleUs) {
+            return;
+        }
+
+        switch (state_) {
+        case State::kCalibrateRa:
+        case State::kCalibrateDec:
+            calibrate();
+            break;
+        case State::kGuiding:
+            correct(img);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void selectStar(
+        const ImageBuffer *img
+    ) noexcept {
+        bool found = false;
+        {
+            ScopedTimer timer(time_find_);
+            found = star_.find(img->bayer_, pool_);
+        }
+        if (found == false) {
+            setStatus("no guide star.");
+            return;
+        }
+        LOG("GuiderThread Guide star at "<<star_.getX()<<","<<star_.getY()<<" snr="<<star_.getSnr());
+        lost_frames_ = 0;
+        if (calibrated_) {
+            startGuiding();
+        } else {
+            startCalibration(State::kCalibrateRa);
+        }
+    }
+
+    void startCalibration(
+        State axis
+    ) noexcept {
+        state_ = axis;
+        start_x_ = star_.getX();
+        start_y_ = star_.getY();
+        steps_ = 0;
+        bool is_ra = (axis == State::kCalibrateRa);
+        setStatus(is_ra ? "calibrating ra." : "calibrating dec.");
+        calibrationPulse();
+    }
+
+    void calibrationPulse() noexcept {
+        bool is_ra = (state_ == State::kCalibrateRa);
+        pulse(is_ra ? 'w' : 'n', kCalibrationPulseMs);
+        ++steps_;
+    }
+
+    /** keep pulsing until the star has moved far enough. **/
+    void calibrate() noexcept {
+        double dx = star_.getX() - start_x_;
+        double dy = star_.getY() - start_y_;
+        double dist = std::sqrt(dx * dx + dy * dy);
+        if (dist < kCalibrationPixels && steps_ < kMaxCalibrationSteps) {
+            calibrationPulse();
+            return;
+        }
+
+        bool is_ra = (state_ == State::kCalibrateRa);
+        if (dist < kMinCalibrationPixels) {
+            stopGuiding(is_ra ? "calibration failed. the star didn't move in ra."
+                : "calibration failed. the star didn't move in dec.");
+            return;
+        }
+        double ms = double(steps_ * kCalibrationPulseMs);
+        if (is_ra) {
+            ra_x_ = dx / ms;
+            ra_y_ = dy / ms;
+            startCalibration(State::kCalibrateDec);
+            return;
+        }
+        dec_x_ = dx / ms;
+        dec_y_ = dy / ms;
+
+        /** the axes should be about perpendicular. **/
+        double ra_len = std::sqrt(ra_x_ * ra_x_ + ra_y_ * ra_y_);
+        double dec_len = std::sqrt(dec_x_ * dec_x_ + dec_y_ * dec_y_);
+        double cos_angle = (ra_x_ * dec_x_ + ra_y_ * dec_y_) / (ra_len * dec_len);
+        double angle = std::acos(std::max(-1.0, std::min(cos_angle, 1.0))) * 180.0 / M_PI;
+        LOG("GuiderThread Calibrated ra="<<ra_len * 1000.0<<" dec="<<dec_len * 1000.0
+            <<" pixels per second. angle between axes="<<angle<<" degrees.");
+        if (std::abs(angle - 90.0) > 30.0) {
+            stopGuiding("calibration failed. the axes aren't perpendicular.");
+            return;
+        }
+        calibrated_ = true;
+        startGuiding();
+    }
+
+    void startGuiding() noexcept {
+        state_ = State::kGuiding;
+        lock_x_ = star_.getX();
+        lock_y_ = star_.getY();
+        nstats_ = 0;
+        sum_ra2_ = 0.0;
+        sum_dec2_ = 0.0;
+        LOG("GuiderThread Guiding on "<<lock_x_<<","<<lock_y_);
+        setStatus("guiding.");
+    }
+
+    /**
+    solve error = ra * (ra_x, ra_y) + dec * (dec_x, dec_y)
+    for the milliseconds of guiding west and north that caused it.
+    then undo some of it.
+    **/
+    void correct(
+        const ImageBuffer *img
+    ) noexcept {
+        double ex = star_.getX() - lock_x_;
+        double ey = star_.getY() - lock_y_;
+        double det = ra_x_ * dec_y_ - ra_y_ * dec_x_;
+        double ra_ms = (ex * dec_y_ - ey * dec_x_) / det;
+        double dec_ms = (ra_x_ * ey - ra_y_ * ex) / det;
+
+        /** the error in pixels along each axis. **/
+        double ra_px = ra_ms * std::sqrt(ra_x_ * ra_x_ + ra_y_ * ra_y_);
+        double dec_px = dec_ms * std::sqrt(dec_x_ * dec_x_ + dec_y_ * dec_y_);
+        updateStats(ra_px, dec_px);
+
+        double gain = - double(aggressiveness_) / 100.0;
+        int ra_pulse = 0;
+        int dec_pulse = 0;
+        if (std::abs(ra_px) >= kMinMovePixels) {
+            ra_pulse = int(std::round(gain * ra_ms));
+        }
+        if (std::abs(dec_px) >= kMinMovePixels) {
+            dec_pulse = int(std::round(gain * dec_ms));
+        }
+        ra_pulse = std::max(-kMaxPulseMs, std::min(ra_pulse, kMaxPulseMs));
+        dec_pulse = std::max(-kMaxPulseMs, std::min(dec_pulse, kMaxPulseMs));
+
+        /** the mount may run the pulses one after the other. **/
+        if (ra_pulse) {
+            pulse(ra_pulse > 0 ? 'w' : 'e', std::abs(ra_pulse));
+        }
+        if (dec_pulse) {
+            pulse(dec_pulse > 0 ? 'n' : 's', std::abs(dec_pulse));
+        }
+        if (ra_pulse || dec_pulse) {
+            pulse_end_ = getUtcMicroseconds() + 1000LL * (std::abs(ra_pulse) + std::abs(dec_pulse));
+            time_latency_->record(getUtcMicroseconds() - img->timestamp_);
+        }
+    }
+
+    void pulse(
+        int direction,
+        int ms
+    ) noexcept {
+        mount_->pulseGuide(direction, ms);
+        pulse_end_ = getUtcMicroseconds() + 1000LL * ms;
+    }
+
+    void updateStats(
+        double ra_px,
+        double dec_px
+    ) noexcept {
+        sum_ra2_ += ra_px * ra_px;
+        sum_dec2_ += dec_px * dec_px;
+        ++nstats_;
+        if (nstats_ < kStatsFrames) {
+            return;
+        }
+        std::stringstream ss;
+        ss<<std::fixed<<std::setprecision(2);
+        ss<<"guiding. rms error ra="<<std::sqrt(sum_ra2_ / nstats_)
+            <<" dec="<<std::sqrt(sum_dec2_ / nstats_)<<" pixels.";
+        LOG("GuiderThread "<<ss.str());
+        setStatus(ss.str());
+        nstats_ = 0;
+        sum_ra2_ = 0.0;
+        sum_dec2_ = 0.0;
+    }
+
+    /** tell the menu thread we stopped. **/
+    void stopGuiding(
+        const char *reason
+    ) noexcept {
+        LOG("GuiderThread Stopped guiding: "<<reason);
+        state_ = State::kOff;
+        star_.reset();
+        guide_ = false;
+        SettingsLock lock(settings_buffer_);
+        settings_buffer_->guide_ = false;
+        settings_buffer_->guide_status_ = reason;
+        status_ = reason;
+    }
+
+    /** the menu shows the status. only publish it when it changes. **/
+    void setStatus(
+        const std::string &status
+    ) noexcept {
+        if (status == status_) {
+            return;
+        }
+        status_ = status;
+        SettingsLock lock(settings_buffer_);
+        settings_buffer_->guide_status_ = status;
+    }
+};
+}
+
+agm::Thread *createGuiderThread(
+    ImageRing *image_ring,
+    SettingsBuffer *settings_buffer,
+    Ioptron *mount,
+    PerfStats *perf_stats
+) noexcept {
+    return new(std::nothrow) GuiderThread(image_ring, settings_buffer, mount, perf_stats);
+}
@@ -3,50 +3,206 @@ Copyright (C) 2012-2024 tim cotter. All rights reserved.
 */
 
 /**
-drive the zwo asi astrophotography camera and the ioptron smarteq pro(+) mount.
+drive the zwo asi astrophotography cameras and the ioptron smarteq pro(+) mount.
 
 launch the threads that do the actual work.
 create the containers for them to exchange data.
+
+usage: zwo [--replay file-or-directory [--fps frames-per-second]] [--lock-memory] [--headless [--port n]]
+           [--camera n] [--guide-camera n] [--usb-bandwidth percent]
+replay recorded frames instead of capturing from the camera.
+lock the frame buffers in memory so they're never paged out.
+stream previews over the network instead of showing them in a window.
+
+every camera gets a capture thread, an image ring, its own settings, and a recorder.
+the imaging camera is shown in the window, solved, and measured for focus.
+the guide camera is the one the guider watches.
+it defaults to the last camera that isn't the imaging camera.
+the cameras share the usb bandwidth in proportion to the data they send.
+
+a build configured with ZWO_HEADLESS has no window. it doesn't need x11 or opengl.
 **/
 
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
 #include <aggiornamento/aggiornamento.h>
 #include <aggiornamento/log.h>
 #include <aggiornamento/thread.h>
 
-#include <shared/image_double_buffer.h>
+#include <capture/usb_bandwidth.h>
+#include <menu/ioptron.h>
+#include <shared/frame_pool.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/save_queue.h>
 #include <shared/settings_buffer.h>
 
 
 /** threads defined elsewhere. **/
-extern agm::Thread *createCaptureThread(ImageDoubleBuffer *image_double_buffer, SettingsBuffer *settings_buffer);
-extern agm::Thread *createWindowThread(ImageDoubleBuffer *image_double_buffer, SettingsBuffer *settings_buffer);
-extern agm::Thread *createMenuThread(SettingsBuffer *settings_buffer);
+extern int findCameras(UsbBandwidth *usb);
+extern agm::Thread *createCaptureThread(ImageRing *image_ring, SettingsBuffer *settings_buffer, Ioptron *mount, PerfStats *perf_stats, int camera_index, UsbBandwidth *usb, bool require_color);
+extern agm::Thread *createReplayThread(ImageRing *image_ring, SettingsBuffer *settings_buffer, PerfStats *perf_stats, const std::string &path, double fps);
+extern agm::Thread *createWindowThread(ImageRing *image_ring, SaveQueue *save_queue, SettingsBuffer *settings_buffer, Ioptron *mount, PerfStats *perf_stats, FramePool *frame_pool);
+extern agm::Thread *createRecorderThread(ImageRing *image_ring, SettingsBuffer *settings_buffer, PerfStats *perf_stats, FramePool *frame_pool);
+extern agm::Thread *createSaverThread(SaveQueue *save_queue, SettingsBuffer *settings_buffer, PerfStats *perf_stats, FramePool *frame_pool);
+extern agm::Thread *createGuiderThread(ImageRing *image_ring, SettingsBuffer *settings_buffer, Ioptron *mount, PerfStats *perf_stats);
+extern agm::Thread *createSolverThread(ImageRing *image_ring, SettingsBuffer *settings_buffer, Ioptron *mount, PerfStats *perf_stats);
+extern agm::Thread *createFocusThread(ImageRing *image_ring, SettingsBuffer *settings_buffer, PerfStats *perf_stats);
+extern agm::Thread *createMenuThread(const std::vector<SettingsBuffer *> &settings_buffers, int imaging_camera, int guide_camera, Ioptron *mount, PerfStats *perf_stats);
+extern agm::Thread *createStreamerThread(ImageRing *image_ring, SettingsBuffer *settings_buffer, SettingsBuffer *guide_settings, Ioptron *mount, PerfStats *perf_stats, int port);
+
+/**
+number of frames in the ring between the capture thread and its consumers.
+one for capture, one for each consumer, and some spares.
+the spares are the queue between the camera and the recorder.
+**/
+static const int kImageRingSlots = 9;
+
+/** the other cameras' rings only feed the guider and a recorder. **/
+static const int kGuideRingSlots = 5;
+
+/** the percent of the usb bandwidth all of the cameras may use. **/
+static const int kDefaultUsbBandwidth = 80;
+
+/** where remote clients connect in headless mode. **/
+static const int kDefaultStreamPort = 4030;
 
 /** start logging and all threads. **/
 int main(
     int argc, char *argv[]
 ) noexcept {
-    (void) argc;
-    (void) argv;
-
     agm::log::init(TARGET_NAME ".log");
 
-    /** create the containers. **/
-    auto image_double_buffer = ImageDoubleBuffer::create();
-    SettingsBuffer settings_buffer;
+    /** parse the command line. **/
+    std::string replay_path;
+    double replay_fps = 0.0;
+    bool lock_memory = false;
+#if ZWO_HEADLESS
+    bool headless = true;
+#else
+    bool headless = false;
+#endif
+    int stream_port = kDefaultStreamPort;
+    int imaging_camera = 0;
+    int guide_camera = -1;
+    int usb_bandwidth = kDefaultUsbBandwidth;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            replay_fps = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--lock-memory") == 0) {
+            lock_memory = true;
+        } else if (std::strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            stream_port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--camera") == 0 && i + 1 < argc) {
+            imaging_camera = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--guide-camera") == 0 && i + 1 < argc) {
+            guide_camera = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--usb-bandwidth") == 0 && i + 1 < argc) {
+            usb_bandwidth = std::atoi(argv[++i]);
+        } else {
+            LOG("Unknown option: "<<argv[i]);
+            LOG("Usage: " TARGET_NAME " [--replay file-or-directory [--fps frames-per-second]] [--lock-memory] [--headless [--port n]]");
+            LOG("       [--camera n] [--guide-camera n] [--usb-bandwidth percent]");
+            return 1;
+        }
+    }
+
+    /** the big images are shared by the threads. **/
+    FramePool frame_pool;
+    frame_pool.setLockPages(lock_memory);
+
+    /** find the cameras. a replay is one camera. **/
+    UsbBandwidth usb;
+    usb.setTotal(usb_bandwidth);
+    int ncameras = 1;
+    if (replay_path.empty()) {
+        ncameras = findCameras(&usb);
+    }
+    if (ncameras == 0) {
+        LOG("No cameras found.");
+        return 1;
+    }
+    if (imaging_camera < 0 || imaging_camera >= ncameras) {
+        LOG("There is no camera "<<imaging_camera<<".");
+        return 1;
+    }
+    if (guide_camera < 0) {
+        guide_camera = imaging_camera;
+        for (int i = 0; i < ncameras; ++i) {
+            if (i != imaging_camera) {
+                guide_camera = i;
+            }
+        }
+    }
+    if (guide_camera >= ncameras) {
+        LOG("There is no guide camera "<<guide_camera<<".");
+        return 1;
+    }
+    LOG("Imaging camera: "<<imaging_camera<<" guide camera: "<<guide_camera);
+
+    /** create the containers. one ring and one set of settings per camera. **/
+    std::vector<ImageRing *> image_rings;
+    std::vector<SettingsBuffer *> settings_buffers;
+    for (int i = 0; i < ncameras; ++i) {
+        int nslots = (i == imaging_camera) ? kImageRingSlots : kGuideRingSlots;
+        image_rings.push_back(ImageRing::create(nslots, &frame_pool));
+        settings_buffers.push_back(new(std::nothrow) SettingsBuffer);
+    }
+    auto image_ring = image_rings[imaging_camera];
+    auto settings_buffer = settings_buffers[imaging_camera];
+    auto save_queue = SaveQueue::create();
+    PerfStats perf_stats;
+    /** the menu thread connects the mount. the other threads use it. **/
+    auto mount = Ioptron::create();
 
     /** store the containers. **/
     std::vector<agm::Container *> containers;
-    containers.push_back(image_double_buffer);
+    for (auto ring : image_rings) {
+        containers.push_back(ring);
+    }
+    containers.push_back(save_queue);
 
     /** create the threads. **/
     std::vector<agm::Thread *> threads;
-    threads.push_back(createCaptureThread(image_double_buffer, &settings_buffer));
-    threads.push_back(createWindowThread(image_double_buffer, &settings_buffer));
-    threads.push_back(createMenuThread(&settings_buffer));
+    if (replay_path.size()) {
+        threads.push_back(createReplayThread(image_ring, settings_buffer, &perf_stats, replay_path, replay_fps));
+    } else {
+        for (int i = 0; i < ncameras; ++i) {
+            bool require_color = (i == imaging_camera);
+            threads.push_back(createCaptureThread(image_rings[i], settings_buffers[i], mount, &perf_stats,
+                i, &usb, require_color));
+        }
+    }
+    if (headless) {
+        threads.push_back(createStreamerThread(image_ring, settings_buffer, settings_buffers[guide_camera], mount, &perf_stats, stream_port));
+    } else {
+#if !ZWO_HEADLESS
+        threads.push_back(createWindowThread(image_ring, save_queue, settings_buffer, mount, &perf_stats, &frame_pool));
+#endif
+    }
+    for (int i = 0; i < ncameras; ++i) {
+        threads.push_back(createRecorderThread(image_rings[i], settings_buffers[i], &perf_stats, &frame_pool));
+    }
+    threads.push_back(createSaverThread(save_queue, settings_buffer, &perf_stats, &frame_pool));
+    threads.push_back(createGuiderThread(image_rings[guide_camera], settings_buffers[guide_camera], mount, &perf_stats));
+    threads.push_back(createSolverThread(image_ring, settings_buffer, mount, &perf_stats));
+    threads.push_back(createFocusThread(image_ring, settings_buffer, &perf_stats));
+    threads.push_back(createMenuThread(settings_buffers, imaging_camera, guide_camera, mount, &perf_stats));
 
     /** run the threads one of them stops all of them. **/
     agm::Thread::runAll(threads, containers);
 
+    delete mount;
+    for (auto buffer : settings_buffers) {
+        delete buffer;
+    }
+
     return 0;
 }
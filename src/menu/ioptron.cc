@@ -107,13 +107,13 @@ side for the calibration object. This command is ignored if slewing is in progre
 should be used for initial calibration. It should not be used after the mount has been tracking unless
 it is known that it has not tracked across the meridian.
 
-:Sr HH:MM:SS# 1
+:SrXXXXXXXX# 1
 Defines the commanded Right Ascension, RA. Move, calibrate and park commands operate on the
-most recently defined RA.
+most recently defined RA. XXXXXXXX is in milliseconds.
 
-:Sd sDD*MM:SS# 1
+:SdsTTTTTTTT# 1
 Defines the commanded Declination, DEC. Move, calibrate and park commands operate on the most
-recently defined DEC.
+recently defined DEC. sTTTTTTTT is in 0.01 arc seconds.
 
 :FW1# YYMMDDYYMMDD# hand controller's firmware date.
 
@@ -125,8 +125,11 @@ recently defined DEC.
 
 **/
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 
 #include <aggiornamento/aggiornamento.h>
@@ -135,90 +138,94 @@ recently defined DEC.
 #include "ioptron.h"
 
 namespace {
-class ArcSeconds {
-public:
-    ArcSeconds() noexcept = default;
-    ~ArcSeconds() noexcept = default;
+/** the status is polled once a second unless the menu changes it. **/
+const int kDefaultPollMs = 1000;
 
-    void fromLongitude(
-        std::string &s
-    ) noexcept {
-        /**
-        range is -648,000 to +648,000.
-        east is positive.
-        resolution is 1 arc-second.
-        **/
-        int angle = std::stoi(s);
-        angle_ = double(angle) / 3600.0;
-        angle = std::abs(angle);
-        secs_ = double(angle % 60);
-        angle /= 60;
-        mins_ = angle % 60;
-        degs_ = angle / 60;
-
-        /** set E/W for pretty print. **/
-        if (angle_ >= 0) {
-            east_west_ = 'E';
-        } else {
-            east_west_ = 'W';
+/**
+parse a field of a reply. an optional sign then digits.
+doesn't allocate or throw like std::stoi.
+returns false if the field isn't a number.
+**/
+bool parseNumber(
+    const std::string &reply,
+    int start,
+    int len,
+    agm::int64 &value
+) noexcept {
+    if (start < 0 || len <= 0 || start + len > int(reply.size())) {
+        return false;
+    }
+    auto ptr = reply.data() + start;
+    auto end = ptr + len;
+    bool negative = false;
+    if (*ptr == '+' || *ptr == '-') {
+        negative = (*ptr == '-');
+        ++ptr;
+    }
+    if (ptr == end) {
+        return false;
+    }
+    agm::int64 result = 0;
+    for (; ptr < end; ++ptr) {
+        int digit = *ptr - '0';
+        if (digit < 0 || digit > 9) {
+            return false;
         }
+        result = 10 * result + digit;
     }
+    value = negative ? - result : result;
+    return true;
+}
 
-    void fromLatitude(
-        std::string &s
-    ) noexcept {
-        /**
-        range is 0 to 648,000.
-        resolution is 1 arc-second.
-        value is +90 degrees.
-        **/
-        int angle = std::stoi(s);
-        angle_ = double(angle) / 3600.0;
-        angle = std::abs(angle);
-        secs_ = double(angle % 60);
-        angle /= 60;
-        mins_ = angle % 60;
-        degs_ = angle / 60;
-
-        /** remove bias. **/
-        angle_ -= 90.0;
-        degs_ -= 90;
+/** a digit of the :GLS# reply. -1 if it's not a digit. **/
+int getDigit(
+    const std::string &reply,
+    int index
+) noexcept {
+    int digit = reply[index] - '0';
+    if (digit < 0 || digit > 9) {
+        return -1;
     }
+    return digit;
+}
 
-    void fromDeclination(
-        std::string &s
+/** the same clock as the image ring timestamps. **/
+agm::int64 getUtcMicroseconds() noexcept {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+class ArcSeconds {
+public:
+    ArcSeconds() noexcept = default;
+    ~ArcSeconds() noexcept = default;
+
+    /** also hours. **/
+    void fromDegrees(
+        double angle
     ) noexcept {
-        /**
-        range is -32,400,000 to +32,400,000.
-        resolution is 0.01 arc-second.
-        **/
-        int angle = std::stoi(s);
-        angle_ = double(angle) / 360000.0;
-        angle = std::abs(angle);
-        secs_ = double(angle % 6000) / 100.0;
-        angle /= 6000;
-        mins_ = angle % 60;
-        degs_ = angle / 60;
-
-        if (angle_ < 0.0) {
+        angle_ = angle;
+        double a = std::abs(angle);
+        degs_ = int(a);
+        a = (a - degs_) * 60.0;
+        mins_ = int(a);
+        secs_ = (a - mins_) * 60.0;
+        if (angle < 0.0) {
             degs_ = - degs_;
         }
     }
 
-    void fromRightAscension(
-        std::string &s
+    /** set E/W for pretty print. **/
+    void fromLongitude(
+        double angle
     ) noexcept {
-        /**
-        range is 0 to +86,400,000.
-        resolution is 0.001 milli-second.
-        **/
-        int angle = std::stoi(s);
-        angle_ = double(angle) / 3600000.0;
-        angle = std::abs(angle);
-        secs_ = double(angle % 60000) / 1000.0;
-        angle /= 60000;
-        mins_ = angle % 60;
-        degs_ = angle / 60;
+        fromDegrees(std::abs(angle));
+        angle_ = angle;
+        if (angle >= 0.0) {
+            east_west_ = 'E';
+        } else {
+            east_west_ = 'W';
+        }
     }
 
     std::string toString() noexcept {
@@ -237,228 +244,217 @@ public:
     char east_west_ = 0;
 };
 
+const char *getGpsName(
+    int gps
+) noexcept {
+    switch (gps) {
+    case 0: return "none";
+    case 1: return "no data";
+    case 2: return "yes";
+    default: return "unknown";
+    }
+}
+
+const char *getSystemName(
+    int system
+) noexcept {
+    switch (system) {
+    case 0: return "stopped at non-zero position.";
+    case 1: return "tracking with PEC disabled.";
+    case 2: return "slewing.";
+    case 3: return "auto-guiding.";
+    case 4: return "meridian flipping.";
+    case 5: return "tracking with PEC enabled.";
+    case 6: return "parked.";
+    case 7: return "stopped at zero position.";
+    default: return "unknown";
+    }
+}
+
+const char *getTrackingRateName(
+    int rate
+) noexcept {
+    switch (rate) {
+    case 0: return "sidereal.";
+    case 1: return "lunar.";
+    case 2: return "solar.";
+    case 3: return "king.";
+    case 4: return "custom.";
+    default: return "unknown";
+    }
+}
+
+const char *getTimeSourceName(
+    int source
+) noexcept {
+    switch (source) {
+    case 1: return "RS-232 or Ethernet port.";
+    case 2: return "Hand controller.";
+    case 3: return "GPS.";
+    default: return "unknown";
+    }
+}
+
 class IoptronImpl : public Ioptron {
 public:
     IoptronImpl() noexcept = default;
-    virtual ~IoptronImpl() noexcept = default;
+    virtual ~IoptronImpl() noexcept {
+        delete io_;
+    }
+
+    MountIo *io_ = nullptr;
+    /** the guider thread checks this before guiding. **/
+    std::atomic<bool> is_connected_{false};
+
+    /** the latest polled status. any thread reads it. **/
+    MountStatusCache status_cache_;
+    std::atomic<int> poll_interval_ms_{kDefaultPollMs};
+    /** a poll is queued or in flight. **/
+    std::atomic<bool> polling_{false};
+    /** the poll in progress. only the io thread touches these. **/
+    MountStatus polled_;
+    bool poll_failed_ = false;
 
-    SerialConnection port_;
-    bool is_connected_ = false;
+    /** the pending stop of a timed move for each axis. **/
+    std::mutex move_mutex_;
+    int stop_ra_timer_ = 0;
+    int stop_dec_timer_ = 0;
 
     bool connect() noexcept {
-        /** open the serial port. **/
-        is_connected_ = port_.open();
-        if (is_connected_ == false) {
+        /** open the serial port and start the io thread. **/
+        if (io_ == nullptr) {
+            io_ = MountIo::create();
+        }
+        bool connected = io_->open();
+        if (connected == false) {
             LOG("Serial cable is not connected.");
             return false;
         }
 
-        /** required initialize. **/
-        port_.write(":MountInfo#");
-        auto response = port_.read(-1);
+        /** required initialize. the reply has no '#'. **/
+        auto response = io_->request(":MountInfo#", 4).get();
         if (response.empty()) {
             response = "MOUNT NOT CONNECTED";
-            is_connected_ = false;
+            connected = false;
         } else if (response == "0011") {
             response = "IOptron SmartEQ Pro+";
         }
         LOG("IOptron Mount type [:MountInfo#]: "<<response);
 
         /** bail if connection failed. **/
-        if (is_connected_ == false) {
+        if (connected == false) {
             LOG("IOptron mount is not powered or the cable is not connected to the handset.");
+            io_->close();
             return false;
         }
+        is_connected_ = true;
 
-        port_.write(":RT0#");
-        response = port_.read(1);
-        LOG("IOptron Set sidereal tracking rate [:RT0#]: "<<response);
-
-    #if 0
-        port_.write(":Q#");
-        response = port_.read(1);
-        LOG("IOptron Slewing stopped: "<<response);
+        io_->send(":RT0#", 1, [](bool ok, const std::string &reply) {
+            (void) ok;
+            LOG("IOptron Set sidereal tracking rate [:RT0#]: "<<reply);
+        });
 
-        port_.write(":q#");
-        response = port_.read(1);
-        LOG("IOptron Stopped moving by arrow keys: "<<response);
-
-        port_.write(":ST1#");
-        response = port_.read(1);
-        LOG("IOptron Started tracking [:ST1#]: "<<response);
-
-        agm::sleep::seconds(2);
-
-        port_.write(":mn#");
-        LOG("IOptron Moving north...");
-        port_.write(":me#");
-        LOG("IOptron Moving east...");
-
-        agm::sleep::seconds(2);
-        port_.write(":q#");
-        response = port_.read(1);
-        LOG("IOptron Stopped: "<<response);
-
-        agm::sleep::seconds(2);
-        port_.write(":ST0#");
-        response = port_.read(1);
-        LOG("IOptron Stop tracking [:ST0#]: "<<response);
+        startPolling();
+        return true;
+    }
 
-        agm::sleep::seconds(2);
-        port_.write(":MH#");
-        response = port_.read(1);
-        LOG("IOptron Slew to home position [:MH#]: "<<response);
-    #endif
+    /** log the result of a command that replies 1 or 0. **/
+    void sendAndLog(
+        const char *cmd
+    ) noexcept {
+        io_->send(cmd, 1, [](bool ok, const std::string &reply) {
+            if (ok) {
+                LOG("result: "<<reply);
+            } else {
+                LOG("result: no reply");
+            }
+        });
+    }
 
+    /** returns false if the reply failed or is too short to parse. **/
+    static bool checkReply(
+        const char *cmd,
+        bool ok,
+        const std::string &reply,
+        int len
+    ) noexcept {
+        if (ok == false || int(reply.size()) < len) {
+            LOG("IOptron Bad reply ["<<cmd<<"]: "<<reply);
+            return false;
+        }
         return true;
     }
 
+    /**
+    log the polled status. it's never older than the poll interval.
+    the time and the altitude limit aren't polled.
+    they're queried now. the replies are logged as they arrive.
+    the menu thread doesn't wait.
+    **/
     void showStatus() noexcept {
         if (is_connected_ == false) {
             LOG("Ioptron mount is not connected.");
             return;
         }
 
-        port_.write(":GLS#");
-        auto response = port_.read(0);
-        showInfo(response);
-
-        port_.write(":GLT#");
-        response = port_.read(0);
-        showTime(response);
-
-        port_.write(":GEC#");
-        response = port_.read(0);
-        showRightAscensionDeclination(response);
-
-        port_.write(":GAC#");
-        response = port_.read(0);
-        showAltitudeAzimuth(response);
+        MountStatus status;
+        bool valid = status_cache_.load(status);
+        if (valid) {
+            logStatus(status);
+        } else {
+            LOG("IOptron Status: not polled yet.");
+        }
 
-        port_.write(":GAL#");
-        response = port_.read(0);
-        auto s = response.substr(0, 3);
-        int limit = std::stoi(s);
-        LOG("IOptron Get altitude limit [:GAL#]: "<<limit);
+        io_->send(":GLT#", MountIo::kHashReply, [this](bool ok, const std::string &reply) {
+            if (checkReply(":GLT#", ok, reply, 17)) {
+                showTime(reply);
+            }
+        });
+
+        io_->send(":GAL#", MountIo::kHashReply, [](bool ok, const std::string &reply) {
+            agm::int64 limit = 0;
+            if (checkReply(":GAL#", ok, reply, 3) && parseNumber(reply, 0, 3, limit)) {
+                LOG("IOptron Get altitude limit [:GAL#]: "<<limit);
+            }
+        });
     }
 
-    void showInfo(
-        std::string &response
+    void logStatus(
+        const MountStatus &status
     ) noexcept {
-        ArcSeconds lat;
-        ArcSeconds lng;
-
-        auto s = response.substr(7, 6);
-        lat.fromLatitude(s);
-        s = lat.toString();
-        LOG("IOptron Status Latitude: "<<s);
-
-        s = response.substr(0, 7);
-        lng.fromLongitude(s);
-        s = lng.toString();
-        LOG("IOptron Status Longitude: "<<s);
-
-        switch (response[13]) {
-        case '0':
-            LOG("IOptron Status GPS: none");
-            break;
-        case '1':
-            LOG("IOptron Status GPS: no data");
-            break;
-        case '2':
-            LOG("IOptron Status GPS: yes");
-            break;
-        default:
-            LOG("IOptron Status GPS: unknown '"<<response[13]<<"'");
-            break;
-        }
-
-        switch (response[14]) {
-        case '0':
-            LOG("IOptron Status System: stopped at non-zero position.");
-            break;
-        case '1':
-            LOG("IOptron Status System: tracking with PEC disabled.");
-            break;
-        case '2':
-            LOG("IOptron Status System: slewing.");
-            break;
-        case '3':
-            LOG("IOptron Status System: auto-guiding.");
-            break;
-        case '4':
-            LOG("IOptron Status System: meridian flipping.");
-            break;
-        case '5':
-            LOG("IOptron Status System: tracking with PEC enabled.");
-            break;
-        case '6':
-            LOG("IOptron Status System: parked.");
-            break;
-        case '7':
-            LOG("IOptron Status System: stopped at zero position.");
-            break;
-        default:
-            LOG("IOptron Status System: unknown '"<<response[14]<<"'");
-            break;
-        }
-
-        switch (response[15]) {
-        case '0':
-            LOG("IOptron Status Tracking rate: sidereal.");
-            break;
-        case '1':
-            LOG("IOptron Status Tracking rate: lunar.");
-            break;
-        case '2':
-            LOG("IOptron Status Tracking rate: solar.");
-            break;
-        case '3':
-            LOG("IOptron Status Tracking rate: king.");
-            break;
-        case '4':
-            LOG("IOptron Status Tracking rate: custom.");
-            break;
-        default:
-            LOG("IOptron Status Tracking rate: unknown '"<<response[15]<<"'");
-            break;
-        }
-
-        LOG("IOptron Status Arrow key slewing rate: "<<response[16]);
-
-        switch (response[17]) {
-        case '1':
-            LOG("IOptron Status Time source: RS-232 or Ethernet port.");
-            break;
-        case '2':
-            LOG("IOptron Status Time source: Hand controller.");
-            break;
-        case '3':
-            LOG("IOptron Status Time source: GPS.");
-            break;
-        default:
-            LOG("IOptron Status Time source: unknown '"<<response[17]<<"'");
-            break;
-        }
+        auto age_ms = (getUtcMicroseconds() - status.timestamp_) / 1000;
+        LOG("IOptron Status polled "<<age_ms<<" ms ago.");
+
+        ArcSeconds angle;
+        angle.fromDegrees(status.latitude_);
+        LOG("IOptron Status Latitude: "<<angle.toString());
+        angle.fromLongitude(status.longitude_);
+        LOG("IOptron Status Longitude: "<<angle.toString());
+
+        LOG("IOptron Status GPS: "<<getGpsName(status.gps_));
+        LOG("IOptron Status System: "<<getSystemName(status.system_));
+        LOG("IOptron Status Tracking rate: "<<getTrackingRateName(status.tracking_rate_));
+        LOG("IOptron Status Arrow key slewing rate: "<<status.slewing_rate_);
+        LOG("IOptron Status Time source: "<<getTimeSourceName(status.time_source_));
+        LOG("IOptron Status Hemisphere: "<<(status.northern_ ? "northern" : "southern"));
 
-        switch (response[18]) {
-        case '0':
-            LOG("IOptron Status Hemisphere: southern");
-            break;
-        case '1':
-            LOG("IOptron Status Hemisphere: northern");
-            break;
-        default:
-            LOG("IOptron Status Time source: unknown '"<<response[18]<<"'");
-            break;
-        }
+        ArcSeconds ra;
+        ra.fromDegrees(status.ra_ / 15.0);
+        LOG("IOptron Status Right Ascension: "<<ra.toString());
+        angle.fromDegrees(status.dec_);
+        LOG("IOptron Status Declination: "<<angle.toString());
+        angle.fromDegrees(status.altitude_);
+        LOG("IOptron Status Altitude: "<<angle.toString());
+        angle.fromDegrees(status.azimuth_);
+        LOG("IOptron Status Azimuth: "<<angle.toString());
     }
 
     void showTime(
-        std::string &response
+        const std::string &response
     ) noexcept {
-        auto s = response.substr(0, 4);
-        auto utc = std::stof(s) / 60.0;
+        agm::int64 minutes = 0;
+        parseNumber(response, 0, 4, minutes);
+        auto utc = double(minutes) / 60.0;
         std::stringstream ss;
         /** YYYY/MM/DD **/
         ss<<"20"<<response[5]<<response[6];
@@ -478,38 +474,164 @@ public:
         LOG("IOptron Time: "<<ss.str());
     }
 
-    void showRightAscensionDeclination(
-        std::string &response
+    /** returns false if the mount isn't polled. **/
+    bool getStatus(
+        MountStatus &status
     ) noexcept {
-        ArcSeconds ra;
-        ArcSeconds dec;
+        if (is_connected_ == false) {
+            return false;
+        }
+        return status_cache_.load(status);
+    }
 
-        auto s = response.substr(9, 8);
-        ra.fromRightAscension(s);
-        s = ra.toString();
-        LOG("IOptron Status Right Ascension: "<<s);
+    void setPollInterval(
+        int interval_ms
+    ) noexcept {
+        interval_ms = std::max(0, interval_ms);
+        poll_interval_ms_ = interval_ms;
+        if (interval_ms > 0) {
+            LOG("IOptron polling the status every "<<interval_ms<<" ms.");
+            startPolling();
+        } else {
+            LOG("IOptron stopped polling the status.");
+        }
+    }
 
-        s = response.substr(0, 9);
-        dec.fromDeclination(s);
-        s = dec.toString();
-        LOG("IOptron Status Declination: "<<s);
+    /** start polling unless it's stopped or already running. **/
+    void startPolling() noexcept {
+        if (is_connected_ == false || poll_interval_ms_ <= 0) {
+            return;
+        }
+        if (polling_.exchange(true)) {
+            return;
+        }
+        queuePoll(0);
     }
 
-    void showAltitudeAzimuth(
-        std::string &response
+    /**
+    the status queries are queued together.
+    so they're pipelined. the mount answers them back to back.
+    the replies are parsed on the io thread as they arrive.
+    the last one publishes the status and queues the next poll.
+    **/
+    void queuePoll(
+        int delay_ms
     ) noexcept {
-        ArcSeconds alt;
-        ArcSeconds az;
+        io_->sendAfter(delay_ms, ":GLS#", MountIo::kHashReply, [this](bool ok, const std::string &reply) {
+            if (pollReply(":GLS#", ok, reply, 19)) {
+                parseInfo(reply);
+            }
+        });
+        io_->sendAfter(delay_ms, ":GEC#", MountIo::kHashReply, [this](bool ok, const std::string &reply) {
+            if (pollReply(":GEC#", ok, reply, 17)) {
+                parseRightAscensionDeclination(reply);
+            }
+        });
+        io_->sendAfter(delay_ms, ":GAC#", MountIo::kHashReply, [this](bool ok, const std::string &reply) {
+            if (pollReply(":GAC#", ok, reply, 18)) {
+                parseAltitudeAzimuth(reply);
+            }
+            finishPoll();
+        });
+    }
 
-        auto s = response.substr(9, 9);
-        alt.fromRightAscension(s);
-        s = alt.toString();
-        LOG("IOptron Status Altitude: "<<s);
+    /** a bad reply spoils the poll. don't log the failures of a disconnect. **/
+    bool pollReply(
+        const char *cmd,
+        bool ok,
+        const std::string &reply,
+        int len
+    ) noexcept {
+        if (ok == false && is_connected_ == false) {
+            poll_failed_ = true;
+            return false;
+        }
+        if (checkReply(cmd, ok, reply, len) == false) {
+            poll_failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    void finishPoll() noexcept {
+        if (poll_failed_ == false) {
+            polled_.valid_ = true;
+            polled_.timestamp_ = getUtcMicroseconds();
+            status_cache_.store(polled_);
+        }
+        poll_failed_ = false;
+
+        int interval_ms = poll_interval_ms_;
+        if (is_connected_ == false || interval_ms <= 0) {
+            polling_ = false;
+            return;
+        }
+        queuePoll(interval_ms);
+    }
+
+    /**
+    sLLLLLLTTTTTTgstrch
+    longitude in arc seconds. latitude in arc seconds + 90 degrees.
+    then the gps, system, tracking rate, slewing rate, time source, and hemisphere digits.
+    **/
+    void parseInfo(
+        const std::string &reply
+    ) noexcept {
+        agm::int64 longitude = 0;
+        agm::int64 latitude = 0;
+        if (parseNumber(reply, 0, 7, longitude) == false
+        ||  parseNumber(reply, 7, 6, latitude) == false) {
+            LOG("IOptron Bad reply [:GLS#]: "<<reply);
+            poll_failed_ = true;
+            return;
+        }
+        polled_.longitude_ = double(longitude) / 3600.0;
+        polled_.latitude_ = double(latitude) / 3600.0 - 90.0;
+        polled_.gps_ = getDigit(reply, 13);
+        polled_.system_ = getDigit(reply, 14);
+        polled_.tracking_rate_ = getDigit(reply, 15);
+        polled_.slewing_rate_ = getDigit(reply, 16);
+        polled_.time_source_ = getDigit(reply, 17);
+        polled_.northern_ = (reply[18] != '0');
+    }
+
+    /**
+    sDDDDDDDDRRRRRRRR
+    declination in 0.01 arc seconds.
+    right ascension in milliseconds.
+    **/
+    void parseRightAscensionDeclination(
+        const std::string &reply
+    ) noexcept {
+        agm::int64 dec = 0;
+        agm::int64 ra = 0;
+        if (parseNumber(reply, 0, 9, dec) == false
+        ||  parseNumber(reply, 9, 8, ra) == false) {
+            LOG("IOptron Bad reply [:GEC#]: "<<reply);
+            poll_failed_ = true;
+            return;
+        }
+        polled_.dec_ = double(dec) / 360000.0;
+        polled_.ra_ = double(ra) / 3600000.0 * 15.0;
+    }
 
-        s = response.substr(0, 9);
-        az.fromRightAscension(s);
-        s = az.toString();
-        LOG("IOptron Status Azimuth: "<<s);
+    /**
+    sTTTTTTTTZZZZZZZZZ
+    altitude then azimuth in 0.01 arc seconds.
+    **/
+    void parseAltitudeAzimuth(
+        const std::string &reply
+    ) noexcept {
+        agm::int64 alt = 0;
+        agm::int64 az = 0;
+        if (parseNumber(reply, 0, 9, alt) == false
+        ||  parseNumber(reply, 9, 9, az) == false) {
+            LOG("IOptron Bad reply [:GAC#]: "<<reply);
+            poll_failed_ = true;
+            return;
+        }
+        polled_.altitude_ = double(alt) / 360000.0;
+        polled_.azimuth_ = double(az) / 360000.0;
     }
 
     void slewToHomePosition() noexcept {
@@ -519,9 +641,7 @@ public:
         }
 
         LOG("slewing to home (zero) position...");
-        port_.write(":MH#");
-        auto response = port_.read(1);
-        LOG("result: "<<response);
+        sendAndLog(":MH#");
     }
 
     void setZeroPosition() noexcept {
@@ -531,9 +651,7 @@ public:
         }
 
         LOG("setting zero (home) position...");
-        port_.write(":SZP#");
-        auto response = port_.read(1);
-        LOG("result: "<<response);
+        sendAndLog(":SZP#");
     }
 
     void setSlewingRate(
@@ -551,9 +669,7 @@ public:
         LOG("setting slewing rate to "<<rate<<"...");
         std::stringstream ss;
         ss<<":SR"<<rate<<"#";
-        port_.write(ss.str().c_str());
-        auto response = port_.read(1);
-        LOG("result: "<<response);
+        sendAndLog(ss.str().c_str());
     }
 
     void move(
@@ -595,19 +711,152 @@ public:
         duration = std::min(duration, float(99999.0));
 
         LOG("slewing "<<sdir<<" for "<<duration<<" milliseconds...");
+
+        /**
+        start moving now and stop later.
+        stop only this axis so ra and dec moves may overlap.
+        a new move on an axis replaces the pending stop.
+        **/
+        bool is_dec = (direction == 'n' || direction == 's');
+        const char *stop_cmd = is_dec ? ":qD#" : ":qR#";
         std::stringstream ss;
         ss<<":m"<<char(direction)<<"#";
-        port_.write(ss.str().c_str());
 
-        agm::sleep::milliseconds(duration);
+        std::lock_guard<std::mutex> lock(move_mutex_);
+        int &stop_timer = is_dec ? stop_dec_timer_ : stop_ra_timer_;
+        if (stop_timer) {
+            io_->cancelTimer(stop_timer);
+        }
+        io_->send(ss.str().c_str(), MountIo::kNoReply, nullptr, true);
+        stop_timer = io_->sendAfter(int(duration), stop_cmd, 1,
+            [](bool ok, const std::string &reply) {
+                if (ok) {
+                    LOG("result: "<<reply);
+                } else {
+                    LOG("result: no reply");
+                }
+            }, true);
+    }
+
+    void setGuideRate(
+        int percent
+    ) noexcept {
+        if (is_connected_ == false) {
+            LOG("Ioptron mount is not connected.");
+            return;
+        }
+        if (percent < 10 || percent > 80) {
+            LOG("Guide rate must be 10 to 80 percent of sidereal.");
+            return;
+        }
+
+        LOG("setting guide rate to "<<percent<<"% of sidereal...");
+        std::stringstream ss;
+        ss<<":RG"<<std::setfill('0')<<std::setw(3)<<percent<<"#";
+        sendAndLog(ss.str().c_str());
+    }
 
-        port_.write(":q#");
-        auto response = port_.read(1);
-        LOG("result: "<<response);
+    /**
+    the mount times guide pulses itself.
+    so there's no stop command to schedule.
+    the pulses are urgent so they don't wait behind status queries.
+    **/
+    void pulseGuide(
+        int direction,
+        int duration_ms
+    ) noexcept {
+        if (is_connected_ == false) {
+            return;
+        }
+        direction = std::tolower(direction);
+        if (direction != 'n' && direction != 's' && direction != 'e' && direction != 'w') {
+            LOG("guide direction must be n,s,e,w.");
+            return;
+        }
+        if (duration_ms <= 0) {
+            return;
+        }
+        duration_ms = std::min(duration_ms, 32767);
+
+        std::stringstream ss;
+        ss<<":M"<<char(direction)<<std::setfill('0')<<std::setw(5)<<duration_ms<<"#";
+        io_->send(ss.str().c_str(), MountIo::kNoReply, nullptr, true);
+    }
+
+    /**
+    set the commanded ra and dec then calibrate the mount to them.
+    each command is sent when the mount accepted the one before.
+    so the sync never uses stale coordinates.
+    **/
+    void sync(
+        double ra,
+        double dec
+    ) noexcept {
+        if (is_connected_ == false) {
+            LOG("Ioptron mount is not connected.");
+            return;
+        }
+
+        /** ra in milliseconds. dec in 0.01 arc seconds. **/
+        ra = std::fmod(ra, 360.0);
+        if (ra < 0.0) {
+            ra += 360.0;
+        }
+        const agm::int64 kRaUnits = agm::int64(24) * 3600 * 1000;
+        const agm::int64 kMaxDecUnits = agm::int64(90) * 360000;
+        agm::int64 ra_ms = agm::int64(std::llround(ra * 240.0 * 1000.0)) % kRaUnits;
+        agm::int64 dec_units = agm::int64(std::llround(std::abs(dec) * 360000.0));
+        dec_units = std::min(dec_units, kMaxDecUnits);
+
+        std::stringstream ss_ra;
+        ss_ra<<":Sr"<<std::setfill('0')<<std::setw(8)<<ra_ms<<"#";
+        std::stringstream ss_dec;
+        ss_dec<<":Sd"<<(dec < 0.0 ? '-' : '+')<<std::setfill('0')<<std::setw(8)<<dec_units<<"#";
+        std::string ra_cmd = ss_ra.str();
+        std::string dec_cmd = ss_dec.str();
+
+        LOG("syncing mount to ra "<<ra_cmd<<" dec "<<dec_cmd<<"...");
+        io_->send(ra_cmd.c_str(), 1, [this, ra_cmd, dec_cmd](bool ok, const std::string &reply) {
+            if (isAccepted(ra_cmd.c_str(), ok, reply) == false) {
+                return;
+            }
+            io_->send(dec_cmd.c_str(), 1, [this, dec_cmd](bool ok, const std::string &reply) {
+                if (isAccepted(dec_cmd.c_str(), ok, reply) == false) {
+                    return;
+                }
+                io_->send(":CM#", 1, [](bool ok, const std::string &reply) {
+                    if (isAccepted(":CM#", ok, reply)) {
+                        LOG("IOptron synced the mount.");
+                    }
+                });
+            });
+        });
     }
 
+    /** the set and sync commands reply 1 if the mount accepted them. **/
+    static bool isAccepted(
+        const char *cmd,
+        bool ok,
+        const std::string &reply
+    ) noexcept {
+        if (ok == false || reply != "1") {
+            LOG("IOptron Rejected ["<<cmd<<"]: "<<(ok ? reply : "no reply")<<". sync canceled.");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+    other threads may still be sending.
+    the io object fails their commands once it's closed.
+    **/
     void disconnect() noexcept {
-        port_.close();
+        is_connected_ = false;
+        if (io_) {
+            io_->close();
+        }
+        /** the io thread is gone. so this thread is the only writer. **/
+        status_cache_.store(MountStatus());
     }
 };
 }
@@ -639,6 +888,20 @@ void Ioptron::showStatus() noexcept {
     impl->showStatus();
 }
 
+bool Ioptron::getStatus(
+    MountStatus &status
+) noexcept {
+    auto impl = (IoptronImpl *) this;
+    return impl->getStatus(status);
+}
+
+void Ioptron::setPollInterval(
+    int interval_ms
+) noexcept {
+    auto impl = (IoptronImpl *) this;
+    impl->setPollInterval(interval_ms);
+}
+
 void Ioptron::slewToHomePosition() noexcept {
     auto impl = (IoptronImpl *) this;
     impl->slewToHomePosition();
@@ -664,6 +927,29 @@ void Ioptron::move(
     impl->move(direction, duration);
 }
 
+void Ioptron::setGuideRate(
+    int percent
+) noexcept {
+    auto impl = (IoptronImpl *) this;
+    impl->setGuideRate(percent);
+}
+
+void Ioptron::pulseGuide(
+    int direction,
+    int duration_ms
+) noexcept {
+    auto impl = (IoptronImpl *) this;
+    impl->pulseGuide(direction, duration_ms);
+}
+
+void Ioptron::sync(
+    double ra,
+    double dec
+) noexcept {
+    auto impl = (IoptronImpl *) this;
+    impl->sync(ra, dec);
+}
+
 void Ioptron::disconnect() noexcept {
     auto impl = (IoptronImpl *) this;
     impl->disconnect();
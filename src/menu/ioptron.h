@@ -6,9 +6,11 @@ Copyright (C) 2012-2024 tim cotter. All rights reserved.
 drive the ioptron smarteq pro(+) mount.
 **/
 
+#include <atomic>
 #include <cstring>
 
-#include "serial.h"
+#include "mount_io.h"
+#include "mount_status.h"
 
 
 class Ioptron {
@@ -24,9 +26,19 @@ public:
 
     bool isConnected() noexcept;
 
-    /** dump a bunch of mount status. **/
+    /** log the polled status. the replies to the rest are logged as they arrive. **/
     void showStatus() noexcept;
 
+    /**
+    the latest polled status.
+    returns false if the mount isn't connected or hasn't been polled yet.
+    never waits. safe to call from any thread.
+    **/
+    bool getStatus(MountStatus &status) noexcept;
+
+    /** poll the status every so many milliseconds. 0 stops polling. **/
+    void setPollInterval(int interval_ms) noexcept;
+
     /** slew to the currently set home/zero position. **/
     void slewToHomePosition() noexcept;
 
@@ -36,8 +48,27 @@ public:
     /** rate is 1 to 9 **/
     void setSlewingRate(int rate) noexcept;
 
-    /** move the mount n,s,e,w for the specified number of milliseconds. **/
+    /**
+    move the mount n,s,e,w for the specified number of milliseconds.
+    returns immediately. the mount io thread stops the move.
+    **/
     void move(int direction, float duration) noexcept;
 
+    /** guide rate is 10 to 80 percent of the sidereal rate. **/
+    void setGuideRate(int percent) noexcept;
+
+    /**
+    guide the mount n,s,e,w for 0 to 32767 milliseconds at the guide rate.
+    the mount times the pulse.
+    returns immediately. safe to call from any thread.
+    **/
+    void pulseGuide(int direction, int duration_ms) noexcept;
+
+    /**
+    tell the mount it's pointing at ra and dec in degrees of date.
+    returns immediately. safe to call from any thread.
+    **/
+    void sync(double ra, double dec) noexcept;
+
     void disconnect() noexcept;
 };
@@ -6,9 +6,12 @@ Copyright (C) 2012-2024 tim cotter. All rights reserved.
 run the menu thread.
 **/
 
+#include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <iomanip>
 #include <sstream>
+#include <vector>
 
 #include <aggiornamento/aggiornamento.h>
 #include <aggiornamento/log.h>
@@ -16,32 +19,57 @@ run the menu thread.
 #include <aggiornamento/master.h>
 #include <aggiornamento/thread.h>
 
+#include <shared/perf_stats.h>
 #include <shared/settings_buffer.h>
 
 #include "ioptron.h"
 
 
 namespace {
+
+/** log the menu's answers. and send them back to the remote client that asked. **/
+#define REPLY(x) do { std::stringstream reply_ss; reply_ss<<x; reply(reply_ss.str()); } while (0)
+
 class MenuThread : public agm::Thread {
 public:
     agm::NonBlockingInput nbi_;
+    /** the imaging camera. the window, saver, and solver use its settings. **/
     SettingsBuffer *settings_ = nullptr;
+    /** every camera has its own capture settings. **/
+    std::vector<SettingsBuffer *> cameras_;
+    /** the camera the capture commands change. **/
+    SettingsBuffer *camera_ = nullptr;
+    int camera_number_ = 0;
+    /** the camera the guider uses. **/
+    SettingsBuffer *guide_settings_ = nullptr;
     std::string input_;
+    /** the remote client whose input we're handling. or -1 for the console. **/
+    int reply_client_ = -1;
+    std::string reply_;
+    /** shared with the guider thread. **/
     Ioptron *mount_ = nullptr;
+    PerfStats *perf_stats_ = nullptr;
 
     MenuThread(
-        SettingsBuffer *settings_buffer
+        const std::vector<SettingsBuffer *> &settings_buffers,
+        int imaging_camera,
+        int guide_camera,
+        Ioptron *mount,
+        PerfStats *perf_stats
     ) noexcept : agm::Thread("MenuThread") {
-        settings_ = settings_buffer;
+        cameras_ = settings_buffers;
+        settings_ = cameras_[imaging_camera];
+        camera_ = settings_;
+        camera_number_ = imaging_camera;
+        guide_settings_ = cameras_[guide_camera];
+        mount_ = mount;
+        perf_stats_ = perf_stats;
     }
 
-    virtual ~MenuThread() noexcept {
-        delete mount_;
-    }
+    virtual ~MenuThread() = default;
 
     virtual void begin() noexcept {
         LOG("MenuThread");
-        mount_ = Ioptron::create();
         mount_->connect();
     }
 
@@ -49,21 +77,52 @@ public:
     virtual void runOnce() noexcept {
         input_ = nbi_.get();
         parse_input();
+
+        /** then the lines sent by remote clients. **/
+        MenuCommand cmd;
+        while (settings_->menu_commands_.pop(cmd)) {
+            LOG("MenuThread Remote input: "<<cmd.name_);
+            input_ = cmd.name_;
+            reply_client_ = cmd.client_;
+            reply_.clear();
+            parse_input();
+            if (reply_.size()) {
+                MenuCommand answer;
+                answer.type_ = MenuCommand::Type::kMenuReply;
+                answer.name_ = std::move(reply_);
+                answer.client_ = reply_client_;
+                settings_->menu_replies_.push(std::move(answer));
+            }
+            reply_client_ = -1;
+        }
         agm::sleep::milliseconds(100);
     }
 
     virtual void end() noexcept {
         mount_->disconnect();
-        delete mount_;
-        mount_ = nullptr;
         LOG("MenuThread disconnected the mount.");
     }
 
+    /** the whole answer goes back in one message. **/
+    void reply(
+        const std::string &text
+    ) noexcept {
+        LOG(text);
+        if (reply_client_ >= 0) {
+            reply_ += text;
+            reply_ += '\n';
+        }
+    }
+
     void parse_input() noexcept {
         if (input_.size() == 0) {
             return;
         }
         int ch = std::tolower(input_[0]);
+        if (std::isdigit(ch)) {
+            selectCamera(ch - '0');
+            return;
+        }
         switch (ch) {
         case 'a':
             toggleAccumulate();
@@ -77,6 +136,10 @@ public:
             setColorBalance();
             break;
 
+        case 'd':
+            handleCalibration();
+            break;
+
         case 'e':
             toggleAutoExposure();
             break;
@@ -97,14 +160,34 @@ public:
             toggleIso();
             break;
 
+        case 'j':
+            setStackMode();
+            break;
+
         case 'k':
             toggleCircles();
             break;
 
+        case 'l':
+            toggleAlignStack();
+            break;
+
         case 'm':
             handleMount();
             break;
 
+        case 'n':
+            setBinning();
+            break;
+
+        case 'o':
+            setCaptureRoi();
+            break;
+
+        case 'p':
+            toggleFusedPipeline();
+            break;
+
         case 'q':
         case 27: /*escape*/
             quit();
@@ -122,10 +205,30 @@ public:
             saveRaw();
             break;
 
+        case 'u':
+            setDebayerMode();
+            break;
+
+        case 'v':
+            toggleVideoMode();
+            break;
+
+        case 'w':
+            recordSequence();
+            break;
+
         case 'x':
             experiment();
             break;
 
+        case 'y':
+            handlePerf();
+            break;
+
+        case 'z':
+            setZoom();
+            break;
+
         case '?':
             showHelp();
             break;
@@ -137,45 +240,134 @@ public:
     }
 
     void showMenu() noexcept {
-        LOG("Menu (not case sensitive unless specified):");
-        LOG("  a [+-01yn]   : stack (accumulate) images: "<<settings_->accumulate_);
-        LOG("  b [+-01yn]   : toggle capture black: "<<settings_->capture_black_);
-        LOG("  c red blue   : set color balance: r="<<settings_->balance_red_<<" b="<<settings_->balance_blue_);
-        LOG("  e [+-01yn]   : toggle auto exposure: "<<settings_->auto_exposure_);
-        LOG("  e usecs      : set exposure microseconds (disables auto): "<<settings_->exposure_);
-        LOG("  f [+-01yn]   : toggle manual focus helper: "<<settings_->show_focus_);
-        LOG("  g pwr        : set gamma (1.0): "<<settings_->gamma_);
-        LOG("  h [+-01yn]   : toggle histogram: "<<settings_->show_histogram_);
-        LOG("  i [+-01yn]   : toggle auto iso linear scaling: "<<settings_->auto_iso_);
-        LOG("  i iso        : set iso linear scaling [100 none] (disables auto): "<<settings_->iso_);
-        LOG("  k [+-01yn]   : toggle collimation circles: "<<settings_->show_circles_);
-        LOG("  mi           : show mount info");
-        LOG("  mh           : slew to home (zero) position");
-        LOG("  mm [nsew] ms : slew n,s,e,w for milliseconds");
-        LOG("  mr#          : set slewing rate 1-9");
-        LOG("  mz           : slew to zero (home) position");
-        LOG("  q,esc        : quit");
-        LOG("  r [+-01yn]   : toggle fps (frame Rate): "<<settings_->show_fps_);
-        LOG("  s file       : save the image (disables stacking).");
-        LOG("  t file       : save the raw 16 bit image as tiff.");
-        LOG("  x            : run the experiment of the day");
-        LOG("  ?            : show help");
+        REPLY("Menu (not case sensitive unless specified):");
+        REPLY("  0-9          : choose the camera for e, n, o, v, w: "<<camera_number_<<" of "<<cameras_.size());
+        REPLY("  a [+-01yn]   : stack (accumulate) images: "<<settings_->accumulate_);
+        REPLY("  b [+-01yn]   : toggle capture black: "<<settings_->capture_black_);
+        REPLY("  c red blue   : set color balance: r="<<settings_->balance_red_<<" b="<<settings_->balance_blue_);
+        REPLY("  d [+-01yn]   : toggle master calibration frames: "<<settings_->calibrate_);
+        REPLY("  d kind n     : build a master bias, dark, or flat from n frames");
+        REPLY("  e [+-01yn]   : toggle auto exposure: "<<camera_->auto_exposure_);
+        REPLY("  e usecs      : set exposure microseconds (disables auto): "<<camera_->current_exposure_);
+        REPLY("  f [+-01yn]   : toggle manual focus helper: "<<settings_->show_focus_);
+        REPLY("  f stars|blur : focus on star sizes or whole image blur: "<<getFocusMetricName(settings_->focus_metric_));
+        REPLY("  g pwr        : set gamma (1.0): "<<settings_->gamma_);
+        REPLY("  h [+-01yn]   : toggle histogram: "<<settings_->show_histogram_);
+        REPLY("  i [+-01yn]   : toggle auto iso linear scaling: "<<settings_->auto_iso_);
+        REPLY("  i iso        : set iso linear scaling [100 none] (disables auto): "<<settings_->current_iso_);
+        REPLY("  j mode kappa : set stack mode sum, sigma, median: "<<getStackModeName(settings_->stack_mode_)<<" kappa="<<settings_->stack_kappa_);
+        REPLY("  k [+-01yn]   : toggle collimation circles: "<<settings_->show_circles_);
+        REPLY("  l [+-01yn]   : toggle star aligned stacking: "<<settings_->align_stack_);
+        REPLY("  mg [+-01yn]  : toggle autoguiding: "<<guide_settings_->guide_<<" "<<getLocked(guide_settings_, guide_settings_->guide_status_));
+        REPLY("  mg cal       : calibrate guiding again");
+        REPLY("  mg aggr pct  : correct this percent of the guiding error: "<<guide_settings_->guide_aggressiveness_);
+        REPLY("  mg rate pct  : set the guide rate 10-80 percent of sidereal");
+        REPLY("  mc [index]   : plate solve and sync the mount");
+        REPLY("  mi           : show mount info: "<<getMountPosition());
+        REPLY("  mi ms        : poll the mount status every ms milliseconds (0 stops)");
+        REPLY("  mh           : slew to home (zero) position");
+        REPLY("  mm [nsew] ms : slew n,s,e,w for milliseconds");
+        REPLY("  mp [index]   : polar align. solve, rotate ra, repeat 3 times");
+        REPLY("  mp reset     : restart polar alignment");
+        REPLY("  mr#          : set slewing rate 1-9");
+        REPLY("  ms [index]   : plate solve: "<<getLocked(settings_, settings_->solve_status_));
+        REPLY("  mz           : slew to zero (home) position");
+        REPLY("  n bin        : set hardware binning 1, 2, 4: "<<camera_->bin_);
+        REPLY("  o [+-01yn]   : toggle capture roi follows the display: "<<camera_->roi_follows_display_);
+        REPLY("  o wd ht      : set centered capture roi (0 0 full frame): "<<camera_->roi_width_<<" x "<<camera_->roi_height_);
+        REPLY("  p [+-01yn]   : toggle fused pipeline: "<<settings_->fused_pipeline_);
+        REPLY("  q,esc        : quit");
+        REPLY("  r [+-01yn]   : toggle fps (frame Rate): "<<settings_->show_fps_);
+        REPLY("  s file       : save the image (disables stacking).");
+        REPLY("  t file       : save the raw 16 bit image as tiff.");
+        REPLY("               : last save: "<<getLocked(settings_, settings_->save_status_));
+        REPLY("  u mode       : set debayer mode full, super, opencl: "<<getDebayerModeName(settings_->debayer_mode_));
+        REPLY("  v [+-01yn]   : toggle video capture mode (short exposures): "<<camera_->video_mode_);
+        REPLY("  w file.ser   : record raw frames to a SER file.");
+        REPLY("  w            : stop recording: "<<getLocked(camera_, camera_->record_file_name_));
+        REPLY("  x            : run the experiment of the day");
+        REPLY("  y [+-01yn]   : toggle stage times overlay: "<<settings_->show_perf_);
+        REPLY("  y log        : log stage times since the start");
+        REPLY("  y csv file   : write stage times since the start to a csv file");
+        REPLY("  z fit        : fit the image in the window");
+        REPLY("  z n [dx dy]  : magnify n times. pan dx,dy pixels from the center: "
+            <<settings_->zoom_<<" "<<settings_->pan_x_<<" "<<settings_->pan_y_);
+        REPLY("  ?            : show help");
+    }
+
+    /** from the polled status. doesn't touch the serial port. **/
+    std::string getMountPosition() noexcept {
+        MountStatus status;
+        bool valid = mount_->getStatus(status);
+        if (valid == false) {
+            return "not connected";
+        }
+        std::stringstream ss;
+        ss<<std::fixed<<std::setprecision(3);
+        ss<<"ra="<<status.ra_<<" dec="<<status.dec_<<" alt="<<status.altitude_<<" az="<<status.azimuth_;
+        return ss.str();
+    }
+
+    /** other threads write these strings. copy them with the lock held. **/
+    std::string getLocked(
+        SettingsBuffer *buffer,
+        const std::string &value
+    ) noexcept {
+        std::lock_guard<std::mutex> lock(buffer->mutex_);
+        return value;
+    }
+
+    void selectCamera(
+        int number
+    ) noexcept {
+        if (number >= int(cameras_.size())) {
+            REPLY("MenuThread There are only "<<cameras_.size()<<" cameras.");
+            return;
+        }
+        camera_number_ = number;
+        camera_ = cameras_[number];
+        REPLY("MenuThread capture commands change camera: "<<number);
     }
 
     void toggleAccumulate() noexcept {
         bool new_accumulate = getToggleOnOff(settings_->accumulate_);
-        LOG("MenuThread stack (accumulate) images: "<<new_accumulate);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        REPLY("MenuThread stack (accumulate) images: "<<new_accumulate);
+        SettingsLock lock(settings_);
         settings_->accumulate_ = new_accumulate;
     }
 
     void toggleCaptureBlack() noexcept {
         bool new_capture_black = getToggleOnOff(settings_->capture_black_);
-        LOG("MenuThread capture black: "<<new_capture_black);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        REPLY("MenuThread capture black: "<<new_capture_black);
+        SettingsLock lock(settings_);
         settings_->capture_black_ = new_capture_black;
     }
 
+    void handleCalibration() noexcept {
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        ss >> ch;
+        std::string kind;
+        int nframes = 16;
+        ss >> kind >> nframes;
+        if (kind == "bias" || kind == "dark" || kind == "flat") {
+            nframes = std::max(nframes, 1);
+            REPLY("MenuThread build master "<<kind<<" from "<<nframes<<" frames.");
+            MenuCommand cmd;
+            cmd.type_ = MenuCommand::Type::kBuildMaster;
+            cmd.name_ = kind;
+            cmd.frames_ = nframes;
+            settings_->commands_.push(std::move(cmd));
+            return;
+        }
+
+        bool new_calibrate = getToggleOnOff(settings_->calibrate_);
+        REPLY("MenuThread master calibration frames: "<<new_calibrate);
+        SettingsLock lock(settings_);
+        settings_->calibrate_ = new_calibrate;
+    }
+
     void setColorBalance() noexcept {
         std::stringstream ss;
         ss << input_;
@@ -184,9 +376,9 @@ public:
         double new_balance_red = settings_->balance_red_;
         double new_balance_blue = settings_->balance_blue_;
         ss >> new_balance_red >> new_balance_blue;
-        LOG("ManeuThread color balance: r="<<new_balance_red<<" b="<<new_balance_blue);
+        REPLY("ManeuThread color balance: r="<<new_balance_red<<" b="<<new_balance_blue);
 
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        SettingsLock lock(settings_);
         settings_->balance_red_ = new_balance_red;
         settings_->balance_blue_ = new_balance_blue;
     }
@@ -195,22 +387,51 @@ public:
         bool new_auto_exposure = false;
         int new_exposure = getInt(-1);
         if (new_exposure <= 0) {
-            new_exposure = settings_->exposure_;
-            new_auto_exposure = getToggleOnOff(settings_->auto_exposure_);
+            new_exposure = camera_->current_exposure_;
+            new_auto_exposure = getToggleOnOff(camera_->auto_exposure_);
         }
 
-        LOG("MenuThread auto exposure: "<<new_auto_exposure);
-        LOG("MenuThread exposure: "<<new_exposure);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
-        settings_->auto_exposure_ = new_auto_exposure;
-        settings_->exposure_ = new_exposure;
+        REPLY("MenuThread auto exposure: "<<new_auto_exposure);
+        REPLY("MenuThread exposure: "<<new_exposure);
+        SettingsLock lock(camera_);
+        camera_->auto_exposure_ = new_auto_exposure;
+        camera_->exposure_ = new_exposure;
     }
 
+    /** choosing a metric turns on the focus helper. **/
     void toggleFocus() noexcept {
-        bool new_focus = getToggleOnOff(settings_->show_focus_);
-        LOG("MenuThread focus: "<<new_focus);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        ss >> ch;
+        std::string metric;
+        ss >> metric;
+        bool new_focus = true;
+        auto new_metric = settings_->focus_metric_;
+        if (metric == "stars") {
+            new_metric = FocusMetric::kStars;
+        } else if (metric == "blur") {
+            new_metric = FocusMetric::kLaplacian;
+        } else {
+            new_focus = getToggleOnOff(settings_->show_focus_);
+        }
+
+        REPLY("MenuThread focus: "<<new_focus<<" metric: "<<getFocusMetricName(new_metric));
+        SettingsLock lock(settings_);
         settings_->show_focus_ = new_focus;
+        settings_->focus_metric_ = new_metric;
+    }
+
+    const char *getFocusMetricName(
+        FocusMetric metric
+    ) noexcept {
+        switch (metric) {
+        case FocusMetric::kStars:
+            return "stars";
+        case FocusMetric::kLaplacian:
+            return "blur";
+        }
+        return "unknown";
     }
 
     void toggleGamma() noexcept {
@@ -219,15 +440,15 @@ public:
             new_gamma = 1.0;
         }
 
-        LOG("MenuThread gamma: "<<new_gamma);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        REPLY("MenuThread gamma: "<<new_gamma);
+        SettingsLock lock(settings_);
         settings_->gamma_ = new_gamma;
     }
 
     void toggleHistogram() noexcept {
         bool new_histogram = getToggleOnOff(settings_->show_histogram_);
-        LOG("MenuThread histogram: "<<new_histogram);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        REPLY("MenuThread histogram: "<<new_histogram);
+        SettingsLock lock(settings_);
         settings_->show_histogram_ = new_histogram;
     }
 
@@ -235,41 +456,235 @@ public:
         bool new_auto_iso = false;
         int new_iso = getInt(-1);
         if (new_iso <= 0) {
-            new_iso = settings_->iso_;
+            new_iso = settings_->current_iso_;
             new_auto_iso = getToggleOnOff(settings_->auto_iso_);
         }
 
-        LOG("MenuThread auto iso: "<<new_auto_iso);
-        LOG("MenuThread iso: "<<new_iso);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        REPLY("MenuThread auto iso: "<<new_auto_iso);
+        REPLY("MenuThread iso: "<<new_iso);
+        /** the window only reports the iso it chose itself. **/
+        if (new_auto_iso == false) {
+            settings_->current_iso_.store(new_iso, std::memory_order_relaxed);
+        }
+        SettingsLock lock(settings_);
         settings_->auto_iso_ = new_auto_iso;
         settings_->iso_ = new_iso;
     }
 
     void toggleCircles() noexcept {
         bool new_circles = getToggleOnOff(settings_->show_circles_);
-        LOG("MenuThread stack collimation circles: "<<new_circles);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        REPLY("MenuThread stack collimation circles: "<<new_circles);
+        SettingsLock lock(settings_);
         settings_->show_circles_ = new_circles;
     }
 
     void toggleFps() noexcept {
         bool new_fps = getToggleOnOff(settings_->show_fps_);
-        LOG("MenuThread show fps (frame rate): "<<new_fps);
-        std::lock_guard<std::mutex> lock(settings_->mutex_);
+        REPLY("MenuThread show fps (frame rate): "<<new_fps);
+        SettingsLock lock(settings_);
         settings_->show_fps_ = new_fps;
     }
 
+    void toggleFusedPipeline() noexcept {
+        bool new_fused = getToggleOnOff(settings_->fused_pipeline_);
+        REPLY("MenuThread fused pipeline: "<<new_fused);
+        SettingsLock lock(settings_);
+        settings_->fused_pipeline_ = new_fused;
+    }
+
+    void setBinning() noexcept {
+        int new_bin = getInt(1);
+        if (new_bin != 1 && new_bin != 2 && new_bin != 4) {
+            new_bin = 1;
+        }
+
+        REPLY("MenuThread binning: "<<new_bin);
+        SettingsLock lock(camera_);
+        camera_->bin_ = new_bin;
+    }
+
+    void setCaptureRoi() noexcept {
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        ss >> ch;
+        int new_width = -1;
+        int new_height = -1;
+        ss >> new_width >> new_height;
+        bool new_follows = false;
+        if (new_width < 0 || new_height < 0) {
+            new_width = camera_->roi_width_;
+            new_height = camera_->roi_height_;
+            new_follows = getToggleOnOff(camera_->roi_follows_display_);
+        }
+
+        REPLY("MenuThread capture roi follows display: "<<new_follows);
+        REPLY("MenuThread capture roi: "<<new_width<<" x "<<new_height);
+        SettingsLock lock(camera_);
+        camera_->roi_follows_display_ = new_follows;
+        camera_->roi_width_ = new_width;
+        camera_->roi_height_ = new_height;
+    }
+
+    void toggleAlignStack() noexcept {
+        bool new_align = getToggleOnOff(settings_->align_stack_);
+        REPLY("MenuThread star aligned stacking: "<<new_align);
+        SettingsLock lock(settings_);
+        settings_->align_stack_ = new_align;
+    }
+
+    /** changing the mode starts a new stack. **/
+    void setStackMode() noexcept {
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        ss >> ch;
+        std::string mode;
+        double new_kappa = settings_->stack_kappa_;
+        ss >> mode >> new_kappa;
+        auto new_mode = StackMode::kSum;
+        if (mode == "sigma") {
+            new_mode = StackMode::kSigmaClip;
+        } else if (mode == "median") {
+            new_mode = StackMode::kMedian;
+        }
+        if (new_kappa <= 0.0) {
+            new_kappa = settings_->stack_kappa_;
+        }
+
+        REPLY("MenuThread stack mode: "<<getStackModeName(new_mode)<<" kappa="<<new_kappa);
+        SettingsLock lock(settings_);
+        settings_->stack_mode_ = new_mode;
+        settings_->stack_kappa_ = new_kappa;
+    }
+
+    const char *getStackModeName(
+        StackMode mode
+    ) noexcept {
+        switch (mode) {
+        case StackMode::kSum:
+            return "sum";
+        case StackMode::kSigmaClip:
+            return "sigma";
+        case StackMode::kMedian:
+            return "median";
+        }
+        return "unknown";
+    }
+
+    /** superpixel halves the resolution. which starts a new stack. **/
+    void setDebayerMode() noexcept {
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        ss >> ch;
+        std::string mode;
+        ss >> mode;
+        auto new_mode = DebayerMode::kBilinear;
+        if (mode == "super") {
+            new_mode = DebayerMode::kSuperpixel;
+        } else if (mode == "opencl") {
+            new_mode = DebayerMode::kOpenCL;
+        }
+
+        REPLY("MenuThread debayer mode: "<<getDebayerModeName(new_mode));
+        SettingsLock lock(settings_);
+        settings_->debayer_mode_ = new_mode;
+    }
+
+    const char *getDebayerModeName(
+        DebayerMode mode
+    ) noexcept {
+        switch (mode) {
+        case DebayerMode::kBilinear:
+            return "full";
+        case DebayerMode::kSuperpixel:
+            return "super";
+        case DebayerMode::kOpenCL:
+            return "opencl";
+        }
+        return "unknown";
+    }
+
+    void setZoom() noexcept {
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        ss >> ch;
+        int new_zoom = 0;
+        int new_pan_x = 0;
+        int new_pan_y = 0;
+        ss >> new_zoom >> new_pan_x >> new_pan_y;
+        if (new_zoom < 0) {
+            new_zoom = 0;
+        }
+
+        if (new_zoom == 0) {
+            REPLY("MenuThread zoom: fit");
+        } else {
+            REPLY("MenuThread zoom: "<<new_zoom<<" pan: "<<new_pan_x<<" "<<new_pan_y);
+        }
+        SettingsLock lock(settings_);
+        settings_->zoom_ = new_zoom;
+        settings_->pan_x_ = new_pan_x;
+        settings_->pan_y_ = new_pan_y;
+    }
+
+    void handlePerf() noexcept {
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        std::string cmd;
+        std::string filename;
+        ss >> ch >> cmd >> filename;
+        if (cmd == "log") {
+            perf_stats_->log();
+            return;
+        }
+        if (cmd == "csv") {
+            if (filename.empty()) {
+                REPLY("MenuThread csv needs a file name.");
+                return;
+            }
+            perf_stats_->writeCsv(filename);
+            return;
+        }
+
+        bool new_perf = getToggleOnOff(settings_->show_perf_);
+        REPLY("MenuThread stage times overlay: "<<new_perf);
+        SettingsLock lock(settings_);
+        settings_->show_perf_ = new_perf;
+    }
+
+    void toggleVideoMode() noexcept {
+        bool new_video = getToggleOnOff(camera_->video_mode_);
+        REPLY("MenuThread video capture mode: "<<new_video);
+        SettingsLock lock(camera_);
+        camera_->video_mode_ = new_video;
+    }
+
     void handleMount() noexcept {
         int ch = std::tolower(input_[1]);
         switch (ch) {
+        case 'g':
+            handleGuide();
+            break;
+
         case 'h':
             mount_->slewToHomePosition();
             break;
 
-        case 'i':
-            mount_->showStatus();
-            break;
+        case 'i': {
+            std::stringstream ss;
+            ss << input_.substr(2);
+            int interval_ms = -1;
+            ss >> interval_ms;
+            if (interval_ms >= 0) {
+                mount_->setPollInterval(interval_ms);
+            } else {
+                mount_->showStatus();
+            }
+        } break;
 
         case 'm': {
             int direction = input_[2];
@@ -278,21 +693,102 @@ public:
             mount_->move(direction, duration);
         } break;
 
+        case 'p':
+            handlePolarAlign();
+            break;
+
         case 'r': {
             int rate = input_[2] - '0';
             mount_->setSlewingRate(rate);
         } break;
 
+        case 's':
+            handleSolve(MenuCommand::Type::kSolve);
+            break;
+
+        case 'c':
+            handleSolve(MenuCommand::Type::kSyncMount);
+            break;
+
         case 'z':
             mount_->setZeroPosition();
             break;
 
         default:
-            LOG("Unknown command for mount.");
+            REPLY("Unknown command for mount.");
             break;
         }
     }
 
+    void handleGuide() noexcept {
+        std::stringstream ss;
+        ss << input_.substr(2);
+        std::string cmd;
+        int value = -1;
+        ss >> cmd >> value;
+        if (cmd == "cal") {
+            REPLY("MenuThread calibrate guiding.");
+            SettingsLock lock(guide_settings_);
+            ++guide_settings_->guide_calibration_;
+            guide_settings_->guide_ = true;
+            return;
+        }
+        if (cmd == "aggr") {
+            if (value < 0 || value > 200) {
+                REPLY("MenuThread guiding aggressiveness must be 0 to 200 percent.");
+                return;
+            }
+            REPLY("MenuThread guiding aggressiveness: "<<value);
+            SettingsLock lock(guide_settings_);
+            guide_settings_->guide_aggressiveness_ = value;
+            return;
+        }
+        if (cmd == "rate") {
+            mount_->setGuideRate(value);
+            return;
+        }
+
+        bool new_guide = getToggleOnOff(guide_settings_->guide_, 2);
+        REPLY("MenuThread autoguiding: "<<new_guide);
+        SettingsLock lock(guide_settings_);
+        guide_settings_->guide_ = new_guide;
+    }
+
+    /** solve the next frame. optionally with a different star index. **/
+    void handleSolve(
+        MenuCommand::Type type
+    ) noexcept {
+        std::stringstream ss;
+        ss << input_.substr(2);
+        MenuCommand cmd;
+        cmd.type_ = type;
+        ss >> cmd.name_;
+        if (type == MenuCommand::Type::kSyncMount) {
+            REPLY("MenuThread plate solve and sync the mount.");
+        } else {
+            REPLY("MenuThread plate solve.");
+        }
+        settings_->solve_commands_.push(std::move(cmd));
+    }
+
+    /** solve one of the three frames. or start over. **/
+    void handlePolarAlign() noexcept {
+        std::stringstream ss;
+        ss << input_.substr(2);
+        std::string word;
+        ss >> word;
+        MenuCommand cmd;
+        cmd.type_ = MenuCommand::Type::kPolarAlign;
+        if (word == "reset") {
+            REPLY("MenuThread restart polar alignment.");
+            cmd.frames_ = -1;
+        } else {
+            REPLY("MenuThread polar alignment step.");
+            cmd.name_ = word;
+        }
+        settings_->solve_commands_.push(std::move(cmd));
+    }
+
     /** parse the input as a number. **/
     int getInt(
         int default_value
@@ -319,16 +815,18 @@ public:
 
     /**
     start at the second character of the input.
+    or the third for two letter commands.
     look for plus/minus 0/1 y/n.
     which means on/off.
     if none of those are found, invert the input.
     **/
     bool getToggleOnOff(
-        bool cur_value
+        bool cur_value,
+        int start = 1
     ) noexcept {
         int ch;
         /** skip white space **/
-        for (int i = 1; ; ++i) {
+        for (int i = start; ; ++i) {
             ch = input_[i];
             if (ch == 0) {
                 /** flip it. **/
@@ -352,7 +850,7 @@ public:
 
     /** stop all threads. **/
     void quit() noexcept {
-        LOG("MenuThread stopping all threads.");
+        REPLY("MenuThread stopping all threads.");
         agm::master::setDone();
     }
 
@@ -366,11 +864,11 @@ public:
             return;
         }
 
-        LOG("MenuThread save file: "<<filename);
-        {
-            std::lock_guard<std::mutex> lock(settings_->mutex_);
-            std::swap(settings_->save_file_name_, filename);
-        }
+        REPLY("MenuThread save file: "<<filename);
+        MenuCommand cmd;
+        cmd.type_ = MenuCommand::Type::kSaveImage;
+        cmd.name_ = std::move(filename);
+        settings_->commands_.push(std::move(cmd));
     }
 
     void saveRaw() noexcept {
@@ -383,44 +881,70 @@ public:
             return;
         }
 
-        LOG("MenuThread save raw: "<<filename);
+        REPLY("MenuThread save raw: "<<filename);
+        MenuCommand cmd;
+        cmd.type_ = MenuCommand::Type::kSaveRaw;
+        cmd.name_ = std::move(filename);
+        settings_->commands_.push(std::move(cmd));
+    }
+
+    void recordSequence() noexcept {
+        std::stringstream ss;
+        ss << input_;
+        char ch;
+        std::string filename;
+        ss >> ch >> filename;
+
+        if (filename.size()) {
+            REPLY("MenuThread record sequence: "<<filename);
+        } else {
+            REPLY("MenuThread stop recording.");
+        }
         {
-            std::lock_guard<std::mutex> lock(settings_->mutex_);
-            std::swap(settings_->raw_file_name_, filename);
+            SettingsLock lock(camera_);
+            std::swap(camera_->record_file_name_, filename);
         }
     }
 
     /** run the experiment of the day. **/
     void experiment() noexcept {
-        LOG("Hello, World!");
+        REPLY("Hello, World!");
     }
 
     /** show how the program is to be used. **/
     void showHelp() noexcept {
-        LOG("General usage:");
-        LOG("-- Aim the camera at the target.");
-        LOG("-- Rough focus the camera.");
-        LOG("-- Wait for auto exposure to settle.");
-        LOG("-- Disable auto exposure. E");
-        LOG("-- Enable manual focus helper. F");
-        LOG("-- Minimize the blurriness number.");
-        LOG("-- Disable manual focus helper. F");
-        LOG("-- Put lens cap on camera.");
-        LOG("-- Enable capture black. B");
-        LOG("-- Wait for black levels to settle.");
-        LOG("-- Disable capture black. B");
-        LOG("-- Remove lens cap from camera.");
-        LOG("-- Enable histogram. H");
-        LOG("-- Balance colors. C r b");
-        LOG("-- Disable histogram. H");
-        LOG("-- Stack (accumulate) images. A");
-        LOG("-- Wait as long as you wish.");
-        LOG("-- Save the image.");
-        LOG("-- Profit.");
+        REPLY("General usage:");
+        REPLY("-- Aim the camera at the target.");
+        REPLY("-- Rough focus the camera.");
+        REPLY("-- Wait for auto exposure to settle.");
+        REPLY("-- Disable auto exposure. E");
+        REPLY("-- Enable manual focus helper. F");
+        REPLY("-- Minimize the blurriness number.");
+        REPLY("-- Disable manual focus helper. F");
+        REPLY("-- Put lens cap on camera.");
+        REPLY("-- Enable capture black. B");
+        REPLY("-- Wait for black levels to settle.");
+        REPLY("-- Disable capture black. B");
+        REPLY("-- Remove lens cap from camera.");
+        REPLY("-- Enable histogram. H");
+        REPLY("-- Balance colors. C r b");
+        REPLY("-- Disable histogram. H");
+        REPLY("-- Stack (accumulate) images. A");
+        REPLY("-- Wait as long as you wish.");
+        REPLY("-- Save the image.");
+        REPLY("-- Profit.");
     }
 };
+
+#undef REPLY
 }
 
-agm::Thread *createMenuThread(SettingsBuffer *settings_buffer) noexcept {
-    return new(std::nothrow) MenuThread(settings_buffer);
+agm::Thread *createMenuThread(
+    const std::vector<SettingsBuffer *> &settings_buffers,
+    int imaging_camera,
+    int guide_camera,
+    Ioptron *mount,
+    PerfStats *perf_stats
+) noexcept {
+    return new(std::nothrow) MenuThread(settings_buffers, imaging_camera, guide_camera, mount, perf_stats);
 }
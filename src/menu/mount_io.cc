@@ -0,0 +1,510 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+asynchronous serial i/o for the ioptron mount.
+
+the io thread polls the serial port and a wake pipe.
+other threads write a byte to the pipe when they queue something.
+the poll timeout is the earlier of the next timer and the oldest reply deadline.
+**/
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "mount_io.h"
+
+
+// use an anonymous namespace to avoid name collisions at link time.
+namespace {
+    class Command {
+    public:
+        std::string text_;
+        int reply_ = MountIo::kNoReply;
+        bool urgent_ = false;
+        MountIo::Callback callback_;
+        /** when the reply is late. **/
+        agm::int64 deadline_ = 0;
+    };
+
+    class Timer {
+    public:
+        int id_ = 0;
+        agm::int64 when_ = 0;
+        Command command_;
+    };
+
+    /** a finished command waiting for its callback. **/
+    class Completion {
+    public:
+        MountIo::Callback callback_;
+        bool ok_ = false;
+        std::string reply_;
+    };
+
+    agm::int64 getMilliseconds() noexcept {
+        return agm::time::microseconds() / 1000;
+    }
+
+    class MountIoImpl : public MountIo {
+    public:
+        MountIoImpl() noexcept = default;
+        MountIoImpl(const MountIoImpl &) = delete;
+        virtual ~MountIoImpl() noexcept {
+            closeImpl();
+        }
+
+        SerialConnection port_;
+        std::thread thread_;
+        int wake_read_ = -1;
+        int wake_write_ = -1;
+
+        /** protects everything below. **/
+        std::mutex mutex_;
+        /** true whenever the io thread isn't running. **/
+        bool stop_ = true;
+        std::deque<Command> urgent_;
+        std::deque<Command> queued_;
+        std::vector<Timer> timers_;
+        int next_timer_id_ = 1;
+
+        /** owned by the io thread. **/
+        std::deque<Command> in_flight_;
+        std::string rx_;
+        /** a late reply may still arrive. throw it away before the next command. **/
+        bool flush_input_ = false;
+        std::vector<Completion> completions_;
+
+        bool openImpl() noexcept {
+            if (thread_.joinable()) {
+                return true;
+            }
+            bool result = port_.open();
+            if (result == false) {
+                return false;
+            }
+            int fds[2];
+            if (::pipe(fds) != 0) {
+                LOG("MountIo Unable to create the wake pipe.");
+                port_.close();
+                return false;
+            }
+            wake_read_ = fds[0];
+            wake_write_ = fds[1];
+            fcntl(wake_read_, F_SETFL, fcntl(wake_read_, F_GETFL, 0) | O_NONBLOCK);
+            fcntl(wake_write_, F_SETFL, fcntl(wake_write_, F_GETFL, 0) | O_NONBLOCK);
+            std::lock_guard<std::mutex> lock(mutex_);
+            thread_ = std::thread(&MountIoImpl::ioMain, this);
+            stop_ = false;
+            return true;
+        }
+
+        /**
+        other threads may be queueing while we open or close.
+        they check stop_ with the lock held before they look at the thread.
+        and the pipe is only closed with the lock held.
+        so they never wake a closed pipe.
+        **/
+        void closeImpl() noexcept {
+            if (thread_.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stop_ = true;
+                    wake();
+                }
+                thread_.join();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (wake_read_ >= 0) {
+                    ::close(wake_read_);
+                    ::close(wake_write_);
+                }
+                wake_read_ = -1;
+                wake_write_ = -1;
+            }
+            port_.close();
+        }
+
+        /** call with the lock held. **/
+        void wake() noexcept {
+            if (wake_write_ < 0) {
+                return;
+            }
+            char ch = 0;
+            int result = ::write(wake_write_, &ch, 1);
+            /** a full pipe still wakes the thread. **/
+            (void) result;
+        }
+
+        void queue(
+            Command &cmd
+        ) noexcept {
+            bool failed = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_ || thread_.joinable() == false) {
+                    failed = true;
+                } else if (cmd.urgent_) {
+                    urgent_.push_back(std::move(cmd));
+                    wake();
+                } else {
+                    queued_.push_back(std::move(cmd));
+                    wake();
+                }
+            }
+            if (failed && cmd.callback_) {
+                cmd.callback_(false, std::string());
+            }
+        }
+
+        int addTimer(
+            int delay_ms,
+            Command &cmd
+        ) noexcept {
+            int id = 0;
+            bool failed = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_ || thread_.joinable() == false) {
+                    failed = true;
+                } else {
+                    Timer timer;
+                    timer.id_ = next_timer_id_++;
+                    timer.when_ = getMilliseconds() + delay_ms;
+                    timer.command_ = std::move(cmd);
+                    id = timer.id_;
+                    timers_.push_back(std::move(timer));
+                    wake();
+                }
+            }
+            if (failed && cmd.callback_) {
+                cmd.callback_(false, std::string());
+            }
+            return id;
+        }
+
+        bool removeTimer(
+            int id
+        ) noexcept {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = timers_.begin(); it != timers_.end(); ++it) {
+                if (it->id_ == id) {
+                    timers_.erase(it);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void ioMain() noexcept {
+            struct pollfd fds[2];
+            fds[0].fd = port_.getFd();
+            fds[0].events = POLLIN;
+            fds[1].fd = wake_read_;
+            fds[1].events = POLLIN;
+
+            for(;;) {
+                int timeout = -1;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (stop_) {
+                        break;
+                    }
+                    auto now = getMilliseconds();
+                    fireTimers(now);
+                    writeCommands(now);
+                    timeout = getPollTimeout(now);
+                }
+
+                ::poll(fds, 2, timeout);
+
+                if (fds[1].revents & POLLIN) {
+                    char drain[64];
+                    while (::read(wake_read_, drain, sizeof(drain)) > 0) {
+                    }
+                }
+                if (fds[0].revents) {
+                    int result = port_.readAvailable(rx_);
+                    /** the usb cable was pulled. **/
+                    if (result < 0 || (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))) {
+                        LOG("MountIo serial port failed.");
+                        fds[0].fd = -1;
+                    }
+                }
+
+                matchReplies();
+                expireReplies(getMilliseconds());
+                runCallbacks();
+            }
+
+            /** fail everything that's left. **/
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                failAll(in_flight_);
+                failAll(urgent_);
+                failAll(queued_);
+                for (auto &timer : timers_) {
+                    fail(timer.command_);
+                }
+                timers_.clear();
+            }
+            runCallbacks();
+        }
+
+        /** move due timers to the queues. call with the lock held. **/
+        void fireTimers(
+            agm::int64 now
+        ) noexcept {
+            for (auto it = timers_.begin(); it != timers_.end(); ) {
+                if (it->when_ > now) {
+                    ++it;
+                    continue;
+                }
+                if (it->command_.urgent_) {
+                    urgent_.push_back(std::move(it->command_));
+                } else {
+                    queued_.push_back(std::move(it->command_));
+                }
+                it = timers_.erase(it);
+            }
+        }
+
+        /** write what we can. urgent first. call with the lock held. **/
+        void writeCommands(
+            agm::int64 now
+        ) noexcept {
+            while (int(in_flight_.size()) < kMaxInFlight) {
+                auto &queue = urgent_.empty() ? queued_ : urgent_;
+                if (queue.empty()) {
+                    break;
+                }
+                auto cmd = std::move(queue.front());
+                queue.pop_front();
+
+                if (flush_input_) {
+                    flush_input_ = false;
+                    port_.flushInput();
+                    rx_.clear();
+                }
+
+                bool written = port_.write(cmd.text_.c_str());
+                if (written == false) {
+                    fail(cmd);
+                    continue;
+                }
+                if (cmd.reply_ == kNoReply) {
+                    complete(cmd, true, std::string());
+                    continue;
+                }
+                cmd.deadline_ = now + kReplyTimeoutMs;
+                in_flight_.push_back(std::move(cmd));
+            }
+        }
+
+        /** call with the lock held. **/
+        int getPollTimeout(
+            agm::int64 now
+        ) noexcept {
+            agm::int64 next = -1;
+            for (auto &timer : timers_) {
+                if (next < 0 || timer.when_ < next) {
+                    next = timer.when_;
+                }
+            }
+            if (in_flight_.size()) {
+                auto deadline = in_flight_.front().deadline_;
+                if (next < 0 || deadline < next) {
+                    next = deadline;
+                }
+            }
+            if (next < 0) {
+                return -1;
+            }
+            return int(std::max(next - now, agm::int64(0)));
+        }
+
+        /** the mount replies in order. **/
+        void matchReplies() noexcept {
+            while (in_flight_.size()) {
+                auto &cmd = in_flight_.front();
+                int len = 0;
+                if (cmd.reply_ > 0) {
+                    if (int(rx_.size()) < cmd.reply_) {
+                        break;
+                    }
+                    len = cmd.reply_;
+                } else {
+                    auto pos = rx_.find('#');
+                    if (pos == std::string::npos) {
+                        break;
+                    }
+                    len = pos + 1;
+                }
+                complete(cmd, true, rx_.substr(0, len));
+                rx_.erase(0, len);
+                in_flight_.pop_front();
+            }
+
+            /** nobody asked for these. **/
+            if (in_flight_.empty() && rx_.size()) {
+                LOG("MountIo discarded unexpected reply: "<<rx_);
+                rx_.clear();
+            }
+        }
+
+        /**
+        a missing reply means we don't know where the next one starts.
+        the late reply could be mistaken for the answers to the rest.
+        so they fail too. and the input is flushed before the next command.
+        **/
+        void expireReplies(
+            agm::int64 now
+        ) noexcept {
+            if (in_flight_.empty() || in_flight_.front().deadline_ > now) {
+                return;
+            }
+            LOG("MountIo timed out waiting for the reply to "<<in_flight_.front().text_);
+            failAll(in_flight_);
+            rx_.clear();
+            flush_input_ = true;
+        }
+
+        void complete(
+            Command &cmd,
+            bool ok,
+            std::string reply
+        ) noexcept {
+            if (cmd.callback_) {
+                Completion done;
+                done.callback_ = std::move(cmd.callback_);
+                done.ok_ = ok;
+                done.reply_ = std::move(reply);
+                completions_.push_back(std::move(done));
+            }
+        }
+
+        void fail(
+            Command &cmd
+        ) noexcept {
+            complete(cmd, false, std::string());
+        }
+
+        void failAll(
+            std::deque<Command> &cmds
+        ) noexcept {
+            for (auto &cmd : cmds) {
+                fail(cmd);
+            }
+            cmds.clear();
+        }
+
+        /** callbacks are called without the lock so they may queue more commands. **/
+        void runCallbacks() noexcept {
+            std::vector<Completion> done;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done.swap(completions_);
+            }
+            for (auto &c : done) {
+                c.callback_(c.ok_, c.reply_);
+            }
+        }
+    };
+
+    Command makeCommand(
+        const char *cmd,
+        int reply,
+        const MountIo::Callback &callback,
+        bool urgent
+    ) noexcept {
+        Command command;
+        command.text_ = cmd;
+        command.reply_ = reply;
+        command.callback_ = callback;
+        command.urgent_ = urgent;
+        return command;
+    }
+}
+
+MountIo::MountIo() noexcept {
+}
+
+MountIo::~MountIo() noexcept {
+}
+
+MountIo *MountIo::create() noexcept {
+    auto impl = new(std::nothrow) MountIoImpl;
+    return impl;
+}
+
+bool MountIo::open() noexcept {
+    auto impl = (MountIoImpl *) this;
+    return impl->openImpl();
+}
+
+void MountIo::close() noexcept {
+    auto impl = (MountIoImpl *) this;
+    impl->closeImpl();
+}
+
+bool MountIo::isOpen() noexcept {
+    auto impl = (MountIoImpl *) this;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    return (impl->stop_ == false);
+}
+
+void MountIo::send(
+    const char *cmd,
+    int reply,
+    const Callback &callback,
+    bool urgent
+) noexcept {
+    auto impl = (MountIoImpl *) this;
+    auto command = makeCommand(cmd, reply, callback, urgent);
+    impl->queue(command);
+}
+
+std::future<std::string> MountIo::request(
+    const char *cmd,
+    int reply,
+    bool urgent
+) noexcept {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    auto future = promise->get_future();
+    send(cmd, reply, [promise](bool ok, const std::string &response) {
+        (void) ok;
+        promise->set_value(response);
+    }, urgent);
+    return future;
+}
+
+int MountIo::sendAfter(
+    int delay_ms,
+    const char *cmd,
+    int reply,
+    const Callback &callback,
+    bool urgent
+) noexcept {
+    auto impl = (MountIoImpl *) this;
+    auto command = makeCommand(cmd, reply, callback, urgent);
+    return impl->addTimer(delay_ms, command);
+}
+
+bool MountIo::cancelTimer(
+    int id
+) noexcept {
+    auto impl = (MountIoImpl *) this;
+    return impl->removeTimer(id);
+}
@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+asynchronous serial i/o for the ioptron mount.
+
+the mount io thread owns the serial port.
+other threads queue commands and never wait for the mount.
+unless they ask for a future and wait on it.
+
+commands are written as soon as they're queued.
+up to kMaxInFlight of them may be waiting for replies.
+the mount answers in order.
+so replies are matched to commands first in first out.
+each command says how its reply is framed.
+no reply, a fixed number of characters, or up to and including a '#'.
+a reply that times out fails the commands in flight.
+the input is flushed before the next command. so a late reply isn't taken for its answer.
+
+urgent commands are written before the other queued commands.
+guiding corrections should be urgent.
+so they don't wait behind status polling.
+
+timed commands are held by the io thread until their time.
+a timed move is a move command now and a stop command later.
+nobody sleeps.
+
+replies are delivered by callback on the io thread.
+callbacks should be quick.
+**/
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <string>
+
+#include "serial.h"
+
+
+class MountIo {
+protected:
+    MountIo() noexcept;
+public:
+    MountIo(const MountIo &) = delete;
+    virtual ~MountIo() noexcept;
+
+    /** reply framing. positive values are the number of characters. **/
+    static const int kNoReply = 0;
+    static const int kHashReply = -1;
+
+    /** at most this many commands waiting for replies. **/
+    static const int kMaxInFlight = 4;
+
+    /** a command fails if the reply doesn't arrive in time. **/
+    static const int kReplyTimeoutMs = 500;
+
+    /** ok is false if the command timed out or the port closed. **/
+    typedef std::function<void(bool ok, const std::string &reply)> Callback;
+
+    static MountIo *create() noexcept;
+
+    /** open the port and start the io thread. **/
+    bool open() noexcept;
+
+    /** stop the io thread and close the port. pending commands fail. **/
+    void close() noexcept;
+
+    bool isOpen() noexcept;
+
+    /** queue a command. the callback may be empty. **/
+    void send(
+        const char *cmd,
+        int reply,
+        const Callback &callback = nullptr,
+        bool urgent = false
+    ) noexcept;
+
+    /** queue a command. the future is the reply or empty on failure. **/
+    std::future<std::string> request(
+        const char *cmd,
+        int reply,
+        bool urgent = false
+    ) noexcept;
+
+    /**
+    queue a command delay_ms milliseconds from now.
+    returns an id for cancelTimer.
+    **/
+    int sendAfter(
+        int delay_ms,
+        const char *cmd,
+        int reply,
+        const Callback &callback = nullptr,
+        bool urgent = false
+    ) noexcept;
+
+    /** returns true if the timed command was cancelled before it was sent. **/
+    bool cancelTimer(int id) noexcept;
+};
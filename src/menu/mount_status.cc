@@ -0,0 +1,55 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+#include <cstring>
+#include <type_traits>
+
+#include "mount_status.h"
+
+
+static_assert(std::is_trivially_copyable<MountStatus>::value, "MountStatus is copied as words.");
+
+MountStatusCache::MountStatusCache() noexcept {
+    for (auto &word : words_) {
+        word.store(0, std::memory_order_relaxed);
+    }
+}
+
+void MountStatusCache::store(
+    const MountStatus &status
+) noexcept {
+    agm::uint64 words[kWords] = {0};
+    std::memcpy(words, &status, sizeof(status));
+
+    auto sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < kWords; ++i) {
+        words_[i].store(words[i], std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+bool MountStatusCache::load(
+    MountStatus &status
+) const noexcept {
+    agm::uint64 words[kWords];
+    for(;;) {
+        auto before = sequence_.load(std::memory_order_acquire);
+        /** the writer is a few stores from done. **/
+        if (before & 1) {
+            continue;
+        }
+        for (int i = 0; i < kWords; ++i) {
+            words[i] = words_[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto after = sequence_.load(std::memory_order_relaxed);
+        if (before == after) {
+            break;
+        }
+    }
+    std::memcpy(&status, words, sizeof(status));
+    return status.valid_;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+the latest state of the mount.
+
+the mount io thread polls the mount and stores the state here.
+any thread reads it without touching the serial port.
+and without waiting for the io thread.
+**/
+
+#pragma once
+
+#include <atomic>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class MountStatus {
+public:
+    /** false until the first poll completes. **/
+    bool valid_ = false;
+    /** when the poll completed. utc microseconds. the same clock as the image timestamps. **/
+    agm::int64 timestamp_ = 0;
+
+    /** degrees of date. **/
+    double ra_ = 0.0;
+    double dec_ = 0.0;
+    double altitude_ = 0.0;
+    double azimuth_ = 0.0;
+    /** degrees. east is positive. **/
+    double latitude_ = 0.0;
+    double longitude_ = 0.0;
+
+    /** the digits of the :GLS# reply. see ioptron.cc. **/
+    int gps_ = 0;
+    int system_ = 0;
+    int tracking_rate_ = 0;
+    int slewing_rate_ = 0;
+    int time_source_ = 0;
+    bool northern_ = true;
+
+    bool isSlewing() const noexcept {
+        return system_ == 2 || system_ == 4;
+    }
+    bool isParked() const noexcept {
+        return system_ == 6;
+    }
+};
+
+/**
+one writer. any number of readers. nobody waits.
+
+a sequence lock.
+the writer makes the sequence odd, writes the words, then makes it even.
+a reader copies the words and checks the sequence didn't change.
+if it did the reader copies again.
+the words are relaxed atomics.
+so a torn copy is detected instead of undefined.
+**/
+class MountStatusCache {
+public:
+    MountStatusCache() noexcept;
+    MountStatusCache(const MountStatusCache &) = delete;
+    ~MountStatusCache() noexcept = default;
+
+    /** only the mount io thread stores. **/
+    void store(const MountStatus &status) noexcept;
+
+    /** returns false if there's no status yet. **/
+    bool load(MountStatus &status) const noexcept;
+
+private:
+    static const int kWords = (sizeof(MountStatus) + sizeof(agm::uint64) - 1) / sizeof(agm::uint64);
+    std::atomic<agm::uint32> sequence_{0};
+    std::atomic<agm::uint64> words_[kWords];
+};
@@ -11,7 +11,9 @@ left a thank you very much.
 actual settings came from digging through indi driver code.
 **/
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
@@ -21,13 +23,6 @@ actual settings came from digging through indi driver code.
 
 #include "serial.h"
 
-/**
-we do need to wait for a response.
-10 ms is not long enough.
-**/
-static const int kTimeoutSeconds = 0;
-static const int kTimeoutMicroseconds = 100*1000;
-
 SerialConnection::SerialConnection() noexcept {
 }
 
@@ -102,8 +97,8 @@ bool SerialConnection::open() noexcept {
     **/
     tty.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG | IEXTEN | NOFLSH | TOSTOP);
     tty.c_lflag |= NOFLSH;
-    /** blocking read until 1 char arrives **/
-    tty.c_cc[VMIN]  = 1;
+    /** reads return whatever has arrived. **/
+    tty.c_cc[VMIN]  = 0;
     tty.c_cc[VTIME] = 0;
 
     /** now clear input and output buffers **/
@@ -117,79 +112,96 @@ bool SerialConnection::open() noexcept {
         return false;
     }
 
+    /** the mount io thread polls the port. **/
+    int flags = fcntl(fd_, F_GETFL, 0);
+    result = fcntl(fd_, F_SETFL, flags | O_NONBLOCK);
+    if (result != 0) {
+        LOG("Unable to set device non-blocking.");
+        close();
+        return false;
+    }
+
     return true;
 }
 
-void SerialConnection::write(
+bool SerialConnection::isopen() noexcept {
+    return (fd_ >= 0);
+}
+
+bool SerialConnection::write(
     const char *cmd
 ) noexcept {
     if (fd_ < 0) {
-        return;
+        return false;
     }
-    int len = strlen(cmd);
-    int result = ::write(fd_, cmd, len);
-    (void) result;
-}
 
-std::string SerialConnection::read(
-    int nbytes
-) noexcept {
-    std::string reply;
-    if (fd_ < 0) {
-        return reply;
+    /**
+    commands are a few characters.
+    they usually fit in the driver's buffer.
+    if they don't wait for room. but not forever.
+    **/
+    int len = strlen(cmd);
+    auto deadline = agm::time::microseconds() / 1000 + kWriteTimeoutMs;
+    while (len > 0) {
+        int result = ::write(fd_, cmd, len);
+        if (result >= 0) {
+            cmd += result;
+            len -= result;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        auto timeout = deadline - agm::time::microseconds() / 1000;
+        if (timeout <= 0) {
+            LOG("Timed out writing to the serial port.");
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        ::poll(&pfd, 1, int(timeout));
     }
+    return true;
+}
 
-    /** let's just assume 100 bytes is enough. **/
-    char buffer[100];
-    int sz = sizeof(buffer)-1;
-    for (int i = 0; i <= sz; ++i) {
-        buffer[i] = 0;
+void SerialConnection::flushInput() noexcept {
+    if (fd_ >= 0) {
+        tcflush(fd_, TCIFLUSH);
     }
+}
 
-    /** special cases. **/
-    bool break_on_timeout = (nbytes < 0);
-    if (nbytes <= 0 || nbytes > sz) {
-        nbytes = sz;
+int SerialConnection::readAvailable(
+    std::string &buffer
+) noexcept {
+    if (fd_ < 0) {
+        return -1;
     }
 
-    /** read bytes into the buffer. **/
-    struct timeval timeout;
-    auto cp = buffer;
-    while (nbytes > 0) {
-        /** use the select method. **/
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fd_, &fds);
-        timeout.tv_sec = kTimeoutSeconds;
-        timeout.tv_usec = kTimeoutMicroseconds;
-        int result = ::select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
-        if (result == 0) {
-            if (break_on_timeout) {
+    int total = 0;
+    char chunk[256];
+    for(;;) {
+        int nread = ::read(fd_, chunk, sizeof(chunk));
+        if (nread < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 break;
             }
-            continue;
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
-        /** read bytes. **/
-        int nread = ::read(fd_, cp, nbytes);
-        if (nread <= 0) {
+        if (nread == 0) {
             break;
         }
-        /** stop when we get to a '#'. **/
-        for (int i = 0; i < nread; ++i) {
-            if (cp[i] == '#') {
-                cp[i+1] = 0;
-                nread = nbytes;
-                break;
-            }
-        }
-
-        /** advance the buffer pointers. **/
-        cp += nread;
-        nbytes -= nread;
+        buffer.append(chunk, nread);
+        total += nread;
     }
-    reply = buffer;
-
-    return reply;
+    return total;
 }
 
 void SerialConnection::close() noexcept {
@@ -6,7 +6,10 @@ Copyright (C) 2012-2024 tim cotter. All rights reserved.
 open the usb serial port connection to the ioptron smarteq pro(+) mount.
 **/
 
+#pragma once
+
 #include <cstring>
+#include <string>
 
 
 class SerialConnection {
@@ -20,25 +23,30 @@ public:
     void close() noexcept;
 
     bool isopen() noexcept;
-    void write(const char *cmd) noexcept;
 
-    /**
-    read data from the serial port.
-    stops when a '#' is received.
-    stops when the internal buffer is full.
+    /** the port is non-blocking. so the mount io thread can poll it. **/
+    int getFd() noexcept {
+        return fd_;
+    }
 
-    if nbytes == 0:
-        will block until at least 1 character is returned.
-        will not return an empty string.
+    /**
+    returns false if the command wasn't written.
+    waits up to kWriteTimeoutMs for room in the driver's buffer.
+    **/
+    static const int kWriteTimeoutMs = 100;
+    bool write(const char *cmd) noexcept;
 
-    if nbytes > 0:
-        stops when the specified number of bytes is received.
+    /** throw away whatever has arrived and not been read. **/
+    void flushInput() noexcept;
 
-    if nbytes < 0:
-        does not block if there is no data.
-        may return an empty string.
+    /**
+    read whatever has arrived without blocking.
+    appends to the buffer.
+    returns the number of characters read.
+    returns 0 if there's no data.
+    returns -1 if the port failed.
     **/
-    std::string read(int nbytes = 0) noexcept;
+    int readAvailable(std::string &buffer) noexcept;
 
 private:
     int fd_ = -1;
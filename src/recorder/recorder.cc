@@ -0,0 +1,402 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+record sequences of raw bayer images to disk.
+
+we read every frame from the capture ring.
+the slots in the ring are the queue between the camera and the disk.
+if we fall behind by more than the ring can hold then frames are overwritten.
+those are counted and logged.
+
+the file format is SER.
+http://www.grischa-hahn.homepage.t-online.de/astro/ser/
+
+the file is a 178 byte header followed by the frames.
+followed by a utc timestamp for each frame.
+
+frames are copied into a large aligned staging buffer.
+which is written all at once.
+the buffer comes from the frame pool. so it's page aligned and may be locked.
+the file is opened with O_DIRECT if the file system allows it.
+**/
+
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+#include <aggiornamento/thread.h>
+
+#include <shared/frame_pool.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/settings_buffer.h>
+
+
+namespace {
+
+/** the SER header. all fields are little endian. **/
+const int kSerHeaderBytes = 178;
+/** the ser color ids in the same order as the bayer patterns. **/
+const int kSerColorBayer[] = {
+    8, /*RGGB*/
+    11, /*BGGR*/
+    9, /*GRBG*/
+    10 /*GBRG*/
+};
+const int kSerColorMono = 0;
+/** 100ns ticks from 0001-01-01 to 1970-01-01. **/
+const agm::int64 kSerEpochTicks = 621355968000000000LL;
+
+class RecorderThread : public agm::Thread {
+public:
+    /** share data with the capture thread. **/
+    ImageRing *image_ring_ = nullptr;
+    int ring_consumer_ = -1;
+    /** share data with the menu thread. **/
+    SettingsBuffer *settings_buffer_ = nullptr;
+    SettingsSnapshot settings_;
+    std::string record_file_name_;
+    /** how long writes take. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_write_ = nullptr;
+    FramePool *frame_pool_ = nullptr;
+
+    /** our fields. **/
+    static const int kAlignBytes = 4096;
+    static const int kStageBytes = 8 * 1024 * 1024;
+    cv::Mat stage_mat_;
+    agm::uint8 *stage_ = nullptr;
+    int stage_used_ = 0;
+    std::string file_name_;
+    int fd_ = -1;
+    bool direct_ = false;
+    agm::int64 file_bytes_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    BayerPattern bayer_pattern_ = BayerPattern::kRGGB;
+    bool mono_ = false;
+    std::vector<agm::int64> timestamps_;
+
+    /** backpressure statistics. **/
+    agm::int64 start_time_ = 0;
+    agm::int64 start_overwritten_ = 0;
+    agm::int64 write_time_ = 0;
+    agm::int64 max_lag_ = 0;
+    agm::int64 stats_time_ = 0;
+
+    RecorderThread(
+        ImageRing *image_ring,
+        SettingsBuffer *settings_buffer,
+        PerfStats *perf_stats,
+        FramePool *frame_pool
+    ) noexcept : agm::Thread("RecorderThread") {
+        image_ring_ = image_ring;
+        settings_buffer_ = settings_buffer;
+        perf_stats_ = perf_stats;
+        frame_pool_ = frame_pool;
+        /** we want every frame. **/
+        ring_consumer_ = image_ring_->addConsumer(ImageRing::Policy::kEvery);
+    }
+
+    virtual ~RecorderThread() = default;
+
+    virtual void begin() noexcept {
+        LOG("RecorderThread.");
+        time_write_ = perf_stats_->addStage("RecorderThread", "write");
+        frame_pool_->create(stage_mat_, 1, kStageBytes, CV_8UC1);
+        stage_ = stage_mat_.data;
+        if (stage_ == nullptr || (agm::uint64(stage_) % kAlignBytes) != 0) {
+            LOG("RecorderThread Failed to allocate an aligned staging buffer.");
+            stage_mat_.release();
+            stage_ = nullptr;
+        }
+    }
+
+    virtual void runOnce() noexcept {
+        /** wait for the next frame. **/
+        auto img = image_ring_->acquireRead(ring_consumer_);
+        if (img == nullptr) {
+            return;
+        }
+
+        /** copy all of the settings at once. **/
+        copySettings();
+
+        /** start or stop recording. **/
+        if (record_file_name_ != file_name_) {
+            finishFile();
+            if (record_file_name_.size()) {
+                startFile(img);
+            }
+        }
+
+        /** write the frame. **/
+        if (fd_ >= 0) {
+            if (img->width_ != width_ || img->height_ != height_) {
+                LOG("RecorderThread Frame size changed. Stopping.");
+                stopRecording();
+            } else {
+                writeFrame(img);
+            }
+            if (fd_ < 0) {
+                stopRecording();
+            }
+        }
+
+        image_ring_->releaseRead(ring_consumer_, img);
+
+        /** show statistics every 3 seconds. **/
+        showStats(false);
+    }
+
+    virtual void end() noexcept {
+        finishFile();
+        stage_mat_.release();
+        stage_ = nullptr;
+    }
+
+    void copySettings() noexcept {
+        if (settings_.update(settings_buffer_)) {
+            record_file_name_ = settings_->record_file_name_;
+        }
+    }
+
+    /** tell the menu thread we stopped. **/
+    void stopRecording() noexcept {
+        finishFile();
+        record_file_name_.clear();
+        SettingsLock lock(settings_buffer_);
+        settings_buffer_->record_file_name_.clear();
+    }
+
+    void startFile(
+        const ImageBuffer *img
+    ) noexcept {
+        if (stage_ == nullptr) {
+            stopRecording();
+            return;
+        }
+
+        file_name_ = record_file_name_;
+        direct_ = true;
+        fd_ = open(file_name_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (fd_ < 0) {
+            /** some file systems don't support direct io. **/
+            direct_ = false;
+            fd_ = open(file_name_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd_ < 0) {
+            LOG("RecorderThread Failed to open file: "<<file_name_);
+            stopRecording();
+            return;
+        }
+        LOG("RecorderThread Recording to file: "<<file_name_<<" direct io: "<<direct_);
+
+        width_ = img->width_;
+        height_ = img->height_;
+        bayer_pattern_ = img->bayer_pattern_;
+        mono_ = img->mono_;
+        stage_used_ = 0;
+        file_bytes_ = 0;
+        timestamps_.clear();
+        timestamps_.reserve(100*1000);
+
+        auto stats = image_ring_->getStats(ring_consumer_);
+        start_time_ = agm::time::microseconds();
+        stats_time_ = start_time_;
+        start_overwritten_ = stats.overwritten_;
+        write_time_ = 0;
+        max_lag_ = 0;
+
+        /** the frame count isn't known yet. it's rewritten at the end. **/
+        agm::uint8 header[kSerHeaderBytes];
+        fillHeader(header, 0);
+        append(header, kSerHeaderBytes);
+    }
+
+    void writeFrame(
+        const ImageBuffer *img
+    ) noexcept {
+        /** note how far behind the camera we are. **/
+        auto stats = image_ring_->getStats(ring_consumer_);
+        agm::int64 lag = stats.published_ - img->sequence_;
+        max_lag_ = std::max(max_lag_, lag);
+
+        append(img->bayer_.data, img->bytes_);
+        timestamps_.push_back(img->timestamp_ * 10 + kSerEpochTicks);
+    }
+
+    /** copy bytes to the staging buffer. write it when it's full. **/
+    void append(
+        const void *data,
+        int nbytes
+    ) noexcept {
+        auto src = (const agm::uint8 *) data;
+        while (nbytes > 0 && fd_ >= 0) {
+            int n = std::min(nbytes, kStageBytes - stage_used_);
+            std::memcpy(stage_ + stage_used_, src, n);
+            stage_used_ += n;
+            file_bytes_ += n;
+            src += n;
+            nbytes -= n;
+            if (stage_used_ == kStageBytes) {
+                flushStage(kStageBytes);
+            }
+        }
+    }
+
+    /**
+    write the staging buffer.
+    direct io requires the size be a multiple of the alignment.
+    **/
+    void flushStage(
+        int nbytes
+    ) noexcept {
+        auto start = agm::time::microseconds();
+        auto src = stage_;
+        while (nbytes > 0) {
+            auto written = write(fd_, src, nbytes);
+            if (written <= 0) {
+                LOG("RecorderThread Failed to write file: "<<file_name_);
+                close(fd_);
+                fd_ = -1;
+                break;
+            }
+            src += written;
+            nbytes -= written;
+        }
+        stage_used_ = 0;
+        auto elapsed = agm::time::microseconds() - start;
+        time_write_->record(elapsed);
+        write_time_ += elapsed;
+    }
+
+    /**
+    write the timestamps and whatever's left in the staging buffer.
+    padded to the alignment.
+    then fix the header and the file size without direct io.
+    **/
+    void finishFile() noexcept {
+        if (file_name_.empty()) {
+            return;
+        }
+        if (fd_ >= 0) {
+            int nframes = timestamps_.size();
+            append(timestamps_.data(), nframes * sizeof(agm::int64));
+            if (fd_ >= 0) {
+                int padded = (stage_used_ + kAlignBytes - 1) / kAlignBytes * kAlignBytes;
+                std::memset(stage_ + stage_used_, 0, padded - stage_used_);
+                flushStage(padded);
+            }
+            if (fd_ >= 0) {
+                close(fd_);
+                fd_ = open(file_name_.c_str(), O_WRONLY);
+            }
+            if (fd_ >= 0) {
+                agm::uint8 header[kSerHeaderBytes];
+                fillHeader(header, nframes);
+                auto written = pwrite(fd_, header, kSerHeaderBytes, 0);
+                int result = ftruncate(fd_, file_bytes_);
+                if (written != kSerHeaderBytes || result != 0) {
+                    LOG("RecorderThread Failed to finish file: "<<file_name_);
+                }
+                close(fd_);
+                fd_ = -1;
+            }
+            showStats(true);
+            LOG("RecorderThread Recorded "<<nframes<<" frames to file: "<<file_name_);
+        }
+        file_name_.clear();
+        timestamps_.clear();
+    }
+
+    void fillHeader(
+        agm::uint8 *header,
+        int nframes
+    ) noexcept {
+        std::memset(header, 0, kSerHeaderBytes);
+        std::memcpy(header, "LUCAM-RECORDER", 14);
+        int pos = 14;
+        putInt32(header, pos, 0);
+        putInt32(header, pos, mono_ ? kSerColorMono : kSerColorBayer[(int) bayer_pattern_]);
+        /** most readers take 0 to mean little endian despite the spec. **/
+        putInt32(header, pos, 0);
+        putInt32(header, pos, width_);
+        putInt32(header, pos, height_);
+        putInt32(header, pos, 16);
+        putInt32(header, pos, nframes);
+        std::strncpy((char *) header + pos, "zwo", 40);
+        pos += 40;
+        std::strncpy((char *) header + pos, "ZWO ASI", 40);
+        pos += 40;
+        pos += 40;
+        agm::int64 utc = 0;
+        if (timestamps_.size()) {
+            utc = timestamps_[0];
+        }
+        putInt64(header, pos, utc);
+        putInt64(header, pos, utc);
+    }
+
+    void putInt32(
+        agm::uint8 *header,
+        int &pos,
+        int value
+    ) noexcept {
+        for (int i = 0; i < 4; ++i) {
+            header[pos++] = value >> (8 * i);
+        }
+    }
+
+    void putInt64(
+        agm::uint8 *header,
+        int &pos,
+        agm::int64 value
+    ) noexcept {
+        for (int i = 0; i < 8; ++i) {
+            header[pos++] = value >> (8 * i);
+        }
+    }
+
+    void showStats(
+        bool force
+    ) noexcept {
+        if (fd_ < 0 && force == false) {
+            return;
+        }
+        auto now = agm::time::microseconds();
+        if (force == false && now - stats_time_ < 3000000LL) {
+            return;
+        }
+        stats_time_ = now;
+
+        auto stats = image_ring_->getStats(ring_consumer_);
+        double elapsed = double(now - start_time_) / 1000000.0;
+        double mb = double(file_bytes_) / (1024.0 * 1024.0);
+        double busy = 0.0;
+        if (now > start_time_) {
+            busy = 100.0 * double(write_time_) / double(now - start_time_);
+        }
+        LOG("RecorderThread frames: "<<timestamps_.size()
+            <<" MB/s: "<<(elapsed > 0.0 ? mb / elapsed : 0.0)
+            <<" disk busy: "<<busy<<"%"
+            <<" max lag: "<<max_lag_
+            <<" overwritten: "<<stats.overwritten_ - start_overwritten_);
+    }
+};
+}
+
+agm::Thread *createRecorderThread(
+    ImageRing *image_ring,
+    SettingsBuffer *settings_buffer,
+    PerfStats *perf_stats,
+    FramePool *frame_pool
+) noexcept {
+    return new(std::nothrow) RecorderThread(image_ring, settings_buffer, perf_stats, frame_pool);
+}
@@ -0,0 +1,197 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+replay recorded frames in place of the camera.
+
+so the pipeline can be run and profiled without a camera.
+the frames are read from a SER sequence or tiffs.
+they're published to the image ring just like the capture thread does.
+the replay loops forever.
+
+the frames are paced by the exposure setting like a camera.
+unless a fixed frame rate is given.
+the region of interest and binning are ignored.
+**/
+
+#include <algorithm>
+#include <string>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+#include <aggiornamento/master.h>
+#include <aggiornamento/thread.h>
+
+#include <shared/frame_reader.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/settings_buffer.h>
+
+
+namespace {
+class ReplayThread : public agm::Thread {
+public:
+    /** share data with the windows thread. **/
+    ImageRing *image_ring_ = nullptr;
+    ImageBuffer *img_ = nullptr;
+    /** share data with the menu thread. **/
+    SettingsBuffer *settings_buffer_ = nullptr;
+    SettingsSnapshot settings_;
+    /** where the time goes. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_frame_ = nullptr;
+    LatencyHistogram *time_read_ = nullptr;
+    LatencyHistogram *time_stats_ = nullptr;
+    LatencyHistogram *time_publish_ = nullptr;
+
+    /** where the frames come from. **/
+    std::string path_;
+    FrameReader reader_;
+    int next_frame_ = 0;
+    /** frames per second. 0 means pace by the exposure. **/
+    double fps_ = 0.0;
+    int exposure_ = 0;
+    agm::int64 next_time_ = 0;
+
+    ReplayThread(
+        ImageRing *image_ring,
+        SettingsBuffer *settings_buffer,
+        PerfStats *perf_stats,
+        const std::string &path,
+        double fps
+    ) noexcept : agm::Thread("ReplayThread") {
+        image_ring_ = image_ring;
+        settings_buffer_ = settings_buffer;
+        perf_stats_ = perf_stats;
+        path_ = path;
+        fps_ = fps;
+    }
+
+    virtual ~ReplayThread() = default;
+
+    virtual void begin() noexcept {
+        LOG("ReplayThread.");
+        static const char *kThread = "ReplayThread";
+        time_frame_ = perf_stats_->addStage(kThread, "frame");
+        time_read_ = perf_stats_->addStage(kThread, "read");
+        time_stats_ = perf_stats_->addStage(kThread, "stats");
+        time_publish_ = perf_stats_->addStage(kThread, "publish");
+
+        bool success = reader_.open(path_);
+        if (success == false) {
+            LOG("ReplayThread Aborting.");
+            LOG("  Failed to open: "<<path_);
+            agm::master::setDone();
+            return;
+        }
+        if (fps_ > 0.0) {
+            LOG("ReplayThread Replaying at "<<fps_<<" frames per second.");
+        } else {
+            LOG("ReplayThread Replaying at the exposure time.");
+        }
+
+        /** allocate all of the buffers in the ring once. **/
+        image_ring_->allocate(reader_.getWidth(), reader_.getHeight());
+        copySettings();
+        next_time_ = agm::time::microseconds();
+    }
+
+    virtual void runOnce() noexcept {
+        /** the ring never makes us wait for the window thread. **/
+        ScopedTimer frame_timer(time_frame_);
+        if (img_ == nullptr) {
+            img_ = image_ring_->acquireWrite();
+        }
+        if (img_ == nullptr || img_->width_ == 0) {
+            return;
+        }
+
+        copySettings();
+        waitForFrameTime();
+
+        /** read the next frame. **/
+        img_->allocate(reader_.getWidth(), reader_.getHeight());
+        bool success = false;
+        {
+            ScopedTimer timer(time_read_);
+            success = reader_.read(next_frame_, img_->bayer_);
+        }
+        if (success == false) {
+            LOG("ReplayThread Aborting.");
+            LOG("  Failed to read frame "<<next_frame_<<" of "<<path_);
+            agm::master::setDone();
+            return;
+        }
+        ++next_frame_;
+        if (next_frame_ >= reader_.getFrameCount()) {
+            next_frame_ = 0;
+        }
+
+        /** compute the stats once for all consumers. **/
+        {
+            ScopedTimer timer(time_stats_);
+            auto data = (const agm::uint16 *) img_->bayer_.data;
+            img_->stats_.compute(data, img_->width_, img_->height_, 65535);
+        }
+
+        /** pretend it was captured with the current settings. **/
+        img_->exposure_ = exposure_;
+        img_->bin_ = 1;
+        img_->bayer_pattern_ = reader_.getBayerPattern();
+        img_->temperature_ = 0;
+
+        /** give the image to the consumers. **/
+        {
+            ScopedTimer timer(time_publish_);
+            image_ring_->publish(img_);
+        }
+        img_ = nullptr;
+    }
+
+    /** the menu shows the exposure we're pretending to use. **/
+    void copySettings() noexcept {
+        bool changed = settings_.update(settings_buffer_);
+        if (changed == false) {
+            return;
+        }
+        exposure_ = std::max(settings_->exposure_, 1);
+        settings_buffer_->current_exposure_.store(exposure_, std::memory_order_relaxed);
+    }
+
+    /**
+    sleep until it's time for the next frame.
+    if we fall behind start over from now.
+    rather than replaying a burst to catch up.
+    **/
+    void waitForFrameTime() noexcept {
+        agm::int64 period = exposure_;
+        if (fps_ > 0.0) {
+            period = agm::int64(1000000.0 / fps_);
+        }
+        auto now = agm::time::microseconds();
+        if (next_time_ > now) {
+            auto wait_ms = int((next_time_ - now + 999) / 1000);
+            agm::sleep::milliseconds(wait_ms);
+        } else {
+            next_time_ = now;
+        }
+        next_time_ += period;
+    }
+
+    virtual void end() noexcept {
+        reader_.close();
+        LOG("ReplayThread Closed: "<<path_);
+    }
+};
+}
+
+agm::Thread *createReplayThread(
+    ImageRing *image_ring,
+    SettingsBuffer *settings_buffer,
+    PerfStats *perf_stats,
+    const std::string &path,
+    double fps
+) noexcept {
+    return new(std::nothrow) ReplayThread(image_ring, settings_buffer, perf_stats, path, fps);
+}
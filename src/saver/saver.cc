@@ -0,0 +1,288 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+save images to files.
+
+the window thread queues the images.
+so it never waits for the disk.
+**/
+
+#include <sstream>
+
+#include <opencv2/opencv.hpp>
+#include <tiffio.h>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+#include <aggiornamento/thread.h>
+
+#include <shared/frame_pool.h>
+#include <shared/perf_stats.h>
+#include <shared/save_queue.h>
+#include <shared/settings_buffer.h>
+
+
+namespace {
+class SaverThread : public agm::Thread {
+public:
+    /** share data with the window thread. **/
+    SaveQueue *save_queue_ = nullptr;
+    /** share data with the menu thread. **/
+    SettingsBuffer *settings_buffer_ = nullptr;
+    /** how long saves take. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_save_ = nullptr;
+    /** the scanline is reused for every save. **/
+    FramePool *frame_pool_ = nullptr;
+    cv::Mat scanline_;
+
+    SaverThread(
+        SaveQueue *save_queue,
+        SettingsBuffer *settings_buffer,
+        PerfStats *perf_stats,
+        FramePool *frame_pool
+    ) noexcept : agm::Thread("SaverThread") {
+        save_queue_ = save_queue;
+        settings_buffer_ = settings_buffer;
+        perf_stats_ = perf_stats;
+        frame_pool_ = frame_pool;
+    }
+
+    virtual ~SaverThread() = default;
+
+    virtual void begin() noexcept {
+        LOG("SaverThread.");
+        time_save_ = perf_stats_->addStage("SaverThread", "save");
+    }
+
+    virtual void runOnce() noexcept {
+        /** wait for an image. **/
+        SaveJob job;
+        bool got_job = save_queue_->pop(job);
+        if (got_job == false) {
+            return;
+        }
+
+        auto start = agm::time::microseconds();
+        bool success = false;
+        const char *what = "";
+        switch (job.format_) {
+        case SaveJob::Format::k8Bit:
+            success = saveImage8(job);
+            what = "gamma corrected 8 bit image";
+            break;
+        case SaveJob::Format::k16Bit:
+            success = saveImage16(job);
+            what = "raw image to 16 bit tiff";
+            break;
+        case SaveJob::Format::k32Bit:
+            success = saveImage32(job);
+            what = "stacked image to 32 bit tiff";
+            break;
+        }
+        auto elapsed = agm::time::microseconds() - start;
+        time_save_->record(elapsed);
+        auto elapsed_ms = elapsed / 1000;
+
+        /** report the result to the log and the menu. **/
+        std::stringstream ss;
+        if (success) {
+            ss<<"Saved "<<what<<" file: "<<job.file_name_<<" in "<<elapsed_ms<<" ms.";
+        } else {
+            ss<<"Failed to save "<<what<<" file: "<<job.file_name_;
+        }
+        LOG("SaverThread "<<ss.str());
+        SettingsLock lock(settings_buffer_);
+        settings_buffer_->save_status_ = ss.str();
+    }
+
+    /** save the 8 bit image using opencv. **/
+    bool saveImage8(
+        const SaveJob &job
+    ) noexcept {
+        /** this is why you do not throw exceptions ever. **/\
+        bool success = false;
+        try {
+            success = cv::imwrite(job.file_name_, job.image_);
+        } catch (const cv::Exception& ex) {
+            LOG("SaverThread Failed to save image to file: "<<job.file_name_<<" OpenCV reason: "<<ex.what());
+        }
+        return success;
+    }
+
+    /** save the raw 16 bit image using tiff. **/
+    bool saveImage16(
+        const SaveJob &job
+    ) noexcept {
+        /** create the tiff file. **/
+        TIFF *tiff = TIFFOpen(job.file_name_.c_str(), "w");
+        if (tiff == nullptr) {
+            LOG("SaverThread Failed to create tiff file: "<<job.file_name_);
+            return false;
+        }
+
+        /** do some tiff things. **/
+        int wd = job.image_.cols;
+        int ht = job.image_.rows;
+        TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, wd);
+        TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, ht);
+        TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 3);
+        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 16);
+        TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+        TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+
+        /** after we do the above. **/
+        int default_strip_size = TIFFDefaultStripSize(tiff, 3 * wd);
+        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, default_strip_size);
+
+        /** allocate a tiff-sized scanline. **/
+        int scanline_size = TIFFScanlineSize(tiff);
+        auto buffer = getScanline(scanline_size);
+
+        /** zero the trailing bytes. **/
+        int src_sz = 3 * sizeof(agm::int16) * wd;
+        for (int i = src_sz; i < scanline_size; ++i) {
+            buffer[i] = 0;
+        }
+
+        /** write all scanlines. **/
+        bool success = true;
+        auto src = (agm::int16 *) job.image_.data;
+        for (int y = 0; y < ht; ++y) {
+            auto dst = (agm::int16 *) buffer;
+            for (int x = 0; x < wd; ++x) {
+                /** convert opencv BGR to tiff RGB. **/
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                src += 3;
+                dst += 3;
+            }
+            int result = TIFFWriteScanline(tiff, buffer, y, 0);
+            if (result < 0) {
+                success = false;
+                break;
+            }
+        }
+
+        if (success == false) {
+            LOG("SaverThread Failed to write tiff file: "<<job.file_name_);
+        }
+
+        TIFFClose(tiff);
+
+        return success;
+    }
+
+    /** save the 32 bit image using tiff. **/
+    bool saveImage32(
+        const SaveJob &job
+    ) noexcept {
+        /** create the tiff file. **/
+        TIFF *tiff = TIFFOpen(job.file_name_.c_str(), "w");
+        if (tiff == nullptr) {
+            LOG("SaverThread Failed to create tiff file: "<<job.file_name_);
+            return false;
+        }
+
+        /** do some tiff things. **/
+        int wd = job.image_.cols;
+        int ht = job.image_.rows;
+        TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, wd);
+        TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, ht);
+        TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 3);
+        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 32);
+        TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+        TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+        TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+        TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+
+        /** after we do the above. **/
+        int default_strip_size = TIFFDefaultStripSize(tiff, 3 * wd);
+        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, default_strip_size);
+
+        /** allocate a tiff-sized scanline. **/
+        int scanline_size = TIFFScanlineSize(tiff);
+        auto buffer = getScanline(scanline_size);
+
+        /** zero the trailing bytes. **/
+        int src_sz = 3 * sizeof(agm::int32) * wd;
+        for (int i = src_sz; i < scanline_size; ++i) {
+            buffer[i] = 0;
+        }
+
+        /** find the max for scaling unless the window thread knows it. **/
+        int scale = job.scale_;
+        auto src = (agm::int32 *) job.image_.data;
+        if (scale <= 0) {
+            int sz = 3 * ht * wd;
+            for (int i = 0; i < sz; ++i) {
+                int val = *src++;
+                scale = std::max(scale, val);
+            }
+        }
+        /** avoid dividing by zero when the stack is all black. **/
+        scale = std::max(scale, 1);
+
+        /** write all scanlines. **/
+        bool success = true;
+        src = (agm::int32 *) job.image_.data;
+        for (int y = 0; y < ht; ++y) {
+            auto dst = (agm::int32 *) buffer;
+            for (int x = 0; x < wd; ++x) {
+                /** convert opencv BGR to tiff RGB. **/
+                dst[0] = scale32(src[2], scale);
+                dst[1] = scale32(src[1], scale);
+                dst[2] = scale32(src[0], scale);
+                src += 3;
+                dst += 3;
+            }
+            int result = TIFFWriteScanline(tiff, buffer, y, 0);
+            if (result < 0) {
+                success = false;
+                break;
+            }
+        }
+
+        if (success == false) {
+            LOG("SaverThread Failed to write tiff file: "<<job.file_name_);
+        }
+
+        TIFFClose(tiff);
+
+        return success;
+    }
+
+    /** a tiff-sized scanline. only allocated when the size changes. **/
+    char *getScanline(
+        int size
+    ) noexcept {
+        frame_pool_->create(scanline_, 1, size, CV_8UC1);
+        return (char *) scanline_.data;
+    }
+
+    int scale32(
+        int src,
+        int scale
+    ) noexcept {
+        static const int kInt32Max = 0x7FFFFFFF;
+        agm::int64 x = src;
+        x *= kInt32Max;
+        x /= scale;
+        return (int) x;
+    }
+};
+}
+
+agm::Thread *createSaverThread(
+    SaveQueue *save_queue,
+    SettingsBuffer *settings_buffer,
+    PerfStats *perf_stats,
+    FramePool *frame_pool
+) noexcept {
+    return new(std::nothrow) SaverThread(save_queue, settings_buffer, perf_stats, frame_pool);
+}
@@ -0,0 +1,32 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+**/
+
+#include <aggiornamento/aggiornamento.h>
+
+#include "command_queue.h"
+
+
+void CommandQueue::push(
+    MenuCommand &&cmd
+) noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_.push_back(std::move(cmd));
+    count_.store(commands_.size(), std::memory_order_release);
+}
+
+bool CommandQueue::pop(
+    MenuCommand &cmd
+) noexcept {
+    if (count_.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (commands_.empty()) {
+        return false;
+    }
+    cmd = std::move(commands_.front());
+    commands_.pop_front();
+    count_.store(commands_.size(), std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,74 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+
+one shot requests from the menu thread to the window and solver threads.
+and lines of menu input from remote clients to the menu thread.
+and the menu's answers back to them.
+each thread has its own queue.
+
+the thread checks for commands every frame.
+the check is one atomic load.
+the lock is only taken when there's a command.
+**/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+
+
+class MenuCommand {
+public:
+    enum class Type {
+        /** save the display or stacked image. **/
+        kSaveImage,
+        /** save the 16 bit debayered image. **/
+        kSaveRaw,
+        /** build a master calibration frame. **/
+        kBuildMaster,
+        /** plate solve the next frame. **/
+        kSolve,
+        /** plate solve the next frame and sync the mount to it. **/
+        kSyncMount,
+        /** plate solve the next frame as a step of polar alignment. **/
+        kPolarAlign,
+        /** a line of menu input from a remote client. **/
+        kMenuInput,
+        /** the menu's answer to the remote client. **/
+        kMenuReply
+    };
+
+    Type type_ = Type::kSaveImage;
+    /** the file name. or bias, dark, or flat. or the star index. or the menu input or answer. **/
+    std::string name_;
+    /** the number of frames in the master. or -1 to restart polar alignment. **/
+    int frames_ = 0;
+    /** the remote client that sent the menu input. the answer goes back to it. **/
+    int client_ = -1;
+
+    MenuCommand() noexcept = default;
+    ~MenuCommand() noexcept = default;
+};
+
+class CommandQueue {
+public:
+    CommandQueue() noexcept = default;
+    CommandQueue(const CommandQueue &) = delete;
+    ~CommandQueue() noexcept = default;
+
+    /** never waits. **/
+    void push(MenuCommand &&cmd) noexcept;
+
+    /**
+    never waits.
+    returns false if there are no commands.
+    **/
+    bool pop(MenuCommand &cmd) noexcept;
+
+private:
+    std::mutex mutex_;
+    std::deque<MenuCommand> commands_;
+    std::atomic<int> count_{0};
+};
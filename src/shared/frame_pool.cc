@@ -0,0 +1,229 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+the buffers are mapped anonymous memory.
+page aligned. whole pages. and zero the first time they're touched.
+**/
+
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "frame_pool.h"
+
+
+namespace {
+    /**
+    free the buffers of a size nobody asked for in this long.
+    in steady state most matrices keep their buffers and never ask.
+    so count time. not requests.
+    **/
+    const agm::int64 kIdleMicroseconds = 5 * 1000 * 1000;
+}
+
+FramePool::~FramePool() noexcept {
+    trim();
+}
+
+void FramePool::setLockPages(
+    bool lock
+) noexcept {
+    lock_pages_ = lock;
+}
+
+void FramePool::create(
+    cv::Mat &mat,
+    int rows,
+    int cols,
+    int type
+) noexcept {
+    if (mat.allocator != this) {
+        mat.release();
+        mat.allocator = this;
+    }
+    mat.create(rows, cols, type);
+}
+
+void FramePool::trim() noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = sizes_.begin(); it != sizes_.end(); ) {
+        auto &size_class = it->second;
+        for (auto ptr : size_class.free_) {
+            munmap(ptr, it->first);
+            stats_.bytes_ -= it->first;
+            stats_.free_bytes_ -= it->first;
+        }
+        size_class.free_.clear();
+        it = sizes_.erase(it);
+    }
+}
+
+void FramePool::trimIdle() noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    freeIdle(agm::time::microseconds());
+}
+
+FramePoolStats FramePool::getStats() noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+/** the same as the standard allocator except where the bytes come from. **/
+cv::UMatData *FramePool::allocate(
+    int dims,
+    const int *sizes,
+    int type,
+    void *data,
+    size_t *step,
+    cv::AccessFlag flags,
+    cv::UMatUsageFlags usage
+) const noexcept {
+    /** the caller's own buffer isn't ours. **/
+    auto std_allocator = cv::Mat::getStdAllocator();
+    if (data) {
+        return std_allocator->allocate(dims, sizes, type, data, step, flags, usage);
+    }
+
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; --i) {
+        total *= sizes[i];
+    }
+    auto ptr = getBuffer(total);
+    if (ptr == nullptr) {
+        return std_allocator->allocate(dims, sizes, type, data, step, flags, usage);
+    }
+
+    if (step) {
+        size_t bytes = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; --i) {
+            step[i] = bytes;
+            bytes *= sizes[i];
+        }
+    }
+    auto u = new(std::nothrow) cv::UMatData(this);
+    if (u == nullptr) {
+        putBuffer(ptr, total);
+        return nullptr;
+    }
+    u->data = u->origdata = (agm::uint8 *) ptr;
+    u->size = total;
+    return u;
+}
+
+bool FramePool::allocate(
+    cv::UMatData *data,
+    cv::AccessFlag flags,
+    cv::UMatUsageFlags usage
+) const noexcept {
+    (void) flags;
+    (void) usage;
+    return (data != nullptr);
+}
+
+void FramePool::deallocate(
+    cv::UMatData *data
+) const noexcept {
+    if (data == nullptr) {
+        return;
+    }
+    putBuffer(data->origdata, data->size);
+    data->origdata = nullptr;
+    delete data;
+}
+
+void *FramePool::getBuffer(
+    size_t bytes
+) const noexcept {
+    bytes = roundUp(bytes);
+    auto now = agm::time::microseconds();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &size_class = sizes_[bytes];
+        size_class.last_request_ = now;
+        freeIdle(now);
+        if (size_class.free_.size()) {
+            auto ptr = size_class.free_.back();
+            size_class.free_.pop_back();
+            stats_.free_bytes_ -= bytes;
+            ++stats_.reused_;
+            return ptr;
+        }
+    }
+
+    /** map a new one without holding the lock. **/
+    void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        LOG("FramePool Failed to map "<<bytes<<" bytes.");
+        return nullptr;
+    }
+    if (lock_pages_) {
+        int result = mlock(ptr, bytes);
+        if (result != 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (warned_lock_ == false) {
+                warned_lock_ = true;
+                LOG("FramePool Failed to lock buffers in memory. Raise RLIMIT_MEMLOCK (ulimit -l).");
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.bytes_ += bytes;
+    ++stats_.allocated_;
+    return ptr;
+}
+
+void FramePool::putBuffer(
+    void *ptr,
+    size_t bytes
+) const noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    bytes = roundUp(bytes);
+    auto now = agm::time::microseconds();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &size_class = sizes_[bytes];
+    if (now - size_class.last_request_ >= kIdleMicroseconds) {
+        /** nobody wants this size anymore. munlock is implied. **/
+        munmap(ptr, bytes);
+        stats_.bytes_ -= bytes;
+        return;
+    }
+    size_class.free_.push_back(ptr);
+    stats_.free_bytes_ += bytes;
+}
+
+/** call with the lock held. **/
+void FramePool::freeIdle(
+    agm::int64 now
+) const noexcept {
+    for (auto it = sizes_.begin(); it != sizes_.end(); ) {
+        auto &size_class = it->second;
+        if (now - size_class.last_request_ < kIdleMicroseconds) {
+            ++it;
+            continue;
+        }
+        for (auto ptr : size_class.free_) {
+            munmap(ptr, it->first);
+            stats_.bytes_ -= it->first;
+            stats_.free_bytes_ -= it->first;
+        }
+        size_class.free_.clear();
+        it = sizes_.erase(it);
+    }
+}
+
+size_t FramePool::roundUp(
+    size_t bytes
+) noexcept {
+    static const size_t kPageBytes = sysconf(_SC_PAGESIZE);
+    bytes = std::max(bytes, size_t(1));
+    return (bytes + kPageBytes - 1) / kPageBytes * kPageBytes;
+}
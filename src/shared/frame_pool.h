@@ -0,0 +1,104 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+a pool of page aligned buffers for the big opencv images.
+
+a matrix created from the pool gets a buffer from the pool.
+opencv matrices are reference counted.
+so the capture, window, recorder, and saver threads share a buffer without copying it.
+the buffer goes back to the pool when the last reference is dropped.
+by whichever thread drops it.
+
+the free buffers are kept by size.
+a request for a size gets one of that size back.
+so there are no new allocations until the roi or the binning changes.
+the buffers of a size nobody has asked for in a few seconds are freed.
+the image ring frees them right away when the roi or the binning changes.
+
+the buffers may be locked in memory.
+so the camera driver and the disk writes never wait for a page fault.
+locking needs a big enough RLIMIT_MEMLOCK.
+it's skipped if it fails.
+**/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class FramePoolStats {
+public:
+    /** buffers in use and free. **/
+    agm::int64 bytes_ = 0;
+    agm::int64 free_bytes_ = 0;
+    /** requests served by a new buffer or by a free one. **/
+    agm::int64 allocated_ = 0;
+    agm::int64 reused_ = 0;
+};
+
+class FramePool : public cv::MatAllocator {
+public:
+    FramePool() noexcept = default;
+    FramePool(const FramePool &) = delete;
+    virtual ~FramePool() noexcept;
+
+    /** lock new buffers in memory. call before the threads start. **/
+    void setLockPages(bool lock) noexcept;
+
+    /**
+    make the matrix use the pool and create it.
+    keeps the buffer if the size and type didn't change.
+    other opencv functions that write the matrix use the pool too.
+    **/
+    void create(cv::Mat &mat, int rows, int cols, int type) noexcept;
+
+    /** free all of the free buffers. **/
+    void trim() noexcept;
+
+    /** free the buffers of the sizes nobody has asked for in a while. **/
+    void trimIdle() noexcept;
+
+    FramePoolStats getStats() noexcept;
+
+    /** cv::MatAllocator. **/
+    virtual cv::UMatData *allocate(
+        int dims,
+        const int *sizes,
+        int type,
+        void *data,
+        size_t *step,
+        cv::AccessFlag flags,
+        cv::UMatUsageFlags usage
+    ) const noexcept;
+    virtual bool allocate(cv::UMatData *data, cv::AccessFlag flags, cv::UMatUsageFlags usage) const noexcept;
+    virtual void deallocate(cv::UMatData *data) const noexcept;
+
+private:
+    /** the buffers of one size. **/
+    class SizeClass {
+    public:
+        std::vector<void *> free_;
+        /** microseconds when this size was last asked for. **/
+        agm::int64 last_request_ = 0;
+    };
+
+    bool lock_pages_ = false;
+    /** opencv calls the allocator through const pointers. **/
+    mutable std::mutex mutex_;
+    mutable std::map<size_t, SizeClass> sizes_;
+    mutable bool warned_lock_ = false;
+    mutable FramePoolStats stats_;
+
+    void *getBuffer(size_t bytes) const noexcept;
+    void putBuffer(void *ptr, size_t bytes) const noexcept;
+    void freeIdle(agm::int64 now) const noexcept;
+    static size_t roundUp(size_t bytes) noexcept;
+};
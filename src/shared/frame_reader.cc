@@ -0,0 +1,310 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+**/
+
+#include <algorithm>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <tiffio.h>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "frame_reader.h"
+
+
+namespace {
+    /** the SER header. same as the recorder. **/
+    const int kSerHeaderBytes = 178;
+    const int kSerColorOffset = 18;
+    const int kSerWidthOffset = 26;
+    const int kSerHeightOffset = 30;
+    const int kSerDepthOffset = 34;
+    const int kSerFramesOffset = 38;
+
+    agm::int32 getInt32(
+        const agm::uint8 *header,
+        int pos
+    ) noexcept {
+        agm::uint32 value = 0;
+        for (int i = 3; i >= 0; --i) {
+            value = (value << 8) | header[pos + i];
+        }
+        return agm::int32(value);
+    }
+
+    /** the ser color id to the bayer pattern. mono is treated as RGGB. **/
+    BayerPattern getSerBayer(
+        int color_id
+    ) noexcept {
+        switch (color_id) {
+        case 11:
+            return BayerPattern::kBGGR;
+        case 9:
+            return BayerPattern::kGRBG;
+        case 10:
+            return BayerPattern::kGBRG;
+        }
+        return BayerPattern::kRGGB;
+    }
+
+    bool isTiffName(
+        const std::string &name
+    ) noexcept {
+        auto pos = name.rfind('.');
+        if (pos == std::string::npos) {
+            return false;
+        }
+        auto ext = name.substr(pos + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return (ext == "tif" || ext == "tiff");
+    }
+}
+
+FrameReader::~FrameReader() noexcept {
+    close();
+}
+
+bool FrameReader::open(
+    const std::string &path
+) noexcept {
+    close();
+
+    bool result = false;
+    auto pos = path.rfind('.');
+    std::string ext;
+    if (pos != std::string::npos) {
+        ext = path.substr(pos + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    }
+    if (ext == "ser") {
+        result = openSer(path);
+    } else {
+        result = openTiffs(path);
+    }
+    if (result == false) {
+        close();
+        return false;
+    }
+
+    static const char *kBayerNames[] = {"RGGB", "BGGR", "GRBG", "GBRG"};
+    LOG("FrameReader Opened "<<path<<": "<<nframes_<<" frames "<<width_<<"x"<<height_
+        <<" "<<kBayerNames[(int) bayer_pattern_]);
+    return true;
+}
+
+void FrameReader::close() noexcept {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    tiff_files_.clear();
+    width_ = 0;
+    height_ = 0;
+    nframes_ = 0;
+    bayer_pattern_ = BayerPattern::kRGGB;
+}
+
+bool FrameReader::read(
+    int index,
+    cv::Mat &bayer
+) noexcept {
+    if (index < 0 || index >= nframes_) {
+        return false;
+    }
+    bayer.create(height_, width_, CV_16UC1);
+    if (fd_ >= 0) {
+        return readSer(index, bayer);
+    }
+    return readTiff(tiff_files_[index], bayer, false);
+}
+
+/**
+the little endian field is ambiguous.
+every writer we care about writes little endian data.
+including the recorder.
+so we ignore it.
+**/
+bool FrameReader::openSer(
+    const std::string &path
+) noexcept {
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        LOG("FrameReader Failed to open file: "<<path);
+        return false;
+    }
+
+    agm::uint8 header[kSerHeaderBytes];
+    auto nbytes = ::pread(fd_, header, kSerHeaderBytes, 0);
+    if (nbytes != kSerHeaderBytes || std::memcmp(header, "LUCAM-RECORDER", 14) != 0) {
+        LOG("FrameReader Not a SER file: "<<path);
+        return false;
+    }
+    int depth = getInt32(header, kSerDepthOffset);
+    if (depth <= 8 || depth > 16) {
+        LOG("FrameReader Unsupported SER pixel depth: "<<depth);
+        return false;
+    }
+    width_ = getInt32(header, kSerWidthOffset);
+    height_ = getInt32(header, kSerHeightOffset);
+    nframes_ = getInt32(header, kSerFramesOffset);
+    bayer_pattern_ = getSerBayer(getInt32(header, kSerColorOffset));
+    if (width_ <= 0 || height_ <= 0) {
+        LOG("FrameReader Bad SER frame size: "<<width_<<"x"<<height_);
+        return false;
+    }
+
+    /** a recording that wasn't closed has no frame count. count what's there. **/
+    struct stat st;
+    if (fstat(fd_, &st) == 0) {
+        agm::int64 frame_bytes = 2LL * width_ * height_;
+        auto available = int((st.st_size - kSerHeaderBytes) / frame_bytes);
+        if (nframes_ <= 0 || nframes_ > available) {
+            nframes_ = available;
+        }
+    }
+    if (nframes_ <= 0) {
+        LOG("FrameReader SER file has no frames: "<<path);
+        return false;
+    }
+    return true;
+}
+
+bool FrameReader::openTiffs(
+    const std::string &path
+) noexcept {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        LOG("FrameReader Failed to find: "<<path);
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        auto dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            LOG("FrameReader Failed to open directory: "<<path);
+            return false;
+        }
+        for (;;) {
+            auto entry = readdir(dir);
+            if (entry == nullptr) {
+                break;
+            }
+            std::string name = entry->d_name;
+            if (isTiffName(name)) {
+                tiff_files_.push_back(path + "/" + name);
+            }
+        }
+        closedir(dir);
+        std::sort(tiff_files_.begin(), tiff_files_.end());
+    } else {
+        tiff_files_.push_back(path);
+    }
+    if (tiff_files_.empty()) {
+        LOG("FrameReader No tiff files in: "<<path);
+        return false;
+    }
+
+    /** the first one sets the size. **/
+    cv::Mat none;
+    bool result = readTiff(tiff_files_[0], none, true);
+    if (result == false) {
+        return false;
+    }
+    nframes_ = tiff_files_.size();
+    return true;
+}
+
+bool FrameReader::readSer(
+    int index,
+    cv::Mat &bayer
+) noexcept {
+    agm::int64 frame_bytes = 2LL * width_ * height_;
+    agm::int64 offset = kSerHeaderBytes + index * frame_bytes;
+    auto dst = (char *) bayer.data;
+    while (frame_bytes > 0) {
+        auto nbytes = ::pread(fd_, dst, frame_bytes, offset);
+        if (nbytes <= 0) {
+            LOG("FrameReader Failed to read SER frame: "<<index);
+            return false;
+        }
+        dst += nbytes;
+        offset += nbytes;
+        frame_bytes -= nbytes;
+    }
+    return true;
+}
+
+/**
+read a tiff into the bayer image.
+or just get its size.
+**/
+bool FrameReader::readTiff(
+    const std::string &file_name,
+    cv::Mat &bayer,
+    bool size_only
+) noexcept {
+    TIFF *tiff = TIFFOpen(file_name.c_str(), "r");
+    if (tiff == nullptr) {
+        LOG("FrameReader Failed to open tiff file: "<<file_name);
+        return false;
+    }
+
+    agm::uint32 wd = 0;
+    agm::uint32 ht = 0;
+    agm::uint16 spp = 1;
+    agm::uint16 bps = 0;
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &wd);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &ht);
+    TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &spp);
+    TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &bps);
+
+    bool success = true;
+    if (bps != 16 || (spp != 1 && spp != 3)) {
+        LOG("FrameReader Expected a 16 bit tiff with 1 or 3 channels: "<<file_name);
+        success = false;
+    } else if (size_only) {
+        width_ = wd;
+        height_ = ht;
+    } else if (int(wd) != width_ || int(ht) != height_) {
+        LOG("FrameReader Frame size changed to "<<wd<<"x"<<ht<<": "<<file_name);
+        success = false;
+    }
+    if (success == false || size_only) {
+        TIFFClose(tiff);
+        return success;
+    }
+
+    /** pick the channel each bayer pixel would have seen. RGGB. **/
+    std::vector<agm::uint16> line(TIFFScanlineSize(tiff) / 2 + 1);
+    for (int y = 0; y < height_; ++y) {
+        int result = TIFFReadScanline(tiff, line.data(), y, 0);
+        if (result < 0) {
+            LOG("FrameReader Failed to read tiff file: "<<file_name);
+            success = false;
+            break;
+        }
+        auto dst = bayer.ptr<agm::uint16>(y);
+        if (spp == 1) {
+            std::memcpy(dst, line.data(), 2 * width_);
+            continue;
+        }
+        for (int x = 0; x < width_; ++x) {
+            int channel = 1;
+            if ((y & 1) == 0 && (x & 1) == 0) {
+                channel = 0;
+            } else if ((y & 1) && (x & 1)) {
+                channel = 2;
+            }
+            dst[x] = line[3 * x + channel];
+        }
+    }
+
+    TIFFClose(tiff);
+    return success;
+}
@@ -0,0 +1,70 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+
+read recorded frames back as raw 16 bit bayer images.
+
+the source is one of:
+a SER sequence written by the recorder.
+a 16 bit tiff.
+a directory of 16 bit tiffs read in name order.
+
+a one channel tiff is taken as bayer data.
+a three channel tiff is a saved raw image which has been debayered.
+it's sampled back to a bayer pattern.
+which is close enough to drive the pipeline.
+
+all frames must be the same size.
+**/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include "image_ring.h"
+
+
+class FrameReader {
+public:
+    FrameReader() noexcept = default;
+    FrameReader(const FrameReader &) = delete;
+    ~FrameReader() noexcept;
+
+    /** returns false if the source can't be read. **/
+    bool open(const std::string &path) noexcept;
+
+    void close() noexcept;
+
+    int getWidth() const noexcept { return width_; }
+    int getHeight() const noexcept { return height_; }
+    int getFrameCount() const noexcept { return nframes_; }
+    BayerPattern getBayerPattern() const noexcept { return bayer_pattern_; }
+
+    /**
+    read one frame into a CV_16UC1 image.
+    the image is reallocated if it's the wrong size.
+    returns false if the frame can't be read.
+    **/
+    bool read(int index, cv::Mat &bayer) noexcept;
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int nframes_ = 0;
+    BayerPattern bayer_pattern_ = BayerPattern::kRGGB;
+
+    /** the ser file. **/
+    int fd_ = -1;
+    bool big_endian_ = false;
+    /** or the tiff files. **/
+    std::vector<std::string> tiff_files_;
+
+    bool openSer(const std::string &path) noexcept;
+    bool openTiffs(const std::string &path) noexcept;
+    bool readSer(int index, cv::Mat &bayer) noexcept;
+    bool readTiff(const std::string &file_name, cv::Mat &bayer, bool size_only) noexcept;
+};
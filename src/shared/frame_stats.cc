@@ -0,0 +1,85 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+**/
+
+#include "frame_stats.h"
+
+
+void FrameStats::compute(
+    const agm::uint16 *data,
+    int width,
+    int height,
+    int saturation
+) noexcept {
+    for (int i = 0; i < kBins; ++i) {
+        hist_[i] = 0;
+    }
+
+    /** bin every step'th pair of rows. **/
+    int count = width * height;
+    int step = 1;
+    if (count > kMaxSamples) {
+        step = (count + kMaxSamples - 1) / kMaxSamples;
+    }
+
+    /**
+    one pass over the data.
+    the max, sum, and saturated count see every value. that loop vectorizes.
+    the histogram bins the sampled rows while they're in the cache.
+    the mean is the sum of 16 bit values which needs 64 bits.
+    **/
+    int mx = 0;
+    int saturated = 0;
+    int samples = 0;
+    agm::uint64 sum = 0;
+    for (int y = 0; y < height; ++y) {
+        auto row = data + y * width;
+        agm::uint32 row_sum = 0;
+        for (int x = 0; x < width; ++x) {
+            int v = row[x];
+            mx = std::max(mx, v);
+            row_sum += v;
+            saturated += (v >= saturation);
+        }
+        sum += row_sum;
+        if ((y / 2) % step == 0) {
+            for (int x = 0; x < width; ++x) {
+                ++hist_[row[x] >> kBinShift];
+            }
+            samples += width;
+        }
+    }
+
+    valid_ = true;
+    count_ = count;
+    max_ = mx;
+    saturated_ = saturated;
+    samples_ = samples;
+    mean_ = 0.0;
+    if (count > 0) {
+        mean_ = double(sum) / double(count);
+    }
+}
+
+int FrameStats::getPercentile(
+    double fraction
+) const noexcept {
+    if (samples_ <= 0) {
+        return 0;
+    }
+    fraction = std::max(0.0, std::min(fraction, 1.0));
+    double target = fraction * double(samples_);
+    double below = 0.0;
+    for (int i = 0; i < kBins; ++i) {
+        int n = hist_[i];
+        if (n > 0 && below + n >= target) {
+            /** interpolate within the bin. **/
+            double t = (target - below) / double(n);
+            int lo = i << kBinShift;
+            int x = lo + int(t * double(1 << kBinShift));
+            return std::min(x, max_);
+        }
+        below += n;
+    }
+    return max_;
+}
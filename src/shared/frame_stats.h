@@ -0,0 +1,53 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+
+statistics of a raw bayer frame.
+
+computed once by the capture thread while the frame is still in the cache.
+they travel with the frame through the ring.
+so the consumers don't need to scan the frame again.
+**/
+
+#pragma once
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class FrameStats {
+public:
+    FrameStats() noexcept = default;
+    FrameStats(const FrameStats &) = default;
+    FrameStats &operator=(const FrameStats &) = default;
+    ~FrameStats() noexcept = default;
+
+    /** the histogram bins are the high 8 bits of the 16 bit values. **/
+    static const int kBins = 256;
+    static const int kBinShift = 8;
+    /**
+    the histogram samples pairs of rows. so it sees all four bayer colors.
+    big frames skip pairs to bin about this many values.
+    **/
+    static const int kMaxSamples = 512 * 1024;
+
+    bool valid_ = false;
+    int count_ = 0;
+    int max_ = 0;
+    double mean_ = 0.0;
+    /** number of values at or above the saturation level. **/
+    int saturated_ = 0;
+    /** the number of values in the histogram. **/
+    int samples_ = 0;
+    int hist_[kBins] = {0};
+
+    /**
+    compute the stats for a width x height 16 bit bayer image.
+    saturation is the value the sensor reports when it's full.
+    **/
+    void compute(const agm::uint16 *data, int width, int height, int saturation) noexcept;
+
+    /**
+    estimate the value below which fraction of the values lie.
+    interpolated within the histogram bin.
+    **/
+    int getPercentile(double fraction) const noexcept;
+};
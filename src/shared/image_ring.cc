@@ -0,0 +1,358 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+**/
+
+/**
+each slot has a reader count and a sequence number.
+the reader count is -1 while the producer owns the slot.
+readers increment it.
+the producer takes a slot by changing it from 0 to -1.
+so a slot is never written while someone reads it.
+and the sequence number of a slot can't change while it's read.
+
+the producer only takes the lock to wake sleeping consumers.
+consumers hold the lock just long enough to check for a new frame.
+**/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <aggiornamento/log.h>
+
+#include "image_ring.h"
+
+
+// use an anonymous namespace to avoid name collisions at link time.
+namespace {
+    class Slot {
+    public:
+        ImageBuffer img_;
+        std::atomic<int> readers_{0};
+        std::atomic<agm::int64> sequence_{0};
+    };
+
+    class Consumer {
+    public:
+        ImageRing::Policy policy_ = ImageRing::Policy::kLatest;
+        /** the last sequence number seen. **/
+        agm::int64 last_ = 0;
+        std::atomic<agm::int64> consumed_{0};
+        std::atomic<agm::int64> dropped_{0};
+        std::atomic<agm::int64> overwritten_{0};
+    };
+
+    class ImageRingImpl : public ImageRing {
+    public:
+        ImageRingImpl() = default;
+        ImageRingImpl(const ImageRingImpl &) = delete;
+        virtual ~ImageRingImpl() noexcept {
+            delete[] slots_;
+        }
+
+        Slot *slots_ = nullptr;
+        int nslots_ = 0;
+        Consumer consumers_[kMaxConsumers];
+        int nconsumers_ = 0;
+        std::atomic<int> latest_{-1};
+        std::atomic<agm::int64> published_{0};
+        std::atomic<bool> unblocked_{false};
+        std::mutex mutex_;
+        std::condition_variable cv_;
+
+        Slot *findSlot(
+            const ImageBuffer *img
+        ) noexcept {
+            for (int i = 0; i < nslots_; ++i) {
+                if (&slots_[i].img_ == img) {
+                    return &slots_[i];
+                }
+            }
+            return nullptr;
+        }
+
+        /** try to become a reader of the slot. **/
+        bool tryRead(
+            Slot *slot
+        ) noexcept {
+            int readers = slot->readers_.load();
+            while (readers >= 0) {
+                if (slot->readers_.compare_exchange_weak(readers, readers + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /** newest published frame for the latest policy. **/
+        ImageBuffer *tryReadLatest(
+            Consumer *consumer
+        ) noexcept {
+            int idx = latest_.load();
+            if (idx < 0) {
+                return nullptr;
+            }
+            auto slot = &slots_[idx];
+            if (tryRead(slot) == false) {
+                return nullptr;
+            }
+            agm::int64 seq = slot->sequence_.load();
+            if (seq <= consumer->last_) {
+                slot->readers_.fetch_sub(1);
+                return nullptr;
+            }
+            consumer->dropped_ += seq - consumer->last_ - 1;
+            consumer->last_ = seq;
+            ++consumer->consumed_;
+            return &slot->img_;
+        }
+
+        /**
+        the next frame in order for the every policy.
+        if it was overwritten then the oldest frame after it.
+        **/
+        ImageBuffer *tryReadNext(
+            Consumer *consumer
+        ) noexcept {
+            agm::int64 want = consumer->last_ + 1;
+            if (want > published_.load()) {
+                return nullptr;
+            }
+
+            Slot *best = nullptr;
+            agm::int64 best_seq = 0;
+            for (int i = 0; i < nslots_; ++i) {
+                auto slot = &slots_[i];
+                if (tryRead(slot) == false) {
+                    continue;
+                }
+                agm::int64 seq = slot->sequence_.load();
+                if (seq >= want && (best == nullptr || seq < best_seq)) {
+                    if (best) {
+                        best->readers_.fetch_sub(1);
+                    }
+                    best = slot;
+                    best_seq = seq;
+                } else {
+                    slot->readers_.fetch_sub(1);
+                }
+            }
+            if (best == nullptr) {
+                return nullptr;
+            }
+            consumer->overwritten_ += best_seq - want;
+            consumer->last_ = best_seq;
+            ++consumer->consumed_;
+            return &best->img_;
+        }
+    };
+}
+
+void ImageBuffer::allocate(
+    int width,
+    int height
+) noexcept {
+    if (width_ == width && height_ == height) {
+        return;
+    }
+    const int kBytesPerPixel = 2;
+    width_ = width;
+    height_ = height;
+    bytes_ = kBytesPerPixel * width * height;
+    if (pool_) {
+        pool_->create(bayer_, height, width, CV_16UC1);
+        /** the old size is likely idle now. don't keep it mapped or locked. **/
+        pool_->trimIdle();
+    } else {
+        bayer_ = cv::Mat(height, width, CV_16UC1);
+    }
+}
+
+ImageRing::ImageRing() noexcept :
+    agm::Container("ImageRing") {
+}
+
+ImageRing::~ImageRing() noexcept {
+}
+
+ImageRing *ImageRing::create(
+    int nslots,
+    FramePool *pool
+) noexcept {
+    auto impl = new(std::nothrow) ImageRingImpl;
+    impl->nslots_ = std::max(nslots, kMinSlots);
+    impl->slots_ = new(std::nothrow) Slot[impl->nslots_];
+    for (int i = 0; i < impl->nslots_; ++i) {
+        impl->slots_[i].img_.pool_ = pool;
+    }
+    return impl;
+}
+
+int ImageRing::addConsumer(
+    Policy policy
+) noexcept {
+    auto impl = (ImageRingImpl *) this;
+    if (impl->nconsumers_ >= kMaxConsumers) {
+        LOG("ImageRing Too many consumers.");
+        return -1;
+    }
+    int id = impl->nconsumers_++;
+    impl->consumers_[id].policy_ = policy;
+    if (impl->nslots_ < impl->nconsumers_ + 2) {
+        LOG("ImageRing Warning: "<<impl->nslots_<<" slots for "<<impl->nconsumers_
+            <<" consumers. Capture may wait for a free slot.");
+    }
+    return id;
+}
+
+void ImageRing::allocate(
+    int width,
+    int height
+) noexcept {
+    auto impl = (ImageRingImpl *) this;
+    for (int i = 0; i < impl->nslots_; ++i) {
+        impl->slots_[i].img_.allocate(width, height);
+    }
+}
+
+ImageBuffer *ImageRing::acquireWrite() noexcept {
+    /**
+    take the oldest slot nobody is reading.
+    which is never the latest.
+    **/
+    auto impl = (ImageRingImpl *) this;
+    for(;;) {
+        int latest = impl->latest_.load();
+        Slot *oldest = nullptr;
+        for (int i = 0; i < impl->nslots_; ++i) {
+            auto slot = &impl->slots_[i];
+            if (i == latest || slot->readers_.load() != 0) {
+                continue;
+            }
+            if (oldest == nullptr || slot->sequence_.load() < oldest->sequence_.load()) {
+                oldest = slot;
+            }
+        }
+        if (oldest) {
+            int expected = 0;
+            if (oldest->readers_.compare_exchange_strong(expected, -1)) {
+                return &oldest->img_;
+            }
+        }
+
+        /** every slot is busy. there are too many consumers. **/
+        if (impl->unblocked_) {
+            return nullptr;
+        }
+        std::this_thread::yield();
+    }
+}
+
+void ImageRing::publish(
+    ImageBuffer *img
+) noexcept {
+    auto impl = (ImageRingImpl *) this;
+    auto slot = impl->findSlot(img);
+    if (slot == nullptr) {
+        return;
+    }
+
+    agm::int64 seq = impl->published_.load() + 1;
+    img->sequence_ = seq;
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    img->timestamp_ = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+    slot->sequence_ = seq;
+    slot->readers_ = 0;
+    impl->latest_ = int(slot - impl->slots_);
+    impl->published_ = seq;
+
+    /** wake the consumers. **/
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+    }
+    impl->cv_.notify_all();
+}
+
+ImageBuffer *ImageRing::acquireRead(
+    int consumer,
+    int timeout_ms
+) noexcept {
+    auto impl = (ImageRingImpl *) this;
+    if (consumer < 0 || consumer >= impl->nconsumers_) {
+        return nullptr;
+    }
+    auto cons = &impl->consumers_[consumer];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for(;;) {
+        if (impl->unblocked_) {
+            return nullptr;
+        }
+
+        /** note the sequence number before we look. **/
+        agm::int64 published = impl->published_.load();
+
+        ImageBuffer *img = nullptr;
+        if (cons->policy_ == Policy::kLatest) {
+            img = impl->tryReadLatest(cons);
+        } else {
+            img = impl->tryReadNext(cons);
+        }
+        if (img) {
+            return img;
+        }
+
+        /** wait for the producer to publish something new. **/
+        std::unique_lock<std::mutex> lock(impl->mutex_);
+        auto ready = [&]{
+            return impl->unblocked_ || impl->published_.load() != published;
+        };
+        if (timeout_ms < 0) {
+            impl->cv_.wait(lock, ready);
+        } else {
+            bool success = impl->cv_.wait_until(lock, deadline, ready);
+            if (success == false) {
+                return nullptr;
+            }
+        }
+    }
+}
+
+void ImageRing::releaseRead(
+    int consumer,
+    ImageBuffer *img
+) noexcept {
+    (void) consumer;
+    auto impl = (ImageRingImpl *) this;
+    auto slot = impl->findSlot(img);
+    if (slot) {
+        slot->readers_.fetch_sub(1);
+    }
+}
+
+ImageRingStats ImageRing::getStats(
+    int consumer
+) noexcept {
+    auto impl = (ImageRingImpl *) this;
+    ImageRingStats stats;
+    stats.published_ = impl->published_.load();
+    if (consumer < 0 || consumer >= impl->nconsumers_) {
+        return stats;
+    }
+    auto cons = &impl->consumers_[consumer];
+    stats.consumed_ = cons->consumed_.load();
+    stats.dropped_ = cons->dropped_.load();
+    stats.overwritten_ = cons->overwritten_.load();
+    return stats;
+}
+
+/** wake all waiting consumers. **/
+void ImageRing::unblock() noexcept {
+    auto impl = (ImageRingImpl *) this;
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        impl->unblocked_ = true;
+    }
+    impl->cv_.notify_all();
+}
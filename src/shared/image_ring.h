@@ -0,0 +1,141 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+
+ring of images produced by the capture thread.
+consumed by the window thread and friends.
+
+there is one producer and any number of consumers.
+the producer never waits for a consumer.
+it writes the oldest slot nobody is reading.
+a consumer that wants the latest frame skips the frames it missed.
+those are dropped.
+a consumer that wants every frame counts the frames it missed.
+those were overwritten.
+**/
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/container.h>
+
+#include "frame_pool.h"
+#include "frame_stats.h"
+
+/**
+the color of the top left pixel and its neighbors.
+same order as the camera sdk.
+**/
+enum class BayerPattern {
+    kRGGB,
+    kBGGR,
+    kGRBG,
+    kGBRG
+};
+
+/** hold one image. **/
+class ImageBuffer {
+public:
+    int width_ = 0;
+    int height_ = 0;
+    int bytes_ = 0;
+    /** frame number assigned when the image is published. starts at 1. **/
+    agm::int64 sequence_ = 0;
+    /** microseconds since 1970 utc when the image is published. **/
+    agm::int64 timestamp_ = 0;
+    /** how the image was captured. **/
+    int exposure_ = 0; /*microseconds*/
+    int temperature_ = 0; /*tenths of a degree C*/
+    int bin_ = 1;
+    BayerPattern bayer_pattern_ = BayerPattern::kRGGB;
+    /** a mono guide camera has no bayer pattern. **/
+    bool mono_ = false;
+    /** computed by the capture thread. **/
+    FrameStats stats_;
+    cv::Mat bayer_;
+    /** where the bayer image comes from. nullptr is the heap. **/
+    FramePool *pool_ = nullptr;
+
+    ImageBuffer() noexcept = default;
+    ~ImageBuffer() noexcept = default;
+
+    /** allocate the bayer image if the size changed. **/
+    void allocate(int width, int height) noexcept;
+};
+
+/** frame counts for one consumer. **/
+class ImageRingStats {
+public:
+    agm::int64 published_ = 0;
+    agm::int64 consumed_ = 0;
+    agm::int64 dropped_ = 0;
+    agm::int64 overwritten_ = 0;
+};
+
+class ImageRing : public agm::Container {
+protected:
+    ImageRing() noexcept;
+public:
+    ImageRing(const ImageRing &) = delete;
+    virtual ~ImageRing() noexcept;
+
+    /** the producer needs one slot and each reading consumer holds one. **/
+    static const int kMinSlots = 3;
+    static const int kMaxConsumers = 8;
+
+    /** how a consumer reads the ring. **/
+    enum class Policy {
+        /** get the newest frame. skip the rest. **/
+        kLatest,
+        /** get every frame in order. **/
+        kEvery
+    };
+
+    /**
+    master thread creates the container.
+    nslots should be at least 2 more than the number of consumers
+    or the producer may have to wait for a free slot.
+    the bayer images come from the pool if there is one.
+    **/
+    static ImageRing *create(int nslots, FramePool *pool = nullptr) noexcept;
+
+    /**
+    register a consumer before the threads start.
+    returns the consumer id.
+    **/
+    int addConsumer(Policy policy) noexcept;
+
+    /**
+    capture thread allocates all of the buffers once.
+    they are reused for every frame.
+    call this before publishing any frames.
+    after that the capture thread may only resize the buffer it's writing.
+    **/
+    void allocate(int width, int height) noexcept;
+
+    /** producer gets exclusive access to a free buffer. **/
+    ImageBuffer *acquireWrite() noexcept;
+
+    /** producer makes the buffer available to the consumers. **/
+    void publish(ImageBuffer *img) noexcept;
+
+    /**
+    consumer gets shared read access to a frame it hasn't seen.
+    waits until there is one.
+    or for at most timeout milliseconds if it's not negative.
+    returns nullptr if the ring was unblocked or the wait timed out.
+    consumers must not modify the image.
+    **/
+    ImageBuffer *acquireRead(int consumer, int timeout_ms = -1) noexcept;
+
+    /** consumer is done with the frame. **/
+    void releaseRead(int consumer, ImageBuffer *img) noexcept;
+
+    /** get the frame counts for a consumer. **/
+    ImageRingStats getStats(int consumer) noexcept;
+
+    /** wake all waiting consumers. **/
+    virtual void unblock() noexcept;
+};
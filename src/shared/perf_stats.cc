@@ -0,0 +1,204 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+**/
+
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "perf_stats.h"
+
+
+namespace {
+    /** the time of the given fraction of the samples. **/
+    agm::int64 getPercentile(
+        const agm::uint32 *buckets,
+        agm::int64 count,
+        double fraction
+    ) noexcept {
+        agm::int64 target = agm::int64(fraction * double(count));
+        agm::int64 sum = 0;
+        for (int i = 0; i < LatencyCounts::kBuckets; ++i) {
+            sum += buckets[i];
+            if (sum > target) {
+                return LatencyHistogram::getBucketValue(i);
+            }
+        }
+        return 0;
+    }
+
+    double toMs(
+        double usecs
+    ) noexcept {
+        return usecs / 1000.0;
+    }
+}
+
+LatencySummary LatencySummary::summarize(
+    const LatencyCounts &counts,
+    const LatencyCounts *before
+) noexcept {
+    LatencySummary result;
+    agm::uint32 diff[LatencyCounts::kBuckets];
+    const agm::uint32 *buckets = counts.buckets_;
+    agm::int64 count = counts.count_;
+    agm::int64 sum = counts.sum_;
+    if (before) {
+        for (int i = 0; i < LatencyCounts::kBuckets; ++i) {
+            diff[i] = counts.buckets_[i] - before->buckets_[i];
+        }
+        buckets = diff;
+        count = counts.count_ - before->count_;
+        sum = counts.sum_ - before->sum_;
+    }
+    if (count <= 0) {
+        return result;
+    }
+
+    result.count_ = count;
+    result.mean_ = double(sum) / double(count);
+    result.p50_ = getPercentile(buckets, count, 0.50);
+    result.p99_ = getPercentile(buckets, count, 0.99);
+    if (before) {
+        for (int i = LatencyCounts::kBuckets - 1; i >= 0; --i) {
+            if (buckets[i]) {
+                result.max_ = LatencyHistogram::getBucketValue(i);
+                break;
+            }
+        }
+    } else {
+        result.max_ = counts.max_;
+    }
+    return result;
+}
+
+LatencyHistogram::LatencyHistogram(
+    const char *thread,
+    const char *stage
+) noexcept : thread_(thread), stage_(stage) {
+    for (auto &bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+/** values below 16 are exact. **/
+int LatencyHistogram::getBucket(
+    agm::int64 usecs
+) noexcept {
+    if (usecs < 16) {
+        return int(std::max(usecs, agm::int64(0)));
+    }
+    agm::uint32 value = agm::uint32(std::min(usecs, agm::int64(0x7FFFFFFF)));
+    int msb = 31 - __builtin_clz(value);
+    int mantissa = (value >> (msb - 4)) & 15;
+    return 16 * (msb - 3) + mantissa;
+}
+
+agm::int64 LatencyHistogram::getBucketValue(
+    int bucket
+) noexcept {
+    if (bucket < 16) {
+        return bucket;
+    }
+    int msb = bucket / 16 + 3;
+    int mantissa = bucket % 16;
+    agm::int64 low = agm::int64(16 + mantissa) << (msb - 4);
+    agm::int64 width = agm::int64(1) << (msb - 4);
+    return low + width / 2;
+}
+
+/** one writer. so load and store is enough. **/
+void LatencyHistogram::record(
+    agm::int64 usecs
+) noexcept {
+    auto &bucket = buckets_[getBucket(usecs)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum_.store(sum_.load(std::memory_order_relaxed) + usecs, std::memory_order_relaxed);
+    if (usecs > max_.load(std::memory_order_relaxed)) {
+        max_.store(usecs, std::memory_order_relaxed);
+    }
+    /** the count is last so a reader never sees more count than buckets. **/
+    count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void LatencyHistogram::copyCounts(
+    LatencyCounts &counts
+) const noexcept {
+    counts.count_ = count_.load(std::memory_order_acquire);
+    counts.sum_ = sum_.load(std::memory_order_relaxed);
+    counts.max_ = max_.load(std::memory_order_relaxed);
+    for (int i = 0; i < LatencyCounts::kBuckets; ++i) {
+        counts.buckets_[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram *PerfStats::addStage(
+    const char *thread,
+    const char *stage
+) noexcept {
+    auto histogram = new(std::nothrow) LatencyHistogram(thread, stage);
+    if (histogram == nullptr) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stages_.push_back(std::unique_ptr<LatencyHistogram>(histogram));
+    return histogram;
+}
+
+void PerfStats::getStages(
+    std::vector<LatencyHistogram *> &stages
+) noexcept {
+    stages.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &stage : stages_) {
+        stages.push_back(stage.get());
+    }
+}
+
+void PerfStats::log() noexcept {
+    std::vector<LatencyHistogram *> stages;
+    getStages(stages);
+    LatencyCounts counts;
+    LOG("PerfStats stage times in milliseconds since the start:");
+    for (auto stage : stages) {
+        stage->copyCounts(counts);
+        auto summary = LatencySummary::summarize(counts);
+        std::stringstream ss;
+        ss<<std::fixed<<std::setprecision(2);
+        ss<<"  "<<std::left<<std::setw(14)<<stage->thread_<<std::setw(12)<<stage->stage_<<std::right;
+        ss<<" n="<<summary.count_<<" mean="<<toMs(summary.mean_)
+            <<" p50="<<toMs(summary.p50_)<<" p99="<<toMs(summary.p99_)<<" max="<<toMs(summary.max_);
+        LOG(ss.str());
+    }
+}
+
+bool PerfStats::writeCsv(
+    const std::string &file_name
+) noexcept {
+    auto fp = std::fopen(file_name.c_str(), "w");
+    if (fp == nullptr) {
+        LOG("PerfStats Failed to open file: "<<file_name);
+        return false;
+    }
+
+    std::vector<LatencyHistogram *> stages;
+    getStages(stages);
+    LatencyCounts counts;
+    std::fprintf(fp, "thread,stage,count,mean_us,p50_us,p99_us,max_us\n");
+    for (auto stage : stages) {
+        stage->copyCounts(counts);
+        auto summary = LatencySummary::summarize(counts);
+        std::fprintf(fp, "%s,%s,%lld,%.1f,%lld,%lld,%lld\n",
+            stage->thread_.c_str(), stage->stage_.c_str(),
+            (long long) summary.count_, summary.mean_,
+            (long long) summary.p50_, (long long) summary.p99_, (long long) summary.max_);
+    }
+    bool success = (std::fclose(fp) == 0);
+    if (success) {
+        LOG("PerfStats Wrote stage times to: "<<file_name);
+    }
+    return success;
+}
@@ -0,0 +1,142 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+
+latency statistics for the stages of the pipeline.
+
+each stage has a histogram of its times in microseconds.
+only the thread that owns the stage records into it.
+so recording is a few relaxed atomic loads and stores.
+no locks and no read-modify-write.
+any thread may read the histograms while they're being written.
+
+the buckets are on a log scale.
+a time is reduced to its leading bit and the next 4 bits.
+so the percentiles are within about 3%.
+
+threads add their stages in begin.
+the histograms live as long as the PerfStats.
+**/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+/** a copy of the counts of one histogram. **/
+class LatencyCounts {
+public:
+    /** up to 2^31 microseconds. **/
+    static const int kBuckets = 16 * 28;
+
+    agm::uint32 buckets_[kBuckets] = {0};
+    agm::int64 count_ = 0;
+    agm::int64 sum_ = 0;
+    agm::int64 max_ = 0;
+
+    LatencyCounts() noexcept = default;
+    ~LatencyCounts() noexcept = default;
+};
+
+/** percentiles in microseconds. **/
+class LatencySummary {
+public:
+    agm::int64 count_ = 0;
+    double mean_ = 0.0;
+    agm::int64 p50_ = 0;
+    agm::int64 p99_ = 0;
+    agm::int64 max_ = 0;
+
+    LatencySummary() noexcept = default;
+    ~LatencySummary() noexcept = default;
+
+    /**
+    summarize the counts.
+    if before is given summarize the difference.
+    the max of a difference is the top of the highest bucket.
+    **/
+    static LatencySummary summarize(
+        const LatencyCounts &counts,
+        const LatencyCounts *before = nullptr
+    ) noexcept;
+};
+
+class LatencyHistogram {
+public:
+    LatencyHistogram(const char *thread, const char *stage) noexcept;
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    ~LatencyHistogram() noexcept = default;
+
+    const std::string thread_;
+    const std::string stage_;
+
+    /** only the owning thread may record. **/
+    void record(agm::int64 usecs) noexcept;
+
+    /** any thread may copy the counts. **/
+    void copyCounts(LatencyCounts &counts) const noexcept;
+
+    static int getBucket(agm::int64 usecs) noexcept;
+    /** the middle of the bucket. **/
+    static agm::int64 getBucketValue(int bucket) noexcept;
+
+private:
+    std::atomic<agm::uint32> buckets_[LatencyCounts::kBuckets];
+    std::atomic<agm::int64> count_{0};
+    std::atomic<agm::int64> sum_{0};
+    std::atomic<agm::int64> max_{0};
+};
+
+/** the times of all of the stages. **/
+class PerfStats {
+public:
+    PerfStats() noexcept = default;
+    PerfStats(const PerfStats &) = delete;
+    ~PerfStats() noexcept = default;
+
+    /** add a stage. call from the owning thread before recording. **/
+    LatencyHistogram *addStage(const char *thread, const char *stage) noexcept;
+
+    /** the stages in the order they were added. **/
+    void getStages(std::vector<LatencyHistogram *> &stages) noexcept;
+
+    /** log the times of every stage since the start. **/
+    void log() noexcept;
+
+    /** write the times of every stage since the start. returns false if the file can't be written. **/
+    bool writeCsv(const std::string &file_name) noexcept;
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<LatencyHistogram>> stages_;
+};
+
+/**
+time a scope and record it when the scope ends.
+a null histogram records nothing.
+**/
+class ScopedTimer {
+public:
+    ScopedTimer(
+        LatencyHistogram *histogram
+    ) noexcept : histogram_(histogram) {
+        if (histogram_) {
+            start_ = agm::time::microseconds();
+        }
+    }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ~ScopedTimer() noexcept {
+        if (histogram_) {
+            histogram_->record(agm::time::microseconds() - start_);
+        }
+    }
+
+private:
+    LatencyHistogram *histogram_;
+    agm::int64 start_ = 0;
+};
@@ -0,0 +1,86 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+**/
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include "save_queue.h"
+
+
+// use an anonymous namespace to avoid name collisions at link time.
+namespace {
+    class SaveQueueImpl : public SaveQueue {
+    public:
+        SaveQueueImpl() = default;
+        SaveQueueImpl(const SaveQueueImpl &) = delete;
+        virtual ~SaveQueueImpl() noexcept = default;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<SaveJob> jobs_;
+        bool unblocked_ = false;
+    };
+}
+
+SaveQueue::SaveQueue() noexcept :
+    agm::Container("SaveQueue") {
+}
+
+SaveQueue::~SaveQueue() noexcept {
+}
+
+SaveQueue *SaveQueue::create() noexcept {
+    auto impl = new(std::nothrow) SaveQueueImpl;
+    return impl;
+}
+
+bool SaveQueue::push(
+    SaveJob &job
+) noexcept {
+    auto impl = (SaveQueueImpl *) this;
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        if (int(impl->jobs_.size()) >= kMaxPending) {
+            return false;
+        }
+        impl->jobs_.push_back(job);
+    }
+    impl->cv_.notify_one();
+    return true;
+}
+
+bool SaveQueue::pop(
+    SaveJob &job
+) noexcept {
+    auto impl = (SaveQueueImpl *) this;
+    std::unique_lock<std::mutex> lock(impl->mutex_);
+    impl->cv_.wait(lock, [impl]{
+        return impl->unblocked_ || impl->jobs_.size() > 0;
+    });
+    if (impl->jobs_.size() == 0) {
+        return false;
+    }
+    job = impl->jobs_.front();
+    impl->jobs_.pop_front();
+    return true;
+}
+
+int SaveQueue::getPending() noexcept {
+    auto impl = (SaveQueueImpl *) this;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    return impl->jobs_.size();
+}
+
+/** wake the saver thread. **/
+void SaveQueue::unblock() noexcept {
+    auto impl = (SaveQueueImpl *) this;
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        impl->unblocked_ = true;
+    }
+    impl->cv_.notify_all();
+}
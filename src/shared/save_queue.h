@@ -0,0 +1,75 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+
+queue of images to be saved by the saver thread.
+
+the window thread hands over its buffer.
+opencv matrices are reference counted.
+so the window thread gives the saver a reference.
+and replaces its own with a new buffer.
+no pixels are copied and the window thread doesn't wait for the disk.
+**/
+
+#pragma once
+
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/container.h>
+
+
+/** one image to save. **/
+class SaveJob {
+public:
+    enum class Format {
+        /** 8 bit BGR gamma corrected display image. any format opencv knows. **/
+        k8Bit,
+        /** 16 bit BGR image as tiff. **/
+        k16Bit,
+        /** 32 bit BGR stacked image as tiff. scaled to the full range. **/
+        k32Bit
+    };
+
+    Format format_ = Format::k8Bit;
+    std::string file_name_;
+    cv::Mat image_;
+    /** the maximum value of the 32 bit image if known. 0 if not. **/
+    int scale_ = 0;
+
+    SaveJob() noexcept = default;
+    ~SaveJob() noexcept = default;
+};
+
+class SaveQueue : public agm::Container {
+protected:
+    SaveQueue() noexcept;
+public:
+    SaveQueue(const SaveQueue &) = delete;
+    virtual ~SaveQueue() noexcept;
+
+    /** the window thread won't queue more than this many images. **/
+    static const int kMaxPending = 4;
+
+    /** master thread creates the container. **/
+    static SaveQueue *create() noexcept;
+
+    /**
+    window thread adds an image to the queue.
+    never waits.
+    returns false if the queue is full.
+    **/
+    bool push(SaveJob &job) noexcept;
+
+    /**
+    saver thread waits for an image.
+    returns false if the queue was unblocked.
+    **/
+    bool pop(SaveJob &job) noexcept;
+
+    /** number of images waiting to be saved. **/
+    int getPending() noexcept;
+
+    /** wake the saver thread. **/
+    virtual void unblock() noexcept;
+};
@@ -4,20 +4,57 @@ Copyright (C) 2012-2024 tim cotter. All rights reserved.
 
 /**
 holds the settings for the how to process the captured image for display.
+
+the settings are published as immutable versioned snapshots.
+writers change the master copy with the lock held.
+the snapshot is published when the lock is released.
+readers check the version once per frame with one atomic load.
+they only copy the snapshot when the version changed.
+so they can skip their reconfiguration when it didn't.
+
+one shot requests like saving an image are commands in a queue.
+not strings polled every frame.
 **/
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <string>
+
+#include <shared/command_queue.h>
 
 #include <aggiornamento/aggiornamento.h>
 
 
+/** how the window thread combines stacked frames. **/
+enum class StackMode {
+    kSum,
+    kSigmaClip,
+    kMedian
+};
+
+/** how the focus helper measures the focus. **/
+enum class FocusMetric {
+    kStars,
+    kLaplacian
+};
+
+/** how the window thread debayers the raw image. **/
+enum class DebayerMode {
+    kBilinear,
+    kSuperpixel,
+    kOpenCL
+};
+
 /**
-you must hold the lock before accessing any of the settings.
+you must hold the lock before changing any of the settings.
 use this code in the code block:
 
-    std::lock_guard<std::mutex> lock(mutex_);
+    SettingsLock lock(settings_buffer);
+
+other threads read snapshots. see SettingsSnapshot.
 **/
 
 class Settings {
@@ -33,22 +70,136 @@ public:
     bool auto_exposure_ = false;
     int exposure_ = 100; /*microseconds*/
     bool show_focus_ = false;
+    FocusMetric focus_metric_ = FocusMetric::kStars;
     double gamma_ = 1.0;
     bool auto_iso_ = false;
     int iso_ = 100; /*no scaling*/
     bool show_histogram_ = false;
     bool show_circles_ = false;
     bool show_fps_ = false;
-    std::string save_file_name_;
-    std::string raw_file_name_;
+    bool show_perf_ = false; /*stage times overlay*/
+    bool fused_pipeline_ = true;
+    bool video_mode_ = false;
+    bool align_stack_ = true;
+    DebayerMode debayer_mode_ = DebayerMode::kBilinear; /*saves are always full resolution*/
+    StackMode stack_mode_ = StackMode::kSum;
+    double stack_kappa_ = 2.5; /*sigma clip rejects samples this many sigmas from the mean*/
+    int bin_ = 1; /*1, 2, or 4*/
+    bool roi_follows_display_ = false;
+    int roi_width_ = 0; /*0 is the full frame*/
+    int roi_height_ = 0;
+    int zoom_ = 0; /*0 fits the image in the window. n magnifies n times*/
+    int pan_x_ = 0; /*offset of the view from the center in pixels. not used to fit*/
+    int pan_y_ = 0;
+    int display_width_ = 0; /*set by the window thread*/
+    int display_height_ = 0;
+    bool calibrate_ = true; /*use the master calibration frames*/
+    bool guide_ = false; /*autoguide the mount*/
+    int guide_aggressiveness_ = 70; /*percent of the error corrected per frame*/
+    int guide_calibration_ = 0; /*changed to force a new guiding calibration*/
+    std::string record_file_name_; /*empty when not recording*/
+    std::string save_status_; /*set by the saver thread*/
+    std::string guide_status_; /*set by the guider thread*/
+    std::string solve_status_; /*set by the solver thread*/
 };
 
 class SettingsBuffer : public Settings {
 public:
-    SettingsBuffer() noexcept = default;
+    SettingsBuffer() noexcept {
+        publish();
+    }
     SettingsBuffer(const SettingsBuffer &) = delete;
     ~SettingsBuffer() noexcept = default;
 
     std::mutex mutex_;
 
+    /**
+    the exposure and iso in use.
+    auto exposure and auto iso change them every few frames.
+    so they're written without the lock and without a new version.
+    the menu shows them and keeps them when auto is turned off.
+    **/
+    std::atomic<int> current_exposure_{100};
+    std::atomic<int> current_iso_{100};
+
+    /** save images and build master calibration frames. **/
+    CommandQueue commands_;
+
+    /** plate solve and polar align. **/
+    CommandQueue solve_commands_;
+
+    /** menu input from the network streamer. **/
+    CommandQueue menu_commands_;
+    /** the menu's answers to the network streamer. **/
+    CommandQueue menu_replies_;
+
+    agm::uint64 getVersion() const noexcept {
+        return version_.load(std::memory_order_acquire);
+    }
+
+    std::shared_ptr<const Settings> getSnapshot() const noexcept {
+        return std::atomic_load(&snapshot_);
+    }
+
+    /** copy the settings to a new snapshot. call with the lock held. **/
+    void publish() noexcept {
+        auto snapshot = std::make_shared<const Settings>(*(const Settings *) this);
+        std::atomic_store(&snapshot_, snapshot);
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<agm::uint64> version_{0};
+    std::shared_ptr<const Settings> snapshot_;
+};
+
+/** hold the lock while changing the settings. publish them when done. **/
+class SettingsLock {
+public:
+    SettingsLock(
+        SettingsBuffer *buffer
+    ) noexcept : buffer_(buffer), lock_(buffer->mutex_) {
+    }
+    SettingsLock(const SettingsLock &) = delete;
+    ~SettingsLock() noexcept {
+        buffer_->publish();
+    }
+
+private:
+    SettingsBuffer *buffer_;
+    std::lock_guard<std::mutex> lock_;
+};
+
+/**
+a reader's copy of the settings.
+the version is read before the snapshot.
+so a newer snapshot may be taken with an older version.
+which is just copied again next time.
+**/
+class SettingsSnapshot {
+public:
+    SettingsSnapshot() noexcept = default;
+    SettingsSnapshot(const SettingsSnapshot &) = delete;
+    ~SettingsSnapshot() noexcept = default;
+
+    /** returns true if the settings changed since the last update. **/
+    bool update(
+        const SettingsBuffer *buffer
+    ) noexcept {
+        auto version = buffer->getVersion();
+        if (version == version_) {
+            return false;
+        }
+        version_ = version;
+        settings_ = buffer->getSnapshot();
+        return true;
+    }
+
+    const Settings *operator->() const noexcept {
+        return settings_.get();
+    }
+
+private:
+    agm::uint64 version_ = 0;
+    std::shared_ptr<const Settings> settings_;
 };
@@ -0,0 +1,170 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+**/
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include "worker_pool.h"
+
+
+// use an anonymous namespace to avoid name collisions at link time.
+namespace {
+    class WorkerPoolImpl : public WorkerPool {
+    public:
+        WorkerPoolImpl() = default;
+        WorkerPoolImpl(const WorkerPoolImpl &) = delete;
+        virtual ~WorkerPoolImpl() noexcept {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            start_cv_.notify_all();
+            for (auto &th : threads_) {
+                th.join();
+            }
+        }
+
+        std::vector<std::thread> threads_;
+        std::mutex mutex_;
+        std::condition_variable start_cv_;
+        std::condition_variable done_cv_;
+        bool stop_ = false;
+        int generation_ = 0;
+        int busy_ = 0;
+
+        /** the current job. **/
+        const BandFunc *func_ = nullptr;
+        int nrows_ = 0;
+        int band_rows_ = 0;
+        std::atomic<int> next_band_{0};
+
+        void start(
+            int nthreads
+        ) noexcept {
+            for (int i = 1; i < nthreads; ++i) {
+                threads_.push_back(std::thread(&WorkerPoolImpl::workerMain, this, i));
+            }
+        }
+
+        /** workers wait for a new generation of work. **/
+        void workerMain(
+            int worker
+        ) noexcept {
+            int seen = 0;
+            for(;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    start_cv_.wait(lock, [&]{ return stop_ || generation_ != seen; });
+                    if (stop_) {
+                        return;
+                    }
+                    seen = generation_;
+                }
+
+                doBands(worker);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    --busy_;
+                    if (busy_ == 0) {
+                        done_cv_.notify_one();
+                    }
+                }
+            }
+        }
+
+        /** grab bands until there are none left. **/
+        void doBands(
+            int worker
+        ) noexcept {
+            for(;;) {
+                int band = next_band_.fetch_add(1);
+                int y0 = band * band_rows_;
+                if (y0 >= nrows_) {
+                    break;
+                }
+                int y1 = std::min(y0 + band_rows_, nrows_);
+                (*func_)(worker, y0, y1);
+            }
+        }
+    };
+}
+
+WorkerPool::WorkerPool() noexcept {
+}
+
+WorkerPool::~WorkerPool() noexcept {
+}
+
+WorkerPool *WorkerPool::create(
+    int nthreads
+) noexcept {
+    if (nthreads <= 0) {
+        nthreads = std::thread::hardware_concurrency();
+    }
+    nthreads = std::max(nthreads, 1);
+    auto impl = new(std::nothrow) WorkerPoolImpl;
+    impl->start(nthreads);
+    return impl;
+}
+
+int WorkerPool::getThreadCount() noexcept {
+    auto impl = (WorkerPoolImpl *) this;
+    return 1 + impl->threads_.size();
+}
+
+void WorkerPool::run(
+    int nrows,
+    int band_rows,
+    const BandFunc &func
+) noexcept {
+    auto impl = (WorkerPoolImpl *) this;
+    band_rows = std::max(band_rows, 1);
+
+    /** don't bother waking the workers for one band. **/
+    if (impl->threads_.empty() || nrows <= band_rows) {
+        for (int y0 = 0; y0 < nrows; y0 += band_rows) {
+            int y1 = std::min(y0 + band_rows, nrows);
+            func(0, y0, y1);
+        }
+        return;
+    }
+
+    /** wake the workers. **/
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        impl->func_ = &func;
+        impl->nrows_ = nrows;
+        impl->band_rows_ = band_rows;
+        impl->next_band_ = 0;
+        impl->busy_ = impl->threads_.size();
+        ++impl->generation_;
+    }
+    impl->start_cv_.notify_all();
+
+    /** help out. **/
+    impl->doBands(0);
+
+    /** wait for the workers to finish. **/
+    std::unique_lock<std::mutex> lock(impl->mutex_);
+    impl->done_cv_.wait(lock, [&]{ return impl->busy_ == 0; });
+    impl->func_ = nullptr;
+}
+
+int WorkerPool::getBandRows(
+    int nrows,
+    int align
+) noexcept {
+    static const int kBandsPerThread = 4;
+    int nbands = kBandsPerThread * getThreadCount();
+    int rows = (nrows + nbands - 1) / nbands;
+    rows = (rows + align - 1) / align * align;
+    rows = std::max(rows, align);
+    return rows;
+}
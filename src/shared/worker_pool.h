@@ -0,0 +1,51 @@
+/**
+Copyright (C) 2024 tim cotter. All rights reserved.
+
+a pool of worker threads that process an image in bands of rows.
+**/
+
+#pragma once
+
+#include <functional>
+
+
+class WorkerPool {
+protected:
+    WorkerPool() noexcept;
+public:
+    WorkerPool(const WorkerPool &) = delete;
+    virtual ~WorkerPool() noexcept;
+
+    /**
+    nthreads includes the calling thread.
+    nthreads <= 0 uses one thread per core.
+    **/
+    static WorkerPool *create(int nthreads = 0) noexcept;
+
+    /** the number of threads including the calling thread. **/
+    int getThreadCount() noexcept;
+
+    /**
+    the band function is called with the index of the worker
+    and the range of rows [y0, y1) to process.
+    worker indexes are 0 to getThreadCount()-1.
+    the calling thread is worker 0.
+    a worker processes one band at a time.
+    so per-worker buffers and partial results are safe.
+    **/
+    typedef std::function<void(int worker, int y0, int y1)> BandFunc;
+
+    /**
+    split rows [0, nrows) into bands of band_rows rows.
+    the last band may be smaller.
+    run the function on every band.
+    returns when all bands are done.
+    **/
+    void run(int nrows, int band_rows, const BandFunc &func) noexcept;
+
+    /**
+    choose the band size so every thread gets a few bands.
+    band sizes are a multiple of align.
+    **/
+    int getBandRows(int nrows, int align) noexcept;
+};
@@ -0,0 +1,428 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+the image points are complex numbers.
+z = x + iy for a frame that isn't mirrored.
+z = x - iy for a frame that is.
+the tangent plane points are w = xi + i eta.
+the map from the image to the sky is a similarity w = m * z + t.
+|m| is the scale in radians per pixel. arg(m) is the rotation.
+**/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "plate_solver.h"
+
+
+namespace {
+    /** quads are made from this many of the brightest stars. **/
+    const int kQuadStars = 16;
+    /** this many image stars must match catalog stars. **/
+    const int kMinMatches = 6;
+    /** the distance between an image code and an index code. **/
+    const double kCodeTolerance = 0.015;
+    /** an image star matches a predicted catalog star this close in pixels. **/
+    const double kMatchPixels = 3.0;
+    /** give up after this long. **/
+    const double kMaxMilliseconds = 5000.0;
+
+    const double kRadiansPerArcsec = M_PI / (180.0 * 3600.0);
+    const double kRadiansPerDegree = M_PI / 180.0;
+
+    /** julian centuries since J2000. **/
+    double getJulianCenturies(
+        agm::int64 unix_time
+    ) noexcept {
+        double jd = double(unix_time) / 86400.0 + 2440587.5;
+        return (jd - 2451545.0) / 36525.0;
+    }
+
+    /**
+    the IAU 1976 precession matrix from J2000 to date.
+    v_date = p * v_J2000
+    **/
+    void getPrecession(
+        agm::int64 unix_time,
+        double p[3][3]
+    ) noexcept {
+        double t = getJulianCenturies(unix_time);
+        double zeta = (2306.2181 * t + 0.30188 * t * t + 0.017998 * t * t * t) * kRadiansPerArcsec;
+        double z = (2306.2181 * t + 1.09468 * t * t + 0.018203 * t * t * t) * kRadiansPerArcsec;
+        double theta = (2004.3109 * t - 0.42665 * t * t - 0.041833 * t * t * t) * kRadiansPerArcsec;
+        double cz = std::cos(zeta);
+        double sz = std::sin(zeta);
+        double cZ = std::cos(z);
+        double sZ = std::sin(z);
+        double ct = std::cos(theta);
+        double st = std::sin(theta);
+        p[0][0] = cz * ct * cZ - sz * sZ;
+        p[0][1] = - sz * ct * cZ - cz * sZ;
+        p[0][2] = - st * cZ;
+        p[1][0] = cz * ct * sZ + sz * cZ;
+        p[1][1] = - sz * ct * sZ + cz * cZ;
+        p[1][2] = - st * sZ;
+        p[2][0] = cz * st;
+        p[2][1] = - sz * st;
+        p[2][2] = ct;
+    }
+
+    double getMilliseconds(
+        std::chrono::steady_clock::time_point start
+    ) noexcept {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    }
+
+    /** C and D must be in the circle through A and B. the index is built the same way. **/
+    bool isInCircle(
+        const double code[4]
+    ) noexcept {
+        for (int i = 0; i < 4; i += 2) {
+            double dx = code[i] - 0.5;
+            double dy = code[i + 1] - 0.5;
+            if (dx * dx + dy * dy > 0.5) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+bool PlateSolver::solve(
+    const StarIndex &index,
+    const std::vector<StarRegistration::Star> &stars,
+    int width,
+    int height,
+    double min_scale,
+    double max_scale,
+    Solution &solution
+) noexcept {
+    auto start = std::chrono::steady_clock::now();
+    solution = Solution();
+    index_ = &index;
+    stars_ = &stars;
+    width_ = width;
+    height_ = height;
+    min_scale_ = 0.0;
+    max_scale_ = 1e30;
+    if (max_scale > 0.0) {
+        min_scale_ = min_scale * kRadiansPerArcsec;
+        max_scale_ = max_scale * kRadiansPerArcsec;
+    }
+
+    int n = std::min(int(stars.size()), kQuadStars);
+    if (index.isOpen() == false || n < kMinMatches) {
+        solution.ms_ = getMilliseconds(start);
+        return false;
+    }
+
+    /** the quads of the brightest stars are tried first. **/
+    bool solved = false;
+    bool timed_out = false;
+    for (int d = 3; d < n && solved == false && timed_out == false; ++d) {
+    for (int c = 2; c < d && solved == false; ++c) {
+    for (int b = 1; b < c && solved == false; ++b) {
+    for (int a = 0; a < b && solved == false; ++a) {
+        int stars4[4] = {a, b, c, d};
+        for (int mirror = 0; mirror < 2 && solved == false; ++mirror) {
+            mirrored_ = (mirror != 0);
+            double xy[4][2];
+            for (int i = 0; i < 4; ++i) {
+                auto z = getPoint(stars4[i]);
+                xy[i][0] = z.real();
+                xy[i][1] = z.imag();
+            }
+            int order[4];
+            double code[4];
+            bool success = StarIndex::computeCode(xy, order, code);
+            if (success == false || isInCircle(code) == false) {
+                continue;
+            }
+
+            /** skip quads the index doesn't have at any allowed scale. **/
+            double dx = xy[order[1]][0] - xy[order[0]][0];
+            double dy = xy[order[1]][1] - xy[order[0]][1];
+            double pixels = std::sqrt(dx * dx + dy * dy);
+            if (pixels * max_scale_ < index.getMinDiameter()
+            ||  pixels * min_scale_ > index.getMaxDiameter()) {
+                continue;
+            }
+
+            int image_quad[4];
+            for (int i = 0; i < 4; ++i) {
+                image_quad[i] = stars4[order[i]];
+            }
+            index.findQuads(code, kCodeTolerance, quads_);
+            for (auto quad : quads_) {
+                ++solution.tried_;
+                solved = tryQuad(image_quad, quad, solution);
+                if (solved) {
+                    break;
+                }
+            }
+        }
+    }
+    }
+    }
+        timed_out = (getMilliseconds(start) > kMaxMilliseconds);
+    }
+
+    solution.ms_ = getMilliseconds(start);
+    if (timed_out && solved == false) {
+        LOG("PlateSolver Gave up after "<<solution.ms_<<" ms.");
+    }
+    return solved;
+}
+
+PlateSolver::Complex PlateSolver::getPoint(
+    int index
+) const noexcept {
+    auto &star = (*stars_)[index];
+    if (mirrored_) {
+        return Complex(star.x_, - star.y_);
+    }
+    return Complex(star.x_, star.y_);
+}
+
+bool PlateSolver::tryQuad(
+    const int image_quad[4],
+    int quad,
+    Solution &solution
+) noexcept {
+    /** the tangent plane at the middle of A and B. **/
+    auto &q = index_->getQuad(quad);
+    auto &sa = index_->getStar(q.stars_[0]);
+    auto &sb = index_->getStar(q.stars_[1]);
+    Fit fit;
+    fit.center_[0] = sa.x_ + sb.x_;
+    fit.center_[1] = sa.y_ + sb.y_;
+    fit.center_[2] = sa.z_ + sb.z_;
+    double len = std::sqrt(fit.center_[0] * fit.center_[0]
+        + fit.center_[1] * fit.center_[1] + fit.center_[2] * fit.center_[2]);
+    if (len <= 0.0) {
+        return false;
+    }
+    for (auto &v : fit.center_) {
+        v /= len;
+    }
+
+    z_.clear();
+    w_.clear();
+    for (int i = 0; i < 4; ++i) {
+        auto &star = index_->getStar(q.stars_[i]);
+        double v[3] = {star.x_, star.y_, star.z_};
+        double xi;
+        double eta;
+        bool success = StarIndex::project(fit.center_, v, xi, eta);
+        if (success == false) {
+            return false;
+        }
+        z_.push_back(getPoint(image_quad[i]));
+        w_.push_back(Complex(xi, eta));
+    }
+    bool success = fitSimilarity(fit.m_, fit.t_);
+    if (success == false) {
+        return false;
+    }
+    double scale = std::abs(fit.m_);
+    if (scale < min_scale_ || scale > max_scale_) {
+        return false;
+    }
+
+    /** check the guess against the rest of the field. **/
+    int matched = matchStars(fit);
+    if (matched < kMinMatches) {
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        success = refine(fit);
+        if (success == false) {
+            return false;
+        }
+        matched = matchStars(fit);
+        if (matched < kMinMatches) {
+            return false;
+        }
+    }
+
+    /** the center of the frame. **/
+    Complex zc(0.5 * width_, mirrored_ ? -0.5 * height_ : 0.5 * height_);
+    auto wc = fit.m_ * zc + fit.t_;
+    double v[3];
+    StarIndex::unproject(fit.center_, wc.real(), wc.imag(), v);
+    StarIndex::fromVector(v, solution.ra_, solution.dec_);
+
+    /** the top of the frame is -y. **/
+    Complex up(0.0, mirrored_ ? 1.0 : -1.0);
+    auto dw = fit.m_ * up;
+    double angle = std::atan2(dw.real(), dw.imag()) / kRadiansPerDegree;
+    if (angle < 0.0) {
+        angle += 360.0;
+    }
+
+    solution.solved_ = true;
+    solution.scale_ = std::abs(fit.m_) / kRadiansPerArcsec;
+    solution.angle_ = angle;
+    solution.mirrored_ = mirrored_;
+    solution.matched_ = matched;
+    return true;
+}
+
+/**
+predict where the catalog stars in the field are in the frame.
+match each image star to the nearest prediction.
+**/
+int PlateSolver::matchStars(
+    const Fit &fit
+) noexcept {
+    Complex zc(0.5 * width_, mirrored_ ? -0.5 * height_ : 0.5 * height_);
+    auto wc = fit.m_ * zc + fit.t_;
+    double field_center[3];
+    StarIndex::unproject(fit.center_, wc.real(), wc.imag(), field_center);
+    double diagonal = std::sqrt(double(width_) * width_ + double(height_) * height_);
+    double radius = 0.55 * diagonal * std::abs(fit.m_);
+    index_->findStars(field_center, radius, field_);
+
+    int nstars = stars_->size();
+    matches_.assign(nstars, -1);
+    match_d2_.assign(nstars, kMatchPixels * kMatchPixels);
+    for (auto s : field_) {
+        auto &star = index_->getStar(s);
+        double v[3] = {star.x_, star.y_, star.z_};
+        double xi;
+        double eta;
+        bool success = StarIndex::project(fit.center_, v, xi, eta);
+        if (success == false) {
+            continue;
+        }
+        auto z = (Complex(xi, eta) - fit.t_) / fit.m_;
+        double x = z.real();
+        double y = mirrored_ ? - z.imag() : z.imag();
+        if (x < - kMatchPixels || x > width_ + kMatchPixels
+        ||  y < - kMatchPixels || y > height_ + kMatchPixels) {
+            continue;
+        }
+        for (int i = 0; i < nstars; ++i) {
+            double d2 = std::norm(getPoint(i) - z);
+            if (d2 < match_d2_[i]) {
+                match_d2_[i] = d2;
+                matches_[i] = s;
+            }
+        }
+    }
+
+    int matched = 0;
+    for (auto m : matches_) {
+        if (m >= 0) {
+            ++matched;
+        }
+    }
+    return matched;
+}
+
+/** move the tangent point to the center of the frame and fit all the matched stars. **/
+bool PlateSolver::refine(
+    Fit &fit
+) noexcept {
+    Complex zc(0.5 * width_, mirrored_ ? -0.5 * height_ : 0.5 * height_);
+    auto wc = fit.m_ * zc + fit.t_;
+    Fit refined;
+    StarIndex::unproject(fit.center_, wc.real(), wc.imag(), refined.center_);
+
+    z_.clear();
+    w_.clear();
+    int nstars = matches_.size();
+    for (int i = 0; i < nstars; ++i) {
+        if (matches_[i] < 0) {
+            continue;
+        }
+        auto &star = index_->getStar(matches_[i]);
+        double v[3] = {star.x_, star.y_, star.z_};
+        double xi;
+        double eta;
+        bool success = StarIndex::project(refined.center_, v, xi, eta);
+        if (success == false) {
+            continue;
+        }
+        z_.push_back(getPoint(i));
+        w_.push_back(Complex(xi, eta));
+    }
+    bool success = fitSimilarity(refined.m_, refined.t_);
+    if (success == false) {
+        return false;
+    }
+    fit = refined;
+    return true;
+}
+
+/**
+least squares.
+m = sum (w - w0) * conj(z - z0) / sum |z - z0|^2
+t = w0 - m * z0
+**/
+bool PlateSolver::fitSimilarity(
+    Complex &m,
+    Complex &t
+) const noexcept {
+    int n = z_.size();
+    if (n < 2) {
+        return false;
+    }
+    Complex z0(0.0, 0.0);
+    Complex w0(0.0, 0.0);
+    for (int i = 0; i < n; ++i) {
+        z0 += z_[i];
+        w0 += w_[i];
+    }
+    z0 /= double(n);
+    w0 /= double(n);
+    Complex num(0.0, 0.0);
+    double den = 0.0;
+    for (int i = 0; i < n; ++i) {
+        auto dz = z_[i] - z0;
+        num += (w_[i] - w0) * std::conj(dz);
+        den += std::norm(dz);
+    }
+    if (den <= 0.0) {
+        return false;
+    }
+    m = num / den;
+    t = w0 - m * z0;
+    return std::abs(m) > 0.0;
+}
+
+void PlateSolver::precessToDate(
+    double ra,
+    double dec,
+    agm::int64 unix_time,
+    double &ra_date,
+    double &dec_date
+) noexcept {
+    double p[3][3];
+    getPrecession(unix_time, p);
+    double v[3];
+    StarIndex::toVector(ra, dec, v);
+    double vd[3];
+    for (int i = 0; i < 3; ++i) {
+        vd[i] = p[i][0] * v[0] + p[i][1] * v[1] + p[i][2] * v[2];
+    }
+    StarIndex::fromVector(vd, ra_date, dec_date);
+}
+
+/** the pole of date is the bottom row of the matrix. **/
+void PlateSolver::getPoleOfDate(
+    agm::int64 unix_time,
+    double &ra,
+    double &dec
+) noexcept {
+    double p[3][3];
+    getPrecession(unix_time, p);
+    StarIndex::fromVector(p[2], ra, dec);
+}
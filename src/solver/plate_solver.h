@@ -0,0 +1,117 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+find where on the sky the camera is pointing from the stars in a frame.
+
+quads are made from the brightest stars in the frame.
+brightest first. so the first quads tried are the most likely to be in the index.
+the code of each quad is looked up in the index.
+both ways round. the image may be mirrored.
+
+each catalog quad found is a guess.
+the guess maps the image to the plane tangent to the sky.
+it's checked by predicting where the other catalog stars in the field should be.
+the first guess that enough image stars agree with is the solution.
+it's refined with all the matched stars.
+
+the scale of the last solution narrows the search of the next one.
+**/
+
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include <window/star_registration.h>
+
+#include "star_index.h"
+
+
+class PlateSolver {
+public:
+    PlateSolver() noexcept = default;
+    PlateSolver(const PlateSolver &) = delete;
+    ~PlateSolver() noexcept = default;
+
+    class Solution {
+    public:
+        bool solved_ = false;
+        /** the center of the frame in J2000 degrees. **/
+        double ra_ = 0.0;
+        double dec_ = 0.0;
+        /** arcseconds per bayer pixel. **/
+        double scale_ = 0.0;
+        /** the direction of the top of the frame in degrees east of north. **/
+        double angle_ = 0.0;
+        /** the frame is mirrored. east is clockwise from north. **/
+        bool mirrored_ = false;
+        /** the image stars that match catalog stars. **/
+        int matched_ = 0;
+        /** the number of index quads tried. **/
+        int tried_ = 0;
+        double ms_ = 0.0;
+    };
+
+    /**
+    solve the stars of a frame. the stars are brightest first.
+    the scale range is in arcseconds per bayer pixel. zeros are any scale.
+    returns false if there's no solution.
+    **/
+    bool solve(
+        const StarIndex &index,
+        const std::vector<StarRegistration::Star> &stars,
+        int width,
+        int height,
+        double min_scale,
+        double max_scale,
+        Solution &solution
+    ) noexcept;
+
+    /**
+    the earth's axis precesses about 50 arcseconds a year.
+    the index is J2000. the mount is of date.
+    unix time is seconds since 1970.
+    **/
+    static void precessToDate(double ra, double dec, agm::int64 unix_time, double &ra_date, double &dec_date) noexcept;
+
+    /** the celestial pole of date in J2000 degrees. **/
+    static void getPoleOfDate(agm::int64 unix_time, double &ra, double &dec) noexcept;
+
+private:
+    typedef std::complex<double> Complex;
+
+    /** maps image points to the plane tangent to the sky at center. w = m * z + t **/
+    class Fit {
+    public:
+        double center_[3] = {0.0, 0.0, 1.0};
+        Complex m_;
+        Complex t_;
+    };
+
+    /** the solve in progress. **/
+    const StarIndex *index_ = nullptr;
+    const std::vector<StarRegistration::Star> *stars_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    bool mirrored_ = false;
+    double min_scale_ = 0.0;
+    double max_scale_ = 0.0;
+
+    std::vector<int> quads_;
+    std::vector<int> field_;
+    /** the catalog star matched to each image star. -1 for none. **/
+    std::vector<int> matches_;
+    std::vector<double> match_d2_;
+    std::vector<Complex> z_;
+    std::vector<Complex> w_;
+
+    Complex getPoint(int index) const noexcept;
+    bool tryQuad(const int image_quad[4], int quad, Solution &solution) noexcept;
+    int matchStars(const Fit &fit) noexcept;
+    bool refine(Fit &fit) noexcept;
+    bool fitSimilarity(Complex &m, Complex &t) const noexcept;
+};
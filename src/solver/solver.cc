@@ -0,0 +1,327 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+plate solve frames on request.
+
+the solver has its own thread and its own place in the image ring.
+it takes the newest frame when the menu asks for a solve.
+a solve takes a while. the other threads don't wait for it.
+
+the star index is opened the first time it's needed.
+the default is stars.idx in the working directory.
+build it with zwo_index.
+
+sync:
+the solution is precessed to date and sent to the mount.
+
+polar alignment:
+solve a frame. rotate the mount in ra only. repeat three times.
+the centers of the three frames are on a circle around the mount's ra axis.
+the axis is compared to the celestial pole of date.
+the error is reported as where the axis points.
+it's not split into altitude and azimuth adjustments.
+**/
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+#include <aggiornamento/thread.h>
+
+#include <menu/ioptron.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/settings_buffer.h>
+#include <shared/worker_pool.h>
+#include <window/star_registration.h>
+
+#include "plate_solver.h"
+#include "star_index.h"
+
+
+namespace {
+
+const char *kDefaultIndex = "stars.idx";
+/** the next solve looks for scales this close to the last one. **/
+const double kScaleRange = 1.25;
+/** the frames should be this far apart for polar alignment. **/
+const double kMinPolarDegrees = 10.0;
+
+class SolverThread : public agm::Thread {
+public:
+    /** share data with the capture thread. **/
+    ImageRing *image_ring_ = nullptr;
+    int ring_consumer_ = -1;
+    /** share data with the menu thread. **/
+    SettingsBuffer *settings_buffer_ = nullptr;
+    /** the mount is shared with the menu thread. **/
+    Ioptron *mount_ = nullptr;
+    /** where the time goes. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_detect_ = nullptr;
+    LatencyHistogram *time_solve_ = nullptr;
+
+    WorkerPool *pool_ = nullptr;
+    StarRegistration finder_;
+    StarIndex index_;
+    std::string index_path_ = kDefaultIndex;
+    PlateSolver solver_;
+    /** arcseconds per unbinned pixel. 0 is unknown. **/
+    double last_scale_ = 0.0;
+
+    /** the frame centers so far. J2000 unit vectors. **/
+    int npolar_ = 0;
+    double polar_[3][3];
+
+    SolverThread(
+        ImageRing *image_ring,
+        SettingsBuffer *settings_buffer,
+        Ioptron *mount,
+        PerfStats *perf_stats
+    ) noexcept : agm::Thread("SolverThread") {
+        image_ring_ = image_ring;
+        /** we want the newest frame. **/
+        ring_consumer_ = image_ring_->addConsumer(ImageRing::Policy::kLatest);
+        settings_buffer_ = settings_buffer;
+        mount_ = mount;
+        perf_stats_ = perf_stats;
+    }
+
+    virtual ~SolverThread() = default;
+
+    virtual void begin() noexcept {
+        LOG("SolverThread.");
+        static const char *kThread = "SolverThread";
+        time_detect_ = perf_stats_->addStage(kThread, "detect");
+        time_solve_ = perf_stats_->addStage(kThread, "solve");
+        /** solves are rare. don't compete with the window thread for the cores. **/
+        pool_ = WorkerPool::create(1);
+    }
+
+    virtual void runOnce() noexcept {
+        /** wait for the next frame. **/
+        auto img = image_ring_->acquireRead(ring_consumer_);
+        if (img == nullptr) {
+            return;
+        }
+
+        MenuCommand cmd;
+        bool have_command = settings_buffer_->solve_commands_.pop(cmd);
+        if (have_command) {
+            handleCommand(cmd, img);
+        }
+
+        image_ring_->releaseRead(ring_consumer_, img);
+    }
+
+    virtual void end() noexcept {
+        index_.close();
+        delete pool_;
+        pool_ = nullptr;
+    }
+
+    void handleCommand(
+        const MenuCommand &cmd,
+        const ImageBuffer *img
+    ) noexcept {
+        if (cmd.type_ == MenuCommand::Type::kPolarAlign && cmd.frames_ < 0) {
+            npolar_ = 0;
+            setStatus("polar alignment restarted.");
+            return;
+        }
+
+        bool success = openIndex(cmd.name_);
+        if (success == false) {
+            return;
+        }
+        PlateSolver::Solution solution;
+        success = solveFrame(img, solution);
+        if (success == false) {
+            return;
+        }
+
+        agm::int64 unix_time = img->timestamp_ / 1000000;
+        switch (cmd.type_) {
+        case MenuCommand::Type::kSyncMount: {
+            double ra;
+            double dec;
+            PlateSolver::precessToDate(solution.ra_, solution.dec_, unix_time, ra, dec);
+            mount_->sync(ra, dec);
+        } break;
+
+        case MenuCommand::Type::kPolarAlign:
+            addPolarFrame(solution, unix_time);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    bool openIndex(
+        const std::string &path
+    ) noexcept {
+        if (path.size() && path != index_path_) {
+            index_path_ = path;
+            index_.close();
+            last_scale_ = 0.0;
+        }
+        if (index_.isOpen()) {
+            return true;
+        }
+        bool success = index_.open(index_path_);
+        if (success == false) {
+            setStatus("failed to open star index " + index_path_);
+        }
+        return success;
+    }
+
+    bool solveFrame(
+        const ImageBuffer *img,
+        PlateSolver::Solution &solution
+    ) noexcept {
+        const std::vector<StarRegistration::Star> *stars = nullptr;
+        {
+            ScopedTimer timer(time_detect_);
+            stars = &finder_.detect(img->bayer_, pool_);
+        }
+
+        /** try the last scale first. then any scale. **/
+        int bin = std::max(img->bin_, 1);
+        bool success = false;
+        {
+            ScopedTimer timer(time_solve_);
+            if (last_scale_ > 0.0) {
+                double scale = last_scale_ * bin;
+                success = solver_.solve(index_, *stars, img->width_, img->height_,
+                    scale / kScaleRange, scale * kScaleRange, solution);
+            }
+            if (success == false) {
+                success = solver_.solve(index_, *stars, img->width_, img->height_, 0.0, 0.0, solution);
+            }
+        }
+
+        std::stringstream ss;
+        if (success == false) {
+            ss<<"no solution. "<<stars->size()<<" stars.";
+            setStatus(ss.str());
+            return false;
+        }
+        last_scale_ = solution.scale_ / bin;
+
+        ss<<std::fixed<<std::setprecision(4);
+        ss<<"ra="<<solution.ra_<<" dec="<<solution.dec_<<" (J2000 degrees)";
+        ss<<std::setprecision(3)<<" scale="<<solution.scale_<<" arcsec/pixel";
+        ss<<std::setprecision(1)<<" angle="<<solution.angle_;
+        if (solution.mirrored_) {
+            ss<<" mirrored";
+        }
+        ss<<" matched "<<solution.matched_<<"/"<<stars->size()
+            <<" in "<<std::setprecision(0)<<solution.ms_<<" ms.";
+        setStatus(ss.str());
+        return true;
+    }
+
+    void addPolarFrame(
+        const PlateSolver::Solution &solution,
+        agm::int64 unix_time
+    ) noexcept {
+        double v[3];
+        StarIndex::toVector(solution.ra_, solution.dec_, v);
+        if (npolar_ > 0) {
+            double d = v[0] * polar_[npolar_ - 1][0] + v[1] * polar_[npolar_ - 1][1] + v[2] * polar_[npolar_ - 1][2];
+            double degrees = std::acos(std::max(-1.0, std::min(d, 1.0))) * 180.0 / M_PI;
+            if (degrees < kMinPolarDegrees) {
+                std::stringstream ss;
+                ss<<"polar alignment: rotate the mount farther in ra. moved "<<std::fixed<<std::setprecision(1)<<degrees<<" degrees.";
+                setStatus(ss.str());
+                return;
+            }
+        }
+        for (int i = 0; i < 3; ++i) {
+            polar_[npolar_][i] = v[i];
+        }
+        ++npolar_;
+        if (npolar_ < 3) {
+            std::stringstream ss;
+            ss<<"polar alignment: frame "<<npolar_<<" of 3. rotate the mount in ra only.";
+            setStatus(ss.str());
+            return;
+        }
+        npolar_ = 0;
+
+        /** the axis is perpendicular to the plane of the three centers. **/
+        double a[3];
+        double b[3];
+        for (int i = 0; i < 3; ++i) {
+            a[i] = polar_[1][i] - polar_[0][i];
+            b[i] = polar_[2][i] - polar_[0][i];
+        }
+        double axis[3] = {
+            a[1] * b[2] - a[2] * b[1],
+            a[2] * b[0] - a[0] * b[2],
+            a[0] * b[1] - a[1] * b[0]
+        };
+        double len = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        if (len < 1e-9) {
+            setStatus("polar alignment failed. the frames are in a line.");
+            return;
+        }
+
+        /** point the axis at the pole on the side of the sky the frames are on. **/
+        double pole_ra;
+        double pole_dec;
+        PlateSolver::getPoleOfDate(unix_time, pole_ra, pole_dec);
+        double pole[3];
+        StarIndex::toVector(pole_ra, pole_dec, pole);
+        if (polar_[0][2] + polar_[1][2] + polar_[2][2] < 0.0) {
+            for (auto &x : pole) {
+                x = -x;
+            }
+        }
+        double d = axis[0] * pole[0] + axis[1] * pole[1] + axis[2] * pole[2];
+        if (d < 0.0) {
+            len = -len;
+            d = -d;
+        }
+        for (auto &x : axis) {
+            x /= len;
+        }
+        d /= std::abs(len);
+        double error = std::acos(std::max(-1.0, std::min(d, 1.0))) * 180.0 / M_PI * 60.0;
+        double axis_ra;
+        double axis_dec;
+        StarIndex::fromVector(axis, axis_ra, axis_dec);
+
+        std::stringstream ss;
+        ss<<std::fixed<<std::setprecision(1);
+        ss<<"polar alignment error "<<error<<" arcmin. the ra axis points at ra="
+            <<std::setprecision(3)<<axis_ra<<" dec="<<axis_dec<<" (J2000 degrees).";
+        setStatus(ss.str());
+    }
+
+    /** the menu shows the status. **/
+    void setStatus(
+        const std::string &status
+    ) noexcept {
+        LOG("SolverThread "<<status);
+        SettingsLock lock(settings_buffer_);
+        settings_buffer_->solve_status_ = status;
+    }
+};
+}
+
+agm::Thread *createSolverThread(
+    ImageRing *image_ring,
+    SettingsBuffer *settings_buffer,
+    Ioptron *mount,
+    PerfStats *perf_stats
+) noexcept {
+    return new(std::nothrow) SolverThread(image_ring, settings_buffer, mount, perf_stats);
+}
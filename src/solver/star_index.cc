@@ -0,0 +1,510 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+the file is a header followed by the arrays.
+all native endian.
+
+    header
+    agm::uint64 keys[nstars]
+    Star stars[nstars]
+    agm::uint32 bins[kCodeBins^4 + 1]
+    Quad quads[nquads]
+
+quads bins[i] to bins[i+1] are in bin i.
+**/
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+
+#include "star_index.h"
+
+
+namespace {
+    const char kMagic[8] = {'Z', 'W', 'O', 'Q', 'U', 'A', 'D', '1'};
+    const agm::uint32 kVersion = 1;
+
+    /**
+    C and D are inside the circle with A and B on its diameter.
+    so their codes are from 0.5 - sqrt(0.5) to 0.5 + sqrt(0.5). about -0.21 to 1.21.
+    the range has a little margin.
+    **/
+    const double kCodeMin = -0.25;
+    const double kCodeMax = 1.25;
+    const int kBinCount = StarIndex::kCodeBins * StarIndex::kCodeBins
+        * StarIndex::kCodeBins * StarIndex::kCodeBins;
+
+    /** the cell indexes are offset to make them positive. **/
+    const int kKeyBits = 21;
+    const int kKeyOffset = 1 << (kKeyBits - 1);
+
+    class Header {
+    public:
+        char magic_[8];
+        agm::uint32 version_;
+        agm::uint32 nstars_;
+        agm::uint32 nquads_;
+        agm::uint32 bins_;
+        double min_diameter_;
+        double max_diameter_;
+        double cell_size_;
+        agm::uint8 reserved_[16];
+    };
+    static_assert(sizeof(Header) == 64, "Header must be 64 bytes.");
+
+    double dot(
+        const double a[3],
+        const double b[3]
+    ) noexcept {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    void normalize(
+        double v[3]
+    ) noexcept {
+        double len = std::sqrt(dot(v, v));
+        if (len > 0.0) {
+            v[0] /= len;
+            v[1] /= len;
+            v[2] /= len;
+        }
+    }
+
+    /** east and north at center. **/
+    void getTangentBasis(
+        const double center[3],
+        double east[3],
+        double north[3]
+    ) noexcept {
+        /** east is the pole cross the center. **/
+        east[0] = - center[1];
+        east[1] = center[0];
+        east[2] = 0.0;
+        if (dot(east, east) < 1e-18) {
+            /** at the pole any direction is south. **/
+            east[0] = 0.0;
+            east[1] = 1.0;
+        }
+        normalize(east);
+        /** north is the center cross east. **/
+        north[0] = center[1] * east[2] - center[2] * east[1];
+        north[1] = center[2] * east[0] - center[0] * east[2];
+        north[2] = center[0] * east[1] - center[1] * east[0];
+    }
+
+    int getCell(
+        double value,
+        double cell_size
+    ) noexcept {
+        return int(std::floor(value / cell_size));
+    }
+
+    bool writeArray(
+        std::FILE *fp,
+        const void *data,
+        size_t bytes
+    ) noexcept {
+        if (bytes == 0) {
+            return true;
+        }
+        return std::fwrite(data, 1, bytes, fp) == bytes;
+    }
+}
+
+StarIndex::~StarIndex() noexcept {
+    close();
+}
+
+bool StarIndex::open(
+    const std::string &path
+) noexcept {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG("StarIndex Failed to open file: "<<path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < agm::int64(sizeof(Header))) {
+        LOG("StarIndex Not an index: "<<path);
+        ::close(fd);
+        return false;
+    }
+    size_ = st.st_size;
+    void *base = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    /** the mapping keeps the file open. **/
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        LOG("StarIndex Failed to map file: "<<path);
+        return false;
+    }
+    base_ = base;
+
+    /** check the header and the size. **/
+    auto header = (const Header *) base_;
+    agm::int64 expected = sizeof(Header)
+        + agm::int64(header->nstars_) * (sizeof(agm::uint64) + sizeof(Star))
+        + agm::int64(kBinCount + 1) * sizeof(agm::uint32)
+        + agm::int64(header->nquads_) * sizeof(Quad);
+    if (std::memcmp(header->magic_, kMagic, sizeof(kMagic)) != 0
+    ||  header->version_ != kVersion
+    ||  header->bins_ != agm::uint32(kCodeBins)
+    ||  expected != size_) {
+        LOG("StarIndex Not an index or the wrong version: "<<path);
+        close();
+        return false;
+    }
+
+    nstars_ = header->nstars_;
+    nquads_ = header->nquads_;
+    min_diameter_ = header->min_diameter_;
+    max_diameter_ = header->max_diameter_;
+    cell_size_ = header->cell_size_;
+    auto ptr = (const agm::uint8 *) base_ + sizeof(Header);
+    keys_ = (const agm::uint64 *) ptr;
+    ptr += nstars_ * sizeof(agm::uint64);
+    stars_ = (const Star *) ptr;
+    ptr += nstars_ * sizeof(Star);
+    bins_ = (const agm::uint32 *) ptr;
+    ptr += (kBinCount + 1) * sizeof(agm::uint32);
+    quads_ = (const Quad *) ptr;
+
+    LOG("StarIndex Opened "<<path<<": "<<nstars_<<" stars "<<nquads_<<" quads "
+        <<min_diameter_ * 180.0 / M_PI<<" to "<<max_diameter_ * 180.0 / M_PI<<" degrees.");
+    return true;
+}
+
+void StarIndex::close() noexcept {
+    if (base_) {
+        munmap(base_, size_);
+    }
+    base_ = nullptr;
+    size_ = 0;
+    nstars_ = 0;
+    nquads_ = 0;
+    keys_ = nullptr;
+    stars_ = nullptr;
+    bins_ = nullptr;
+    quads_ = nullptr;
+}
+
+void StarIndex::findQuads(
+    const double code[4],
+    double tolerance,
+    std::vector<int> &quads
+) const noexcept {
+    quads.clear();
+    if (base_ == nullptr) {
+        return;
+    }
+    int lo[4];
+    int hi[4];
+    for (int i = 0; i < 4; ++i) {
+        lo[i] = getBin(code[i] - tolerance);
+        hi[i] = getBin(code[i] + tolerance);
+    }
+    double tol2 = tolerance * tolerance;
+    int bin[4];
+    for (bin[0] = lo[0]; bin[0] <= hi[0]; ++bin[0]) {
+    for (bin[1] = lo[1]; bin[1] <= hi[1]; ++bin[1]) {
+    for (bin[2] = lo[2]; bin[2] <= hi[2]; ++bin[2]) {
+    for (bin[3] = lo[3]; bin[3] <= hi[3]; ++bin[3]) {
+        int index = getBinIndex(bin);
+        auto end = bins_[index + 1];
+        for (auto q = bins_[index]; q < end; ++q) {
+            auto &quad = quads_[q];
+            double d2 = 0.0;
+            for (int i = 0; i < 4; ++i) {
+                double d = quad.code_[i] - code[i];
+                d2 += d * d;
+            }
+            if (d2 <= tol2) {
+                quads.push_back(q);
+            }
+        }
+    }
+    }
+    }
+    }
+}
+
+void StarIndex::findStars(
+    const double center[3],
+    double radius,
+    std::vector<int> &stars
+) const noexcept {
+    stars.clear();
+    if (base_ == nullptr) {
+        return;
+    }
+    /** the chord is shorter than the arc. **/
+    int lo[3];
+    int hi[3];
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = getCell(center[i] - radius, cell_size_);
+        hi[i] = getCell(center[i] + radius, cell_size_);
+    }
+    double min_dot = std::cos(radius);
+    for (int ix = lo[0]; ix <= hi[0]; ++ix) {
+    for (int iy = lo[1]; iy <= hi[1]; ++iy) {
+    for (int iz = lo[2]; iz <= hi[2]; ++iz) {
+        auto key = getKey(ix, iy, iz);
+        auto range = std::equal_range(keys_, keys_ + nstars_, key);
+        for (auto it = range.first; it < range.second; ++it) {
+            int s = int(it - keys_);
+            auto &star = stars_[s];
+            double d = center[0] * star.x_ + center[1] * star.y_ + center[2] * star.z_;
+            if (d >= min_dot) {
+                stars.push_back(s);
+            }
+        }
+    }
+    }
+    }
+}
+
+bool StarIndex::write(
+    const std::string &path,
+    std::vector<Star> &stars,
+    std::vector<Quad> &quads,
+    double min_diameter,
+    double max_diameter,
+    double cell_size
+) noexcept {
+    /** sort the stars by cell. **/
+    int nstars = stars.size();
+    std::vector<agm::uint64> star_keys(nstars);
+    for (int i = 0; i < nstars; ++i) {
+        auto &star = stars[i];
+        star_keys[i] = getKey(getCell(star.x_, cell_size), getCell(star.y_, cell_size), getCell(star.z_, cell_size));
+    }
+    std::vector<int> order(nstars);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return star_keys[a] < star_keys[b];
+    });
+    std::vector<int> new_index(nstars);
+    std::vector<agm::uint64> keys(nstars);
+    std::vector<Star> sorted(nstars);
+    for (int i = 0; i < nstars; ++i) {
+        new_index[order[i]] = i;
+        keys[i] = star_keys[order[i]];
+        sorted[i] = stars[order[i]];
+    }
+    stars.swap(sorted);
+    for (auto &quad : quads) {
+        for (auto &s : quad.stars_) {
+            s = new_index[s];
+        }
+    }
+
+    /** sort the quads by bin. **/
+    int nquads = quads.size();
+    std::vector<int> quad_bins(nquads);
+    std::vector<agm::uint32> bins(kBinCount + 1, 0);
+    for (int q = 0; q < nquads; ++q) {
+        int bin[4];
+        for (int i = 0; i < 4; ++i) {
+            bin[i] = getBin(quads[q].code_[i]);
+        }
+        quad_bins[q] = getBinIndex(bin);
+        ++bins[quad_bins[q] + 1];
+    }
+    for (int i = 0; i < kBinCount; ++i) {
+        bins[i + 1] += bins[i];
+    }
+    std::vector<Quad> binned(nquads);
+    std::vector<agm::uint32> next(bins.begin(), bins.end() - 1);
+    for (int q = 0; q < nquads; ++q) {
+        binned[next[quad_bins[q]]++] = quads[q];
+    }
+    quads.swap(binned);
+
+    auto fp = std::fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+        LOG("StarIndex Failed to create file: "<<path);
+        return false;
+    }
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic_, kMagic, sizeof(kMagic));
+    header.version_ = kVersion;
+    header.nstars_ = nstars;
+    header.nquads_ = nquads;
+    header.bins_ = kCodeBins;
+    header.min_diameter_ = min_diameter;
+    header.max_diameter_ = max_diameter;
+    header.cell_size_ = cell_size;
+    bool success = writeArray(fp, &header, sizeof(header))
+        && writeArray(fp, keys.data(), keys.size() * sizeof(agm::uint64))
+        && writeArray(fp, stars.data(), stars.size() * sizeof(Star))
+        && writeArray(fp, bins.data(), bins.size() * sizeof(agm::uint32))
+        && writeArray(fp, quads.data(), quads.size() * sizeof(Quad));
+    success = (std::fclose(fp) == 0) && success;
+    if (success == false) {
+        LOG("StarIndex Failed to write file: "<<path);
+    }
+    return success;
+}
+
+bool StarIndex::computeCode(
+    const double xy[4][2],
+    int order[4],
+    double code[4]
+) noexcept {
+    /** A and B are the farthest apart. **/
+    int a = 0;
+    int b = 1;
+    double best = -1.0;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = i + 1; j < 4; ++j) {
+            double dx = xy[j][0] - xy[i][0];
+            double dy = xy[j][1] - xy[i][1];
+            double d2 = dx * dx + dy * dy;
+            if (d2 > best) {
+                best = d2;
+                a = i;
+                b = j;
+            }
+        }
+    }
+    if (best <= 0.0) {
+        return false;
+    }
+    int c = -1;
+    int d = -1;
+    for (int i = 0; i < 4; ++i) {
+        if (i != a && i != b) {
+            if (c < 0) {
+                c = i;
+            } else {
+                d = i;
+            }
+        }
+    }
+
+    /** the similarity that takes A to 0 and B to 1+i. **/
+    typedef std::complex<double> Complex;
+    Complex pa(xy[a][0], xy[a][1]);
+    Complex pb(xy[b][0], xy[b][1]);
+    Complex scale = Complex(1.0, 1.0) / (pb - pa);
+    Complex zc = (Complex(xy[c][0], xy[c][1]) - pa) * scale;
+    Complex zd = (Complex(xy[d][0], xy[d][1]) - pa) * scale;
+
+    /** swapping A and B takes z to 1+i-z. **/
+    if (zc.real() + zd.real() > 1.0) {
+        std::swap(a, b);
+        zc = Complex(1.0, 1.0) - zc;
+        zd = Complex(1.0, 1.0) - zd;
+    }
+    if (zc.real() > zd.real()) {
+        std::swap(c, d);
+        std::swap(zc, zd);
+    }
+
+    order[0] = a;
+    order[1] = b;
+    order[2] = c;
+    order[3] = d;
+    code[0] = zc.real();
+    code[1] = zc.imag();
+    code[2] = zd.real();
+    code[3] = zd.imag();
+    return true;
+}
+
+bool StarIndex::project(
+    const double center[3],
+    const double v[3],
+    double &xi,
+    double &eta
+) noexcept {
+    double east[3];
+    double north[3];
+    getTangentBasis(center, east, north);
+    double d = dot(v, center);
+    if (d <= 0.0) {
+        return false;
+    }
+    xi = dot(v, east) / d;
+    eta = dot(v, north) / d;
+    return true;
+}
+
+void StarIndex::unproject(
+    const double center[3],
+    double xi,
+    double eta,
+    double v[3]
+) noexcept {
+    double east[3];
+    double north[3];
+    getTangentBasis(center, east, north);
+    for (int i = 0; i < 3; ++i) {
+        v[i] = center[i] + xi * east[i] + eta * north[i];
+    }
+    normalize(v);
+}
+
+void StarIndex::toVector(
+    double ra,
+    double dec,
+    double v[3]
+) noexcept {
+    double r = ra * M_PI / 180.0;
+    double d = dec * M_PI / 180.0;
+    v[0] = std::cos(d) * std::cos(r);
+    v[1] = std::cos(d) * std::sin(r);
+    v[2] = std::sin(d);
+}
+
+void StarIndex::fromVector(
+    const double v[3],
+    double &ra,
+    double &dec
+) noexcept {
+    ra = std::atan2(v[1], v[0]) * 180.0 / M_PI;
+    if (ra < 0.0) {
+        ra += 360.0;
+    }
+    dec = std::asin(std::max(-1.0, std::min(v[2], 1.0))) * 180.0 / M_PI;
+}
+
+agm::uint64 StarIndex::getKey(
+    int ix,
+    int iy,
+    int iz
+) noexcept {
+    agm::uint64 mask = (agm::uint64(1) << kKeyBits) - 1;
+    agm::uint64 x = agm::uint64(ix + kKeyOffset) & mask;
+    agm::uint64 y = agm::uint64(iy + kKeyOffset) & mask;
+    agm::uint64 z = agm::uint64(iz + kKeyOffset) & mask;
+    return (x << (2 * kKeyBits)) | (y << kKeyBits) | z;
+}
+
+int StarIndex::getBin(
+    double value
+) noexcept {
+    int bin = int(std::floor((value - kCodeMin) * kCodeBins / (kCodeMax - kCodeMin)));
+    return std::max(0, std::min(bin, kCodeBins - 1));
+}
+
+int StarIndex::getBinIndex(
+    const int bin[4]
+) noexcept {
+    return ((bin[0] * kCodeBins + bin[1]) * kCodeBins + bin[2]) * kCodeBins + bin[3];
+}
@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+a precomputed index of star quads for plate solving.
+
+the index is built once from a catalog by zwo_index.
+it's memory mapped. so opening it is instant.
+and only the pages that are searched are read.
+
+stars are unit vectors in J2000 coordinates.
+they're sorted by a cell on a 3d grid.
+so the stars near a point on the sky are found with a few binary searches.
+the grid works the same at the poles.
+
+a quad is 4 stars.
+A and B are the farthest apart.
+the other two are placed in the frame where A is (0,0) and B is (1,1).
+their coordinates are the code of the quad.
+the code doesn't change when the quad is moved, rotated, or scaled.
+so the same code comes from the sky and from an image.
+
+A and B are swapped if need be so cx + dx <= 1.
+C and D are swapped so cx <= dx.
+which makes the code unique.
+
+the codes are hashed into a 4d grid of bins.
+the quads are sorted by bin.
+a lookup reads the bins within the tolerance of the code.
+**/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class StarIndex {
+public:
+    StarIndex() noexcept = default;
+    StarIndex(const StarIndex &) = delete;
+    ~StarIndex() noexcept;
+
+    /** bins per dimension of the code. **/
+    static const int kCodeBins = 16;
+
+    class Star {
+    public:
+        float x_ = 0.0f;
+        float y_ = 0.0f;
+        float z_ = 0.0f;
+        float mag_ = 0.0f;
+    };
+
+    class Quad {
+    public:
+        /** in code order A, B, C, D. **/
+        agm::uint32 stars_[4] = {0};
+        float code_[4] = {0.0f};
+    };
+
+    /** memory map the index. returns false if it's not an index. **/
+    bool open(const std::string &path) noexcept;
+
+    void close() noexcept;
+
+    bool isOpen() const noexcept { return base_ != nullptr; }
+
+    int getStarCount() const noexcept { return nstars_; }
+    int getQuadCount() const noexcept { return nquads_; }
+    const Star &getStar(int index) const noexcept { return stars_[index]; }
+    const Quad &getQuad(int index) const noexcept { return quads_[index]; }
+
+    /** the angular sizes of the quads from A to B in radians. **/
+    double getMinDiameter() const noexcept { return min_diameter_; }
+    double getMaxDiameter() const noexcept { return max_diameter_; }
+
+    /** find the quads with codes within tolerance of code. **/
+    void findQuads(const double code[4], double tolerance, std::vector<int> &quads) const noexcept;
+
+    /** find the stars within radius radians of the unit vector. **/
+    void findStars(const double center[3], double radius, std::vector<int> &stars) const noexcept;
+
+    /**
+    write an index.
+    the stars are sorted into cells and the quad star numbers are changed to match.
+    the diameters and the cell size are in radians.
+    the cell size should be about the size of the field of view.
+    **/
+    static bool write(
+        const std::string &path,
+        std::vector<Star> &stars,
+        std::vector<Quad> &quads,
+        double min_diameter,
+        double max_diameter,
+        double cell_size
+    ) noexcept;
+
+    /**
+    compute the code of 4 points in a plane.
+    order is set to the indexes of the points in code order.
+    returns false if the points are degenerate.
+    **/
+    static bool computeCode(const double xy[4][2], int order[4], double code[4]) noexcept;
+
+    /**
+    project a unit vector onto the plane tangent to the sphere at center.
+    xi is east and eta is north. in radians.
+    returns false if the point is on the far side.
+    **/
+    static bool project(const double center[3], const double v[3], double &xi, double &eta) noexcept;
+
+    /** the inverse of project. **/
+    static void unproject(const double center[3], double xi, double eta, double v[3]) noexcept;
+
+    /** ra and dec in degrees to a unit vector and back. **/
+    static void toVector(double ra, double dec, double v[3]) noexcept;
+    static void fromVector(const double v[3], double &ra, double &dec) noexcept;
+
+private:
+    void *base_ = nullptr;
+    agm::int64 size_ = 0;
+    int nstars_ = 0;
+    int nquads_ = 0;
+    double min_diameter_ = 0.0;
+    double max_diameter_ = 0.0;
+    double cell_size_ = 0.0;
+    const agm::uint64 *keys_ = nullptr;
+    const Star *stars_ = nullptr;
+    const agm::uint32 *bins_ = nullptr;
+    const Quad *quads_ = nullptr;
+
+    static agm::uint64 getKey(int ix, int iy, int iz) noexcept;
+    static int getBin(double value) noexcept;
+    static int getBinIndex(const int bin[4]) noexcept;
+};
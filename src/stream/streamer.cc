@@ -0,0 +1,780 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+stream previews to remote clients instead of showing them in a window.
+
+headless mode runs this thread in place of the window thread.
+so the camera can be driven from a small computer on the mount.
+
+the streamer has its own place in the image ring.
+it takes the newest frame. so a slow link drops frames. it never slows the capture.
+the preview is shrunk to 8 bits while the slot is held.
+it's scaled and encoded after the slot is released.
+
+clients connect with tcp. the default port is 4030.
+each client gets the newest preview when it's read the last one.
+so the frame rate follows the slowest part of the link.
+the jpeg quality drops when a client falls behind.
+and creeps back up when they all keep up.
+
+the server sends messages. a 32 byte header followed by the payload.
+all fields are little endian.
+    uint32 magic        "ZWOS"
+    uint16 type         1 text, 2 jpeg preview, 3 raw bayer
+    uint16 pattern      the bayer pattern of raw frames. 0 rggb, 1 bggr, 2 grbg, 3 gbrg
+    uint32 width        pixels. 0 for text
+    uint32 height
+    uint32 bytes        of the payload
+    uint32 exposure     microseconds
+    int64 timestamp     microseconds since 1970 utc
+raw frames are 16 bits per pixel. uncompressed.
+
+the client sends lines of text.
+lines that start with a . are for the streamer.
+    .raw [+-01yn]   also send the raw frames
+    .size wd ht     fit the previews in wd by ht pixels
+everything else is menu input.
+the menu sends its answer back to the client that sent the input.
+as one text message. it's in the log too.
+the streamer sends a status line every few seconds.
+
+the window thread does the saves and master frames.
+they're refused in headless mode. record raw frames or stream them instead.
+**/
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+#include <aggiornamento/log.h>
+#include <aggiornamento/thread.h>
+
+#include <menu/ioptron.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/settings_buffer.h>
+
+
+namespace {
+
+const int kMaxClients = 4;
+const int kMaxLine = 1024;
+/** a client that stops reading is dropped when this many messages are waiting. **/
+const int kMaxPending = 64;
+/** wait this long for a frame before checking the network. **/
+const int kPollMs = 20;
+const agm::int64 kStatusMicroseconds = 3 * 1000 * 1000;
+
+const int kDefaultPreviewWidth = 1280;
+const int kDefaultPreviewHeight = 960;
+const int kMinQuality = 40;
+const int kMaxQuality = 90;
+const int kDefaultQuality = 75;
+/** raise the quality after this many previews nobody missed. **/
+const int kQualityRaiseFrames = 10;
+const int kQualityStep = 5;
+
+const int kHeaderBytes = 32;
+const agm::uint32 kMagic = 0x534F575A; /*"ZWOS"*/
+
+enum class MessageType {
+    kText = 1,
+    kPreview = 2,
+    kRaw = 3
+};
+
+typedef std::vector<agm::uint8> Message;
+typedef std::shared_ptr<Message> MessagePtr;
+
+class Client {
+public:
+    /** the menu's answers find the client by id. **/
+    int id_ = 0;
+    int fd_ = -1;
+    std::string address_;
+    std::string input_;
+    /** messages waiting to be sent. the first one may be partly sent. **/
+    std::deque<MessagePtr> pending_;
+    size_t sent_ = 0;
+    bool raw_ = false;
+    agm::int64 previews_ = 0;
+    agm::int64 missed_ = 0;
+
+    /** ready for the next frame. **/
+    bool isIdle() const noexcept {
+        return pending_.empty();
+    }
+};
+
+class StreamerThread : public agm::Thread {
+public:
+    /** share data with the capture thread. **/
+    ImageRing *image_ring_ = nullptr;
+    int ring_consumer_ = -1;
+    /** share data with the menu thread. **/
+    SettingsBuffer *settings_buffer_ = nullptr;
+    /** the guider writes its status to the guide camera's settings. **/
+    SettingsBuffer *guide_settings_ = nullptr;
+    /** the status line shows where the mount is pointing. **/
+    Ioptron *mount_ = nullptr;
+    /** where the time goes. **/
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *time_shrink_ = nullptr;
+    LatencyHistogram *time_encode_ = nullptr;
+    LatencyHistogram *time_send_ = nullptr;
+
+    /** our fields. **/
+    int port_ = 0;
+    int listen_fd_ = -1;
+    std::vector<Client> clients_;
+    int next_client_id_ = 0;
+    int preview_width_ = kDefaultPreviewWidth;
+    int preview_height_ = kDefaultPreviewHeight;
+    int quality_ = kDefaultQuality;
+    int quality_frames_ = 0;
+    agm::int64 status_time_ = 0;
+
+    /** the 8 bit superpixel image. the curve maps 10 bits to 8. **/
+    cv::Mat shrunk_;
+    cv::Mat preview_;
+    agm::uint8 curve_[1024];
+    std::vector<agm::uint8> jpeg_;
+    std::vector<int> jpeg_params_;
+    MessagePtr preview_msg_;
+    MessagePtr raw_msg_;
+
+    StreamerThread(
+        ImageRing *image_ring,
+        SettingsBuffer *settings_buffer,
+        SettingsBuffer *guide_settings,
+        Ioptron *mount,
+        PerfStats *perf_stats,
+        int port
+    ) noexcept : agm::Thread("StreamerThread") {
+        image_ring_ = image_ring;
+        /** we only want to send the newest frame. **/
+        ring_consumer_ = image_ring_->addConsumer(ImageRing::Policy::kLatest);
+        settings_buffer_ = settings_buffer;
+        guide_settings_ = guide_settings;
+        mount_ = mount;
+        perf_stats_ = perf_stats;
+        port_ = port;
+    }
+
+    virtual ~StreamerThread() = default;
+
+    virtual void begin() noexcept {
+        LOG("StreamerThread.");
+        static const char *kThread = "StreamerThread";
+        time_shrink_ = perf_stats_->addStage(kThread, "shrink");
+        time_encode_ = perf_stats_->addStage(kThread, "encode");
+        time_send_ = perf_stats_->addStage(kThread, "send");
+
+        initCurve();
+        openListener();
+
+        /** the capture thread can limit its roi to what we send. **/
+        setDisplaySize();
+    }
+
+    virtual void runOnce() noexcept {
+        /** wait a little while for the next frame. **/
+        auto img = image_ring_->acquireRead(ring_consumer_, kPollMs);
+
+        refuseCommands();
+        serviceNetwork();
+        sendReplies();
+
+        if (img) {
+            sendFrame(img);
+        }
+
+        agm::int64 now = agm::time::microseconds();
+        if (now - status_time_ >= kStatusMicroseconds) {
+            status_time_ = now;
+            sendStatus();
+        }
+    }
+
+    virtual void end() noexcept {
+        for (auto &client : clients_) {
+            close(client.fd_);
+        }
+        clients_.clear();
+        if (listen_fd_ >= 0) {
+            close(listen_fd_);
+            listen_fd_ = -1;
+        }
+    }
+
+    /** the standard display gamma. same as the window. **/
+    void initCurve() noexcept {
+        static const double kPower = 1.0 / 2.22222;
+        static const double kTs = 4.5;
+        static const double kG3 = 0.0180539;
+        static const double kG4 = 0.0992964;
+        for (int i = 0; i < 1024; ++i) {
+            double r = double(i) / 1023.0;
+            double x;
+            if (r < kG3) {
+                x = r * kTs;
+            } else {
+                x = std::pow(r, kPower) * (1 + kG4) - kG4;
+            }
+            int ix = std::round(x * 255.0);
+            curve_[i] = std::max(0, std::min(ix, 255));
+        }
+    }
+
+    void openListener() noexcept {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd_ < 0) {
+            LOG("StreamerThread Failed to create socket: "<<std::strerror(errno));
+            return;
+        }
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port_);
+        int result = bind(listen_fd_, (sockaddr *) &addr, sizeof(addr));
+        if (result == 0) {
+            result = listen(listen_fd_, kMaxClients);
+        }
+        if (result != 0) {
+            LOG("StreamerThread Failed to listen on port "<<port_<<": "<<std::strerror(errno));
+            close(listen_fd_);
+            listen_fd_ = -1;
+            return;
+        }
+        setNonBlocking(listen_fd_);
+        LOG("StreamerThread Listening on port "<<port_<<".");
+    }
+
+    static void setNonBlocking(
+        int fd
+    ) noexcept {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    void setDisplaySize() noexcept {
+        SettingsLock lock(settings_buffer_);
+        settings_buffer_->display_width_ = preview_width_;
+        settings_buffer_->display_height_ = preview_height_;
+    }
+
+    /** there's no window thread to save images. don't let the commands pile up. **/
+    void refuseCommands() noexcept {
+        MenuCommand cmd;
+        bool have_command = false;
+        while (settings_buffer_->commands_.pop(cmd)) {
+            have_command = true;
+        }
+        if (have_command) {
+            static const char *kRefused = "saves and master frames need the window. record with w instead.";
+            LOG("StreamerThread "<<kRefused);
+            SettingsLock lock(settings_buffer_);
+            settings_buffer_->save_status_ = kRefused;
+        }
+    }
+
+    /** accept new clients. read their input. send what's pending. **/
+    void serviceNetwork() noexcept {
+        std::vector<pollfd> fds;
+        if (listen_fd_ >= 0) {
+            pollfd pfd;
+            pfd.fd = listen_fd_;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            fds.push_back(pfd);
+        }
+        for (auto &client : clients_) {
+            pollfd pfd;
+            pfd.fd = client.fd_;
+            pfd.events = POLLIN;
+            if (client.isIdle() == false) {
+                pfd.events |= POLLOUT;
+            }
+            pfd.revents = 0;
+            fds.push_back(pfd);
+        }
+        if (fds.empty()) {
+            return;
+        }
+        int result = poll(fds.data(), fds.size(), 0);
+        if (result <= 0) {
+            return;
+        }
+
+        int first = 0;
+        if (listen_fd_ >= 0) {
+            first = 1;
+            if (fds[0].revents & POLLIN) {
+                acceptClient();
+            }
+        }
+        /** new clients are at the end. they weren't polled. **/
+        int nclients = fds.size() - first;
+        for (int i = 0; i < nclients; ++i) {
+            auto &client = clients_[i];
+            auto revents = fds[first + i].revents;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                readClient(client);
+            }
+            if (client.fd_ >= 0 && (revents & POLLOUT)) {
+                writeClient(client);
+            }
+        }
+        dropClosed();
+    }
+
+    void acceptClient() noexcept {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept(listen_fd_, (sockaddr *) &addr, &len);
+        if (fd < 0) {
+            return;
+        }
+        char buffer[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &addr.sin_addr, buffer, sizeof(buffer));
+        if (int(clients_.size()) >= kMaxClients) {
+            LOG("StreamerThread Too many clients. Refused "<<buffer<<".");
+            close(fd);
+            return;
+        }
+        setNonBlocking(fd);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        Client client;
+        client.id_ = next_client_id_++;
+        client.fd_ = fd;
+        client.address_ = buffer;
+        clients_.push_back(client);
+        LOG("StreamerThread Client connected: "<<buffer);
+        queueText(clients_.back(),
+            "zwo stream. send menu commands one per line. .raw [+-01yn] sends raw frames. .size wd ht sets the preview size.");
+    }
+
+    void readClient(
+        Client &client
+    ) noexcept {
+        char buffer[4096];
+        for(;;) {
+            auto n = recv(client.fd_, buffer, sizeof(buffer), 0);
+            if (n == 0) {
+                closeClient(client, "disconnected");
+                return;
+            }
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    closeClient(client, std::strerror(errno));
+                }
+                return;
+            }
+            client.input_.append(buffer, n);
+
+            /** handle the whole lines. **/
+            for(;;) {
+                auto eol = client.input_.find('\n');
+                if (eol == std::string::npos) {
+                    break;
+                }
+                std::string line = client.input_.substr(0, eol);
+                client.input_.erase(0, eol + 1);
+                if (line.size() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                handleLine(client, line);
+            }
+            if (client.input_.size() > kMaxLine) {
+                closeClient(client, "line too long");
+                return;
+            }
+        }
+    }
+
+    void handleLine(
+        Client &client,
+        const std::string &line
+    ) noexcept {
+        if (line.empty()) {
+            return;
+        }
+        if (line[0] != '.') {
+            MenuCommand cmd;
+            cmd.type_ = MenuCommand::Type::kMenuInput;
+            cmd.name_ = line;
+            cmd.client_ = client.id_;
+            settings_buffer_->menu_commands_.push(std::move(cmd));
+            return;
+        }
+
+        std::stringstream ss(line.substr(1));
+        std::string cmd;
+        ss>>cmd;
+        if (cmd == "raw") {
+            std::string value;
+            ss>>value;
+            if (value.empty()) {
+                client.raw_ = !client.raw_;
+            } else {
+                int ch = std::tolower(value[0]);
+                client.raw_ = (ch == '+' || ch == '1' || ch == 'y');
+            }
+            queueText(client, client.raw_ ? "raw frames on." : "raw frames off.");
+            return;
+        }
+        if (cmd == "size") {
+            int wd = 0;
+            int ht = 0;
+            ss>>wd>>ht;
+            if (wd < 64 || ht < 64 || wd > 8192 || ht > 8192) {
+                queueText(client, "bad size.");
+                return;
+            }
+            preview_width_ = wd;
+            preview_height_ = ht;
+            setDisplaySize();
+            std::stringstream ss2;
+            ss2<<"preview size "<<wd<<"x"<<ht<<".";
+            queueText(client, ss2.str());
+            return;
+        }
+        queueText(client, "unknown streamer command: " + line);
+    }
+
+    /** the menu's answers to remote input. the client may be gone. **/
+    void sendReplies() noexcept {
+        MenuCommand cmd;
+        while (settings_buffer_->menu_replies_.pop(cmd)) {
+            for (auto &client : clients_) {
+                if (client.id_ == cmd.client_) {
+                    queueText(client, cmd.name_);
+                    writeClient(client);
+                    break;
+                }
+            }
+        }
+        dropClosed();
+    }
+
+    void writeClient(
+        Client &client
+    ) noexcept {
+        if (client.fd_ < 0) {
+            return;
+        }
+        ScopedTimer timer(time_send_);
+        while (client.pending_.size()) {
+            auto &msg = *client.pending_.front();
+            auto n = send(client.fd_, msg.data() + client.sent_, msg.size() - client.sent_, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    closeClient(client, std::strerror(errno));
+                }
+                return;
+            }
+            client.sent_ += n;
+            if (client.sent_ < msg.size()) {
+                return;
+            }
+            client.pending_.pop_front();
+            client.sent_ = 0;
+        }
+    }
+
+    void closeClient(
+        Client &client,
+        const char *why
+    ) noexcept {
+        LOG("StreamerThread Client "<<client.address_<<" "<<why<<". sent "<<client.previews_
+            <<" previews. missed "<<client.missed_<<".");
+        close(client.fd_);
+        client.fd_ = -1;
+    }
+
+    void dropClosed() noexcept {
+        clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+            [](const Client &client) { return client.fd_ < 0; }), clients_.end());
+    }
+
+    void queue(
+        Client &client,
+        const MessagePtr &msg
+    ) noexcept {
+        if (client.fd_ < 0) {
+            return;
+        }
+        if (int(client.pending_.size()) >= kMaxPending) {
+            closeClient(client, "stopped reading");
+            return;
+        }
+        client.pending_.push_back(msg);
+    }
+
+    void queueText(
+        Client &client,
+        const std::string &text
+    ) noexcept {
+        auto msg = std::make_shared<Message>();
+        setHeader(*msg, MessageType::kText, 0, 0, 0, 0, agm::time::microseconds(), text.size());
+        std::memcpy(msg->data() + kHeaderBytes, text.data(), text.size());
+        queue(client, msg);
+    }
+
+    /** size the message and write its header. **/
+    static void setHeader(
+        Message &msg,
+        MessageType type,
+        int pattern,
+        int width,
+        int height,
+        int exposure,
+        agm::int64 timestamp,
+        size_t bytes
+    ) noexcept {
+        msg.resize(kHeaderBytes + bytes);
+        auto ptr = msg.data();
+        putLittle(ptr + 0, kMagic, 4);
+        putLittle(ptr + 4, int(type), 2);
+        putLittle(ptr + 6, pattern, 2);
+        putLittle(ptr + 8, width, 4);
+        putLittle(ptr + 12, height, 4);
+        putLittle(ptr + 16, bytes, 4);
+        putLittle(ptr + 20, exposure, 4);
+        putLittle(ptr + 24, timestamp, 8);
+    }
+
+    static void putLittle(
+        agm::uint8 *ptr,
+        agm::uint64 value,
+        int nbytes
+    ) noexcept {
+        for (int i = 0; i < nbytes; ++i) {
+            ptr[i] = agm::uint8(value >> (8 * i));
+        }
+    }
+
+    /** reuse the last message unless a client is still sending it. **/
+    static Message &reuse(
+        MessagePtr &msg
+    ) noexcept {
+        if (msg == nullptr || msg.use_count() > 1) {
+            msg = std::make_shared<Message>();
+        }
+        return *msg;
+    }
+
+    void sendFrame(
+        ImageBuffer *img
+    ) noexcept {
+        /** only do the work for the clients that are ready for it. **/
+        bool want_preview = false;
+        bool want_raw = false;
+        bool missed = false;
+        for (auto &client : clients_) {
+            if (client.isIdle()) {
+                want_preview = true;
+                want_raw |= client.raw_;
+            } else {
+                ++client.missed_;
+                missed = true;
+            }
+        }
+        if (want_preview == false) {
+            image_ring_->releaseRead(ring_consumer_, img);
+            adjustQuality(missed);
+            return;
+        }
+
+        int width = img->width_;
+        int height = img->height_;
+        int exposure = img->exposure_;
+        agm::int64 timestamp = img->timestamp_;
+        {
+            ScopedTimer timer(time_shrink_);
+            shrink(img);
+            if (want_raw) {
+                auto &msg = reuse(raw_msg_);
+                setHeader(msg, MessageType::kRaw, int(img->bayer_pattern_), width, height,
+                    exposure, timestamp, img->bytes_);
+                std::memcpy(msg.data() + kHeaderBytes, img->bayer_.data, img->bytes_);
+            }
+        }
+        /** the rest doesn't need the frame. **/
+        image_ring_->releaseRead(ring_consumer_, img);
+
+        {
+            ScopedTimer timer(time_encode_);
+            double scale = std::min(double(preview_width_) / shrunk_.cols, double(preview_height_) / shrunk_.rows);
+            if (scale < 1.0) {
+                int wd = std::max(1, int(shrunk_.cols * scale));
+                int ht = std::max(1, int(shrunk_.rows * scale));
+                cv::resize(shrunk_, preview_, cv::Size(wd, ht), 0, 0, cv::INTER_AREA);
+            } else {
+                preview_ = shrunk_;
+            }
+            jpeg_params_.clear();
+            jpeg_params_.push_back(cv::IMWRITE_JPEG_QUALITY);
+            jpeg_params_.push_back(quality_);
+            jpeg_.clear();
+            bool success = cv::imencode(".jpg", preview_, jpeg_, jpeg_params_);
+            if (success == false) {
+                LOG("StreamerThread Failed to encode the preview.");
+                return;
+            }
+            auto &msg = reuse(preview_msg_);
+            setHeader(msg, MessageType::kPreview, 0, preview_.cols, preview_.rows,
+                exposure, timestamp, jpeg_.size());
+            std::memcpy(msg.data() + kHeaderBytes, jpeg_.data(), jpeg_.size());
+        }
+
+        for (auto &client : clients_) {
+            if (client.isIdle() == false) {
+                continue;
+            }
+            queue(client, preview_msg_);
+            if (client.raw_) {
+                queue(client, raw_msg_);
+            }
+            ++client.previews_;
+            writeClient(client);
+        }
+        dropClosed();
+        adjustQuality(missed);
+    }
+
+    /** drop the quality quickly when a client falls behind. raise it slowly. **/
+    void adjustQuality(
+        bool missed
+    ) noexcept {
+        if (missed) {
+            quality_ = std::max(kMinQuality, quality_ - kQualityStep);
+            quality_frames_ = 0;
+            return;
+        }
+        if (++quality_frames_ >= kQualityRaiseFrames) {
+            quality_ = std::min(kMaxQuality, quality_ + kQualityStep);
+            quality_frames_ = 0;
+        }
+    }
+
+    /**
+    make an 8 bit bgr image half the size of the bayer image.
+    one pixel per 2x2 block. the greens are averaged.
+    the brightest pixel of the frame is white.
+    **/
+    void shrink(
+        const ImageBuffer *img
+    ) noexcept {
+        int wd = img->width_ / 2;
+        int ht = img->height_ / 2;
+        shrunk_.create(ht, wd, CV_8UC3);
+
+        /** where red and blue are in the 2x2 block. the greens are the others. **/
+        int red = 0;
+        int blue = 0;
+        switch (img->bayer_pattern_) {
+        case BayerPattern::kRGGB: red = 0; blue = 3; break;
+        case BayerPattern::kBGGR: red = 3; blue = 0; break;
+        case BayerPattern::kGRBG: red = 1; blue = 2; break;
+        case BayerPattern::kGBRG: red = 2; blue = 1; break;
+        }
+        int green1 = (red == 0 || blue == 0) ? 1 : 0;
+        int green2 = 3 - green1;
+
+        /** map 0 to the max to the 1024 entries of the curve. **/
+        int max = std::max(img->stats_.max_, 1);
+        if (img->stats_.valid_ == false) {
+            max = 65535;
+        }
+        agm::uint64 scale = (agm::uint64(1023) << 16) / max;
+        auto map = [&](int value) -> agm::uint8 {
+            agm::uint64 index = (value * scale) >> 16;
+            return curve_[std::min(index, agm::uint64(1023))];
+        };
+
+        for (int y = 0; y < ht; ++y) {
+            auto row0 = img->bayer_.ptr<agm::uint16>(2 * y);
+            auto row1 = img->bayer_.ptr<agm::uint16>(2 * y + 1);
+            auto dst = shrunk_.ptr<agm::uint8>(y);
+            for (int x = 0; x < wd; ++x) {
+                int block[4] = {row0[0], row0[1], row1[0], row1[1]};
+                dst[0] = map(block[blue]);
+                dst[1] = map((block[green1] + block[green2]) / 2);
+                dst[2] = map(block[red]);
+                row0 += 2;
+                row1 += 2;
+                dst += 3;
+            }
+        }
+    }
+
+    /** what the menu would show for the one shot things. **/
+    void sendStatus() noexcept {
+        if (clients_.empty()) {
+            return;
+        }
+        std::stringstream ss;
+        ss<<"status exposure="<<settings_buffer_->current_exposure_
+            <<" iso="<<settings_buffer_->current_iso_
+            <<" quality="<<quality_;
+        {
+            std::lock_guard<std::mutex> lock(settings_buffer_->mutex_);
+            ss<<" record="<<settings_buffer_->record_file_name_
+                <<" | save: "<<settings_buffer_->save_status_
+                <<" | solve: "<<settings_buffer_->solve_status_;
+        }
+        {
+            std::lock_guard<std::mutex> lock(guide_settings_->mutex_);
+            ss<<" | guide: "<<guide_settings_->guide_status_;
+        }
+        MountStatus status;
+        bool valid = mount_->getStatus(status);
+        if (valid) {
+            ss<<" | mount ra="<<status.ra_<<" dec="<<status.dec_;
+        }
+        auto text = ss.str();
+        for (auto &client : clients_) {
+            queueText(client, text);
+            writeClient(client);
+        }
+        dropClosed();
+    }
+};
+}
+
+agm::Thread *createStreamerThread(
+    ImageRing *image_ring,
+    SettingsBuffer *settings_buffer,
+    SettingsBuffer *guide_settings,
+    Ioptron *mount,
+    PerfStats *perf_stats,
+    int port
+) noexcept {
+    return new(std::nothrow) StreamerThread(image_ring, settings_buffer, guide_settings, mount, perf_stats, port);
+}
@@ -0,0 +1,624 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+a library of master calibration frames.
+
+each master is a file in the directory.
+a small header followed by the average of the frames as floats.
+the roi is always centered. so the size and binning identify it.
+**/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <aggiornamento/log.h>
+
+#include "calibration.h"
+
+
+namespace {
+const char kMagic[8] = {'Z', 'W', 'O', 'C', 'A', 'L', '0', '1'};
+
+class FileHeader {
+public:
+    char magic_[8];
+    agm::int32 kind_;
+    agm::int32 width_;
+    agm::int32 height_;
+    agm::int32 bin_;
+    agm::int32 exposure_;
+    agm::int32 temperature_;
+    agm::int32 nframes_;
+    agm::int32 reserved_;
+    agm::int64 created_;
+    char padding_[16];
+};
+
+/** one degree C. **/
+const int kTemperatureStep = 10;
+/** hot pixels in the dark are this many sigmas above the mean. **/
+const double kHotSigmas = 5.0;
+/** pixels in the flat outside this range of their channel's mean are suspect. **/
+const double kMinFlat = 0.5;
+const double kMaxFlat = 1.5;
+/** the largest gain that can't overflow 32 bits. **/
+const double kMaxGain = 65535.0 / 4096.0;
+}
+
+const char *Calibration::getKindName(
+    Kind kind
+) noexcept {
+    switch (kind) {
+    case Kind::kBias:
+        return "bias";
+    case Kind::kDark:
+        return "dark";
+    case Kind::kFlat:
+        return "flat";
+    }
+    return "unknown";
+}
+
+void Calibration::load(
+    const std::string &dir
+) noexcept {
+    dir_ = dir;
+    masters_.clear();
+    auto dp = opendir(dir_.c_str());
+    if (dp == nullptr) {
+        LOG("Calibration No master frames in: "<<dir_);
+        return;
+    }
+    for(;;) {
+        auto entry = readdir(dp);
+        if (entry == nullptr) {
+            break;
+        }
+        std::string name = entry->d_name;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".cal") != 0) {
+            continue;
+        }
+        Master master;
+        if (readHeader(dir_ + "/" + name, master)) {
+            masters_.push_back(master);
+        }
+    }
+    closedir(dp);
+    LOG("Calibration Found "<<masters_.size()<<" master frames in: "<<dir_);
+}
+
+bool Calibration::readHeader(
+    const std::string &file_name,
+    Master &master
+) const noexcept {
+    auto fp = std::fopen(file_name.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    FileHeader header;
+    auto nread = std::fread(&header, sizeof(header), 1, fp);
+    std::fclose(fp);
+    if (nread != 1 || std::memcmp(header.magic_, kMagic, sizeof(kMagic)) != 0) {
+        LOG("Calibration Not a master frame: "<<file_name);
+        return false;
+    }
+    master.kind_ = (Kind) header.kind_;
+    master.width_ = header.width_;
+    master.height_ = header.height_;
+    master.bin_ = header.bin_;
+    master.exposure_ = header.exposure_;
+    master.temperature_ = header.temperature_;
+    master.nframes_ = header.nframes_;
+    master.created_ = header.created_;
+    master.file_name_ = file_name;
+    return true;
+}
+
+bool Calibration::readMaster(
+    const Master &master,
+    cv::Mat &data
+) const noexcept {
+    data = cv::Mat();
+    auto fp = std::fopen(master.file_name_.c_str(), "rb");
+    if (fp == nullptr) {
+        LOG("Calibration Failed to open master frame: "<<master.file_name_);
+        return false;
+    }
+    cv::Mat image(master.height_, master.width_, CV_32FC1);
+    bool success = (std::fseek(fp, sizeof(FileHeader), SEEK_SET) == 0);
+    if (success) {
+        std::size_t count = master.width_ * master.height_;
+        success = (std::fread(image.data, sizeof(float), count, fp) == count);
+    }
+    std::fclose(fp);
+    if (success == false) {
+        LOG("Calibration Failed to read master frame: "<<master.file_name_);
+        return false;
+    }
+    data = image;
+    return true;
+}
+
+void Calibration::startMaster(
+    Kind kind,
+    int nframes
+) noexcept {
+    build_ = Master();
+    build_.kind_ = kind;
+    build_.nframes_ = nframes;
+    build_remaining_ = nframes;
+    build_sum_ = cv::Mat();
+    build_temperature_ = 0;
+    LOG("Calibration Building a master "<<getKindName(kind)<<" from "<<nframes<<" frames.");
+}
+
+void Calibration::addFrame(
+    const cv::Mat &bayer,
+    int exposure,
+    int temperature,
+    int bin
+) noexcept {
+    if (build_remaining_ <= 0) {
+        return;
+    }
+
+    int wd = bayer.cols;
+    int ht = bayer.rows;
+    if (build_sum_.rows == 0) {
+        build_.width_ = wd;
+        build_.height_ = ht;
+        build_.bin_ = bin;
+        build_.exposure_ = exposure;
+        build_sum_ = cv::Mat(ht, wd, CV_32SC1);
+        build_sum_ = 0;
+    }
+
+    /** every frame must be the same. **/
+    if (wd != build_.width_ || ht != build_.height_ || bin != build_.bin_ || exposure != build_.exposure_) {
+        LOG("Calibration The frame size or exposure changed. Abandoned the master "<<getKindName(build_.kind_)<<".");
+        build_remaining_ = 0;
+        build_sum_ = cv::Mat();
+        return;
+    }
+
+    int sz = wd * ht;
+    auto src = (const agm::uint16 *) bayer.data;
+    auto sum = (agm::int32 *) build_sum_.data;
+    for (int i = 0; i < sz; ++i) {
+        sum[i] += src[i];
+    }
+    build_temperature_ += temperature;
+
+    --build_remaining_;
+    if (build_remaining_ == 0) {
+        saveMaster();
+        build_sum_ = cv::Mat();
+    }
+}
+
+void Calibration::saveMaster() noexcept {
+    int n = build_.nframes_;
+    build_.temperature_ = std::round(double(build_temperature_) / double(n));
+    build_.created_ = std::time(nullptr);
+
+    std::stringstream ss;
+    ss<<dir_<<"/"<<getKindName(build_.kind_)
+        <<"_"<<build_.width_<<"x"<<build_.height_
+        <<"_bin"<<build_.bin_
+        <<"_"<<build_.exposure_<<"us"
+        <<"_t"<<build_.temperature_<<".cal";
+    build_.file_name_ = ss.str();
+
+    /** the average. **/
+    cv::Mat average(build_.height_, build_.width_, CV_32FC1);
+    int sz = build_.width_ * build_.height_;
+    auto sum = (const agm::int32 *) build_sum_.data;
+    auto avg = (float *) average.data;
+    float scale = 1.0f / float(n);
+    for (int i = 0; i < sz; ++i) {
+        avg[i] = float(sum[i]) * scale;
+    }
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic_, kMagic, sizeof(kMagic));
+    header.kind_ = (agm::int32) build_.kind_;
+    header.width_ = build_.width_;
+    header.height_ = build_.height_;
+    header.bin_ = build_.bin_;
+    header.exposure_ = build_.exposure_;
+    header.temperature_ = build_.temperature_;
+    header.nframes_ = n;
+    header.created_ = build_.created_;
+
+    mkdir(dir_.c_str(), 0755);
+    auto fp = std::fopen(build_.file_name_.c_str(), "wb");
+    bool success = (fp != nullptr);
+    if (success) {
+        success = (std::fwrite(&header, sizeof(header), 1, fp) == 1);
+        success = success && (std::fwrite(avg, sizeof(float), sz, fp) == std::size_t(sz));
+        success = (std::fclose(fp) == 0) && success;
+    }
+    if (success == false) {
+        LOG("Calibration Failed to save master frame: "<<build_.file_name_);
+        return;
+    }
+    LOG("Calibration Saved master frame: "<<build_.file_name_);
+
+    /** replace the old master with the same name. **/
+    for (auto it = masters_.begin(); it != masters_.end(); ++it) {
+        if (it->file_name_ == build_.file_name_) {
+            masters_.erase(it);
+            break;
+        }
+    }
+    masters_.push_back(build_);
+
+    /** choose and combine the masters again. **/
+    width_ = 0;
+    bias_index_ = -1;
+    dark_index_ = -1;
+    flat_index_ = -1;
+    bias_ = cv::Mat();
+    dark_master_ = cv::Mat();
+    flat_master_ = cv::Mat();
+}
+
+/**
+flats are the newest.
+bias frames are the closest temperature.
+darks weigh one degree C the same as a factor of 2 in exposure.
+returns the index of the master or -1.
+**/
+int Calibration::choose(
+    Kind kind,
+    int temperature,
+    int exposure
+) const noexcept {
+    int best = -1;
+    double best_cost = 0.0;
+    int nmasters = masters_.size();
+    for (int i = 0; i < nmasters; ++i) {
+        auto &master = masters_[i];
+        if (master.kind_ != kind
+        ||  master.width_ != width_
+        ||  master.height_ != height_
+        ||  master.bin_ != bin_) {
+            continue;
+        }
+        double cost = 0.0;
+        double dtemp = std::abs(double(temperature - master.temperature_)) / double(kTemperatureStep);
+        switch (kind) {
+        case Kind::kFlat:
+            cost = -double(master.created_);
+            break;
+        case Kind::kBias:
+            cost = dtemp;
+            break;
+        case Kind::kDark:
+            cost = dtemp + std::abs(std::log2(double(std::max(exposure, 1)) / double(std::max(master.exposure_, 1))));
+            break;
+        }
+        if (best < 0 || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+bool Calibration::prepare(
+    int width,
+    int height,
+    int exposure,
+    int temperature,
+    int bin
+) noexcept {
+    bool same_frame = (width == width_ && height == height_ && bin == bin_);
+    if (same_frame
+    &&  exposure == exposure_
+    &&  std::abs(temperature - temperature_) < kTemperatureStep) {
+        return active_;
+    }
+    width_ = width;
+    height_ = height;
+    bin_ = bin;
+    exposure_ = exposure;
+    temperature_ = temperature;
+
+    /** load the masters that changed. **/
+    bool changed = (same_frame == false);
+    int index = choose(Kind::kBias, temperature, exposure);
+    if (index != bias_index_) {
+        bias_index_ = index;
+        bias_ = cv::Mat();
+        if (index >= 0) {
+            readMaster(masters_[index], bias_);
+        }
+        changed = true;
+    }
+    index = choose(Kind::kDark, temperature, exposure);
+    if (index != dark_index_) {
+        dark_index_ = index;
+        dark_master_ = cv::Mat();
+        if (index >= 0) {
+            readMaster(masters_[index], dark_master_);
+        }
+        changed = true;
+    }
+    index = choose(Kind::kFlat, temperature, exposure);
+    if (index != flat_index_) {
+        flat_index_ = index;
+        flat_master_ = cv::Mat();
+        if (index >= 0) {
+            readMaster(masters_[index], flat_master_);
+        }
+        changed = true;
+    }
+
+    active_ = (bias_.rows > 0 || dark_master_.rows > 0 || flat_master_.rows > 0);
+    if (active_ == false) {
+        dark_ = cv::Mat();
+        gain_ = cv::Mat();
+        bad_pixels_.clear();
+        bad_map_.clear();
+        return false;
+    }
+
+    if (changed) {
+        LOG("Calibration Using masters for "<<width_<<"x"<<height_<<" bin "<<bin_<<":");
+        if (bias_.rows) {
+            LOG("  "<<masters_[bias_index_].file_name_);
+        }
+        if (dark_master_.rows) {
+            LOG("  "<<masters_[dark_index_].file_name_);
+        }
+        if (flat_master_.rows) {
+            LOG("  "<<masters_[flat_index_].file_name_);
+        }
+        findBadPixels();
+        combineFlat();
+    }
+    combineDark();
+    return true;
+}
+
+/**
+scale the dark current to the exposure time.
+without a bias the offset is scaled along with the dark current.
+**/
+void Calibration::combineDark() noexcept {
+    int sz = width_ * height_;
+    dark_.create(height_, width_, CV_16UC1);
+    auto dst = (agm::uint16 *) dark_.data;
+    auto bias = (const float *) bias_.data;
+    auto dark = (const float *) dark_master_.data;
+    float scale = 0.0f;
+    if (dark) {
+        scale = float(exposure_) / float(std::max(masters_[dark_index_].exposure_, 1));
+    }
+    for (int i = 0; i < sz; ++i) {
+        float b = bias ? bias[i] : 0.0f;
+        float d = dark ? (dark[i] - b) * scale : 0.0f;
+        float px = b + d + 0.5f;
+        px = std::max(0.0f, std::min(px, 65535.0f));
+        dst[i] = (agm::uint16) px;
+    }
+    repairImage(dark_);
+}
+
+/**
+the gain brings each pixel to the mean of its bayer channel.
+so the flat doesn't change the color balance.
+**/
+void Calibration::combineFlat() noexcept {
+    gain_ = cv::Mat();
+    if (flat_master_.rows == 0) {
+        return;
+    }
+
+    /** the mean of each channel of the flat less the bias. **/
+    double sum[4] = {0.0, 0.0, 0.0, 0.0};
+    double count[4] = {0.0, 0.0, 0.0, 0.0};
+    for (int y = 0; y < height_; ++y) {
+        auto flat = flat_master_.ptr<float>(y);
+        auto bias = bias_.rows ? bias_.ptr<float>(y) : nullptr;
+        for (int x = 0; x < width_; ++x) {
+            int ch = 2 * (y & 1) + (x & 1);
+            sum[ch] += flat[x] - (bias ? bias[x] : 0.0f);
+            count[ch] += 1.0;
+        }
+    }
+    double mean[4];
+    for (int ch = 0; ch < 4; ++ch) {
+        mean[ch] = (count[ch] > 0.0) ? sum[ch] / count[ch] : 0.0;
+    }
+
+    gain_.create(height_, width_, CV_16UC1);
+    double one = double(1 << kGainBits);
+    for (int y = 0; y < height_; ++y) {
+        auto flat = flat_master_.ptr<float>(y);
+        auto bias = bias_.rows ? bias_.ptr<float>(y) : nullptr;
+        auto dst = gain_.ptr<agm::uint16>(y);
+        for (int x = 0; x < width_; ++x) {
+            int ch = 2 * (y & 1) + (x & 1);
+            double f = flat[x] - (bias ? bias[x] : 0.0f);
+            double gain = 1.0;
+            if (f > 0.0) {
+                gain = std::min(mean[ch] / f, kMaxGain);
+            }
+            dst[x] = (agm::uint16) std::round(gain * one);
+        }
+    }
+    repairImage(gain_);
+}
+
+void Calibration::findBadPixels() noexcept {
+    bad_map_.assign(width_ * height_, 0);
+    if (dark_master_.rows) {
+        cv::Mat current;
+        if (bias_.rows) {
+            cv::subtract(dark_master_, bias_, current);
+        } else {
+            current = dark_master_;
+        }
+        markHotPixels(current);
+    }
+    if (flat_master_.rows) {
+        cv::Mat flat;
+        if (bias_.rows) {
+            cv::subtract(flat_master_, bias_, flat);
+        } else {
+            flat = flat_master_;
+        }
+        markFlatPixels(flat);
+    }
+
+    bad_pixels_.clear();
+    int sz = width_ * height_;
+    for (int i = 0; i < sz; ++i) {
+        if (bad_map_[i]) {
+            bad_pixels_.push_back(i);
+        }
+    }
+    LOG("Calibration Found "<<bad_pixels_.size()<<" suspect pixels.");
+}
+
+/** pixels that leak far more current than the rest. **/
+void Calibration::markHotPixels(
+    const cv::Mat &image
+) noexcept {
+    cv::Scalar mean;
+    cv::Scalar stddev;
+    cv::meanStdDev(image, mean, stddev);
+    float thresh = mean[0] + kHotSigmas * stddev[0];
+    int sz = width_ * height_;
+    auto src = (const float *) image.data;
+    for (int i = 0; i < sz; ++i) {
+        if (src[i] > thresh) {
+            bad_map_[i] = 1;
+        }
+    }
+}
+
+/** pixels that respond too little or too much to light. **/
+void Calibration::markFlatPixels(
+    const cv::Mat &flat
+) noexcept {
+    double sum[4] = {0.0, 0.0, 0.0, 0.0};
+    double count[4] = {0.0, 0.0, 0.0, 0.0};
+    for (int y = 0; y < height_; ++y) {
+        auto src = flat.ptr<float>(y);
+        for (int x = 0; x < width_; ++x) {
+            int ch = 2 * (y & 1) + (x & 1);
+            sum[ch] += src[x];
+            count[ch] += 1.0;
+        }
+    }
+    for (int y = 0; y < height_; ++y) {
+        auto src = flat.ptr<float>(y);
+        for (int x = 0; x < width_; ++x) {
+            int ch = 2 * (y & 1) + (x & 1);
+            double mean = sum[ch] / count[ch];
+            double ratio = (mean > 0.0) ? src[x] / mean : 1.0;
+            if (ratio < kMinFlat || ratio > kMaxFlat) {
+                bad_map_[y * width_ + x] = 1;
+            }
+        }
+    }
+}
+
+void Calibration::repair(
+    cv::Mat &bayer
+) const noexcept {
+    repairImage(bayer);
+}
+
+/**
+the dark and the gains are repaired too.
+so a repaired pixel is corrected like its neighbors.
+**/
+void Calibration::repairImage(
+    cv::Mat &image
+) const noexcept {
+    if (image.cols != width_ || image.rows != height_) {
+        return;
+    }
+    auto ptr = (agm::uint16 *) image.data;
+    for (auto i : bad_pixels_) {
+        int y = i / width_;
+        int x = i - y * width_;
+        ptr[i] = averageNeighbors(image, x, y);
+    }
+}
+
+/**
+the nearest pixels of the same bayer color are 2 away.
+suspect neighbors are skipped.
+**/
+int Calibration::averageNeighbors(
+    const cv::Mat &image,
+    int x,
+    int y
+) const noexcept {
+    static const int kDx[4] = {-2, 2, 0, 0};
+    static const int kDy[4] = {0, 0, -2, 2};
+    auto ptr = (const agm::uint16 *) image.data;
+    int sum = 0;
+    int count = 0;
+    for (int k = 0; k < 4; ++k) {
+        int nx = x + kDx[k];
+        int ny = y + kDy[k];
+        if (nx < 0 || nx >= width_ || ny < 0 || ny >= height_) {
+            continue;
+        }
+        int i = ny * width_ + nx;
+        if (bad_map_[i]) {
+            continue;
+        }
+        sum += ptr[i];
+        ++count;
+    }
+    if (count == 0) {
+        return ptr[y * width_ + x];
+    }
+    return (sum + count / 2) / count;
+}
+
+int Calibration::correct(
+    cv::Mat &bayer,
+    int y0,
+    int y1,
+    const PixelKernels *kernels
+) const noexcept {
+    int wd = bayer.cols;
+    int sz = wd * (y1 - y0);
+    auto pimg = (agm::uint16 *) bayer.data + wd * y0;
+    auto pdark = (const agm::uint16 *) dark_.data + wd * y0;
+    int mx = kernels->subtract_(pimg, pdark, sz);
+    if (gain_.rows == 0) {
+        return mx;
+    }
+
+    /** the largest gain can't overflow. **/
+    static const agm::uint32 kHalf = 1 << (kGainBits - 1);
+    auto pgain = (const agm::uint16 *) gain_.data + wd * y0;
+    agm::uint32 umx = 0;
+    for (int i = 0; i < sz; ++i) {
+        agm::uint32 px = pimg[i];
+        px = (px * pgain[i] + kHalf) >> kGainBits;
+        px = std::min(px, agm::uint32(65535));
+        umx = std::max(umx, px);
+        pimg[i] = px;
+    }
+    return umx;
+}
@@ -0,0 +1,152 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+a library of master calibration frames.
+
+masters are averages of many raw bayer frames.
+they're saved in a directory. so they survive restarts.
+
+bias frames are the shortest possible exposure.
+dark frames are taken with the lens cap on.
+they're indexed by exposure time and sensor temperature.
+flat frames are taken of an evenly lit target.
+
+the masters are combined once in prepare.
+which is called every frame but only does work when something changed.
+such as the exposure time or the temperature.
+the dark is scaled to the exposure time and the flat is turned into
+fixed point gains.
+so correcting a frame is one subtract and one multiply per pixel.
+
+suspect pixels are found in the masters.
+hot pixels in the dark and dead or hot pixels in the flat.
+they're repaired from their same color neighbors in the bayer image.
+**/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include "pixel_kernels.h"
+
+
+class Calibration {
+public:
+    Calibration() noexcept = default;
+    Calibration(const Calibration &) = delete;
+    ~Calibration() noexcept = default;
+
+    enum class Kind {
+        kBias,
+        kDark,
+        kFlat
+    };
+
+    /** the flat gains are fixed point with this many fraction bits. **/
+    static const int kGainBits = 12;
+
+    /** read the headers of the masters in the directory. **/
+    void load(const std::string &dir) noexcept;
+
+    /**
+    average the next nframes raw frames into a master.
+    the master is saved when it's done.
+    **/
+    void startMaster(Kind kind, int nframes) noexcept;
+
+    /** true while a master is being built. **/
+    bool isBuilding() const noexcept {
+        return build_remaining_ > 0;
+    }
+
+    /** add a raw frame to the master being built. **/
+    void addFrame(const cv::Mat &bayer, int exposure, int temperature, int bin) noexcept;
+
+    /**
+    choose the masters for this frame and combine them.
+    returns false if there's nothing to correct.
+    **/
+    bool prepare(int width, int height, int exposure, int temperature, int bin) noexcept;
+
+    /**
+    replace the suspect pixels with the average of their neighbors.
+    call this on the whole raw image before correct.
+    **/
+    void repair(cv::Mat &bayer) const noexcept;
+
+    /**
+    subtract the dark and apply the flat to rows [y0, y1).
+    returns the maximum corrected value.
+    **/
+    int correct(cv::Mat &bayer, int y0, int y1, const PixelKernels *kernels) const noexcept;
+
+    static const char *getKindName(Kind kind) noexcept;
+
+private:
+    class Master {
+    public:
+        Kind kind_ = Kind::kBias;
+        int width_ = 0;
+        int height_ = 0;
+        int bin_ = 1;
+        /** microseconds. **/
+        int exposure_ = 0;
+        /** tenths of a degree C. **/
+        int temperature_ = 0;
+        int nframes_ = 0;
+        /** seconds since 1970. **/
+        agm::int64 created_ = 0;
+        std::string file_name_;
+    };
+
+    std::string dir_;
+    std::vector<Master> masters_;
+
+    /** the master being built. **/
+    Master build_;
+    int build_remaining_ = 0;
+    cv::Mat build_sum_;
+    agm::int64 build_temperature_ = 0;
+
+    /** the masters chosen by prepare. -1 for none. **/
+    int bias_index_ = -1;
+    int dark_index_ = -1;
+    int flat_index_ = -1;
+    cv::Mat bias_;
+    cv::Mat dark_master_;
+    cv::Mat flat_master_;
+
+    /** what was last prepared. **/
+    int width_ = 0;
+    int height_ = 0;
+    int bin_ = 0;
+    int exposure_ = 0;
+    int temperature_ = 0;
+    bool active_ = false;
+
+    /** the combined masters. **/
+    cv::Mat dark_;
+    cv::Mat gain_;
+    std::vector<int> bad_pixels_;
+    /** 1 for suspect pixels. **/
+    std::vector<agm::uint8> bad_map_;
+
+    int choose(Kind kind, int temperature, int exposure) const noexcept;
+    bool readMaster(const Master &master, cv::Mat &data) const noexcept;
+    bool readHeader(const std::string &file_name, Master &master) const noexcept;
+    void saveMaster() noexcept;
+    void combineDark() noexcept;
+    void combineFlat() noexcept;
+    void findBadPixels() noexcept;
+    void markHotPixels(const cv::Mat &image) noexcept;
+    void markFlatPixels(const cv::Mat &flat) noexcept;
+    void repairImage(cv::Mat &image) const noexcept;
+    int averageNeighbors(const cv::Mat &image, int x, int y) const noexcept;
+};
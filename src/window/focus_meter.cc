@@ -0,0 +1,221 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+measure the focus from the size of a few stars.
+
+the windows are tiny. so the loops are plain integer and float.
+a star is lost when its peak falls into the noise.
+the stars are found again when all of them are lost.
+**/
+
+#include <algorithm>
+#include <cmath>
+
+#include "focus_meter.h"
+
+
+namespace {
+    /** the peak must be this many standard deviations above the background. **/
+    const double kPeakSigmas = 5.0;
+    /** ignore blocks less than this many standard deviations above the background. **/
+    const double kNoiseSigmas = 2.0;
+    /** fwhm is this many sigmas of a gaussian. **/
+    const double kFwhmSigmas = 2.3548;
+
+    double median(
+        std::vector<double> &values
+    ) noexcept {
+        int n = values.size();
+        std::nth_element(values.begin(), values.begin() + n / 2, values.end());
+        return values[n / 2];
+    }
+}
+
+void FocusMeter::reset() noexcept {
+    targets_.clear();
+    skip_ = 0;
+    backoff_ = 0;
+}
+
+bool FocusMeter::measure(
+    const cv::Mat &bayer,
+    WorkerPool *pool,
+    Result &result
+) noexcept {
+    result = Result();
+    if (bayer.cols < kWindow || bayer.rows < kWindow) {
+        return false;
+    }
+
+    /** the capture roi or the binning changed. **/
+    if (bayer.cols != width_ || bayer.rows != height_) {
+        width_ = bayer.cols;
+        height_ = bayer.rows;
+        reset();
+    }
+    if (targets_.empty()) {
+        if (skip_ > 0) {
+            --skip_;
+            return false;
+        }
+        findTargets(bayer, pool);
+        if (targets_.empty()) {
+            backoff_ = std::min(std::max(2 * backoff_, 1), kMaxBackoff);
+            skip_ = backoff_;
+            return false;
+        }
+        backoff_ = 0;
+    }
+
+    hfr_.clear();
+    fwhm_.clear();
+    for (int i = 0; i < int(targets_.size()); ) {
+        double hfr = 0.0;
+        double fwhm = 0.0;
+        bool found = measureStar(bayer, targets_[i], hfr, fwhm);
+        if (found == false) {
+            targets_.erase(targets_.begin() + i);
+            continue;
+        }
+        hfr_.push_back(hfr);
+        fwhm_.push_back(fwhm);
+        ++i;
+    }
+
+    result.nstars_ = hfr_.size();
+    if (result.nstars_ == 0) {
+        return false;
+    }
+    result.hfr_ = median(hfr_);
+    result.fwhm_ = median(fwhm_);
+    return true;
+}
+
+/** the brightest stars whose windows fit in the frame and don't overlap. **/
+void FocusMeter::findTargets(
+    const cv::Mat &bayer,
+    WorkerPool *pool
+) noexcept {
+    auto &stars = finder_.detect(bayer, pool);
+    double half = 0.5 * kWindow;
+    for (auto &star : stars) {
+        if (star.x_ < half || star.x_ > width_ - half
+        ||  star.y_ < half || star.y_ > height_ - half) {
+            continue;
+        }
+        bool overlaps = false;
+        for (auto &target : targets_) {
+            if (std::abs(star.x_ - target.x_) < kWindow
+            &&  std::abs(star.y_ - target.y_) < kWindow) {
+                overlaps = true;
+                break;
+            }
+        }
+        if (overlaps) {
+            continue;
+        }
+        Target target;
+        target.x_ = star.x_;
+        target.y_ = star.y_;
+        targets_.push_back(target);
+        if (int(targets_.size()) >= kMaxStars) {
+            break;
+        }
+    }
+}
+
+/**
+measure one star and move its window to the centroid.
+returns false if the star is lost.
+**/
+bool FocusMeter::measureStar(
+    const cv::Mat &bayer,
+    Target &target,
+    double &hfr,
+    double &fwhm
+) noexcept {
+    /** the window starts on an even pixel so the blocks have all four colors. **/
+    int x0 = int(std::lround(target.x_)) - kWindow / 2;
+    int y0 = int(std::lround(target.y_)) - kWindow / 2;
+    x0 = std::max(0, std::min(x0, width_ - kWindow)) & ~1;
+    y0 = std::max(0, std::min(y0, height_ - kWindow)) & ~1;
+
+    /** sum the 2x2 blocks. **/
+    auto src = (const agm::uint16 *) bayer.data;
+    for (int by = 0; by < kBlocks; ++by) {
+        auto row0 = src + (y0 + 2 * by) * width_ + x0;
+        auto row1 = row0 + width_;
+        auto out = lum_ + by * kBlocks;
+        for (int bx = 0; bx < kBlocks; ++bx) {
+            int sum = row0[2 * bx] + row0[2 * bx + 1] + row1[2 * bx] + row1[2 * bx + 1];
+            out[bx] = float(sum);
+        }
+    }
+
+    /** the background and noise from the border. **/
+    double sum = 0.0;
+    double sum2 = 0.0;
+    int n = 0;
+    for (int by = 0; by < kBlocks; ++by) {
+        int step = (by == 0 || by == kBlocks - 1) ? 1 : kBlocks - 1;
+        for (int bx = 0; bx < kBlocks; bx += step) {
+            double v = lum_[by * kBlocks + bx];
+            sum += v;
+            sum2 += v * v;
+            ++n;
+        }
+    }
+    double background = sum / n;
+    double sigma = std::sqrt(std::max(sum2 / n - background * background, 1.0));
+
+    /** the flux and the centroid. **/
+    float bkg = float(background);
+    float noise_floor = float(kNoiseSigmas * sigma);
+    float peak = 0.0f;
+    double flux = 0.0;
+    double cx = 0.0;
+    double cy = 0.0;
+    for (int by = 0; by < kBlocks; ++by) {
+        auto row = lum_ + by * kBlocks;
+        for (int bx = 0; bx < kBlocks; ++bx) {
+            float v = row[bx] - bkg;
+            peak = std::max(peak, v);
+            v = (v > noise_floor) ? v : 0.0f;
+            row[bx] = v;
+            flux += v;
+            cx += v * bx;
+            cy += v * by;
+        }
+    }
+    if (peak < kPeakSigmas * sigma || flux <= 0.0) {
+        return false;
+    }
+    cx /= flux;
+    cy /= flux;
+
+    /** the first and second radial moments. **/
+    double sum_r = 0.0;
+    double sum_r2 = 0.0;
+    for (int by = 0; by < kBlocks; ++by) {
+        auto row = lum_ + by * kBlocks;
+        double dy = by - cy;
+        for (int bx = 0; bx < kBlocks; ++bx) {
+            double v = row[bx];
+            double dx = bx - cx;
+            double r2 = dx * dx + dy * dy;
+            sum_r += v * std::sqrt(r2);
+            sum_r2 += v * r2;
+        }
+    }
+
+    /** a block is 2 bayer pixels. **/
+    hfr = 2.0 * sum_r / flux;
+    fwhm = 2.0 * kFwhmSigmas * std::sqrt(0.5 * sum_r2 / flux);
+
+    /** follow the star. the block center is half a pixel in. **/
+    target.x_ = x0 + 2.0 * cx + 0.5;
+    target.y_ = y0 + 2.0 * cy + 0.5;
+    return true;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+measure the focus from the size of a few stars.
+
+the stars are found once in the whole frame.
+if there aren't any the search waits a few frames before it tries again.
+twice as long each time it fails.
+after that only a small window around each star is read.
+the windows follow the stars as they drift.
+so the cost doesn't depend on the size of the frame.
+
+each window is summed into 2x2 blocks of bayer pixels.
+which averages away the bayer pattern.
+the background is the mean of the border of the window.
+
+the sizes are in bayer pixels:
+half flux radius is the flux weighted mean distance from the centroid.
+full width half max assumes the star is a gaussian.
+smaller is better for both.
+**/
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include <shared/worker_pool.h>
+
+#include "star_registration.h"
+
+
+class FocusMeter {
+public:
+    FocusMeter() noexcept = default;
+    FocusMeter(const FocusMeter &) = delete;
+    ~FocusMeter() noexcept = default;
+
+    /** the median of the measured stars. **/
+    class Result {
+    public:
+        int nstars_ = 0;
+        double hfr_ = 0.0;
+        double fwhm_ = 0.0;
+    };
+
+    /** find new stars in the next frame. **/
+    void reset() noexcept;
+
+    /**
+    measure the stars in the bayer image.
+    black should already be subtracted.
+    returns false if there are no stars.
+    **/
+    bool measure(const cv::Mat &bayer, WorkerPool *pool, Result &result) noexcept;
+
+private:
+    static const int kMaxStars = 5;
+    /** the most frames to wait between searches for stars. **/
+    static const int kMaxBackoff = 32;
+    /** the size of the window in bayer pixels. must be even. **/
+    static const int kWindow = 32;
+    static const int kBlocks = kWindow / 2;
+
+    /** the center of a star in bayer pixels. **/
+    class Target {
+    public:
+        double x_ = 0.0;
+        double y_ = 0.0;
+    };
+
+    StarRegistration finder_;
+    std::vector<Target> targets_;
+    /** frames to wait before the next search. **/
+    int skip_ = 0;
+    int backoff_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    float lum_[kBlocks * kBlocks];
+    std::vector<double> hfr_;
+    std::vector<double> fwhm_;
+
+    void findTargets(const cv::Mat &bayer, WorkerPool *pool) noexcept;
+    bool measureStar(const cv::Mat &bayer, Target &target, double &hfr, double &fwhm) noexcept;
+};
@@ -0,0 +1,467 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+show the view in an x11 window with opengl.
+
+this is opengl 2.1 and glsl 1.20.
+which every driver has.
+the image and the overlays are drawn in image pixel coordinates.
+**/
+
+#define GL_GLEXT_PROTOTYPES 1
+
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glx.h>
+
+#include <aggiornamento/log.h>
+
+#include "gl_display.h"
+
+
+namespace {
+const char *kVertexShader =
+    "#version 120\n"
+    "varying vec2 v_uv;\n"
+    "void main() {\n"
+    "    v_uv = gl_MultiTexCoord0.xy;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
+    "}\n";
+
+/** look up each component in the gamma table. like the cpu kernel. **/
+const char *kFragmentShader =
+    "#version 120\n"
+    "uniform sampler2D image;\n"
+    "uniform sampler1D gamma;\n"
+    "uniform float gamma_scale;\n"
+    "uniform float gamma_size;\n"
+    "varying vec2 v_uv;\n"
+    "void main() {\n"
+    "    vec3 c = texture2D(image, v_uv).rgb;\n"
+    "    vec3 t = (floor(c * gamma_scale + 0.5) + 0.5) / gamma_size;\n"
+    "    gl_FragColor = vec4(\n"
+    "        texture1D(gamma, t.r).r,\n"
+    "        texture1D(gamma, t.g).r,\n"
+    "        texture1D(gamma, t.b).r,\n"
+    "        1.0);\n"
+    "}\n";
+
+/** line segments in a circle. **/
+const int kCircleSegments = 128;
+
+/** the printable ascii characters have display lists. **/
+const int kFirstChar = 32;
+const int kNumChars = 96;
+
+typedef void (*SwapIntervalExt)(Display *, GLXDrawable, int);
+typedef int (*SwapIntervalMesa)(unsigned int);
+}
+
+GlDisplay::~GlDisplay() noexcept {
+    close();
+}
+
+bool GlDisplay::open(
+    const char *title,
+    int x,
+    int y
+) noexcept {
+    display_ = XOpenDisplay(nullptr);
+    if (display_ == nullptr) {
+        LOG("GlDisplay Failed to open the display.");
+        return false;
+    }
+    int screen = DefaultScreen(display_);
+    int attributes[] = {
+        GLX_RGBA,
+        GLX_DOUBLEBUFFER,
+        GLX_RED_SIZE, 8,
+        GLX_GREEN_SIZE, 8,
+        GLX_BLUE_SIZE, 8,
+        None
+    };
+    auto visual = glXChooseVisual(display_, screen, attributes);
+    if (visual == nullptr) {
+        LOG("GlDisplay No OpenGL visual.");
+        close();
+        return false;
+    }
+
+    auto root = RootWindow(display_, screen);
+    XSetWindowAttributes swa;
+    std::memset(&swa, 0, sizeof(swa));
+    swa.colormap = XCreateColormap(display_, root, visual->visual, AllocNone);
+    swa.event_mask = KeyPressMask | StructureNotifyMask;
+    window_width_ = 640;
+    window_height_ = 480;
+    window_ = XCreateWindow(display_, root, x, y, window_width_, window_height_, 0,
+        visual->depth, InputOutput, visual->visual, CWColormap | CWEventMask, &swa);
+    XStoreName(display_, window_, title);
+    delete_atom_ = XInternAtom(display_, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(display_, window_, &delete_atom_, 1);
+
+    context_ = glXCreateContext(display_, visual, nullptr, True);
+    XFree(visual);
+    if (context_ == nullptr) {
+        LOG("GlDisplay Failed to create the OpenGL context.");
+        close();
+        return false;
+    }
+    XMapWindow(display_, window_);
+    XMoveWindow(display_, window_, x, y);
+    glXMakeCurrent(display_, window_, context_);
+
+    if (createProgram() == false) {
+        close();
+        return false;
+    }
+    disableVsync();
+    createFont();
+
+    glGenTextures(1, &image_texture_);
+    glBindTexture(GL_TEXTURE_2D, image_texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &gamma_texture_);
+    glBindTexture(GL_TEXTURE_1D, gamma_texture_);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+
+    glGenBuffers(1, &pixel_buffer_);
+
+    LOG("GlDisplay Using OpenGL "<<(const char *) glGetString(GL_VERSION)<<" on "<<(const char *) glGetString(GL_RENDERER));
+    return true;
+}
+
+void GlDisplay::close() noexcept {
+    if (display_ == nullptr) {
+        return;
+    }
+    if (context_) {
+        if (program_) {
+            glDeleteProgram(program_);
+        }
+        if (image_texture_) {
+            glDeleteTextures(1, &image_texture_);
+        }
+        if (gamma_texture_) {
+            glDeleteTextures(1, &gamma_texture_);
+        }
+        if (pixel_buffer_) {
+            glDeleteBuffers(1, &pixel_buffer_);
+        }
+        if (font_lists_) {
+            glDeleteLists(font_lists_, kNumChars);
+        }
+        glXMakeCurrent(display_, None, nullptr);
+        glXDestroyContext(display_, context_);
+    }
+    if (font_) {
+        XFreeFont(display_, font_);
+    }
+    if (window_) {
+        XDestroyWindow(display_, window_);
+    }
+    XCloseDisplay(display_);
+    display_ = nullptr;
+    window_ = 0;
+    context_ = nullptr;
+    program_ = 0;
+    image_texture_ = 0;
+    gamma_texture_ = 0;
+    pixel_buffer_ = 0;
+    font_ = nullptr;
+    font_lists_ = 0;
+    width_ = 0;
+    height_ = 0;
+}
+
+GLuint GlDisplay::compileShader(
+    GLenum type,
+    const char *source
+) noexcept {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        LOG("GlDisplay Failed to compile shader: "<<log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+bool GlDisplay::createProgram() noexcept {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, kVertexShader);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, kFragmentShader);
+    if (vs == 0 || fs == 0) {
+        return false;
+    }
+    program_ = glCreateProgram();
+    glAttachShader(program_, vs);
+    glAttachShader(program_, fs);
+    glLinkProgram(program_);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint status = GL_FALSE;
+    glGetProgramiv(program_, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        LOG("GlDisplay Failed to link the shaders.");
+        return false;
+    }
+    glUseProgram(program_);
+    glUniform1i(glGetUniformLocation(program_, "image"), 0);
+    glUniform1i(glGetUniformLocation(program_, "gamma"), 1);
+    gamma_scale_location_ = glGetUniformLocation(program_, "gamma_scale");
+    gamma_size_location_ = glGetUniformLocation(program_, "gamma_size");
+    glUseProgram(0);
+    return true;
+}
+
+/**
+swapping buffers shouldn't wait for the monitor.
+mesa returns an address for any name. so check the extension string.
+**/
+void GlDisplay::disableVsync() noexcept {
+    std::string extensions = glXQueryExtensionsString(display_, DefaultScreen(display_));
+    if (extensions.find("GLX_EXT_swap_control") != std::string::npos) {
+        auto ext = (SwapIntervalExt) glXGetProcAddress((const GLubyte *) "glXSwapIntervalEXT");
+        ext(display_, window_, 0);
+    } else if (extensions.find("GLX_MESA_swap_control") != std::string::npos) {
+        auto mesa = (SwapIntervalMesa) glXGetProcAddress((const GLubyte *) "glXSwapIntervalMESA");
+        mesa(0);
+    }
+}
+
+void GlDisplay::setGammaTable(
+    const agm::uint8 *table,
+    int table_max
+) noexcept {
+    gamma_size_ = table_max + 1;
+    glBindTexture(GL_TEXTURE_1D, gamma_texture_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_LUMINANCE8, gamma_size_, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, table);
+    glBindTexture(GL_TEXTURE_1D, 0);
+
+    glUseProgram(program_);
+    glUniform1f(gamma_scale_location_, float(table_max));
+    glUniform1f(gamma_size_location_, float(gamma_size_));
+    glUseProgram(0);
+}
+
+agm::uint16 *GlDisplay::mapImage(
+    int width,
+    int height,
+    int zoom
+) noexcept {
+    int bytes = 3 * sizeof(agm::uint16) * width * height;
+
+    /** resize the texture and the window. **/
+    if (width != width_ || height != height_ || zoom != zoom_) {
+        if (width != width_ || height != height_) {
+            glBindTexture(GL_TEXTURE_2D, image_texture_);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16, width, height, 0, GL_BGR, GL_UNSIGNED_SHORT, nullptr);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        width_ = width;
+        height_ = height;
+        zoom_ = zoom;
+        XResizeWindow(display_, window_, width * zoom, height * zoom);
+    }
+
+    /** orphan the old buffer so we don't wait for the last upload. **/
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer_);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    mapped_ = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (mapped_) {
+        return (agm::uint16 *) mapped_;
+    }
+    fallback_.resize(3 * width * height);
+    return fallback_.data();
+}
+
+void GlDisplay::unmapImage() noexcept {
+    glBindTexture(GL_TEXTURE_2D, image_texture_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    if (mapped_) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer_);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_BGR, GL_UNSIGNED_SHORT, nullptr);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        mapped_ = nullptr;
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_BGR, GL_UNSIGNED_SHORT, fallback_.data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GlDisplay::setHistogram(
+    int channel,
+    const std::vector<float> &levels
+) noexcept {
+    histogram_[channel] = levels;
+}
+
+void GlDisplay::setCircles(
+    double cx,
+    double cy,
+    const std::vector<double> &radii
+) noexcept {
+    circle_x_ = cx;
+    circle_y_ = cy;
+    radii_ = radii;
+}
+
+void GlDisplay::draw() noexcept {
+    glViewport(0, 0, window_width_, window_height_);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (width_ <= 0 || height_ <= 0) {
+        glXSwapBuffers(display_, window_);
+        return;
+    }
+
+    /** image pixel coordinates with y down. **/
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0.0, width_, height_, 0.0, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    glUseProgram(program_);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, gamma_texture_);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, image_texture_);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 0.0f);
+    glVertex2f(0.0f, 0.0f);
+    glTexCoord2f(1.0f, 0.0f);
+    glVertex2f(width_, 0.0f);
+    glTexCoord2f(1.0f, 1.0f);
+    glVertex2f(width_, height_);
+    glTexCoord2f(0.0f, 1.0f);
+    glVertex2f(0.0f, height_);
+    glEnd();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+
+    drawOverlays();
+    drawText();
+    glXSwapBuffers(display_, window_);
+}
+
+void GlDisplay::drawOverlays() noexcept {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    /** the histogram spans the window. blue, green, red. **/
+    static const float kColors[3][3] = {
+        {0.0f, 0.0f, 1.0f},
+        {0.0f, 1.0f, 0.0f},
+        {1.0f, 0.0f, 0.0f}
+    };
+    for (int c = 0; c < 3; ++c) {
+        auto &levels = histogram_[c];
+        int n = levels.size();
+        if (n == 0) {
+            continue;
+        }
+        glColor4f(kColors[c][0], kColors[c][1], kColors[c][2], 1.0f);
+        glBegin(GL_LINE_STRIP);
+        for (int i = 0; i < n; ++i) {
+            float x = (float(i) + 0.5f) * float(width_) / float(n);
+            float y = float(height_) * (1.0f - levels[i]);
+            glVertex2f(x, y);
+        }
+        glEnd();
+    }
+
+    /** the circles are half transparent red. **/
+    glColor4f(1.0f, 0.0f, 0.0f, 0.5f);
+    for (auto radius : radii_) {
+        glBegin(GL_LINE_LOOP);
+        for (int i = 0; i < kCircleSegments; ++i) {
+            double angle = 2.0 * M_PI * i / kCircleSegments;
+            glVertex2d(circle_x_ + radius * std::cos(angle), circle_y_ + radius * std::sin(angle));
+        }
+        glEnd();
+    }
+    glDisable(GL_BLEND);
+}
+
+void GlDisplay::setText(
+    const std::vector<std::string> &lines
+) noexcept {
+    text_ = lines;
+}
+
+/** no text if the server doesn't have the fixed font. **/
+void GlDisplay::createFont() noexcept {
+    font_ = XLoadQueryFont(display_, "fixed");
+    if (font_ == nullptr) {
+        LOG("GlDisplay No fixed font. Text is not shown.");
+        return;
+    }
+    font_lists_ = glGenLists(kNumChars);
+    glXUseXFont(font_->fid, kFirstChar, kNumChars, font_lists_);
+}
+
+/** the text is in window pixels. so it's the same size at any zoom. **/
+void GlDisplay::drawText() noexcept {
+    if (font_lists_ == 0 || text_.empty()) {
+        return;
+    }
+    int line_height = font_->ascent + font_->descent;
+    glColor3f(0.0f, 1.0f, 0.0f);
+    glListBase(font_lists_ - kFirstChar);
+    int y = window_height_ - 4 - font_->ascent;
+    for (auto &line : text_) {
+        glWindowPos2i(8, y);
+        glCallLists(line.size(), GL_UNSIGNED_BYTE, line.c_str());
+        y -= line_height;
+    }
+}
+
+int GlDisplay::pollKey() noexcept {
+    int key = -1;
+    while (XPending(display_)) {
+        XEvent event;
+        XNextEvent(display_, &event);
+        switch (event.type) {
+        case KeyPress:
+            if (XLookupKeysym(&event.xkey, 0) == XK_Escape) {
+                key = 27;
+            }
+            break;
+        case ConfigureNotify:
+            window_width_ = event.xconfigure.width;
+            window_height_ = event.xconfigure.height;
+            break;
+        case ClientMessage:
+            if (Atom(event.xclient.data.l[0]) == delete_atom_) {
+                key = 27;
+            }
+            break;
+        }
+    }
+    return key;
+}
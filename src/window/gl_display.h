@@ -0,0 +1,117 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+show the view in an x11 window with opengl.
+
+the view is a 16 bit BGR image.
+it's written straight into a pixel buffer owned by opengl.
+which is uploaded to a texture without another copy.
+the texture is stretched to the window.
+which is how the view is magnified.
+
+display gamma is applied by a shader with the gamma table in a texture.
+the histogram and the collimation circles are drawn as lines on top.
+so they don't touch the pixels.
+
+only the window thread may call these.
+except the pointer returned by mapImage may be written by any thread.
+until unmapImage is called.
+**/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <X11/Xlib.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class GlDisplay {
+public:
+    GlDisplay() noexcept = default;
+    GlDisplay(const GlDisplay &) = delete;
+    ~GlDisplay() noexcept;
+
+    /** create the window. returns false if there's no opengl. **/
+    bool open(const char *title, int x, int y) noexcept;
+
+    /** destroy the window. **/
+    void close() noexcept;
+
+    /** the table maps 16 bit values scaled to table_max to 8 bits. **/
+    void setGammaTable(const agm::uint8 *table, int table_max) noexcept;
+
+    /**
+    get the buffer for the next width x height 16 bit BGR image.
+    the window is zoom times the size of the image.
+    **/
+    agm::uint16 *mapImage(int width, int height, int zoom) noexcept;
+
+    /** upload the image written to the buffer. **/
+    void unmapImage() noexcept;
+
+    /**
+    set the histogram for one channel. BGR order.
+    the levels are fractions of the height of the window.
+    an empty vector hides it.
+    **/
+    void setHistogram(int channel, const std::vector<float> &levels) noexcept;
+
+    /** set the circles in pixels of the image. an empty vector hides them. **/
+    void setCircles(double cx, double cy, const std::vector<double> &radii) noexcept;
+
+    /** lines of text in the top left corner. an empty vector hides them. **/
+    void setText(const std::vector<std::string> &lines) noexcept;
+
+    /** draw the image and overlays and show them. **/
+    void draw() noexcept;
+
+    /** handle window events. returns 27 for escape or close. otherwise -1. **/
+    int pollKey() noexcept;
+
+private:
+    Display *display_ = nullptr;
+    Window window_ = 0;
+    GLXContext context_ = nullptr;
+    Atom delete_atom_ = 0;
+    int window_width_ = 0;
+    int window_height_ = 0;
+
+    GLuint program_ = 0;
+    GLuint image_texture_ = 0;
+    GLuint gamma_texture_ = 0;
+    GLuint pixel_buffer_ = 0;
+    GLint gamma_scale_location_ = -1;
+    GLint gamma_size_location_ = -1;
+    int gamma_size_ = 1;
+
+    int width_ = 0;
+    int height_ = 0;
+    int zoom_ = 1;
+    void *mapped_ = nullptr;
+    /** used if the pixel buffer can't be mapped. **/
+    std::vector<agm::uint16> fallback_;
+
+    std::vector<float> histogram_[3];
+    double circle_x_ = 0.0;
+    double circle_y_ = 0.0;
+    std::vector<double> radii_;
+
+    /** the x font is turned into display lists for text. **/
+    XFontStruct *font_ = nullptr;
+    GLuint font_lists_ = 0;
+    std::vector<std::string> text_;
+
+    bool createProgram() noexcept;
+    GLuint compileShader(GLenum type, const char *source) noexcept;
+    void disableVsync() noexcept;
+    void drawOverlays() noexcept;
+    void createFont() noexcept;
+    void drawText() noexcept;
+};
@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+histogram of the 16 bit BGR image for display.
+**/
+
+#include <algorithm>
+#include <cmath>
+
+#include "histogram.h"
+
+
+void Histogram::configure(
+    int bins,
+    int nthreads
+) noexcept {
+    bins_ = bins;
+    shift_ = 0;
+    while ((65536 >> shift_) > bins) {
+        ++shift_;
+    }
+    nthreads_ = nthreads;
+    counts_.assign(kChannels * bins_, 0);
+    partial_.assign(nthreads_ * kChannels * bins_, 0);
+}
+
+void Histogram::decay(
+    int percent
+) noexcept {
+    /** the product overflows an int for big frames. **/
+    for (auto &count : counts_) {
+        count = int(agm::int64(count) * percent / 100);
+    }
+}
+
+void Histogram::add(
+    const cv::Mat &rgb16,
+    int step,
+    WorkerPool *pool
+) noexcept {
+    for (auto &count : partial_) {
+        count = 0;
+    }
+
+    /** the bands are bands of sampled rows. **/
+    int nrows = (rgb16.rows + step - 1) / step;
+    int band = pool->getBandRows(nrows, 1);
+    pool->run(nrows, band, [&](int worker, int r0, int r1) {
+        addRows(worker, rgb16, r0, r1, step);
+    });
+
+    int weight = step * step;
+    int sz = kChannels * bins_;
+    for (int w = 0; w < nthreads_; ++w) {
+        auto partial = &partial_[w * sz];
+        for (int i = 0; i < sz; ++i) {
+            counts_[i] += weight * partial[i];
+        }
+    }
+}
+
+void Histogram::addRows(
+    int worker,
+    const cv::Mat &rgb16,
+    int r0,
+    int r1,
+    int step
+) noexcept {
+    auto partial = &partial_[worker * kChannels * bins_];
+    auto histb = partial;
+    auto histg = partial + bins_;
+    auto histr = partial + 2 * bins_;
+    int shift = shift_;
+    int wd = rgb16.cols;
+    int pixel_step = kChannels * step;
+    for (int r = r0; r < r1; ++r) {
+        auto ptr = (const agm::uint16 *) rgb16.data + kChannels * wd * (r * step);
+        auto end = ptr + kChannels * wd;
+        for (; ptr < end; ptr += pixel_step) {
+            ++histb[ptr[0] >> shift];
+            ++histg[ptr[1] >> shift];
+            ++histr[ptr[2] >> shift];
+        }
+    }
+}
+
+int Histogram::chooseStep(
+    int width,
+    int height,
+    int max_samples
+) noexcept {
+    int step = 1;
+    while (agm::int64(width / step) * agm::int64(height / step) > max_samples) {
+        ++step;
+    }
+    return step;
+}
+
+/** counts below 16 are exact. **/
+int Histogram::getLogIndex(
+    agm::uint32 count
+) noexcept {
+    if (count < 16) {
+        return count;
+    }
+    int msb = 31 - __builtin_clz(count);
+    int mantissa = (count >> (msb - 4)) & 15;
+    return 16 * (msb - 3) + mantissa;
+}
+
+double Histogram::getLogValue(
+    int index
+) noexcept {
+    if (index < 16) {
+        return index;
+    }
+    int msb = index / 16 + 3;
+    int mantissa = index % 16;
+    return std::ldexp(16.0 + mantissa + 0.5, msb - 4);
+}
@@ -0,0 +1,83 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+histogram of the 16 bit BGR image for display.
+
+the number of bins is a power of 2.
+so the bin is the value shifted right.
+
+big images are sampled.
+every step'th pixel of every step'th row.
+each sample counts step^2 so the totals don't depend on the step.
+
+each worker bins its bands into its own partial histograms.
+the partial counts are summed at the end.
+the buffers are kept from frame to frame.
+
+the counts are plotted on a log scale.
+a count is reduced to its leading bit and the next 4 bits.
+which indexes a table of plot heights.
+**/
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include <shared/worker_pool.h>
+
+
+class Histogram {
+public:
+    Histogram() noexcept = default;
+    Histogram(const Histogram &) = delete;
+    ~Histogram() noexcept = default;
+
+    static const int kChannels = 3;
+    /** the number of entries in the log table. **/
+    static const int kLogIndices = 16 * 29;
+
+    /**
+    allocate and clear the counts.
+    bins must be a power of 2 between 2 and 65536.
+    **/
+    void configure(int bins, int nthreads) noexcept;
+
+    int getBins() const noexcept {
+        return bins_;
+    }
+
+    /** multiply the counts by percent / 100. **/
+    void decay(int percent) noexcept;
+
+    /** add the BGR image to the counts. **/
+    void add(const cv::Mat &rgb16, int step, WorkerPool *pool) noexcept;
+
+    /** the counts for one channel. BGR order. **/
+    const int *getCounts(int channel) const noexcept {
+        return &counts_[channel * bins_];
+    }
+
+    /** choose a step that samples about max_samples pixels. **/
+    static int chooseStep(int width, int height, int max_samples) noexcept;
+
+    /** the index into the log table for a count. **/
+    static int getLogIndex(agm::uint32 count) noexcept;
+
+    /** a count with this log index. the middle of the range. **/
+    static double getLogValue(int index) noexcept;
+
+private:
+    int bins_ = 0;
+    int shift_ = 0;
+    int nthreads_ = 0;
+    std::vector<int> counts_;
+    std::vector<int> partial_;
+
+    void addRows(int worker, const cv::Mat &rgb16, int r0, int r1, int step) noexcept;
+};
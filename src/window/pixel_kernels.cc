@@ -0,0 +1,458 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+per-pixel kernels used by the window thread.
+
+the integer divides in the scalar kernels are done in double
+precision by the vector kernels.
+the products are at most 47 bits so they are exact.
+a correctly rounded quotient never crosses an integer boundary
+for these sizes.
+so the floor of the double quotient is the integer quotient.
+
+avx2 is detected at run time.
+neon is always present on aarch64.
+it doesn't have a gather so the gamma table lookup stays scalar.
+**/
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ZWO_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define ZWO_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "pixel_kernels.h"
+
+
+namespace {
+
+/** the scalar reference kernels. **/
+
+int subtractScalar(
+    agm::uint16 *img,
+    const agm::uint16 *black,
+    int count
+) noexcept {
+    int mx = 0;
+    for (int i = 0; i < count; ++i) {
+        int pix = img[i];
+        pix -= black[i];
+        pix = std::max(0, pix);
+        mx = std::max(mx, pix);
+        img[i] = pix;
+    }
+    return mx;
+}
+
+void isoScaleScalar(
+    agm::uint16 *ptr,
+    int count,
+    int iso
+) noexcept {
+    for (int i = 0; i < count; ++i) {
+        int p = *ptr * iso / 100;
+        p = std::min(p, 65535);
+        *ptr++ = p;
+    }
+}
+
+void balanceColorsScalar(
+    agm::uint16 *bgr,
+    int npixels,
+    double red,
+    double blue
+) noexcept {
+    for (int i = 0; i < npixels; ++i) {
+        int r = bgr[2];
+        int b = bgr[0];
+        r = std::round(r * red);
+        b = std::round(b * blue);
+        bgr[2] = r;
+        bgr[0] = b;
+        bgr += 3;
+    }
+}
+
+void displayGammaScalar(
+    const agm::uint16 *src,
+    agm::uint8 *dst,
+    int count,
+    const agm::uint8 *table,
+    int table_max
+) noexcept {
+    for (int i = 0; i < count; ++i) {
+        /** get the source component. **/
+        int sval = *src++;
+
+        /** scale to the size of the table. **/
+        static const int kSourceChannelMax = 65535;
+        int ix = (sval * table_max + kSourceChannelMax/2) / kSourceChannelMax;
+
+        /** pin to 8 bits. **/
+        ix = std::max(0, std::min(ix, table_max));
+
+        /** use the value from the table. **/
+        *dst++ = table[ix];
+    }
+}
+
+PixelKernels makeScalar() noexcept {
+    PixelKernels k;
+    k.name_ = "scalar";
+    k.subtract_ = subtractScalar;
+    k.iso_scale_ = isoScaleScalar;
+    k.balance_colors_ = balanceColorsScalar;
+    k.display_gamma_ = displayGammaScalar;
+    return k;
+}
+
+#if ZWO_HAVE_AVX2
+
+/** 4 unsigned 16 bit values to 4 doubles. **/
+__attribute__((target("avx2")))
+inline __m256d loadPd4(
+    const agm::uint16 *ptr
+) noexcept {
+    __m128i x = _mm_loadl_epi64((const __m128i *) ptr);
+    return _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(x));
+}
+
+/** floor(v * mul / div) pinned to mx for 8 unsigned 32 bit values. **/
+__attribute__((target("avx2")))
+inline __m256i scaleDiv8(
+    __m256i v,
+    __m256d mul,
+    __m256d div,
+    __m256d mx
+) noexcept {
+    __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+    __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+    lo = _mm256_floor_pd(_mm256_div_pd(_mm256_mul_pd(lo, mul), div));
+    hi = _mm256_floor_pd(_mm256_div_pd(_mm256_mul_pd(hi, mul), div));
+    lo = _mm256_min_pd(lo, mx);
+    hi = _mm256_min_pd(hi, mx);
+    __m128i ilo = _mm256_cvttpd_epi32(lo);
+    __m128i ihi = _mm256_cvttpd_epi32(hi);
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(ilo), ihi, 1);
+}
+
+/** pack 8 signed 32 bit values in [0,65535] to 16 bits. **/
+__attribute__((target("avx2")))
+inline __m128i pack8(
+    __m256i v
+) noexcept {
+    __m256i p = _mm256_packus_epi32(v, v);
+    p = _mm256_permute4x64_epi64(p, 0x08);
+    return _mm256_castsi256_si128(p);
+}
+
+__attribute__((target("avx2")))
+int subtractAvx2(
+    agm::uint16 *img,
+    const agm::uint16 *black,
+    int count
+) noexcept {
+    __m256i vmx = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i pix = _mm256_loadu_si256((const __m256i *) (img + i));
+        __m256i blk = _mm256_loadu_si256((const __m256i *) (black + i));
+        pix = _mm256_subs_epu16(pix, blk);
+        vmx = _mm256_max_epu16(vmx, pix);
+        _mm256_storeu_si256((__m256i *) (img + i), pix);
+    }
+
+    /** reduce the maximum. **/
+    alignas(32) agm::uint16 lanes[16];
+    _mm256_store_si256((__m256i *) lanes, vmx);
+    int mx = 0;
+    for (int k = 0; k < 16; ++k) {
+        mx = std::max(mx, int(lanes[k]));
+    }
+
+    /** the leftovers. **/
+    int tail = subtractScalar(img + i, black + i, count - i);
+    return std::max(mx, tail);
+}
+
+__attribute__((target("avx2")))
+void isoScaleAvx2(
+    agm::uint16 *ptr,
+    int count,
+    int iso
+) noexcept {
+    const __m256d mul = _mm256_set1_pd(double(iso));
+    const __m256d div = _mm256_set1_pd(100.0);
+    const __m256d mx65535 = _mm256_set1_pd(65535.0);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i p16 = _mm_loadu_si128((const __m128i *) (ptr + i));
+        __m256i p = scaleDiv8(_mm256_cvtepu16_epi32(p16), mul, div, mx65535);
+        _mm_storeu_si128((__m128i *) (ptr + i), pack8(p));
+    }
+    isoScaleScalar(ptr + i, count - i, iso);
+}
+
+/**
+std::round rounds halves away from zero.
+round the magnitude and restore the sign.
+then wrap to 16 bits like the scalar store does.
+**/
+__attribute__((target("avx2")))
+inline __m128i roundWrap4(
+    __m256d x
+) noexcept {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256d mag = _mm256_andnot_pd(sign, x);
+    __m256d fl = _mm256_floor_pd(mag);
+    __m256d up = _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(mag, fl), half, _CMP_GE_OQ), one);
+    __m256d r = _mm256_or_pd(_mm256_add_pd(fl, up), _mm256_and_pd(sign, x));
+    __m128i ir = _mm256_cvttpd_epi32(r);
+    return _mm_and_si128(ir, _mm_set1_epi32(0xFFFF));
+}
+
+__attribute__((target("avx2")))
+void balanceColorsAvx2(
+    agm::uint16 *bgr,
+    int npixels,
+    double red,
+    double blue
+) noexcept {
+    /**
+    4 pixels are 12 components are 3 vectors of 4 doubles.
+    green is multiplied by 1 which doesn't change it.
+    **/
+    const __m256d m0 = _mm256_setr_pd(blue, 1.0, red, blue);
+    const __m256d m1 = _mm256_setr_pd(1.0, red, blue, 1.0);
+    const __m256d m2 = _mm256_setr_pd(red, blue, 1.0, red);
+    int i = 0;
+    for (; i + 4 <= npixels; i += 4) {
+        auto ptr = bgr + 3 * i;
+        __m128i a = roundWrap4(_mm256_mul_pd(loadPd4(ptr + 0), m0));
+        __m128i b = roundWrap4(_mm256_mul_pd(loadPd4(ptr + 4), m1));
+        __m128i c = roundWrap4(_mm256_mul_pd(loadPd4(ptr + 8), m2));
+        _mm_storeu_si128((__m128i *) ptr, _mm_packus_epi32(a, b));
+        _mm_storel_epi64((__m128i *) (ptr + 8), _mm_packus_epi32(c, c));
+    }
+    balanceColorsScalar(bgr + 3 * i, npixels - i, red, blue);
+}
+
+__attribute__((target("avx2")))
+void displayGammaAvx2(
+    const agm::uint16 *src,
+    agm::uint8 *dst,
+    int count,
+    const agm::uint8 *table,
+    int table_max
+) noexcept {
+    /**
+    for x < 2^28
+    x / 65535 = (x + 1 + (x >> 16)) >> 16.
+    gather 4 bytes from the padded table and keep the low byte.
+    **/
+    const __m256i vmax = _mm256_set1_epi32(table_max);
+    const __m256i vhalf = _mm256_set1_epi32(65535/2);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i lowbyte = _mm256_set1_epi32(0xFF);
+    const __m256i gather = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+    auto base = (const int *) table;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i s16 = _mm_loadu_si128((const __m128i *) (src + i));
+        __m256i x = _mm256_mullo_epi32(_mm256_cvtepu16_epi32(s16), vmax);
+        x = _mm256_add_epi32(x, vhalf);
+        __m256i q = _mm256_add_epi32(_mm256_add_epi32(x, one), _mm256_srli_epi32(x, 16));
+        q = _mm256_srli_epi32(q, 16);
+        q = _mm256_min_epi32(q, vmax);
+        __m256i v = _mm256_i32gather_epi32((const int *) base, q, 1);
+        v = _mm256_and_si256(v, lowbyte);
+        v = _mm256_packus_epi32(v, v);
+        v = _mm256_packus_epi16(v, v);
+        v = _mm256_permutevar8x32_epi32(v, gather);
+        _mm_storel_epi64((__m128i *) (dst + i), _mm256_castsi256_si128(v));
+    }
+    displayGammaScalar(src + i, dst + i, count - i, table, table_max);
+}
+
+PixelKernels makeAvx2() noexcept {
+    PixelKernels k;
+    k.name_ = "avx2";
+    k.subtract_ = subtractAvx2;
+    k.iso_scale_ = isoScaleAvx2;
+    k.balance_colors_ = balanceColorsAvx2;
+    k.display_gamma_ = displayGammaAvx2;
+    return k;
+}
+
+#endif /* ZWO_HAVE_AVX2 */
+
+#if ZWO_HAVE_NEON
+
+/** floor(v * mul / div) pinned to mx for 2 unsigned 32 bit values. **/
+inline uint32x2_t scaleDiv2(
+    uint32x2_t v,
+    float64x2_t mul,
+    float64x2_t div,
+    float64x2_t mx
+) noexcept {
+    float64x2_t d = vcvtq_f64_u64(vmovl_u32(v));
+    d = vrndmq_f64(vdivq_f64(vmulq_f64(d, mul), div));
+    d = vminq_f64(d, mx);
+    return vmovn_u64(vcvtq_u64_f64(d));
+}
+
+/** same for 4 values. **/
+inline uint32x4_t scaleDiv4(
+    uint32x4_t v,
+    float64x2_t mul,
+    float64x2_t div,
+    float64x2_t mx
+) noexcept {
+    uint32x2_t lo = scaleDiv2(vget_low_u32(v), mul, div, mx);
+    uint32x2_t hi = scaleDiv2(vget_high_u32(v), mul, div, mx);
+    return vcombine_u32(lo, hi);
+}
+
+int subtractNeon(
+    agm::uint16 *img,
+    const agm::uint16 *black,
+    int count
+) noexcept {
+    uint16x8_t vmx = vdupq_n_u16(0);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t pix = vqsubq_u16(vld1q_u16(img + i), vld1q_u16(black + i));
+        vmx = vmaxq_u16(vmx, pix);
+        vst1q_u16(img + i, pix);
+    }
+    int mx = vmaxvq_u16(vmx);
+    int tail = subtractScalar(img + i, black + i, count - i);
+    return std::max(mx, tail);
+}
+
+void isoScaleNeon(
+    agm::uint16 *ptr,
+    int count,
+    int iso
+) noexcept {
+    const float64x2_t mul = vdupq_n_f64(double(iso));
+    const float64x2_t div = vdupq_n_f64(100.0);
+    const float64x2_t mx65535 = vdupq_n_f64(65535.0);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t p16 = vld1q_u16(ptr + i);
+        uint32x4_t lo = scaleDiv4(vmovl_u16(vget_low_u16(p16)), mul, div, mx65535);
+        uint32x4_t hi = scaleDiv4(vmovl_u16(vget_high_u16(p16)), mul, div, mx65535);
+        vst1q_u16(ptr + i, vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+    }
+    isoScaleScalar(ptr + i, count - i, iso);
+}
+
+/**
+vrndaq rounds halves away from zero just like std::round.
+narrowing wraps to 16 bits just like the scalar store.
+**/
+inline uint16x4_t roundWrap4(
+    uint16x4_t v,
+    float64x2_t mul
+) noexcept {
+    uint32x4_t v32 = vmovl_u16(v);
+    float64x2_t lo = vcvtq_f64_u64(vmovl_u32(vget_low_u32(v32)));
+    float64x2_t hi = vcvtq_f64_u64(vmovl_u32(vget_high_u32(v32)));
+    lo = vrndaq_f64(vmulq_f64(lo, mul));
+    hi = vrndaq_f64(vmulq_f64(hi, mul));
+    int32x2_t ilo = vmovn_s64(vcvtq_s64_f64(lo));
+    int32x2_t ihi = vmovn_s64(vcvtq_s64_f64(hi));
+    return vmovn_u32(vreinterpretq_u32_s32(vcombine_s32(ilo, ihi)));
+}
+
+void balanceColorsNeon(
+    agm::uint16 *bgr,
+    int npixels,
+    double red,
+    double blue
+) noexcept {
+    const float64x2_t mred = vdupq_n_f64(red);
+    const float64x2_t mblue = vdupq_n_f64(blue);
+    int i = 0;
+    for (; i + 4 <= npixels; i += 4) {
+        auto ptr = bgr + 3 * i;
+        uint16x4x3_t px = vld3_u16(ptr);
+        px.val[0] = roundWrap4(px.val[0], mblue);
+        px.val[2] = roundWrap4(px.val[2], mred);
+        vst3_u16(ptr, px);
+    }
+    balanceColorsScalar(bgr + 3 * i, npixels - i, red, blue);
+}
+
+void displayGammaNeon(
+    const agm::uint16 *src,
+    agm::uint8 *dst,
+    int count,
+    const agm::uint8 *table,
+    int table_max
+) noexcept {
+    /** x / 65535 = (x + 1 + (x >> 16)) >> 16 for x < 2^28. **/
+    const uint32x4_t vmax = vdupq_n_u32(table_max);
+    const uint32x4_t vhalf = vdupq_n_u32(65535/2);
+    const uint32x4_t one = vdupq_n_u32(1);
+    alignas(16) agm::uint32 ix[8];
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t s16 = vld1q_u16(src + i);
+        uint32x4_t lo = vmlaq_u32(vhalf, vmovl_u16(vget_low_u16(s16)), vmax);
+        uint32x4_t hi = vmlaq_u32(vhalf, vmovl_u16(vget_high_u16(s16)), vmax);
+        lo = vshrq_n_u32(vaddq_u32(vaddq_u32(lo, one), vshrq_n_u32(lo, 16)), 16);
+        hi = vshrq_n_u32(vaddq_u32(vaddq_u32(hi, one), vshrq_n_u32(hi, 16)), 16);
+        vst1q_u32(ix + 0, vminq_u32(lo, vmax));
+        vst1q_u32(ix + 4, vminq_u32(hi, vmax));
+        for (int k = 0; k < 8; ++k) {
+            dst[i + k] = table[ix[k]];
+        }
+    }
+    displayGammaScalar(src + i, dst + i, count - i, table, table_max);
+}
+
+PixelKernels makeNeon() noexcept {
+    PixelKernels k;
+    k.name_ = "neon";
+    k.subtract_ = subtractNeon;
+    k.iso_scale_ = isoScaleNeon;
+    k.balance_colors_ = balanceColorsNeon;
+    k.display_gamma_ = displayGammaNeon;
+    return k;
+}
+
+#endif /* ZWO_HAVE_NEON */
+
+}
+
+const PixelKernels *PixelKernels::getScalar() noexcept {
+    static const PixelKernels kScalar = makeScalar();
+    return &kScalar;
+}
+
+const PixelKernels *PixelKernels::get() noexcept {
+#if ZWO_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        static const PixelKernels kAvx2 = makeAvx2();
+        return &kAvx2;
+    }
+#endif
+#if ZWO_HAVE_NEON
+    static const PixelKernels kNeon = makeNeon();
+    return &kNeon;
+#endif
+    return getScalar();
+}
@@ -0,0 +1,62 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+per-pixel kernels used by the window thread.
+
+the scalar versions are the reference.
+the vector versions must produce identical results.
+the fastest version the cpu supports is chosen at run time.
+**/
+
+#pragma once
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class PixelKernels {
+public:
+    PixelKernels() noexcept = default;
+    PixelKernels(const PixelKernels &) = default;
+    ~PixelKernels() noexcept = default;
+
+    /**
+    the vector display gamma kernel reads 4 bytes at a time from the table.
+    the table must be allocated this many bytes larger than needed.
+    **/
+    static const int kTablePadding = 3;
+
+    /** name of the implementation for the log. **/
+    const char *name_ = nullptr;
+
+    /**
+    subtract black from count components.
+    black is already scaled to the exposure time.
+    results are pinned to 0.
+    returns the maximum corrected value.
+    **/
+    int (*subtract_)(agm::uint16 *img, const agm::uint16 *black, int count) = nullptr;
+
+    /** scale count components by iso/100 and pin to 65535. **/
+    void (*iso_scale_)(agm::uint16 *ptr, int count, int iso) = nullptr;
+
+    /**
+    scale the red and blue components of npixels BGR pixels.
+    caution: there's no pinning.
+    values over 65535 wrap when stored.
+    **/
+    void (*balance_colors_)(agm::uint16 *bgr, int npixels, double red, double blue) = nullptr;
+
+    /**
+    scale count 16 bit components to the size of the gamma table.
+    set the destination 8 bit values from the table.
+    **/
+    void (*display_gamma_)(const agm::uint16 *src, agm::uint8 *dst, int count, const agm::uint8 *table, int table_max) = nullptr;
+
+    /** the fastest kernels for this cpu. **/
+    static const PixelKernels *get() noexcept;
+
+    /** the reference kernels. **/
+    static const PixelKernels *getScalar() noexcept;
+};
@@ -0,0 +1,193 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+outlier rejecting stacks.
+
+the loops are written so the compiler can vectorize them.
+the inputs are 16 bit. so float has plenty of precision.
+**/
+
+#include <algorithm>
+#include <cmath>
+
+#include "robust_stack.h"
+
+
+namespace {
+/** don't reject anything until the variance means something. **/
+const int kMinSamples = 3;
+/**
+components that were identical so far have no variance.
+saturated or black for example.
+allow at least this much deviation.
+**/
+const float kMinDeviation = 256.0f;
+/**
+the step that converges fastest for a normal distribution is 1.25 sigma / n.
+sigma is roughly 1.25 times the mean absolute deviation.
+**/
+const float kMedianGain = 1.5f;
+/** outliers would inflate the mean absolute deviation. so clip them. **/
+const float kMaxDeviation = 3.0f;
+}
+
+void RobustStack::allocate(
+    Mode mode,
+    int ncomponents
+) noexcept {
+    mode_ = mode;
+    ncomponents_ = ncomponents;
+    estimate_.assign(ncomponents, 0.0f);
+    spread_.assign(ncomponents, 0.0f);
+    if (mode == Mode::kSigmaClip) {
+        count_.assign(ncomponents, 0);
+    } else {
+        count_ = std::vector<agm::uint16>();
+    }
+}
+
+void RobustStack::release() noexcept {
+    ncomponents_ = 0;
+    estimate_ = std::vector<float>();
+    spread_ = std::vector<float>();
+    count_ = std::vector<agm::uint16>();
+}
+
+void RobustStack::add(
+    const agm::uint16 *src,
+    int offset,
+    int count,
+    int nframes,
+    double kappa
+) noexcept {
+    if (mode_ == Mode::kSigmaClip) {
+        addSigmaClip(src, offset, count, kappa);
+    } else {
+        addMedian(src, offset, count, nframes);
+    }
+}
+
+int RobustStack::getMax(
+    int offset,
+    int count
+) const noexcept {
+    auto est = estimate_.data() + offset;
+    float mx = 0.0f;
+    for (int i = 0; i < count; ++i) {
+        mx = std::max(mx, est[i]);
+    }
+    return (int) std::ceil(mx);
+}
+
+/**
+welford's method.
+a rejected sample leaves the component unchanged.
+**/
+void RobustStack::addSigmaClip(
+    const agm::uint16 *src,
+    int offset,
+    int count,
+    double kappa
+) noexcept {
+    float kappa2 = float(kappa * kappa);
+    float min_dev2 = kMinDeviation * kMinDeviation;
+    auto mean = estimate_.data() + offset;
+    auto m2 = spread_.data() + offset;
+    auto nsamples = count_.data() + offset;
+    for (int i = 0; i < count; ++i) {
+        float x = src[i];
+        float mu = mean[i];
+        float delta = x - mu;
+        int n = nsamples[i];
+
+        /**
+        reject the sample if delta^2 > kappa^2 * m2 / (n - 1).
+        without dividing.
+        **/
+        float dev2 = delta * delta;
+        float limit = std::max(kappa2 * m2[i], min_dev2 * float(n - 1));
+        bool reject = (n >= kMinSamples && dev2 * float(n - 1) > limit);
+        if (reject == false) {
+            n = std::min(n + 1, 65535);
+            mu += delta / float(n);
+            m2[i] += delta * (x - mu);
+            mean[i] = mu;
+            nsamples[i] = n;
+        }
+    }
+}
+
+/**
+robbins monro.
+the estimate moves a step towards the sample.
+the first frame is the initial estimate.
+**/
+void RobustStack::addMedian(
+    const agm::uint16 *src,
+    int offset,
+    int count,
+    int nframes
+) noexcept {
+    auto median = estimate_.data() + offset;
+    auto mad = spread_.data() + offset;
+    if (nframes <= 1) {
+        for (int i = 0; i < count; ++i) {
+            float x = src[i];
+            median[i] = x;
+            mad[i] = 0.0f;
+        }
+        return;
+    }
+
+    float inv_n = 1.0f / float(nframes);
+    float gain = kMedianGain * inv_n;
+    /** clip once the deviation means something. **/
+    bool clip = (nframes > kMinSamples);
+    for (int i = 0; i < count; ++i) {
+        float x = src[i];
+        float m = median[i];
+        float dev = x - m;
+        float d = mad[i];
+        float absdev = std::abs(dev);
+        /** a spread of 0 would freeze the estimate. floor it like the sigma clip. **/
+        if (clip) {
+            absdev = std::min(absdev, std::max(kMaxDeviation * d, kMinDeviation));
+        }
+        d += (absdev - d) * inv_n;
+        float sign = float(dev > 0.0f) - float(dev < 0.0f);
+        m += sign * gain * std::max(d, kMinDeviation);
+        median[i] = m;
+        mad[i] = d;
+    }
+}
+
+void RobustStack::render(
+    agm::uint16 *dst,
+    int offset,
+    int count,
+    int mx
+) const noexcept {
+    /** avoid dividing by zero when the stack is all black. **/
+    float scale = 65535.0f / float(std::max(mx, 1));
+    auto est = estimate_.data() + offset;
+    for (int i = 0; i < count; ++i) {
+        float px = est[i] * scale + 0.5f;
+        px = std::max(0.0f, std::min(px, 65535.0f));
+        dst[i] = (agm::uint16) px;
+    }
+}
+
+void RobustStack::exportFixed(
+    agm::int32 *dst,
+    int offset,
+    int count
+) const noexcept {
+    auto est = estimate_.data() + offset;
+    for (int i = 0; i < count; ++i) {
+        float px = est[i] * float(kFixedScale) + 0.5f;
+        px = std::max(0.0f, px);
+        dst[i] = (agm::int32) px;
+    }
+}
@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+outlier rejecting stacks.
+
+satellites, planes, and flickering hot pixels go straight into a sum.
+these stacks reject them.
+and they never keep more than one frame.
+the state per component is fixed no matter how many frames are stacked.
+
+sigma clip:
+a running mean and variance per component using welford's method.
+a sample farther than kappa sigma from the mean is rejected.
+10 bytes per component.
+
+median:
+a stochastic approximation of the median per component.
+each sample nudges the estimate towards itself.
+the step is proportional to the running mean absolute deviation.
+and shrinks as 1/n.
+8 bytes per component.
+**/
+
+#pragma once
+
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class RobustStack {
+public:
+    RobustStack() noexcept = default;
+    RobustStack(const RobustStack &) = delete;
+    ~RobustStack() noexcept = default;
+
+    enum class Mode {
+        kSigmaClip,
+        kMedian
+    };
+
+    /** exported estimates are fixed point with this many steps per unit. **/
+    static const int kFixedScale = 256;
+
+    /** allocate and clear the stack. **/
+    void allocate(Mode mode, int ncomponents) noexcept;
+
+    /** free the memory. **/
+    void release() noexcept;
+
+    /**
+    add count components starting at offset.
+    nframes counts this frame. so it's 1 for the first frame.
+    **/
+    void add(const agm::uint16 *src, int offset, int count, int nframes, double kappa) noexcept;
+
+    /** get the maximum estimate rounded up. **/
+    int getMax(int offset, int count) const noexcept;
+
+    /** scale the estimates so mx is 65535. **/
+    void render(agm::uint16 *dst, int offset, int count, int mx) const noexcept;
+
+    /** copy the estimates to fixed point. **/
+    void exportFixed(agm::int32 *dst, int offset, int count) const noexcept;
+
+    int getComponents() const noexcept {
+        return ncomponents_;
+    }
+
+private:
+    Mode mode_ = Mode::kSigmaClip;
+    int ncomponents_ = 0;
+    /** the mean or the median. **/
+    std::vector<float> estimate_;
+    /** the sum of squared differences or the mean absolute deviation. **/
+    std::vector<float> spread_;
+    /** samples accepted per component. sigma clip only. **/
+    std::vector<agm::uint16> count_;
+
+    void addSigmaClip(const agm::uint16 *src, int offset, int count, double kappa) noexcept;
+    void addMedian(const agm::uint16 *src, int offset, int count, int nframes) noexcept;
+};
@@ -0,0 +1,408 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+register frames to a reference frame using the stars.
+
+stars are local maxima of the luminance image well above the local background.
+single hot pixels are rejected because they're too sharp.
+the brightest stars are kept.
+
+matching tries translations first.
+every pairing of a bright frame star with a bright reference star is a guess.
+if that fails then pairs of stars the same distance apart give guesses
+with rotation.
+the best guess is refined with a least squares fit to the matched stars.
+**/
+
+#include <algorithm>
+#include <cmath>
+
+#include "star_registration.h"
+
+
+namespace {
+    /** size of the box used to estimate the local background. **/
+    const int kBackgroundSize = 25;
+    /** stars must be this many standard deviations above the background. **/
+    const double kThresholdSigmas = 5.0;
+    /** reject candidates with more than this fraction of the flux in one pixel. **/
+    const double kMaxSharpness = 0.85;
+    /** matched stars must be within this many full resolution pixels. **/
+    const double kMatchTolerance = 3.0;
+    /** the number of bright stars used to make guesses. **/
+    const int kGuessStars = 12;
+    /** pairs of stars closer than this don't give a good angle. **/
+    const double kMinPairDistance = 40.0;
+    /** fraction of the stars that must match to accept a translation guess. **/
+    const double kGoodMatchFraction = 0.6;
+
+    double normalizeAngle(
+        double angle
+    ) noexcept {
+        while (angle > M_PI) {
+            angle -= 2.0 * M_PI;
+        }
+        while (angle < -M_PI) {
+            angle += 2.0 * M_PI;
+        }
+        return angle;
+    }
+}
+
+void StarRegistration::reset() noexcept {
+    reference_.clear();
+    have_reference_ = false;
+}
+
+StarRegistration::Result StarRegistration::measure(
+    const cv::Mat &bayer,
+    WorkerPool *pool,
+    Transform &xform
+) noexcept {
+    xform = Transform();
+    detect(bayer, pool);
+
+    /** the first frame with enough stars is the reference. **/
+    if (have_reference_ == false) {
+        if (int(stars_.size()) < kMinStars) {
+            return Result::kNoReference;
+        }
+        reference_ = stars_;
+        have_reference_ = true;
+        xform.matched_ = stars_.size();
+        return Result::kReference;
+    }
+
+    bool success = match(xform);
+    if (success == false) {
+        return Result::kNoMatch;
+    }
+    return Result::kAligned;
+}
+
+void StarRegistration::getInverseMatrix(
+    const Transform &xform,
+    int y0,
+    double m[6]
+) noexcept {
+    /** the inverse of a rotation is its transpose. **/
+    double c = std::cos(xform.angle_);
+    double s = std::sin(xform.angle_);
+    m[0] = c;
+    m[1] = s;
+    m[2] = - c * xform.dx_ - s * xform.dy_;
+    m[3] = - s;
+    m[4] = c;
+    m[5] = s * xform.dx_ - c * xform.dy_;
+
+    /** the destination row 0 is reference row y0. **/
+    m[2] += m[1] * y0;
+    m[5] += m[4] * y0;
+}
+
+const std::vector<StarRegistration::Star> &StarRegistration::detect(
+    const cv::Mat &bayer,
+    WorkerPool *pool
+) noexcept {
+    downsample(bayer, pool);
+    findStars();
+    return stars_;
+}
+
+/** sum 4x4 blocks of the bayer image into the luminance image. **/
+void StarRegistration::downsample(
+    const cv::Mat &bayer,
+    WorkerPool *pool
+) noexcept {
+    int lum_wd = bayer.cols / kDownsample;
+    int lum_ht = bayer.rows / kDownsample;
+    lum_.create(lum_ht, lum_wd, CV_32FC1);
+
+    int bayer_wd = bayer.cols;
+    auto src = (const agm::uint16 *) bayer.data;
+    auto dst = (float *) lum_.data;
+    int band = pool->getBandRows(lum_ht, 1);
+    pool->run(lum_ht, band, [=](int, int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            auto row = src + kDownsample * y * bayer_wd;
+            auto out = dst + y * lum_wd;
+            for (int x = 0; x < lum_wd; ++x) {
+                int sum = 0;
+                for (int k = 0; k < kDownsample; ++k) {
+                    auto p = row + k * bayer_wd + kDownsample * x;
+                    for (int i = 0; i < kDownsample; ++i) {
+                        sum += p[i];
+                    }
+                }
+                out[x] = float(sum);
+            }
+        }
+    });
+}
+
+void StarRegistration::findStars() noexcept {
+    stars_.clear();
+    int wd = lum_.cols;
+    int ht = lum_.rows;
+    if (wd < 8 || ht < 8) {
+        return;
+    }
+
+    cv::blur(lum_, background_, cv::Size(kBackgroundSize, kBackgroundSize));
+
+    /** estimate the noise from a sample of the pixels. **/
+    auto lum = (const float *) lum_.data;
+    auto bkg = (const float *) background_.data;
+    int sz = wd * ht;
+    double sum = 0.0;
+    double sum2 = 0.0;
+    int n = 0;
+    for (int i = 0; i < sz; i += 7) {
+        double d = lum[i] - bkg[i];
+        sum += d;
+        sum2 += d * d;
+        ++n;
+    }
+    double mean = sum / n;
+    double sigma = std::sqrt(std::max(sum2 / n - mean * mean, 1.0));
+    double threshold = kThresholdSigmas * sigma;
+
+    /** find the local maxima above the threshold. **/
+    for (int y = 2; y < ht - 2; ++y) {
+        for (int x = 2; x < wd - 2; ++x) {
+            int idx = y * wd + x;
+            double d = lum[idx] - bkg[idx];
+            if (d <= threshold) {
+                continue;
+            }
+
+            /** ties go to the first pixel. **/
+            bool is_max = true;
+            double local = 0.0;
+            for (int dy = -1; dy <= 1 && is_max; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int k = idx + dy * wd + dx;
+                    double dk = lum[k] - bkg[k];
+                    if (k < idx && dk >= d) {
+                        is_max = false;
+                        break;
+                    }
+                    if (k > idx && dk > d) {
+                        is_max = false;
+                        break;
+                    }
+                    local += std::max(dk, 0.0);
+                }
+            }
+            if (is_max == false) {
+                continue;
+            }
+            if (d > kMaxSharpness * local) {
+                continue;
+            }
+
+            /** centroid of the 5x5 block. **/
+            double flux = 0.0;
+            double cx = 0.0;
+            double cy = 0.0;
+            for (int dy = -2; dy <= 2; ++dy) {
+                for (int dx = -2; dx <= 2; ++dx) {
+                    int k = idx + dy * wd + dx;
+                    double dk = std::max(double(lum[k] - bkg[k]), 0.0);
+                    flux += dk;
+                    cx += dk * dx;
+                    cy += dk * dy;
+                }
+            }
+
+            /** convert to full resolution. the block center is 1.5 pixels in. **/
+            Star star;
+            star.x_ = (x + cx / flux) * kDownsample + 0.5 * (kDownsample - 1);
+            star.y_ = (y + cy / flux) * kDownsample + 0.5 * (kDownsample - 1);
+            star.flux_ = flux;
+            stars_.push_back(star);
+        }
+    }
+
+    /** keep the brightest. **/
+    std::sort(stars_.begin(), stars_.end(), [](const Star &a, const Star &b) {
+        return a.flux_ > b.flux_;
+    });
+    if (int(stars_.size()) > kMaxStars) {
+        stars_.resize(kMaxStars);
+    }
+}
+
+bool StarRegistration::match(
+    Transform &xform
+) noexcept {
+    int nf = stars_.size();
+    int nr = reference_.size();
+    if (nf < kMinStars) {
+        return false;
+    }
+    int ngf = std::min(nf, kGuessStars);
+    int ngr = std::min(nr, kGuessStars);
+    int good = std::max(kMinStars, int(kGoodMatchFraction * std::min(nf, nr)));
+
+    /** guess translations. **/
+    Transform best;
+    int best_count = 0;
+    for (int i = 0; i < ngf; ++i) {
+        for (int j = 0; j < ngr; ++j) {
+            Transform guess;
+            guess.dx_ = reference_[j].x_ - stars_[i].x_;
+            guess.dy_ = reference_[j].y_ - stars_[i].y_;
+            int count = countInliers(guess, kMatchTolerance, nullptr);
+            if (count > best_count) {
+                best = guess;
+                best_count = count;
+            }
+        }
+    }
+
+    /** guess rotations from pairs of stars the same distance apart. **/
+    if (best_count < good) {
+        for (int a = 0; a < ngr; ++a) {
+            for (int b = a + 1; b < ngr; ++b) {
+                double rx = reference_[b].x_ - reference_[a].x_;
+                double ry = reference_[b].y_ - reference_[a].y_;
+                double rd = std::sqrt(rx * rx + ry * ry);
+                if (rd < kMinPairDistance) {
+                    continue;
+                }
+                for (int c = 0; c < ngf; ++c) {
+                    for (int d = 0; d < ngf; ++d) {
+                        if (c == d) {
+                            continue;
+                        }
+                        double fx = stars_[d].x_ - stars_[c].x_;
+                        double fy = stars_[d].y_ - stars_[c].y_;
+                        double fd = std::sqrt(fx * fx + fy * fy);
+                        if (std::abs(fd - rd) > 2.0 * kMatchTolerance) {
+                            continue;
+                        }
+                        Transform guess;
+                        guess.angle_ = normalizeAngle(std::atan2(ry, rx) - std::atan2(fy, fx));
+                        double cs = std::cos(guess.angle_);
+                        double sn = std::sin(guess.angle_);
+                        guess.dx_ = reference_[a].x_ - (cs * stars_[c].x_ - sn * stars_[c].y_);
+                        guess.dy_ = reference_[a].y_ - (sn * stars_[c].x_ + cs * stars_[c].y_);
+                        int count = countInliers(guess, kMatchTolerance, nullptr);
+                        if (count > best_count) {
+                            best = guess;
+                            best_count = count;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (best_count < kMinStars) {
+        return false;
+    }
+
+    /** refine with all of the matched stars. twice. **/
+    std::vector<int> pairs;
+    for (int i = 0; i < 2; ++i) {
+        countInliers(best, kMatchTolerance, &pairs);
+        refine(best, pairs);
+    }
+    best.matched_ = countInliers(best, kMatchTolerance, nullptr);
+    if (best.matched_ < kMinStars) {
+        return false;
+    }
+    xform = best;
+    return true;
+}
+
+/**
+count the frame stars that land near a reference star.
+optionally return the pairs of matched frame and reference indexes.
+**/
+int StarRegistration::countInliers(
+    const Transform &xform,
+    double tolerance,
+    std::vector<int> *pairs
+) const noexcept {
+    if (pairs) {
+        pairs->clear();
+    }
+    double cs = std::cos(xform.angle_);
+    double sn = std::sin(xform.angle_);
+    double tol2 = tolerance * tolerance;
+    int count = 0;
+    int nf = stars_.size();
+    int nr = reference_.size();
+    for (int i = 0; i < nf; ++i) {
+        double x = cs * stars_[i].x_ - sn * stars_[i].y_ + xform.dx_;
+        double y = sn * stars_[i].x_ + cs * stars_[i].y_ + xform.dy_;
+        int nearest = -1;
+        double nearest2 = tol2;
+        for (int j = 0; j < nr; ++j) {
+            double dx = reference_[j].x_ - x;
+            double dy = reference_[j].y_ - y;
+            double d2 = dx * dx + dy * dy;
+            if (d2 < nearest2) {
+                nearest = j;
+                nearest2 = d2;
+            }
+        }
+        if (nearest >= 0) {
+            ++count;
+            if (pairs) {
+                pairs->push_back(i);
+                pairs->push_back(nearest);
+            }
+        }
+    }
+    return count;
+}
+
+/** least squares rotation and translation of the matched pairs. **/
+void StarRegistration::refine(
+    Transform &xform,
+    const std::vector<int> &pairs
+) const noexcept {
+    int n = pairs.size() / 2;
+    if (n < 2) {
+        return;
+    }
+
+    double fcx = 0.0;
+    double fcy = 0.0;
+    double rcx = 0.0;
+    double rcy = 0.0;
+    for (int i = 0; i < n; ++i) {
+        auto &f = stars_[pairs[2*i]];
+        auto &r = reference_[pairs[2*i+1]];
+        fcx += f.x_;
+        fcy += f.y_;
+        rcx += r.x_;
+        rcy += r.y_;
+    }
+    fcx /= n;
+    fcy /= n;
+    rcx /= n;
+    rcy /= n;
+
+    double a = 0.0;
+    double b = 0.0;
+    for (int i = 0; i < n; ++i) {
+        auto &f = stars_[pairs[2*i]];
+        auto &r = reference_[pairs[2*i+1]];
+        double fx = f.x_ - fcx;
+        double fy = f.y_ - fcy;
+        double rx = r.x_ - rcx;
+        double ry = r.y_ - rcy;
+        a += fx * rx + fy * ry;
+        b += fx * ry - fy * rx;
+    }
+    xform.angle_ = std::atan2(b, a);
+    double cs = std::cos(xform.angle_);
+    double sn = std::sin(xform.angle_);
+    xform.dx_ = rcx - (cs * fcx - sn * fcy);
+    xform.dy_ = rcy - (sn * fcx + cs * fcy);
+}
@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+register frames to a reference frame using the stars.
+
+the stars are found in a luminance image 1/4 the size of the bayer image.
+each pixel is the sum of a 4x4 block of bayer pixels.
+which is cheap and averages away the bayer pattern.
+
+the first frame after reset is the reference.
+later frames are matched to it with a translation plus rotation.
+**/
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <aggiornamento/aggiornamento.h>
+
+#include <shared/worker_pool.h>
+
+
+class StarRegistration {
+public:
+    StarRegistration() noexcept = default;
+    StarRegistration(const StarRegistration &) = delete;
+    ~StarRegistration() noexcept = default;
+
+    /** a star in full resolution pixel coordinates. **/
+    class Star {
+    public:
+        double x_ = 0.0;
+        double y_ = 0.0;
+        double flux_ = 0.0;
+    };
+
+    /**
+    maps frame coordinates to reference coordinates.
+    xr = cos(angle) * xf - sin(angle) * yf + dx
+    yr = sin(angle) * xf + cos(angle) * yf + dy
+    **/
+    class Transform {
+    public:
+        double angle_ = 0.0;
+        double dx_ = 0.0;
+        double dy_ = 0.0;
+        int matched_ = 0;
+    };
+
+    enum class Result {
+        /** this frame is the new reference. **/
+        kReference,
+        /** the transform is valid. **/
+        kAligned,
+        /** the reference doesn't have enough stars to align anything. **/
+        kNoReference,
+        /** this frame doesn't match the reference. **/
+        kNoMatch
+    };
+
+    /** the next frame becomes the reference. **/
+    void reset() noexcept;
+
+    /** find the stars in the bayer image and match them to the reference. **/
+    Result measure(const cv::Mat &bayer, WorkerPool *pool, Transform &xform) noexcept;
+
+    /** find the stars in the bayer image without matching them. brightest first. **/
+    const std::vector<Star> &detect(const cv::Mat &bayer, WorkerPool *pool) noexcept;
+
+    /**
+    get the 2x3 matrix that maps reference coordinates to frame coordinates.
+    for cv::warpAffine with cv::WARP_INVERSE_MAP.
+    the destination starts at row y0 of the reference.
+    **/
+    static void getInverseMatrix(const Transform &xform, int y0, double m[6]) noexcept;
+
+    const std::vector<Star> &getStars() const noexcept {
+        return stars_;
+    }
+
+private:
+    static const int kDownsample = 4;
+    static const int kMaxStars = 40;
+    static const int kMinStars = 4;
+
+    std::vector<Star> reference_;
+    bool have_reference_ = false;
+    std::vector<Star> stars_;
+    cv::Mat lum_;
+    cv::Mat background_;
+
+    void downsample(const cv::Mat &bayer, WorkerPool *pool) noexcept;
+    void findStars() noexcept;
+    bool match(Transform &xform) noexcept;
+    int countInliers(const Transform &xform, double tolerance, std::vector<int> *pairs) const noexcept;
+    void refine(Transform &xform, const std::vector<int> &pairs) const noexcept;
+};
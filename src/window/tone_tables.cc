@@ -0,0 +1,106 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+lookup tables for the 16 bit tone stages of the window thread.
+
+the tables use exactly the same math as the stages they replace.
+so the results are identical.
+**/
+
+#include <algorithm>
+#include <cmath>
+
+#include "tone_tables.h"
+
+
+const agm::uint16 *ToneTables::getPower(
+    double gamma
+) noexcept {
+    if (gamma == 1.0) {
+        return nullptr;
+    }
+    if (gamma <= 0) {
+        return nullptr;
+    }
+
+    /** rebuild the table only when gamma changes. **/
+    if (power_.empty() || power_gamma_ != gamma) {
+        power_.resize(kTableSize);
+        for (int i = 0; i < kTableSize; ++i) {
+            double x = double(i) / 65535.0;
+            x = std::pow(x, gamma);
+            x *= 65535.0;
+            int p = (int) std::round(x);
+            p = std::max(0, std::min(p, 65535));
+            power_[i] = p;
+        }
+        power_gamma_ = gamma;
+    }
+    return power_.data();
+}
+
+void ToneTables::update(
+    int iso,
+    double gamma,
+    double red,
+    double blue
+) noexcept {
+    if (channels_valid_
+    &&  channels_iso_ == iso
+    &&  channels_gamma_ == gamma
+    &&  channels_red_ == red
+    &&  channels_blue_ == blue) {
+        return;
+    }
+    channels_valid_ = true;
+    channels_iso_ = iso;
+    channels_gamma_ = gamma;
+    channels_red_ = red;
+    channels_blue_ = blue;
+
+    bool do_iso = (iso != 100 && iso > 0);
+    auto power = getPower(gamma);
+    for (int c = 0; c < 3; ++c) {
+        channels_[c].resize(kTableSize);
+    }
+    auto tblb = channels_[0].data();
+    auto tblg = channels_[1].data();
+    auto tblr = channels_[2].data();
+    for (int i = 0; i < kTableSize; ++i) {
+        /** iso linear scale. **/
+        int p = i;
+        if (do_iso) {
+            p = p * iso / 100;
+            p = std::min(p, 65535);
+        }
+
+        /** gamma power scale. **/
+        if (power) {
+            p = power[p];
+        }
+
+        /** balance colors. caution: red and blue wrap when stored. **/
+        int r = std::round(p * red);
+        int b = std::round(p * blue);
+        tblb[i] = b;
+        tblg[i] = p;
+        tblr[i] = r;
+    }
+}
+
+void ToneTables::apply(
+    agm::uint16 *bgr,
+    int npixels
+) const noexcept {
+    auto tblb = channels_[0].data();
+    auto tblg = channels_[1].data();
+    auto tblr = channels_[2].data();
+    for (int i = 0; i < npixels; ++i) {
+        bgr[0] = tblb[bgr[0]];
+        bgr[1] = tblg[bgr[1]];
+        bgr[2] = tblr[bgr[2]];
+        bgr += 3;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2012-2024 tim cotter. All rights reserved.
+*/
+
+/**
+lookup tables for the 16 bit tone stages of the window thread.
+
+the power table replaces std::pow per component.
+it is rebuilt only when gamma changes.
+
+iso, gamma, and color balance are all functions of one component.
+so they fold into one table per BGR channel.
+the channel tables are rebuilt only when one of them changes.
+**/
+
+#pragma once
+
+#include <vector>
+
+#include <aggiornamento/aggiornamento.h>
+
+
+class ToneTables {
+public:
+    ToneTables() noexcept = default;
+    ToneTables(const ToneTables &) = delete;
+    ~ToneTables() noexcept = default;
+
+    static const int kTableSize = 65536;
+
+    /**
+    get the power table for gamma.
+    returns nullptr if gamma does nothing.
+    **/
+    const agm::uint16 *getPower(double gamma) noexcept;
+
+    /**
+    fold iso, gamma, and color balance into the channel tables.
+    iso 100 and gamma 1.0 do nothing.
+    **/
+    void update(int iso, double gamma, double red, double blue) noexcept;
+
+    /** replace npixels BGR components with their channel table values. **/
+    void apply(agm::uint16 *bgr, int npixels) const noexcept;
+
+private:
+    std::vector<agm::uint16> power_;
+    double power_gamma_ = 0.0;
+
+    std::vector<agm::uint16> channels_[3];
+    bool channels_valid_ = false;
+    int channels_iso_ = 0;
+    double channels_gamma_ = 0.0;
+    double channels_red_ = 0.0;
+    double channels_blue_ = 0.0;
+};
@@ -6,9 +6,13 @@ Copyright (C) 2012-2024 tim cotter. All rights reserved.
 display images in a window.
 **/
 
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
 #include <opencv2/opencv.hpp>
+#include <opencv2/core/ocl.hpp>
 #include <opencv2/imgproc.hpp>
-#include <tiffio.h>
 #include <X11/Xlib.h>
 
 #include <aggiornamento/aggiornamento.h>
@@ -16,106 +20,327 @@ display images in a window.
 #include <aggiornamento/master.h>
 #include <aggiornamento/thread.h>
 
-#include <shared/image_double_buffer.h>
+#include <menu/ioptron.h>
+#include <shared/frame_pool.h>
+#include <shared/image_ring.h>
+#include <shared/perf_stats.h>
+#include <shared/save_queue.h>
 #include <shared/settings_buffer.h>
+#include <shared/worker_pool.h>
+
+#include "calibration.h"
+#include "gl_display.h"
+#include "histogram.h"
+#include "pixel_kernels.h"
+#include "robust_stack.h"
+#include "star_registration.h"
+#include "tone_tables.h"
 
 
 namespace {
 class WindowThread : public agm::Thread {
 public:
     /** share data with the capture thread. **/
-    ImageDoubleBuffer *image_double_buffer_ = nullptr;
+    ImageRing *image_ring_ = nullptr;
+    int ring_consumer_ = -1;
     ImageBuffer *img_ = nullptr;
+    /** share data with the saver thread. **/
+    SaveQueue *save_queue_ = nullptr;
     /** share data with the menu thread. **/
     SettingsBuffer *settings_buffer_ = nullptr;
+    SettingsSnapshot settings_;
     bool accumulate_ = false;
     bool capture_black_ = false;
     double balance_red_ = 1.0;
     double balance_blue_ = 1.0;
     int exposure_ = 100;
     bool show_focus_ = false;
+    FocusMetric focus_metric_ = FocusMetric::kStars;
     double gamma_ = 1.0;
     bool auto_iso_ = false;
     int iso_ = 100;
     bool show_circles_ = false;
     bool show_histogram_ = false;
     bool show_fps_ = false;
+    bool fused_pipeline_ = true;
+    bool align_stack_ = true;
+    DebayerMode debayer_mode_ = DebayerMode::kBilinear;
+    StackMode stack_mode_ = StackMode::kSum;
+    double stack_kappa_ = 2.5;
+    bool calibrate_ = true;
+    std::string master_kind_;
+    int master_frames_ = 0;
     std::string save_file_name_;
     std::string raw_file_name_;
 
     /** our fields. **/
     cv::String win_name_ = "ZWO ASI";
+    std::string calibration_dir_ = "calibration";
     bool first_image_ = false;
+    ImageBuffer frame_;
+    /** the size of the raw image. **/
+    int bayer_width_ = 0;
+    int bayer_height_ = 0;
+    /** the size of the debayered image. half the raw size for superpixels. **/
+    int rgb_width_ = 0;
+    int rgb_height_ = 0;
+    /** how this frame is debayered. **/
+    DebayerMode frame_debayer_ = DebayerMode::kBilinear;
+    /** saves of single frames use a slower better debayer. **/
+    bool quality_debayer_ = false;
+    bool warned_opencl_ = false;
+    cv::UMat bayer_umat_;
+    cv::UMat rgb16_umat_;
     cv::Mat rgb16_;
     cv::Mat black_;
+    /** black scaled to the exposure time. **/
+    cv::Mat black_scaled_;
+    int black_scaled_exposure_ = 0;
+    Calibration calibration_;
     cv::Mat rgb32_;
     cv::Mat cropped_;
     cv::Mat gray_;
     cv::Mat laplace_;
+    /** the full size 8 bit image. only converted for saves. **/
     cv::Mat rgb8_gamma_;
+    /** the 8 bit image shown in the window without opengl. **/
+    cv::Mat rgb8_display_;
+    /** opengl shows the view if it can. highgui if it can't. **/
+    GlDisplay gl_display_;
+    bool use_gl_ = false;
+    /** the 16 bit view. written straight into the opengl buffer. **/
+    cv::Mat rgb16_view_;
+    std::vector<cv::Mat> band_line_;
+    std::vector<cv::Mat> band_rgb16_;
+    std::vector<cv::Mat> band_warp_;
+    WorkerPool *pool_ = nullptr;
+    std::vector<int> partial_max_;
+    Histogram histogram_;
+    /** the bin plotted in each column of the image. **/
+    std::vector<int> hist_columns_;
+    /** the plotted row for each log index. **/
+    std::vector<int> hist_rows_;
+    /** the plotted fraction of the height for each log index. **/
+    std::vector<float> hist_levels_;
+    std::vector<float> gl_levels_;
+    int hist_plot_height_ = 0;
     double base_stddev_ = 0.0;
     int gamma_max_ = 0;
     agm::uint8 *gamma_table_ = nullptr;
-    int *histr_ = nullptr;
-    int *histg_ = nullptr;
-    int *histb_ = nullptr;
+    const PixelKernels *kernels_ = nullptr;
+    ToneTables tone_tables_;
+    StarRegistration registration_;
+    StarRegistration::Transform align_xform_;
+    bool aligning_ = false;
+    RobustStack robust_stack_;
+    /** the mode of the current stack. **/
+    StackMode stacked_mode_ = StackMode::kSum;
     int nstacked_ = 0;
+    /** maximum of the bayer image after black is captured or subtracted. **/
+    int frame_max_ = 0;
+    /** maximum of the 32 bit stack sums or the robust estimates. **/
+    int stack_max_ = 0;
     agm::int64 fps_start_ = 0;
     int fps_count_ = 0;
     int display_width_ = 0;
     int display_height_ = 0;
+    int zoom_ = 0;
+    int pan_x_ = 0;
+    int pan_y_ = 0;
+    /** the debayered size the stack was allocated for. **/
+    int preview_width_ = 0;
+    int preview_height_ = 0;
+    /** the part of the 16 bit image that's shown. **/
     cv::Rect aoi_;
+    /** the view is the aoi shrunk or magnified by a whole number. **/
+    int view_shrink_ = 1;
+    int view_zoom_ = 1;
+    /** the size of the view before it's magnified. **/
+    int view_cols_ = 0;
+    int view_rows_ = 0;
+    /** where the time goes. **/
+    enum {
+        kTimeWait,
+        kTimeCopy,
+        kTimeFrame,
+        kTimeBlack,
+        kTimeDebayer,
+        kTimeBlur,
+        kTimeStack,
+        kTimeIso,
+        kTimeGamma,
+        kTimeStdRgb,
+        kTimeBalance,
+        kTimeFused,
+        kTimeHistogram,
+        kTimeCircles,
+        kTimeRender,
+        kTimeShow,
+        kTimeSave,
+        kTimeStages
+    };
+    PerfStats *perf_stats_ = nullptr;
+    LatencyHistogram *stage_times_[kTimeStages] = {nullptr};
+    /** the overlay shows the times since it was last updated. **/
+    bool show_perf_ = false;
+    agm::int64 perf_time_ = 0;
+    std::vector<LatencyHistogram *> perf_stages_;
+    std::vector<LatencyCounts> perf_before_;
+    std::vector<std::string> perf_lines_;
+    /** the overlay shows where the mount is pointing. from the polled status. **/
+    Ioptron *mount_ = nullptr;
+    /** the full size images share buffers with the saver thread. **/
+    FramePool *frame_pool_ = nullptr;
 
     WindowThread(
-        ImageDoubleBuffer *image_double_buffer,
-        SettingsBuffer *settings_buffer
+        ImageRing *image_ring,
+        SaveQueue *save_queue,
+        SettingsBuffer *settings_buffer,
+        Ioptron *mount,
+        PerfStats *perf_stats,
+        FramePool *frame_pool
     ) noexcept : agm::Thread("WindowThread") {
-        image_double_buffer_ = image_double_buffer;
+        image_ring_ = image_ring;
+        save_queue_ = save_queue;
+        /** we only want to display the newest frame. **/
+        ring_consumer_ = image_ring_->addConsumer(ImageRing::Policy::kLatest);
         settings_buffer_ = settings_buffer;
+        mount_ = mount;
+        perf_stats_ = perf_stats;
+        frame_pool_ = frame_pool;
     }
 
     virtual ~WindowThread() = default;
 
     virtual void begin() noexcept {
         LOG("WindowThread.");
+        img_ = &frame_;
+
+        static const char *kStageNames[kTimeStages] = {
+            "wait", "copy", "frame", "black", "debayer", "blur", "stack", "iso",
+            "gamma", "srgb", "balance", "fused", "histogram", "circles",
+            "render", "show", "save"
+        };
+        for (int i = 0; i < kTimeStages; ++i) {
+            stage_times_[i] = perf_stats_->addStage("WindowThread", kStageNames[i]);
+        }
+
         /**
-        capture thread starts with buffer 0.
-        window thread starts with buffer 1.
+        the full size images come from the pool.
+        opencv uses the allocator whenever it creates them.
+        release keeps the allocator. assigning an empty matrix doesn't.
         **/
-        img_ = image_double_buffer_->acquire(1);
+        cv::Mat *pooled[] = {
+            &frame_.bayer_, &rgb16_, &black_, &black_scaled_,
+            &rgb32_, &gray_, &laplace_, &rgb8_gamma_
+        };
+        for (auto mat : pooled) {
+            mat->allocator = frame_pool_;
+        }
 
-        /** create the window. **/
-        cv::namedWindow(win_name_);
-        cv::moveWindow(win_name_, 50, 50);
+        /**
+        create the window.
+        opengl applies display gamma and draws the overlays.
+        highgui needs the finished 8 bit image.
+        **/
+        use_gl_ = gl_display_.open(win_name_.c_str(), 50, 50);
+        if (use_gl_ == false) {
+            LOG("WindowThread Using HighGUI to show images.");
+            cv::namedWindow(win_name_);
+            cv::moveWindow(win_name_, 50, 50);
+        }
 
         /** initialize the gamma table. **/
         initGammaTable();
+        if (use_gl_) {
+            gl_display_.setGammaTable(gamma_table_, gamma_max_);
+        }
+
+        /** use the fastest pixel kernels this cpu supports. **/
+        kernels_ = PixelKernels::get();
+
+        LOG("WindowThread Using "<<kernels_->name_<<" pixel kernels.");
+
+        /** find the master calibration frames. **/
+        calibration_.load(calibration_dir_);
+
+        /**
+        process bands of rows on all of the cores.
+        opencv would start its own threads to debayer.
+        which would fight with ours.
+        **/
+        pool_ = WorkerPool::create();
+        int nthreads = pool_->getThreadCount();
+        band_rgb16_.resize(nthreads);
+        band_warp_.resize(nthreads);
+        band_line_.resize(nthreads);
+        partial_max_.resize(nthreads);
+        cv::setNumThreads(1);
+        LOG("WindowThread Using "<<nthreads<<" worker threads.");
 
         /** limit window size to display size. **/
         getDisplayResolution();
+
+        /** the capture thread can limit its roi to what we display. **/
+        {
+            SettingsLock lock(settings_buffer_);
+            settings_buffer_->display_width_ = display_width_;
+            settings_buffer_->display_height_ = display_height_;
+        }
     }
 
     /** run until we're told to stop. **/
     virtual void runOnce() noexcept {
-        /** we expect the first buffer to be empty. **/
-        int wd = img_->width_;
-        int ht = img_->height_;
-        if (img_->width_ == 0) {
-            LOG("WindowThread Received no image.");
-            img_ = image_double_buffer_->swap(img_);
+        /** wait for the newest frame. **/
+        if (copyLatestFrame() == false) {
             return;
         }
+        ScopedTimer frame_timer(stage_times_[kTimeFrame]);
+        int wd = img_->width_;
+        int ht = img_->height_;
+
+        /** copy all of the settings at once if they changed. **/
+        copySettings();
+        getCommand();
+
+        /** black is scaled by the exposure the frame was taken with. **/
+        exposure_ = std::max(img_->exposure_, 1);
 
-        /** note once we are getting images. **/
-        if (first_image_ == false) {
+        /** the debayer mode sets the size of everything downstream. **/
+        chooseDebayer();
+
+        /**
+        note once we are getting images.
+        and when the capture roi or binning changes the size.
+        **/
+        if (first_image_ == false || bayer_width_ != wd || bayer_height_ != ht) {
+            if (first_image_) {
+                /** the black image is the wrong size. **/
+                black_.release();
+                black_scaled_.release();
+            }
             first_image_ = true;
+            bayer_width_ = wd;
+            bayer_height_ = ht;
             LOG("WindowThread Received "<<wd<<"x"<<ht<<".");
+        }
+
+        /** the stack is the wrong size when the debayered size changes. **/
+        if (preview_width_ != rgb_width_ || preview_height_ != rgb_height_) {
+            preview_width_ = rgb_width_;
+            preview_height_ = rgb_height_;
+            rgb32_.release();
+            robust_stack_.release();
+            nstacked_ = 0;
+        }
 
-            /** finish initialization now that we know the capture size. **/
-            rgb8_gamma_ = cv::Mat(ht, wd, CV_8UC3);
+        /** set the area of interest. it's cheap. and zoom and pan can change. **/
+        setWindowCrop();
 
-            /** set the area of interest. **/
-            setWindowCrop();
+        /** the view is rendered straight into the opengl buffer. **/
+        if (use_gl_) {
+            auto ptr = gl_display_.mapImage(view_cols_, view_rows_, view_zoom_);
+            rgb16_view_ = cv::Mat(view_rows_, view_cols_, CV_16UC3, ptr);
         }
 
         /** display fps every 3 seconds. **/
@@ -128,7 +353,9 @@ public:
             auto elapsed = now - fps_start_;
             if (elapsed > 3000000LL) {
                 double fps = double(fps_count_) * 1000000.0 / double(elapsed);
-                LOG("WindowThread fps: "<<fps);
+                auto stats = image_ring_->getStats(ring_consumer_);
+                LOG("WindowThread fps: "<<fps<<" captured: "<<stats.published_
+                    <<" displayed: "<<stats.consumed_<<" dropped: "<<stats.dropped_);
                 fps_count_ = 0;
                 fps_start_ = 0;
             }
@@ -137,94 +364,267 @@ public:
             fps_count_ = 0;
         }
 
-        /** copy all of the settings at once. **/
-        copySettings();
-
         /** capture black. **/
         captureBlack();
 
-        /** subtract black. **/
-        subtractBlack();
+        /** build master calibration frames. **/
+        buildMaster();
 
         /**
-        convert the bayer image to rgb.
-        despite the name RGB the format in memory is BGR.
+        the fused pipeline produces the same image as the individual stages.
+        but it does all of the per-pixel stages one band of rows at a time.
+        the blur focus helper needs the entire debayered image before stacking.
+        so use the individual stages when it's enabled.
         **/
-        cv::cvtColor(img_->bayer_, rgb16_, cv::COLOR_BayerRG2RGB);
+        bool blur_focus = (show_focus_ && focus_metric_ == FocusMetric::kLaplacian);
+        bool display_done = false;
+        if (fused_pipeline_ && blur_focus == false) {
+            ScopedTimer timer(stage_times_[kTimeFused]);
+            display_done = fusedPipeline();
+        } else {
+            /** subtract black. **/
+            {
+                ScopedTimer timer(stage_times_[kTimeBlack]);
+                subtractBlack();
+            }
+
+            /**
+            convert the bayer image to rgb.
+            despite the name RGB the format in memory is BGR.
+            **/
+            {
+                ScopedTimer timer(stage_times_[kTimeDebayer]);
+                debayer();
+            }
 
-        /** check blurriness. **/
-        checkBlurriness();
+            /** check blurriness. **/
+            {
+                ScopedTimer timer(stage_times_[kTimeBlur]);
+                checkBlurriness();
+            }
 
-        /** stack images. **/
-        stackImages();
+            /** stack images. **/
+            {
+                ScopedTimer timer(stage_times_[kTimeStack]);
+                stackImages();
+            }
 
-        /** iso linear scale. **/
-        isoLinearScale();
+            /** iso linear scale. **/
+            {
+                ScopedTimer timer(stage_times_[kTimeIso]);
+                isoLinearScale();
+            }
 
-        /** gamma power scale. **/
-        gammaPowerScale();
+            /** gamma power scale. **/
+            {
+                ScopedTimer timer(stage_times_[kTimeGamma]);
+                gammaPowerScale();
+            }
 
-        /** adjust BGR colors. **/
-        convertStdRgb();
+            /** adjust BGR colors. **/
+            {
+                ScopedTimer timer(stage_times_[kTimeStdRgb]);
+                convertStdRgb();
+            }
 
-        /** balance colors. **/
-        balanceColors();
+            /** balance colors. **/
+            {
+                ScopedTimer timer(stage_times_[kTimeBalance]);
+                balanceColors();
+            }
+        }
 
         /** show histogram. **/
-        showHistogram();
+        {
+            ScopedTimer timer(stage_times_[kTimeHistogram]);
+            showHistogram();
+        }
 
         /** show collimation circlex. **/
-        showCollimationCircles();
+        {
+            ScopedTimer timer(stage_times_[kTimeCircles]);
+            showCollimationCircles();
+        }
 
-        /** apply display gamma. **/
-        applyDisplayGamma();
+        /** apply display gamma to what's shown. **/
+        if (display_done == false) {
+            ScopedTimer timer(stage_times_[kTimeRender]);
+            renderView();
+        }
 
-        /** crop it. **/
-        cv::Mat cropped = rgb8_gamma_(aoi_);
+        /** the stage times since the last update. **/
+        showPerfOverlay();
 
         /** show it. **/
-        cv::imshow(win_name_, cropped);
+        {
+            ScopedTimer timer(stage_times_[kTimeShow]);
+            if (use_gl_) {
+                gl_display_.unmapImage();
+                gl_display_.draw();
+            } else {
+                cv::imshow(win_name_, rgb8_display_);
+            }
+        }
 
         /** save the file. **/
-        saveImage();
+        {
+            ScopedTimer timer(stage_times_[kTimeSave]);
+            saveImage();
+        }
 
         /** check for user hits escape key. **/
-        int key = cv::waitKey(1);
+        int key = -1;
+        if (use_gl_) {
+            key = gl_display_.pollKey();
+        } else {
+            key = cv::waitKey(1);
+        }
         if (key == 27) {
             /** stop all threads. **/
             LOG("WindowThread stopping all threads.");
             agm::master::setDone();
         }
+    }
 
-        /** swap buffers with the capture thread. **/
-        img_ = image_double_buffer_->swap(img_);
+    /**
+    the stages modify the image in place.
+    and other consumers may be reading the same frame.
+    so copy the frame and give the slot back to the ring right away.
+    returns false if the ring was unblocked.
+    **/
+    bool copyLatestFrame() noexcept {
+        ImageBuffer *src = nullptr;
+        {
+            ScopedTimer timer(stage_times_[kTimeWait]);
+            src = image_ring_->acquireRead(ring_consumer_);
+        }
+        if (src == nullptr) {
+            return false;
+        }
+        ScopedTimer timer(stage_times_[kTimeCopy]);
+        frame_.width_ = src->width_;
+        frame_.height_ = src->height_;
+        frame_.bytes_ = src->bytes_;
+        frame_.sequence_ = src->sequence_;
+        frame_.timestamp_ = src->timestamp_;
+        frame_.exposure_ = src->exposure_;
+        frame_.temperature_ = src->temperature_;
+        frame_.bin_ = src->bin_;
+        frame_.bayer_pattern_ = src->bayer_pattern_;
+        frame_.stats_ = src->stats_;
+        frame_max_ = src->stats_.max_;
+        src->bayer_.copyTo(frame_.bayer_);
+        image_ring_->releaseRead(ring_consumer_, src);
+        return true;
     }
 
     virtual void end() noexcept {
-        cv::destroyWindow(win_name_);
+        if (use_gl_) {
+            gl_display_.close();
+        } else {
+            cv::destroyWindow(win_name_);
+        }
         LOG("WindowThread Closed window.");
+        delete pool_;
+        pool_ = nullptr;
+    }
+
+    /**
+    returns false if the settings haven't changed.
+    auto iso keeps its own iso.
+    **/
+    bool copySettings() noexcept {
+        bool changed = settings_.update(settings_buffer_);
+        if (changed == false) {
+            return false;
+        }
+        accumulate_ = settings_->accumulate_;
+        capture_black_ = settings_->capture_black_;
+        balance_red_ = settings_->balance_red_;
+        balance_blue_ = settings_->balance_blue_;
+        show_focus_ = settings_->show_focus_;
+        focus_metric_ = settings_->focus_metric_;
+        gamma_ = settings_->gamma_;
+        show_histogram_ = settings_->show_histogram_;
+        auto_iso_ = settings_->auto_iso_;
+        if (auto_iso_ == false) {
+            iso_ = settings_->iso_;
+        }
+        show_circles_ = settings_->show_circles_;
+        show_fps_ = settings_->show_fps_;
+        fused_pipeline_ = settings_->fused_pipeline_;
+        align_stack_ = settings_->align_stack_;
+        zoom_ = settings_->zoom_;
+        pan_x_ = settings_->pan_x_;
+        pan_y_ = settings_->pan_y_;
+        debayer_mode_ = settings_->debayer_mode_;
+        calibrate_ = settings_->calibrate_;
+        stack_mode_ = settings_->stack_mode_;
+        stack_kappa_ = settings_->stack_kappa_;
+        show_perf_ = settings_->show_perf_;
+        return true;
     }
 
-    void copySettings() noexcept {
-        std::lock_guard<std::mutex> lock(settings_buffer_->mutex_);
-        accumulate_ = settings_buffer_->accumulate_;
-        capture_black_ = settings_buffer_->capture_black_;
-        balance_red_ = settings_buffer_->balance_red_;
-        balance_blue_ = settings_buffer_->balance_blue_;
-        exposure_ = settings_buffer_->exposure_;
-        show_focus_ = settings_buffer_->show_focus_;
-        gamma_ = settings_buffer_->gamma_;
-        show_histogram_ = settings_buffer_->show_histogram_;
-        auto_iso_ = settings_buffer_->auto_iso_;
-        iso_ = settings_buffer_->iso_;
-        show_circles_ = settings_buffer_->show_circles_;
-        show_fps_ = settings_buffer_->show_fps_;
-        save_file_name_ = std::move(settings_buffer_->save_file_name_);
-        raw_file_name_ = std::move(settings_buffer_->raw_file_name_);
+    /**
+    take one command from the menu thread per frame.
+    the file names are only set for the frame that saves.
+    **/
+    void getCommand() noexcept {
+        save_file_name_.clear();
+        raw_file_name_.clear();
+        MenuCommand cmd;
+        bool found = settings_buffer_->commands_.pop(cmd);
+        if (found == false) {
+            return;
+        }
+        switch (cmd.type_) {
+        case MenuCommand::Type::kSaveImage:
+            save_file_name_ = std::move(cmd.name_);
+            break;
+        case MenuCommand::Type::kSaveRaw:
+            raw_file_name_ = std::move(cmd.name_);
+            break;
+        case MenuCommand::Type::kBuildMaster:
+            master_kind_ = std::move(cmd.name_);
+            master_frames_ = cmd.frames_;
+            break;
+        default:
+            /** the solver thread has its own queue. **/
+            break;
+        }
+    }
+
+    /**
+    choose how to debayer this frame and the size of the result.
+    a saved single frame is always full resolution and edge aware.
+    opencl falls back to the cpu if there's no device.
+    **/
+    void chooseDebayer() noexcept {
+        frame_debayer_ = debayer_mode_;
+        if (frame_debayer_ == DebayerMode::kOpenCL && cv::ocl::haveOpenCL() == false) {
+            if (warned_opencl_ == false) {
+                warned_opencl_ = true;
+                LOG("WindowThread OpenCL is not available. Debayering on the cpu.");
+            }
+            frame_debayer_ = DebayerMode::kBilinear;
+        }
+
+        bool saving = (save_file_name_.size() || raw_file_name_.size());
+        quality_debayer_ = (saving && accumulate_ == false);
+        if (quality_debayer_) {
+            frame_debayer_ = DebayerMode::kBilinear;
+        }
+
+        rgb_width_ = img_->width_;
+        rgb_height_ = img_->height_;
+        if (frame_debayer_ == DebayerMode::kSuperpixel) {
+            rgb_width_ /= 2;
+            rgb_height_ /= 2;
+        }
     }
 
     void checkBlurriness() noexcept {
-        if (show_focus_ == false) {
+        if (show_focus_ == false || focus_metric_ != FocusMetric::kLaplacian) {
             return;
         }
 
@@ -237,8 +637,8 @@ public:
         it's weird to maximize a blurriness number.
         so print the inverse scaled arbitrarily.
         **/
-        int wd = img_->width_;
-        int ht = img_->height_;
+        int wd = rgb_width_;
+        int ht = rgb_height_;
         auto wd_range = cv::Range(wd/4, wd*3/4);
         auto ht_range = cv::Range(ht/4, ht*3/4);
         cropped_ = rgb16_(ht_range, wd_range);
@@ -263,7 +663,7 @@ public:
         int wd = img_->width_;
         int ht = img_->height_;
         if (black_.rows == 0) {
-            black_ = cv::Mat(ht, wd, CV_16UC1);
+            black_.create(ht, wd, CV_16UC1);
             black_ = 0;
         }
 
@@ -278,10 +678,26 @@ public:
         which is unfortunate.
         and is why we save the maximum value.
         **/
+        int band = pool_->getBandRows(ht, 1);
+        int mx = parallelMax(ht, band, [this](int, int y0, int y1) {
+            return captureBlackRows(y0, y1);
+        });
+        LOG("max black leakage per second: "<<mx);
+        black_scaled_exposure_ = 0;
+
+        /** we're showing black. **/
+        frame_max_ = mx;
+    }
+
+    int captureBlackRows(
+        int y0,
+        int y1
+    ) noexcept {
         int mx = 0;
-        int sz = wd * ht;
-        auto pimg = (agm::uint16 *) img_->bayer_.data;
-        auto pblk = (agm::uint16 *) black_.data;
+        int wd = img_->width_;
+        int sz = wd * (y1 - y0);
+        auto pimg = (agm::uint16 *) img_->bayer_.data + wd * y0;
+        auto pblk = (agm::uint16 *) black_.data + wd * y0;
         for (int i = 0; i < sz; ++i) {
             /** 16 bits **/
             int pix = *pimg;
@@ -296,86 +712,175 @@ public:
             /** show black while we're capturing it. **/
             *pimg++ = blk;
         }
-        LOG("max black leakage per second: "<<mx);
+        return mx;
+    }
+
+    /**
+    run the function on bands of rows in parallel.
+    each worker keeps the maximum of its bands.
+    returns the maximum of the workers.
+    **/
+    int parallelMax(
+        int nrows,
+        int band_rows,
+        const std::function<int(int worker, int y0, int y1)> &func
+    ) noexcept {
+        for (auto &mx : partial_max_) {
+            mx = 0;
+        }
+        pool_->run(nrows, band_rows, [&](int worker, int y0, int y1) {
+            int mx = func(worker, y0, y1);
+            partial_max_[worker] = std::max(partial_max_[worker], mx);
+        });
+        int mx = 0;
+        for (auto partial : partial_max_) {
+            mx = std::max(mx, partial);
+        }
+        return mx;
     }
 
     /**
     subtract black from the image.
+    the master calibration frames take priority over the captured black.
     **/
     void subtractBlack() noexcept {
+        /** don't subtract black if we're capturing black. **/
+        if (capture_black_) {
+            return;
+        }
+        if (calibrateFrame()) {
+            return;
+        }
         /** no black to subtract. **/
         if (black_.rows == 0) {
             return;
         }
-        /** don't subtract black if we're capturing black. **/
-        if (capture_black_) {
-            return;
+
+        int ht = img_->height_;
+        int band = pool_->getBandRows(ht, 1);
+
+        /** scale black to the exposure time only when it changes. **/
+        if (black_scaled_exposure_ != exposure_ || black_scaled_.rows == 0) {
+            black_scaled_.create(ht, img_->width_, CV_16UC1);
+            pool_->run(ht, band, [this](int, int y0, int y1) {
+                scaleBlackRows(y0, y1);
+            });
+            black_scaled_exposure_ = exposure_;
         }
 
-        /**
-        scale black to exposure time.
-        subtract from captured image.
-        **/
-        int mx = 0;
-        int sz = img_->width_ * img_->height_;
-        auto pimg = (agm::uint16 *) img_->bayer_.data;
-        auto pblk = (agm::uint16 *) black_.data;
+        int mx = parallelMax(ht, band, [this](int, int y0, int y1) {
+            return subtractBlackRows(y0, y1);
+        });
+        LOG("max captured component: "<<mx);
+        frame_max_ = mx;
+    }
+
+    /** scale black to the exposure time. **/
+    void scaleBlackRows(
+        int y0,
+        int y1
+    ) noexcept {
+        int wd = img_->width_;
+        int sz = wd * (y1 - y0);
+        auto pblk = (const agm::uint16 *) black_.data + wd * y0;
+        auto pscaled = (agm::uint16 *) black_scaled_.data + wd * y0;
         for (int i = 0; i < sz; ++i) {
             /** 16 bits **/
-            int pix = *pimg;
-            agm::int64 x = *pblk++;
+            agm::int64 x = pblk[i];
             /** +28 bits = 44 bits > 32 bits **/
             x = x * exposure_ / 1000000;
-            int blk = std::min(x, 65535L);
-            pix -= blk;
-            pix = std::max(0, pix);
-            mx = std::max(mx, pix);
+            pscaled[i] = std::min(x, 65535L);
+        }
+    }
 
-            /**
-            there's a bit of an issue here.
-            some pixels are very leaky.
-            and quite variable in their leakiness.
-            so for these suspect pixels with high black values...
-            we don't know what the correct black value is now.
-            so we should handle suspect pixels by comparing the
-            correct value to the values of its neighbors.
-            if it's out of whack, then we should use the average
-            value of its neighbors instead of the corrected value.
-            **/
-            *pimg++ = pix;
+    /**
+    subtract the scaled black from the captured image.
+    returns the maximum corrected value.
+    **/
+    int subtractBlackRows(
+        int y0,
+        int y1
+    ) noexcept {
+        int wd = img_->width_;
+        int sz = wd * (y1 - y0);
+        auto pimg = (agm::uint16 *) img_->bayer_.data + wd * y0;
+        auto pblk = (const agm::uint16 *) black_scaled_.data + wd * y0;
+        return kernels_->subtract_(pimg, pblk, sz);
+    }
+
+    /**
+    correct the image with the master calibration frames.
+    the suspect pixels are repaired first.
+    returns false if there are no masters for this frame.
+    **/
+    bool calibrateFrame() noexcept {
+        if (calibrate_ == false) {
+            return false;
         }
-        LOG("max captured component: "<<mx);
+        int wd = img_->width_;
+        int ht = img_->height_;
+        bool active = calibration_.prepare(wd, ht, img_->exposure_, img_->temperature_, img_->bin_);
+        if (active == false) {
+            return false;
+        }
+
+        calibration_.repair(img_->bayer_);
+        int band = pool_->getBandRows(ht, 1);
+        int mx = parallelMax(ht, band, [this](int, int y0, int y1) {
+            return calibration_.correct(img_->bayer_, y0, y1, kernels_);
+        });
+        frame_max_ = mx;
+        return true;
     }
 
-    /** no alignment **/
+    /** average raw frames into a master calibration frame. **/
+    void buildMaster() noexcept {
+        if (master_frames_ > 0) {
+            static const Calibration::Kind kKinds[] = {
+                Calibration::Kind::kBias,
+                Calibration::Kind::kDark,
+                Calibration::Kind::kFlat
+            };
+            for (auto kind : kKinds) {
+                if (master_kind_ == Calibration::getKindName(kind)) {
+                    calibration_.startMaster(kind, master_frames_);
+                }
+            }
+            master_frames_ = 0;
+        }
+        if (calibration_.isBuilding()) {
+            calibration_.addFrame(img_->bayer_, img_->exposure_, img_->temperature_, img_->bin_);
+        }
+    }
+
+    /** align the image to the stack if there are stars. **/
     void stackImages() noexcept {
         if (accumulate_ == false) {
             return;
         }
 
-        int wd = img_->width_;
-        int ht = img_->height_;
-        int sz = 3 * wd * ht;
+        int ht = rgb_height_;
 
         /** the first image. **/
-        if (rgb32_.rows == 0) {
-            rgb32_ = cv::Mat(ht, wd, CV_32SC3);
-            rgb32_ = 0;
+        allocateStack();
+
+        /** find the transform to the reference frame. **/
+        bool stack_it = registerFrame();
+
+        /** accumulate the 16 bit values into the 32 bit sums. **/
+        int wd = rgb_width_;
+        int band = pool_->getBandRows(ht, 1);
+        if (stack_it) {
+            pool_->run(ht, band, [this](int worker, int y0, int y1) {
+                stackRows(worker, y0, y1);
+            });
         }
 
-        /**
-        accumulate the 16 bit values into the 32 bit sums.
-        save the maximum value.
-        **/
-        int mx = 0;
-        auto ptr16 = (agm::uint16 *) rgb16_.data;
-        auto ptr32 = (agm::int32 *) rgb32_.data;
-        for (int i = 0; i < sz; ++i) {
-            agm::int32 px = *ptr32;
-            px += *ptr16++;
-            mx = std::max(mx, px);
-            *ptr32++ = px;
-        }
+        /** the individual stages work on the whole image. **/
+        int mx = parallelMax(ht, band, [=](int, int y0, int y1) {
+            return stackMaxRows(y0, y1, 0, wd);
+        });
+        stack_max_ = mx;
 
         #if 0
         /** vvvvvvvv hdr experiments. **/
@@ -387,7 +892,8 @@ public:
         for (int i = 0; i < kHdrHistSize; ++i) {
             hdr_hist_[i] = 0;
         }
-        ptr32 = (agm::int32 *) rgb32_.data;
+        int sz = 3 * rgb_width_ * ht;
+        auto ptr32 = (agm::int32 *) rgb32_.data;
         for (int i = 0; i < sz; ++i) {
             agm::int64 px = *ptr32++;
             px = px * (kHdrHistSize-1) / mx;
@@ -412,11 +918,235 @@ public:
         #endif
 
         /** scale and copy the 32 bit image back to the 16 bit buffer. **/
-        ptr16 = (agm::uint16 *) rgb16_.data;
-        ptr32 = (agm::int32 *) rgb32_.data;
+        pool_->run(ht, band, [=](int, int y0, int y1) {
+            rescaleStackRows(y0, y1, 0, wd, mx);
+        });
+
+        /** bump the counter and log. **/
+        if (stack_it) {
+            countStacked();
+        }
+    }
+
+    /**
+    find the transform from this frame to the first frame of the stack.
+    uses the bayer image. so black must already be subtracted.
+    sets aligning_ if the frame must be warped before it's stacked.
+    returns false if the frame doesn't match and shouldn't be stacked.
+    **/
+    bool registerFrame() noexcept {
+        aligning_ = false;
+        if (align_stack_ == false) {
+            return true;
+        }
+        if (nstacked_ == 0) {
+            registration_.reset();
+        }
+
+        auto result = registration_.measure(img_->bayer_, pool_, align_xform_);
+        switch (result) {
+        case StarRegistration::Result::kReference:
+            LOG("WindowThread Aligning the stack to "<<align_xform_.matched_<<" stars.");
+            break;
+        case StarRegistration::Result::kNoReference:
+            /** not enough stars. stack without aligning. **/
+            break;
+        case StarRegistration::Result::kNoMatch:
+            LOG("WindowThread Skipped frame. The stars don't match the stack.");
+            return false;
+        case StarRegistration::Result::kAligned:
+            aligning_ = true;
+            break;
+        }
+        return true;
+    }
+
+    /** stack a band of rows. aligned if necessary. **/
+    void stackRows(
+        int worker,
+        int y0,
+        int y1
+    ) noexcept {
+        if (aligning_) {
+            alignAccumulateRows(worker, y0, y1);
+        } else {
+            accumulateRows(y0, y1);
+        }
+    }
+
+    /**
+    warp a band of rows of the whole 16 bit image to the reference frame.
+    accumulate it into the 32 bit sums.
+    pixels from outside the frame are black.
+    **/
+    void alignAccumulateRows(
+        int worker,
+        int y0,
+        int y1
+    ) noexcept {
+        double m[6];
+        StarRegistration::getInverseMatrix(getRgbTransform(), y0, m);
+        cv::Mat xform(2, 3, CV_64F, m);
+        auto &band_warp = band_warp_[worker];
+        cv::Size size(rgb_width_, y1 - y0);
+        cv::warpAffine(rgb16_, band_warp, xform, size, cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_CONSTANT);
+        accumulateBand((const agm::uint16 *) band_warp.data, y0, y1);
+    }
+
+    /**
+    the transform is measured on the bayer image.
+    a superpixel at x covers bayer pixels 2x and 2x+1. its center is 2x+0.5.
+    so scale the translation to the half size image.
+    **/
+    StarRegistration::Transform getRgbTransform() noexcept {
+        if (frame_debayer_ != DebayerMode::kSuperpixel) {
+            return align_xform_;
+        }
+        auto xform = align_xform_;
+        double c = std::cos(xform.angle_);
+        double s = std::sin(xform.angle_);
+        double dx = xform.dx_ + 0.5 * (c - 1.0) - 0.5 * s;
+        double dy = xform.dy_ + 0.5 * s + 0.5 * (c - 1.0);
+        xform.dx_ = 0.5 * dx;
+        xform.dy_ = 0.5 * dy;
+        return xform;
+    }
+
+    void allocateStack() noexcept {
+        /** start over when the stack mode changes. **/
+        if (stack_mode_ != stacked_mode_) {
+            stacked_mode_ = stack_mode_;
+            nstacked_ = 0;
+            rgb32_.release();
+            robust_stack_.release();
+        }
+
+        if (stacked_mode_ == StackMode::kSum) {
+            if (rgb32_.rows == 0) {
+                rgb32_.create(rgb_height_, rgb_width_, CV_32SC3);
+                rgb32_ = 0;
+            }
+            return;
+        }
+
+        /** the robust stacks are cleared until the first frame is stacked. **/
+        if (nstacked_ == 0) {
+            auto mode = RobustStack::Mode::kSigmaClip;
+            if (stacked_mode_ == StackMode::kMedian) {
+                mode = RobustStack::Mode::kMedian;
+            }
+            robust_stack_.allocate(mode, 3 * rgb_width_ * rgb_height_);
+        }
+    }
+
+    /** accumulate the 16 bit values into the 32 bit sums. **/
+    void accumulateRows(
+        int y0,
+        int y1
+    ) noexcept {
+        int wd = rgb_width_;
+        auto ptr16 = (const agm::uint16 *) rgb16_.data + 3 * wd * y0;
+        accumulateBand(ptr16, y0, y1);
+    }
+
+    /**
+    accumulate a band of 16 bit values into rows [y0, y1) of the 32 bit sums.
+    or the robust stack.
+    the sum is a pure add. the preview finds the maximum of what it shows.
+    **/
+    void accumulateBand(
+        const agm::uint16 *ptr16,
+        int y0,
+        int y1
+    ) noexcept {
+        int wd = rgb_width_;
+        int sz = 3 * wd * (y1 - y0);
+        if (stacked_mode_ != StackMode::kSum) {
+            robust_stack_.add(ptr16, 3 * wd * y0, sz, nstacked_ + 1, stack_kappa_);
+            return;
+        }
+        auto ptr32 = (agm::int32 *) rgb32_.data + 3 * wd * y0;
         for (int i = 0; i < sz; ++i) {
-            /** caution: overflow **/
-            agm::int64 px = *ptr32++;
+            ptr32[i] += ptr16[i];
+        }
+    }
+
+    /**
+    the part of the image the preview needs.
+    the display shows only the area of interest.
+    the histogram, the collimation circles, and raw saves need all of it.
+    opengl draws the circles on top. so they only need the area of interest.
+    **/
+    cv::Rect getPreviewRect(
+        bool do_display
+    ) noexcept {
+        if (do_display && raw_file_name_.empty() && show_histogram_ == false) {
+            return aoi_;
+        }
+        return cv::Rect(0, 0, rgb_width_, rgb_height_);
+    }
+
+    /** find the maximum of the stack in columns [x0, x1) of a band of rows. **/
+    int stackMaxRows(
+        int y0,
+        int y1,
+        int x0,
+        int x1
+    ) noexcept {
+        int wd = rgb_width_;
+        int count = 3 * (x1 - x0);
+        int mx = 0;
+        for (int y = y0; y < y1; ++y) {
+            int offset = 3 * (wd * y + x0);
+            if (stacked_mode_ != StackMode::kSum) {
+                mx = std::max(mx, robust_stack_.getMax(offset, count));
+                continue;
+            }
+            auto ptr32 = (const agm::int32 *) rgb32_.data + offset;
+            for (int i = 0; i < count; ++i) {
+                mx = std::max(mx, ptr32[i]);
+            }
+        }
+        return mx;
+    }
+
+    /**
+    scale and copy columns [x0, x1) of the 32 bit sums back to the 16 bit buffer.
+    mx becomes 65535.
+    **/
+    void rescaleStackRows(
+        int y0,
+        int y1,
+        int x0,
+        int x1,
+        int mx
+    ) noexcept {
+        int wd = rgb_width_;
+        int count = 3 * (x1 - x0);
+        for (int y = y0; y < y1; ++y) {
+            int offset = 3 * (wd * y + x0);
+            auto ptr16 = (agm::uint16 *) rgb16_.data + offset;
+            if (stacked_mode_ != StackMode::kSum) {
+                robust_stack_.render(ptr16, offset, count, mx);
+            } else {
+                auto ptr32 = (const agm::int32 *) rgb32_.data + offset;
+                rescaleSums(ptr32, ptr16, count, mx);
+            }
+        }
+    }
+
+    void rescaleSums(
+        const agm::int32 *ptr32,
+        agm::uint16 *ptr16,
+        int count,
+        int mx
+    ) noexcept {
+        /** avoid dividing by zero when the stack is all black. **/
+        mx = std::max(mx, 1);
+        double scale = 65535.0 / double(mx);
+
+        for (int i = 0; i < count; ++i) {
+            double px = *ptr32++;
             /** vvvvvvvv hdr experiments **/
             /** scale bright pixels to the full visible range. **/
             //px = (px - hdr_thresh) * 65535 / (mx - hdr_thresh);
@@ -433,12 +1163,14 @@ public:
             }*/
             /** ^^^^^^^^ hdr experiments **/
             /** scale all pixels to the full visible range. **/
-            px = px * 65535 / mx;
-            px = std::max(agm::int64(0), std::min(px, agm::int64(65535)));
-            *ptr16++ = px;
+            px = px * scale;
+            px = std::max(0.0, std::min(px, 65535.0));
+            *ptr16++ = (agm::uint16) px;
         }
+    }
 
-        /** bump the counter and log. **/
+    /** bump the counter and log. **/
+    void countStacked() noexcept {
         ++nstacked_;
         int ns = nstacked_;
         if (ns >= 10) {
@@ -456,28 +1188,10 @@ public:
     }
 
     void isoLinearScale() noexcept {
-        int sz = 3 * img_->width_ * img_->height_;
-        auto ptr = (agm::uint16 *) rgb16_.data;
-        int iso = iso_;
+        int ht = rgb_height_;
 
         /** auto scale to maximum value. **/
-        if (auto_iso_) {
-            int mx = 0;
-            for (int i = 0; i < sz; ++i) {
-                int p = *ptr++;
-                mx = std::max(mx, p);
-            }
-            if (mx == 0) {
-                return;
-            }
-
-            /** update iso only if it's out of whack. **/
-            int test = mx * iso / 100;
-            if (test < 65535*9/10 || test > 65535) {
-                int new_iso = 65535 * 100 / mx;
-                iso = (9*iso + new_iso) / 10;
-            }
-        }
+        int iso = chooseIso(getRgb16Max());
 
         /** sanity checks **/
         if (iso == 100) {
@@ -488,42 +1202,83 @@ public:
         }
 
         /** iso scaling. **/
-        ptr = (agm::uint16 *) rgb16_.data;
-        for (int i = 0; i < sz; ++i) {
-            int p = *ptr * iso / 100;
-            p = std::min(p, 65535);
-            *ptr++ = p;
-        }
+        isoScaleRows(0, ht, iso);
 
         /** update settings. **/
-        if (auto_iso_ && iso != iso_) {
-            iso_ = iso;
-            LOG("new auto iso="<<iso);
-            std::lock_guard<std::mutex> lock(settings_buffer_->mutex_);
-            settings_buffer_->iso_ = iso;
-        }
+        updateAutoIso(iso);
     }
 
-    void gammaPowerScale() noexcept {
-        double gamma = gamma_;
-        if (gamma == 1.0) {
-            return;
+    /**
+    the maximum component of the 16 bit image without scanning it.
+    debayering interpolates so it doesn't change the maximum.
+    the rescaled stack's maximum is 65535 unless everything is black.
+    **/
+    int getRgb16Max() noexcept {
+        if (accumulate_) {
+            return (stack_max_ > 0) ? 65535 : 0;
         }
-        if (gamma <= 0) {
-            return;
+        return frame_max_;
+    }
+
+    /** pick the iso given the maximum component. **/
+    int chooseIso(
+        int mx
+    ) noexcept {
+        int iso = iso_;
+        if (auto_iso_ == false) {
+            return iso;
+        }
+        if (mx == 0) {
+            return iso;
         }
 
-        int sz = 3 * img_->width_ * img_->height_;
-        auto ptr = (agm::uint16 *) rgb16_.data;
+        /** update iso only if it's out of whack. **/
+        int test = mx * iso / 100;
+        if (test < 65535*9/10 || test > 65535) {
+            int new_iso = 65535 * 100 / mx;
+            iso = (9*iso + new_iso) / 10;
+        }
+        return iso;
+    }
+
+    void isoScaleRows(
+        int y0,
+        int y1,
+        int iso
+    ) noexcept {
+        int wd = rgb_width_;
+        int sz = 3 * wd * (y1 - y0);
+        auto ptr = (agm::uint16 *) rgb16_.data + 3 * wd * y0;
+        kernels_->iso_scale_(ptr, sz, iso);
+    }
+
+    void updateAutoIso(
+        int iso
+    ) noexcept {
+        if (auto_iso_ && iso != iso_) {
+            iso_ = iso;
+            LOG("new auto iso="<<iso);
+            /** tell the menu without taking the lock or publishing new settings. **/
+            settings_buffer_->current_iso_.store(iso, std::memory_order_relaxed);
+        }
+    }
 
+    void gammaPowerScale() noexcept {
+        double gamma = gamma_;
+        if (gamma == 1.0) {
+            return;
+        }
+        if (gamma <= 0) {
+            return;
+        }
+
+        /** the table is rebuilt only when gamma changes. **/
+        auto power = tone_tables_.getPower(gamma);
+        int sz = 3 * rgb_width_ * rgb_height_;
+        auto ptr = (agm::uint16 *) rgb16_.data;
         for (int i = 0; i < sz; ++i) {
-            int p = *ptr;
-            double x = double(p) / 65535.0;
-            x = std::pow(x, gamma);
-            x *= 65535.0;
-            p = (int) std::round(x);
-            p = std::max(0, std::min(p, 65535));
-            *ptr++ = p;
+            *ptr = power[*ptr];
+            ++ptr;
         }
     }
 
@@ -544,7 +1299,7 @@ public:
         **/
 #if 0
         /** adjust BGR colors **/
-        int sz = img_->width_ * img_->height_;
+        int sz = rgb_width_ * rgb_height_;
         auto ptr = (agm::uint16 *) rgb16_.data;
         for (int i = 0; i < sz; ++i) {
             int r0 = ptr[2];
@@ -575,116 +1330,421 @@ public:
     }
 
     void balanceColors() noexcept {
-        int sz = img_->width_ * img_->height_;
-        auto ptr = (agm::uint16 *) rgb16_.data;
-        for (int i = 0; i < sz; ++i) {
-            int r = ptr[2];
-            int b = ptr[0];
-            r = std::round(r * balance_red_);
-            b = std::round(b * balance_blue_);
-            ptr[2] = r;
-            ptr[0] = b;
-            ptr += 3;
+        balanceRows(0, rgb_height_);
+    }
+
+    void balanceRows(
+        int y0,
+        int y1
+    ) noexcept {
+        int wd = rgb_width_;
+        int npixels = wd * (y1 - y0);
+        auto ptr = (agm::uint16 *) rgb16_.data + 3 * wd * y0;
+        kernels_->balance_colors_(ptr, npixels, balance_red_, balance_blue_);
+    }
+
+    /**
+    do all of the per-pixel stages on one band of rows before moving on.
+    the band is small enough to stay in the cache.
+    the result is identical to running the stages one at a time.
+    subtract black, debayer, stack, iso, gamma, balance, display gamma.
+    convertStdRgb does nothing so neither do we.
+
+    stacking needs the maximum of the whole stack.
+    so it splits the pass into two sweeps.
+    the first sweep finds the maximum.
+    the second sweep finishes the bands.
+    auto iso uses the maximum from the frame stats.
+    the alignment warp moves pixels between bands.
+    so an aligned frame is debayered before the first sweep.
+
+    the histogram and the collimation circles draw on the 16 bit image.
+    so display gamma is deferred when either is shown.
+    returns true if the display gamma was applied.
+    **/
+    bool fusedPipeline() noexcept {
+        int wd = rgb_width_;
+        int ht = rgb_height_;
+        rgb16_.create(ht, wd, CV_16UC3);
+        if (accumulate_) {
+            allocateStack();
+        }
+
+        bool do_display = (use_gl_ || (show_histogram_ == false && show_circles_ == false));
+        int band = fusedBandRows();
+
+        /**
+        the debayer reads a couple rows past the end of the band.
+        the bands are processed in parallel.
+        so black must be subtracted from the whole image first.
+        **/
+        subtractBlack();
+
+        /** the debayers that need the whole image go first. **/
+        bool do_debayer = debayerInBands();
+        if (do_debayer == false) {
+            debayer();
         }
+
+        int mx = 0;
+        int iso = iso_;
+        bool do_iso = (iso != 100 && iso > 0);
+        bool stack_it = false;
+        if (accumulate_ == false) {
+            /** one sweep. auto iso already knows the maximum. **/
+            iso = chooseIso(getRgb16Max());
+            do_iso = (iso != 100 && iso > 0);
+            updateToneTables(iso, do_iso);
+            pool_->run(ht, band, [=](int worker, int y0, int y1) {
+                fusedStartRows(worker, y0, y1, do_debayer);
+                fusedFinishRows(worker, y0, y1, 0, wd, do_display);
+            });
+        } else {
+            /** stack the frame. a skipped frame shows the stack without it. **/
+            stack_it = registerFrame();
+            if (stack_it && aligning_) {
+                if (do_debayer) {
+                    debayer();
+                }
+                pool_->run(ht, band, [this](int worker, int y0, int y1) {
+                    alignAccumulateRows(worker, y0, y1);
+                });
+            } else if (stack_it) {
+                pool_->run(ht, band, [=](int worker, int y0, int y1) {
+                    fusedStartRows(worker, y0, y1, do_debayer);
+                });
+            }
+
+            /**
+            the preview is rendered only where it's shown.
+            so its cost depends on the display size.
+            not the sensor size or the depth of the stack.
+            **/
+            cv::Rect rect = getPreviewRect(do_display);
+            int x0 = rect.x;
+            int x1 = rect.x + rect.width;
+            mx = parallelMax(rect.height, band, [=](int, int y0, int y1) {
+                return stackMaxRows(rect.y + y0, rect.y + y1, x0, x1);
+            });
+            stack_max_ = mx;
+            iso = chooseIso(getRgb16Max());
+            do_iso = (iso != 100 && iso > 0);
+            updateToneTables(iso, do_iso);
+
+            /** finish the bands. **/
+            pool_->run(rect.height, band, [=](int worker, int y0, int y1) {
+                fusedFinishRows(worker, rect.y + y0, rect.y + y1, x0, x1, do_display);
+            });
+        }
+
+        if (stack_it) {
+            countStacked();
+        }
+        if (do_iso) {
+            updateAutoIso(iso);
+        }
+
+        return do_display;
     }
 
-    void showHistogram() noexcept {
-        if (show_histogram_ == false) {
+    /** fold iso, gamma, and balance into the tone tables. **/
+    void updateToneTables(
+        int iso,
+        bool do_iso
+    ) noexcept {
+        if (do_iso == false) {
+            iso = 100;
+        }
+        tone_tables_.update(iso, gamma_, balance_red_, balance_blue_);
+    }
+
+    /**
+    choose a number of rows that fits in the cache.
+    even for the debayer. and a multiple of the view shrink.
+    **/
+    int fusedBandRows() noexcept {
+        static const int kBandBytes = 256 * 1024;
+        int row_bytes = 3 * sizeof(agm::uint16) * rgb_width_;
+        int align = (view_shrink_ % 2) ? 2 * view_shrink_ : view_shrink_;
+        int rows = kBandBytes / row_bytes;
+        rows = rows / align * align;
+        rows = std::max(rows, align);
+        return rows;
+    }
+
+    /** debayer and stack a band of rows. **/
+    void fusedStartRows(
+        int worker,
+        int y0,
+        int y1,
+        bool do_debayer
+    ) noexcept {
+        if (do_debayer) {
+            debayerRows(worker, y0, y1);
+        }
+
+        /** stack the band. **/
+        if (accumulate_) {
+            accumulateRows(y0, y1);
+        }
+    }
+
+    /** debayer the whole image. in parallel bands if possible. **/
+    void debayer() noexcept {
+        int ht = rgb_height_;
+        rgb16_.create(ht, rgb_width_, CV_16UC3);
+        if (debayerInBands() == false) {
+            debayerWhole();
             return;
         }
+        int band = pool_->getBandRows(ht, 2);
+        pool_->run(ht, band, [this](int worker, int y0, int y1) {
+            debayerRows(worker, y0, y1);
+        });
+    }
 
-        int wd = img_->width_;
+    /** the edge aware and the opencl debayers need the whole image. **/
+    bool debayerInBands() noexcept {
+        return (quality_debayer_ == false && frame_debayer_ != DebayerMode::kOpenCL);
+    }
+
+    /**
+    opencv's vng debayer only handles 8 bits.
+    the edge aware debayer is the best one that handles 16.
+    **/
+    void debayerWhole() noexcept {
+        if (quality_debayer_) {
+            cv::cvtColor(img_->bayer_, rgb16_, getBayerCode(true));
+            return;
+        }
+        img_->bayer_.copyTo(bayer_umat_);
+        cv::cvtColor(bayer_umat_, rgb16_umat_, getBayerCode(false));
+        rgb16_umat_.copyTo(rgb16_);
+    }
+
+    /**
+    opencv names the pattern by the second and third pixels of the second row.
+    so the camera's RGGB is opencv's BG.
+    the output is BGR.
+    **/
+    int getBayerCode(
+        bool edge_aware
+    ) noexcept {
+        switch (img_->bayer_pattern_) {
+        case BayerPattern::kRGGB:
+        default:
+            return edge_aware ? cv::COLOR_BayerBG2BGR_EA : cv::COLOR_BayerBG2BGR;
+        case BayerPattern::kBGGR:
+            return edge_aware ? cv::COLOR_BayerRG2BGR_EA : cv::COLOR_BayerRG2BGR;
+        case BayerPattern::kGRBG:
+            return edge_aware ? cv::COLOR_BayerGB2BGR_EA : cv::COLOR_BayerGB2BGR;
+        case BayerPattern::kGBRG:
+            return edge_aware ? cv::COLOR_BayerGR2BGR_EA : cv::COLOR_BayerGR2BGR;
+        }
+    }
+
+    /**
+    debayer the band plus margins.
+    the band must start on an even row.
+    the margins are even so the bayer pattern doesn't change.
+    they make the edges of the band the same as the full image.
+    **/
+    void debayerRows(
+        int worker,
+        int y0,
+        int y1
+    ) noexcept {
+        if (frame_debayer_ == DebayerMode::kSuperpixel) {
+            superpixelRows(y0, y1);
+            return;
+        }
+
+        static const int kMargin = 2;
         int ht = img_->height_;
-        int hist_sz = wd + 1;
-        if (histr_ == nullptr) {
-            histr_ = new(std::nothrow) int[hist_sz];
-            histg_ = new(std::nothrow) int[hist_sz];
-            histb_ = new(std::nothrow) int[hist_sz];
-            for (int i = 0; i < hist_sz; ++i) {
-                histr_[i] = 0;
-                histg_[i] = 0;
-                histb_[i] = 0;
+        int m0 = std::max(0, y0 - kMargin);
+        int m1 = std::min(ht, y1 + kMargin);
+        auto &band_rgb16 = band_rgb16_[worker];
+        cv::Mat bayer = img_->bayer_.rowRange(m0, m1);
+        cv::cvtColor(bayer, band_rgb16, getBayerCode(false));
+        cv::Mat src = band_rgb16.rowRange(y0 - m0, y1 - m0);
+        cv::Mat dst = rgb16_.rowRange(y0, y1);
+        src.copyTo(dst);
+    }
+
+    /**
+    each 2x2 block of the bayer image is one BGR pixel.
+    the greens are averaged.
+    rows [y0, y1) of the half size image.
+    **/
+    void superpixelRows(
+        int y0,
+        int y1
+    ) noexcept {
+        /** the row and column of red in the block. **/
+        int red_row = 0;
+        int red_col = 0;
+        switch (img_->bayer_pattern_) {
+        case BayerPattern::kRGGB:
+            break;
+        case BayerPattern::kBGGR:
+            red_row = 1;
+            red_col = 1;
+            break;
+        case BayerPattern::kGRBG:
+            red_col = 1;
+            break;
+        case BayerPattern::kGBRG:
+            red_row = 1;
+            break;
+        }
+        int blue_col = 1 - red_col;
+
+        int bayer_wd = img_->width_;
+        int wd = rgb_width_;
+        auto src = (const agm::uint16 *) img_->bayer_.data;
+        for (int y = y0; y < y1; ++y) {
+            auto red = src + bayer_wd * (2 * y + red_row);
+            auto blue = src + bayer_wd * (2 * y + 1 - red_row);
+            auto dst = (agm::uint16 *) rgb16_.data + 3 * wd * y;
+            for (int x = 0; x < wd; ++x) {
+                int r = red[2 * x + red_col];
+                int g1 = red[2 * x + blue_col];
+                int g2 = blue[2 * x + red_col];
+                int b = blue[2 * x + blue_col];
+                dst[0] = b;
+                dst[1] = (g1 + g2 + 1) / 2;
+                dst[2] = r;
+                dst += 3;
             }
         }
-        for (int i = 0; i < hist_sz; ++i) {
-            histr_[i] = histr_[i] * 95 / 100;
-            histg_[i] = histg_[i] * 95 / 100;
-            histb_[i] = histb_[i] * 95 / 100;
+    }
+
+    /**
+    rescale the stack, iso, gamma, balance, and display gamma.
+    columns [x0, x1) of a band of rows.
+    **/
+    void fusedFinishRows(
+        int worker,
+        int y0,
+        int y1,
+        int x0,
+        int x1,
+        bool do_display
+    ) noexcept {
+        if (accumulate_) {
+            rescaleStackRows(y0, y1, x0, x1, stack_max_);
         }
-        int sz = wd * ht;
-        auto ptr = (agm::uint16 *) rgb16_.data;
-        for (int i = 0; i < sz; ++i) {
-            int r = ptr[2];
-            int g = ptr[1];
-            int b = ptr[0];
-            ptr += 3;
-            r = r * wd / 65536;
-            g = g * wd / 65536;
-            b = b * wd / 65536;
-            r = std::max(0, std::min(r, wd));
-            g = std::max(0, std::min(g, wd));
-            b = std::max(0, std::min(b, wd));
-            ++histr_[r];
-            ++histg_[g];
-            ++histb_[b];
+
+        /** iso, gamma, and balance in one table lookup. **/
+        int wd = rgb_width_;
+        if (x0 == 0 && x1 == wd) {
+            auto ptr = (agm::uint16 *) rgb16_.data + 3 * wd * y0;
+            tone_tables_.apply(ptr, wd * (y1 - y0));
+        } else {
+            for (int y = y0; y < y1; ++y) {
+                auto ptr = (agm::uint16 *) rgb16_.data + 3 * (wd * y + x0);
+                tone_tables_.apply(ptr, x1 - x0);
+            }
         }
 
-        plotHistogram(histr_, 2);
-        plotHistogram(histg_, 1);
-        plotHistogram(histb_, 0);
+        if (do_display) {
+            renderRows(worker, y0, y1);
+        }
     }
 
-    void plotHistogram(
-        int *hist,
-        int color
-    ) noexcept {
-    #if 0
-        /**
-        plotting the histogram as a log has potential.
-        the max value of the histogram would be about 20*wd*ht.
-        if everything were evenly distributed it would be about 20*ht.
-        we want 20*ht to be about half way up the screen.
-        but that puts tiny values way too high.
-        i suppose we could look this up in a table for speed.
-        but it might be kinda big.
-        **/
-        (void) hist;
-        (void) color;
-        int wd = img_->width_;
-        int ht = img_->height_;
-        int htm1 = ht - 1;
-        auto ptr = (agm::uint16 *) rgb16_.data;
+    void showHistogram() noexcept {
+        if (show_histogram_ == false) {
+            if (use_gl_) {
+                gl_levels_.clear();
+                for (int c = 0; c < Histogram::kChannels; ++c) {
+                    gl_display_.setHistogram(c, gl_levels_);
+                }
+            }
+            return;
+        }
 
-        for (int x = 0; x < wd; ++x) {
-            int y = std::round(double(ht) * std::pow(double(x)/double(wd), k));
-            y = htm1 - y;
-            y = std::max(0, std::min(y, htm1));
-            LOG("x="<<x<<" y="<<y);
-            auto dst = &ptr[3*wd*y];
-            for (int i = 0; i < 3; ++i) {
-                dst[i] = 65535;
+        /** about one bin per column. **/
+        int wd = rgb_width_;
+        int ht = rgb_height_;
+        int bins = 2;
+        while (bins < 65536 && 2 * bins <= wd) {
+            bins *= 2;
+        }
+        if (histogram_.getBins() != bins) {
+            histogram_.configure(bins, pool_->getThreadCount());
+        }
+        if (int(hist_columns_.size()) != wd + 1 || hist_plot_height_ != ht) {
+            initHistogramPlot(bins);
+        }
+
+        /** the plot shows a decaying average of the recent frames. **/
+        static const int kMaxSamples = 256 * 1024;
+        int step = Histogram::chooseStep(wd, ht, kMaxSamples);
+        histogram_.decay(95);
+        histogram_.add(rgb16_, step, pool_);
+
+        if (use_gl_) {
+            for (int c = 0; c < Histogram::kChannels; ++c) {
+                auto hist = histogram_.getCounts(c);
+                gl_levels_.resize(bins);
+                for (int i = 0; i < bins; ++i) {
+                    gl_levels_[i] = hist_levels_[Histogram::getLogIndex(hist[i])];
+                }
+                gl_display_.setHistogram(c, gl_levels_);
             }
-            ptr += 3;
+            return;
         }
-    #endif
+        plotHistogram(histogram_.getCounts(2), 2);
+        plotHistogram(histogram_.getCounts(1), 1);
+        plotHistogram(histogram_.getCounts(0), 0);
+    }
 
-        int wd = img_->width_;
-        int ht = img_->height_;
+    /**
+    plot the histogram as a log.
+    the max value of the histogram is about 20*wd*ht.
+    if everything were evenly distributed it would be about 20*ht.
+    we want 20*ht to be about half way up the screen.
+    the rows are computed once per log index.
+    so there's no pow per column.
+    **/
+    void initHistogramPlot(
+        int bins
+    ) noexcept {
+        int wd = rgb_width_;
+        int ht = rgb_height_;
+        hist_columns_.resize(wd + 1);
+        for (int x = 0; x <= wd; ++x) {
+            int bin = int(agm::int64(x) * bins / wd);
+            hist_columns_[x] = std::min(bin, bins - 1);
+        }
+
+        hist_plot_height_ = ht;
         int htm1 = ht - 1;
-        double mx = double(20 * wd * ht);
-        double k = std::log(2.0) / std::log(double(wd));
+        double mx = double(20) * double(wd) * double(ht);
+        double k = std::log(2.0) / std::log(double(std::max(wd, 2)));
+        hist_rows_.resize(Histogram::kLogIndices);
+        hist_levels_.resize(Histogram::kLogIndices);
+        for (int i = 0; i < Histogram::kLogIndices; ++i) {
+            double count = Histogram::getLogValue(i);
+            double level = std::min(std::pow(count / mx, k), 1.0);
+            hist_levels_[i] = float(level);
+            int y = std::round(double(ht) * level);
+            y = std::max(0, std::min(y, htm1));
+            hist_rows_[i] = htm1 - y;
+        }
+    }
+
+    void plotHistogram(
+        const int *hist,
+        int color
+    ) noexcept {
+        int wd = rgb_width_;
         auto ptr = (agm::uint16 *) rgb16_.data;
         for (int x = 0; x < wd; ++x) {
-            int c0 = hist[x+0];
-            int c1 = hist[x+1];
-            c0 = std::round(double(ht) * std::pow(double(c0)/mx, k));
-            c1 = std::round(double(ht) * std::pow(double(c1)/mx, k));
-            //c0 = c0 / 400;
-            //c1 = c1 / 400;
-            c0 = std::max(0, std::min(c0, htm1));
-            c1 = std::max(0, std::min(c1, htm1));
-            c0 = htm1 - c0;
-            c1 = htm1 - c1;
+            int c0 = hist[hist_columns_[x]];
+            int c1 = hist[hist_columns_[x+1]];
+            c0 = hist_rows_[Histogram::getLogIndex(c0)];
+            c1 = hist_rows_[Histogram::getLogIndex(c1)];
             if (c0 > c1) {
                 std::swap(c0, c1);
             }
@@ -715,7 +1775,11 @@ public:
         static const int kGammaTableSize = 1124;
         static const double kGammaTableMax = kGammaTableSize - 1;
         gamma_max_ = kGammaTableSize - 1;
-        gamma_table_ = new(std::nothrow) agm::uint8[kGammaTableSize];
+        /** the vector kernels read past the end of the table. **/
+        gamma_table_ = new(std::nothrow) agm::uint8[kGammaTableSize + PixelKernels::kTablePadding];
+        for (int i = 0; i < PixelKernels::kTablePadding; ++i) {
+            gamma_table_[kGammaTableSize + i] = 0;
+        }
 
         /** build the table. **/
         for (int i = 0; i < kGammaTableSize; ++i) {
@@ -741,48 +1805,188 @@ public:
     scale the source 16 bit components to the size of the gamma lookup table.
     set the destination 8 bit values.
     **/
+    /** convert the whole image. for saves. **/
     void applyDisplayGamma() noexcept {
-        /** for each component of every pixel. **/
         static const int kChannelsPerPixel = 3;
-        int wd = img_->width_;
-        int ht = img_->height_;
-        int sz = kChannelsPerPixel * wd * ht;
-        auto src = (agm::uint16 *) rgb16_.data;
-        auto dst = (agm::uint8 *) rgb8_gamma_.data;
-        for (int i = 0; i < sz; ++i) {
-            /** get the source component. **/
-            int sval = *src++;
+        int wd = rgb_width_;
+        int ht = rgb_height_;
+        rgb8_gamma_.create(ht, wd, CV_8UC3);
+        int band = pool_->getBandRows(ht, 1);
+        pool_->run(ht, band, [=](int, int y0, int y1) {
+            int sz = kChannelsPerPixel * wd * (y1 - y0);
+            auto src = (agm::uint16 *) rgb16_.data + kChannelsPerPixel * wd * y0;
+            auto dst = (agm::uint8 *) rgb8_gamma_.data + kChannelsPerPixel * wd * y0;
+            kernels_->display_gamma_(src, dst, sz, gamma_table_, gamma_max_);
+        });
+    }
 
-            /** scale to the size of the table. **/
-            static const int kSourceChannelMax = 65535;
-            int ix = (sval * gamma_max_ + kSourceChannelMax/2) / kSourceChannelMax;
+    /** convert the area of interest to the view. **/
+    void renderView() noexcept {
+        int band = pool_->getBandRows(aoi_.height, view_shrink_);
+        int y0 = aoi_.y;
+        pool_->run(aoi_.height, band, [=](int worker, int r0, int r1) {
+            renderRows(worker, y0 + r0, y0 + r1);
+        });
+    }
+
+    /**
+    convert the rows [y0, y1) of the 16 bit image that are in the view.
+    they must start and end on a multiple of the shrink.
+    a shrunk pixel is the average of the block of pixels.
+    a magnified pixel is repeated.
+    **/
+    void renderRows(
+        int worker,
+        int y0,
+        int y1
+    ) noexcept {
+        if (use_gl_) {
+            renderRows16(y0, y1);
+            return;
+        }
 
-            /** pin to 8 bits. **/
-            ix = std::max(0, std::min(ix, gamma_max_));
+        static const int kChannelsPerPixel = 3;
+        int s = view_shrink_;
+        int m = view_zoom_;
+        int ry0 = std::max(y0, aoi_.y);
+        int ry1 = std::min(y1, aoi_.y + aoi_.height);
+        int wd = rgb_width_;
+        int view_wd = rgb8_display_.cols;
+        int src_wd = view_wd / m;
+        int row_bytes = kChannelsPerPixel * view_wd;
+        auto &line = band_line_[worker];
+        if (s > 1) {
+            line.create(1, src_wd, CV_16UC3);
+        }
+        for (int y = ry0; y < ry1; y += s) {
+            auto src = (const agm::uint16 *) rgb16_.data + kChannelsPerPixel * (wd * y + aoi_.x);
+            int vy = (y - aoi_.y) / s * m;
+            auto dst = (agm::uint8 *) rgb8_display_.data + row_bytes * vy;
+            if (s > 1) {
+                auto out = (agm::uint16 *) line.data;
+                shrinkRow(src, out, src_wd, s);
+                src = out;
+            }
+            kernels_->display_gamma_(src, dst, kChannelsPerPixel * src_wd, gamma_table_, gamma_max_);
+            if (m == 1) {
+                continue;
+            }
 
-            /** use the value from the table. **/
-            *dst++ = gamma_table_[ix];
+            /** spread the pixels right to left in place. then copy the row. **/
+            for (int x = src_wd - 1; x >= 0; --x) {
+                auto px = dst + kChannelsPerPixel * x;
+                agm::uint8 b = px[0];
+                agm::uint8 g = px[1];
+                agm::uint8 r = px[2];
+                for (int k = m - 1; k >= 0; --k) {
+                    auto out = dst + kChannelsPerPixel * (m * x + k);
+                    out[0] = b;
+                    out[1] = g;
+                    out[2] = r;
+                }
+            }
+            for (int k = 1; k < m; ++k) {
+                std::memcpy(dst + row_bytes * k, dst, row_bytes);
+            }
+        }
+    }
+
+    /**
+    copy the rows [y0, y1) that are in the view to the 16 bit view.
+    opengl does the rest.
+    **/
+    void renderRows16(
+        int y0,
+        int y1
+    ) noexcept {
+        static const int kChannelsPerPixel = 3;
+        int s = view_shrink_;
+        int ry0 = std::max(y0, aoi_.y);
+        int ry1 = std::min(y1, aoi_.y + aoi_.height);
+        int wd = rgb_width_;
+        int cols = view_cols_;
+        for (int y = ry0; y < ry1; y += s) {
+            auto src = (const agm::uint16 *) rgb16_.data + kChannelsPerPixel * (wd * y + aoi_.x);
+            int vy = (y - aoi_.y) / s;
+            auto dst = (agm::uint16 *) rgb16_view_.data + kChannelsPerPixel * cols * vy;
+            if (s > 1) {
+                shrinkRow(src, dst, cols, s);
+            } else {
+                std::memcpy(dst, src, kChannelsPerPixel * sizeof(agm::uint16) * cols);
+            }
+        }
+    }
+
+    /** average s x s blocks of the 16 bit image starting at src. **/
+    void shrinkRow(
+        const agm::uint16 *src,
+        agm::uint16 *dst,
+        int count,
+        int s
+    ) noexcept {
+        static const int kChannelsPerPixel = 3;
+        int stride = kChannelsPerPixel * rgb_width_;
+        int area = s * s;
+        for (int x = 0; x < count; ++x) {
+            int sum[kChannelsPerPixel] = {0, 0, 0};
+            for (int dy = 0; dy < s; ++dy) {
+                auto row = src + stride * dy + kChannelsPerPixel * s * x;
+                for (int dx = 0; dx < s; ++dx) {
+                    sum[0] += row[0];
+                    sum[1] += row[1];
+                    sum[2] += row[2];
+                    row += kChannelsPerPixel;
+                }
+            }
+            dst[0] = (sum[0] + area / 2) / area;
+            dst[1] = (sum[1] + area / 2) / area;
+            dst[2] = (sum[2] + area / 2) / area;
+            dst += kChannelsPerPixel;
         }
     }
 
     /** draw concentric circles to aid collimation. **/
     void showCollimationCircles() noexcept {
+        static const int kRadii[] = {10, 30, 100, 300, 1000};
+        static const int kCircles = sizeof(kRadii) / sizeof(kRadii[0]);
+        if (use_gl_) {
+            showGlCircles(kRadii, kCircles);
+            return;
+        }
         if (show_circles_ == false) {
             return;
         }
-        drawCircle(10);
-        drawCircle(30);
-        drawCircle(100);
-        drawCircle(300);
-        drawCircle(1000);
+        for (int i = 0; i < kCircles; ++i) {
+            drawCircle(kRadii[i]);
+        }
+    }
+
+    /** opengl draws the circles in view pixels. **/
+    void showGlCircles(
+        const int *radii,
+        int count
+    ) noexcept {
+        std::vector<double> view_radii;
+        int cx = rgb_width_ / 2;
+        int cy = rgb_height_ / 2;
+        if (show_circles_) {
+            for (int i = 0; i < count; ++i) {
+                if (radii[i] < cx && radii[i] < cy) {
+                    view_radii.push_back(double(radii[i]) / view_shrink_);
+                }
+            }
+        }
+        double x = double(cx - aoi_.x) / view_shrink_;
+        double y = double(cy - aoi_.y) / view_shrink_;
+        gl_display_.setCircles(x, y, view_radii);
     }
 
     /** draw one circle around the center of the image. **/
     void drawCircle(
         int radius
     ) noexcept {
-        int wd = img_->width_;
-        int ht = img_->height_;
+        int wd = rgb_width_;
+        int ht = rgb_height_;
         int cx = wd / 2;
         int cy = ht / 2;
         if (radius >= cx || radius >= cy) {
@@ -843,7 +2047,7 @@ public:
         int x,
         int y
     ) noexcept {
-        int wd = img_->width_;
+        int wd = rgb_width_;
         auto ptr = (agm::uint16 *) rgb16_.data;
         ptr += 3 * (wd * y + x) + 2;
         int p = ptr[0];
@@ -861,31 +2065,134 @@ public:
         LOG("Display Resolution: "<<display_width_<<" x "<<display_height_);
     }
 
-    /** crop the captured image if necessary. **/
+    /**
+    choose the part of the image that's shown and the size of the view.
+    the view fits in 80% of the display.
+    fit shrinks the whole image by a whole number.
+    zoom magnifies the middle of the image by a whole number.
+    and pans it.
+    **/
     void setWindowCrop() noexcept {
-        int max_usable_width = display_width_ * 80 / 100;
-        int max_usable_height = display_height_ * 80 / 100;
-        int image_width = img_->width_;
-        int image_height = img_->height_;
+        static const int kMinUsable = 64;
+        int max_usable_width = std::max(display_width_ * 80 / 100, kMinUsable);
+        int max_usable_height = std::max(display_height_ * 80 / 100, kMinUsable);
+        int image_width = rgb_width_;
+        int image_height = rgb_height_;
+
+        int shrink = 1;
+        int zoom = 1;
+        int view_width = image_width;
+        int view_height = image_height;
+        int pan_x = 0;
+        int pan_y = 0;
+        if (zoom_ <= 0) {
+            while (image_width / shrink > max_usable_width || image_height / shrink > max_usable_height) {
+                ++shrink;
+            }
+            view_width = image_width / shrink * shrink;
+            view_height = image_height / shrink * shrink;
+        } else {
+            zoom = zoom_;
+            view_width = std::min(image_width, std::max(max_usable_width / zoom, 1));
+            view_height = std::min(image_height, std::max(max_usable_height / zoom, 1));
+            pan_x = pan_x_;
+            pan_y = pan_y_;
+        }
+
+        int x = (image_width - view_width) / 2 + pan_x;
+        int y = (image_height - view_height) / 2 + pan_y;
+        x = std::max(0, std::min(x, image_width - view_width));
+        y = std::max(0, std::min(y, image_height - view_height));
+        x -= x % shrink;
+        y -= y % shrink;
+        aoi_ = cv::Rect(x, y, view_width, view_height);
+        view_shrink_ = shrink;
+        view_zoom_ = zoom;
+        view_cols_ = view_width / shrink;
+        view_rows_ = view_height / shrink;
+        if (use_gl_ == false) {
+            rgb8_display_.create(view_rows_ * zoom, view_cols_ * zoom, CV_8UC3);
+        }
+    }
+
+    /**
+    show the stage times on the image.
+    the lines are updated once a second.
+    opengl draws the text over the view.
+    highgui needs it drawn into the 8 bit image.
+    **/
+    void showPerfOverlay() noexcept {
+        if (show_perf_ == false) {
+            if (perf_time_) {
+                perf_time_ = 0;
+                perf_lines_.clear();
+                if (use_gl_) {
+                    gl_display_.setText(perf_lines_);
+                }
+            }
+            return;
+        }
+
+        auto now = agm::time::microseconds();
+        if (perf_time_ == 0 || now - perf_time_ >= 1000000LL) {
+            perf_time_ = now;
+            updatePerfLines();
+            if (use_gl_) {
+                gl_display_.setText(perf_lines_);
+            }
+        }
 
-        aoi_.x = 0;
-        aoi_.y = 0;
-        aoi_.width = image_width;
-        aoi_.height = image_height;
+        if (use_gl_ == false) {
+            int nlines = perf_lines_.size();
+            for (int i = 0; i < nlines; ++i) {
+                cv::putText(rgb8_display_, perf_lines_[i], cv::Point(8, 16 + 14 * i),
+                    cv::FONT_HERSHEY_PLAIN, 1.0, cv::Scalar(0, 255, 0));
+            }
+        }
+    }
+
+    /** one line per stage that ran since the last update. **/
+    void updatePerfLines() noexcept {
+        perf_stats_->getStages(perf_stages_);
+        int nstages = perf_stages_.size();
+        perf_before_.resize(nstages);
+        perf_lines_.clear();
+        perf_lines_.push_back("stage               p50    p99    max ms");
+
+        LatencyCounts counts;
+        for (int i = 0; i < nstages; ++i) {
+            auto stage = perf_stages_[i];
+            stage->copyCounts(counts);
+            auto summary = LatencySummary::summarize(counts, &perf_before_[i]);
+            perf_before_[i] = counts;
+            if (summary.count_ == 0) {
+                continue;
+            }
 
-        if (image_width > max_usable_width) {
-            int margin = (image_width - max_usable_width) / 2;
-            aoi_.x = margin;
-            aoi_.width = max_usable_width;
+            /** CaptureThread is Capture. **/
+            auto thread = stage->thread_.substr(0, stage->thread_.find("Thread"));
+            char line[128];
+            std::snprintf(line, sizeof(line), "%-8.8s %-9.9s %6.2f %6.2f %6.2f",
+                thread.c_str(), stage->stage_.c_str(),
+                summary.p50_ / 1000.0, summary.p99_ / 1000.0, summary.max_ / 1000.0);
+            perf_lines_.push_back(line);
         }
-        if (image_height > max_usable_height) {
-            int margin = (image_height - max_usable_height) / 2;
-            aoi_.y = margin;
-            aoi_.height = max_usable_height;
+
+        MountStatus status;
+        bool valid = mount_->getStatus(status);
+        if (valid) {
+            char line[128];
+            std::snprintf(line, sizeof(line), "mount ra %.3f dec %+.3f alt %.2f az %.2f%s",
+                status.ra_, status.dec_, status.altitude_, status.azimuth_,
+                status.isSlewing() ? " slewing" : "");
+            perf_lines_.push_back(line);
         }
     }
 
-    /** save the image to the file. **/
+    /**
+    save the image to the file.
+    the saver thread does the work.
+    **/
     void saveImage() noexcept {
         if (save_file_name_.size()) {
             if (accumulate_) {
@@ -898,208 +2205,92 @@ public:
         }
     }
 
-    /** save the 8 bit gamma corrected image. **/
+    /**
+    save the 8 bit gamma corrected image.
+    the view is only part of it. so convert all of it.
+    **/
     void saveDisplayImage() noexcept {
-        bool success = saveImage8();
+        applyDisplayGamma();
+        bool success = queueSave(SaveJob::Format::k8Bit, save_file_name_, rgb8_gamma_);
         if (success) {
-            LOG("CaptureThread Saved gamma corrected 8 bit image to file: "<<save_file_name_);
+            /** keep the saver's copy. the next save allocates a new one. **/
+            rgb8_gamma_.release();
         }
     }
 
     /** save the 16 bit raw image. **/
     void saveRawImage() noexcept {
-        bool success = saveImage16();
+        bool success = queueSave(SaveJob::Format::k16Bit, raw_file_name_, rgb16_);
         if (success) {
-            LOG("CaptureThread Saved raw image to 16 bit tiff file: "<<raw_file_name_);
+            /** the next debayer allocates a new one. **/
+            rgb16_.release();
         }
     }
 
     /** save the accumulated image and disable stacking. **/
     void saveAccumulatedImage() noexcept {
-        bool success = saveImage32();
+        /** the stack maximum only covers the preview. the saver finds the real one. **/
+        cv::Mat image = rgb32_;
+        if (stacked_mode_ != StackMode::kSum) {
+            /** save the robust estimates as fixed point 32 bit values. **/
+            int wd = rgb_width_;
+            int ht = rgb_height_;
+            image.release();
+            frame_pool_->create(image, ht, wd, CV_32SC3);
+            int band = pool_->getBandRows(ht, 1);
+            pool_->run(ht, band, [&](int, int y0, int y1) {
+                auto ptr32 = (agm::int32 *) image.data + 3 * wd * y0;
+                robust_stack_.exportFixed(ptr32, 3 * wd * y0, 3 * wd * (y1 - y0));
+            });
+        }
+        bool success = queueSave(SaveJob::Format::k32Bit, save_file_name_, image);
         if (success == false) {
             return;
         }
 
-        LOG("CaptureThread Saved image to 32 bit tiff file: "<<save_file_name_);
-
-        /** disable stacking. **/
+        /** disable stacking. the next stack allocates a new one. **/
         accumulate_ = 0;
         nstacked_ = 0;
-        rgb32_ = 0;
+        rgb32_.release();
+        robust_stack_.release();
 
-        std::lock_guard<std::mutex> lock(settings_buffer_->mutex_);
+        SettingsLock lock(settings_buffer_);
         settings_buffer_->accumulate_ = false;
     }
 
-    /** save the 8 bit image using opencv. **/
-    bool saveImage8() noexcept {
-        /** this is why you do not throw exceptions ever. **/\
-        bool success = false;
-        try {
-            success = cv::imwrite(save_file_name_, rgb8_gamma_);
-        } catch (const cv::Exception& ex) {
-            LOG("CaptureThread Failed to save image to file: "<<save_file_name_<<" OpenCV reason: "<<ex.what());
-        }
-        return success;
-    }
-
-    /** save the raw 16 bit image using tiff. **/
-    bool saveImage16() noexcept {
-        /** create the tiff file. **/
-        TIFF *tiff = TIFFOpen(raw_file_name_.c_str(), "w");
-        if (tiff == nullptr) {
-            LOG("CaptureThread Failed to create tiff file: "<<raw_file_name_);
-            return false;
-        }
-
-        /** do some tiff things. **/
-        int wd = img_->width_;
-        int ht = img_->height_;
-        LOG("wd="<<wd<<" ht="<<ht);
-        TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, wd);
-        TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, ht);
-        TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 3);
-        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 16);
-        TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-        TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-
-        /** after we do the above. **/
-        int default_strip_size = TIFFDefaultStripSize(tiff, 3 * wd);
-        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, default_strip_size);
-
-        /** allocate a tiff-sized scanline. **/
-        int scanline_size = TIFFScanlineSize(tiff);
-        auto buffer = new(std::nothrow) char[scanline_size];
-
-        /** zero the trailing bytes. **/
-        int src_sz = 3 * sizeof(agm::int16) * wd;
-        for (int i = src_sz; i < scanline_size; ++i) {
-            buffer[i] = 0;
-        }
-
-        /** write all scanlines. **/
-        bool success = true;
-        auto src = (agm::int16 *) rgb16_.data;
-        for (int y = 0; y < ht; ++y) {
-            auto dst = (agm::int16 *) buffer;
-            for (int x = 0; x < wd; ++x) {
-                /** convert opencv BGR to tiff RGB. **/
-                dst[0] = src[2];
-                dst[1] = src[1];
-                dst[2] = src[0];
-                src += 3;
-                dst += 3;
-            }
-            int result = TIFFWriteScanline(tiff, buffer, y, 0);
-            if (result < 0) {
-                success = false;
-                break;
-            }
-        }
-
-        if (success == false) {
-            LOG("CaptureThread Failed to write tiff file: "<<raw_file_name_);
-        }
-
-        delete[] buffer;
-        TIFFClose(tiff);
-
-        return success;
-    }
-
-    /** save the 32 bit image using tiff. **/
-    bool saveImage32() noexcept {
-        /** create the tiff file. **/
-        TIFF *tiff = TIFFOpen(save_file_name_.c_str(), "w");
-        if (tiff == nullptr) {
-            LOG("CaptureThread Failed to create tiff file: "<<save_file_name_);
-            return false;
-        }
-
-        /** do some tiff things. **/
-        int wd = img_->width_;
-        int ht = img_->height_;
-        TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, wd);
-        TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, ht);
-        TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 3);
-        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 32);
-        TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-        TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-        TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
-        TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
-
-        /** after we do the above. **/
-        int default_strip_size = TIFFDefaultStripSize(tiff, 3 * wd);
-        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, default_strip_size);
-
-        /** allocate a tiff-sized scanline. **/
-        int scanline_size = TIFFScanlineSize(tiff);
-        auto buffer = new(std::nothrow) char[scanline_size];
-
-        /** zero the trailing bytes. **/
-        int src_sz = 3 * sizeof(agm::int32) * wd;
-        for (int i = src_sz; i < scanline_size; ++i) {
-            buffer[i] = 0;
-        }
-
-        /** find the max for scaling. **/
-        int scale = 0;
-        auto src = (agm::int32 *) rgb32_.data;
-        int sz = 3 * ht * wd;
-        for (int i = 0; i < sz; ++i) {
-            int val = *src++;
-            scale = std::max(scale, val);
-        }
-
-        /** write all scanlines. **/
-        bool success = true;
-        src = (agm::int32 *) rgb32_.data;
-        for (int y = 0; y < ht; ++y) {
-            auto dst = (agm::int32 *) buffer;
-            for (int x = 0; x < wd; ++x) {
-                /** convert opencv BGR to tiff RGB. **/
-                dst[0] = scale32(src[2], scale);
-                dst[1] = scale32(src[1], scale);
-                dst[2] = scale32(src[0], scale);
-                src += 3;
-                dst += 3;
-            }
-            int result = TIFFWriteScanline(tiff, buffer, y, 0);
-            if (result < 0) {
-                success = false;
-                break;
-            }
-        }
-
-        if (success == false) {
-            LOG("CaptureThread Failed to write tiff file: "<<save_file_name_);
+    /**
+    give the saver thread a reference to the image.
+    the caller must not modify the image after this.
+    **/
+    bool queueSave(
+        SaveJob::Format format,
+        const std::string &file_name,
+        const cv::Mat &image,
+        int scale = 0
+    ) noexcept {
+        SaveJob job;
+        job.format_ = format;
+        job.file_name_ = file_name;
+        job.image_ = image;
+        job.scale_ = scale;
+        bool success = save_queue_->push(job);
+        if (success) {
+            LOG("WindowThread Queued image to save to file: "<<file_name);
+        } else {
+            LOG("WindowThread Too many pending saves. Not saving file: "<<file_name);
         }
-
-        delete[] buffer;
-        TIFFClose(tiff);
-
         return success;
     }
-
-    int scale32(
-        int src,
-        int scale
-    ) noexcept {
-        static const int kInt32Max = 0x7FFFFFFF;
-        agm::int64 x = src;
-        x *= kInt32Max;
-        x /= scale;
-        return (int) x;
-    }
 };
 }
 
 agm::Thread *createWindowThread(
-    ImageDoubleBuffer *image_double_buffer,
-    SettingsBuffer *settings_buffer
+    ImageRing *image_ring,
+    SaveQueue *save_queue,
+    SettingsBuffer *settings_buffer,
+    Ioptron *mount,
+    PerfStats *perf_stats,
+    FramePool *frame_pool
 ) noexcept {
-    return new(std::nothrow) WindowThread(image_double_buffer, settings_buffer);
+    return new(std::nothrow) WindowThread(image_ring, save_queue, settings_buffer, mount, perf_stats, frame_pool);
 }